@@ -0,0 +1,110 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <cinttypes>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+typedef std::chrono::steady_clock BenchClock;
+
+// Named benchmark suite, selected from command line by name
+struct BenchSuite
+{
+    const char* name;
+    const char* description;
+    bool (*run)();
+};
+
+class BenchTimer
+{
+public:
+    BenchTimer() : m_start(BenchClock::now()) {}
+
+    void Restart()
+    {
+        m_start = BenchClock::now();
+    }
+    uint64_t ElapsedNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - m_start).count();
+    }
+private:
+    BenchClock::time_point m_start;
+};
+
+// Allocations through global operator new of all threads, ChatBench replaces it to count them
+struct AllocStats
+{
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+AllocStats GetAllocStats() noexcept;
+
+// Cost of one operation
+struct OpStats
+{
+    double ns = 0;
+    double allocs = 0;
+    double bytes = 0;
+};
+
+template <typename Fn>
+OpStats MeasureOps(size_t nOps, Fn fn)
+{
+    AllocStats before = GetAllocStats();
+    BenchTimer timer;
+    for (size_t i = 0; i < nOps; ++i)
+        fn(i);
+    uint64_t ns = timer.ElapsedNs();
+    AllocStats after = GetAllocStats();
+
+    OpStats stats;
+    if (nOps)
+    {
+        stats.ns = double(ns) / nOps;
+        stats.allocs = double(after.count - before.count) / nOps;
+        stats.bytes = double(after.bytes - before.bytes) / nOps;
+    }
+    return stats;
+}
+
+// Prevents compiler from optimizing out computation of the value
+template <typename T>
+inline void DoNotOptimize(const T& value)
+{
+    static const void* volatile sink;
+    sink = &value;
+}
+
+// Prints a row of fixed width columns
+inline void PrintRow(const std::vector<std::string>& columns, size_t width = 14)
+{
+    for (const auto& col : columns)
+    {
+        std::cout << col;
+        if (col.size() < width)
+            std::cout << std::string(width - col.size(), ' ');
+        else
+            std::cout << ' ';
+    }
+    std::cout << '\n';
+}
+
+inline std::string FormatDouble(double value, int precision = 2)
+{
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%.*f", precision, value);
+    return buff;
+}
+
+// Columns "ns/op", "allocs/op", "bytes/op"
+inline void AppendOpStats(std::vector<std::string>& row, const OpStats& stats)
+{
+    row.push_back(FormatDouble(stats.ns, 1));
+    row.push_back(FormatDouble(stats.allocs, 2));
+    row.push_back(FormatDouble(stats.bytes, 0));
+}
+
+#endif // !_BENCH_H_
@@ -0,0 +1,138 @@
+#include "Bench.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <new>
+
+bool RunCompressionBench();
+bool RunTextCodecBench();
+bool RunClientTableBench();
+bool RunSyncBench();
+bool RunMailboxBench();
+bool RunLoggerBench();
+bool RunConsoleBench();
+bool RunScrollbackBench();
+bool RunEndToEndBench();
+bool RunEndToEndPipeBench();
+bool RunMessageBench();
+bool RunFramingBench();
+
+static const BenchSuite suites[] =
+{
+    { "compression", "bytes saved vs CPU cost of frame compression per threshold", RunCompressionBench },
+    { "text", "GB/s of message text validation and UTF-8 transcoding per SIMD level", RunTextCodecBench },
+    { "clienttable", "broadcast throughput over client table during join/leave storm", RunClientTableBench },
+    { "sync", "RWAccessManager and Event implementations vs std::shared_mutex", RunSyncBench },
+    { "mailbox", "Mailbox with 1-64 producers vs mutex protected queue", RunMailboxBench },
+    { "logger", "cost of log calls on calling thread, asynchronous vs wstringstream", RunLoggerBench },
+    { "console", "lines per second through Console, Print vs wstringstream", RunConsoleBench },
+    { "scrollback", "client scrollback memory and window copy time per backlog size", RunScrollbackBench },
+    { "message", "ns, allocations and bytes per ClientMessage serialize and unserialize by text size", RunMessageBench },
+    { "framing", "ns, allocations and bytes per ClientBase frame over loopback socket pair", RunFramingBench },
+    { "e2e", "latency percentiles and deliveries per second of server on loopback, JSON", RunEndToEndBench },
+    { "e2e-pipe", "the same over in-memory pipes, without kernel sockets, JSON", RunEndToEndPipeBench },
+};
+
+// Global operator new counts allocations for AllocStats, relaxed counters keep its cost small
+static std::atomic<uint64_t> allocCount(0);
+static std::atomic<uint64_t> allocBytes(0);
+
+AllocStats GetAllocStats() noexcept
+{
+    AllocStats stats;
+    stats.count = allocCount.load(std::memory_order_relaxed);
+    stats.bytes = allocBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* operator new(size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try { return operator new(size); }
+    catch (std::bad_alloc&) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+static void PrintUsage()
+{
+    std::cout << "Usage: ChatBench [suite...]\nAvailable suites:\n";
+    for (const auto& suite : suites)
+        std::cout << "  " << suite.name << " - " << suite.description << '\n';
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    try
+    {
+        if (argc < 2)
+        {
+            PrintUsage();
+            for (const auto& suite : suites)
+            {
+                std::cout << "\n[" << suite.name << "]\n";
+                if (!suite.run())
+                    ret = 1;
+            }
+            return ret;
+        }
+
+        for (int i = 1; i < argc; ++i)
+        {
+            auto it = std::find_if(std::begin(suites), std::end(suites),
+                [name = argv[i]](const BenchSuite& suite) { return strcmp(suite.name, name) == 0; });
+            if (it == std::end(suites))
+            {
+                std::cerr << "Unknown suite " << argv[i] << '\n';
+                PrintUsage();
+                return 1;
+            }
+            std::cout << "\n[" << it->name << "]\n";
+            if (!it->run())
+                ret = 1;
+        }
+    }
+    catch (std::exception& exc)
+    {
+        std::cerr << exc.what() << std::endl;
+        ret = 1;
+    }
+    catch (...)
+    {
+        std::cerr << "Unknown exception" << std::endl;
+        ret = 1;
+    }
+    return ret;
+}
@@ -0,0 +1,238 @@
+#include "Bench.h"
+#include "../ChatServer/EpochManager.h"
+#include "../ChatServer/RWAccessManager.h"
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <random>
+
+// Broadcast over client table while clients join and leave.
+// Broadcasters walk the table and post to every active session like ProcessBroadcastSend,
+// storm thread closes random sessions and reuses their slots for new ones like AddClient.
+
+namespace
+{
+
+constexpr size_t TABLE_SIZE = 256;
+constexpr auto RUN_TIME = std::chrono::milliseconds(500);
+const size_t broadcasterCounts[] = { 1, 2, 4, 8 };
+
+struct Session
+{
+    std::atomic<bool> completed{ false };
+    std::mutex sendMtx;  // ServerClient::PostData locks per client mutex
+    uint64_t nPosted = 0;
+
+    void Post()
+    {
+        std::unique_lock<std::mutex> lk(sendMtx);
+        ++nPosted;
+    }
+};
+
+typedef std::unique_ptr<Session> SessionUPtr;
+
+struct Result
+{
+    uint64_t nBroadcasts = 0;
+    uint64_t nChanges = 0;  // joins and leaves
+    uint64_t ns = 0;
+};
+
+// Table as before: vector of sessions guarded by RWAccessManager
+class LockedTable
+{
+public:
+    LockedTable()
+    {
+        for (size_t i = 0; i < TABLE_SIZE; ++i)
+            m_sessions.emplace_back(new Session);
+    }
+    void Broadcast()
+    {
+        RWLocker lk(m_rwm);
+        for (const auto& session : m_sessions)
+        {
+            if (!session->completed)
+                session->Post();
+        }
+    }
+    void Leave(size_t ind)
+    {
+        RWLocker lk(m_rwm, true);
+        m_sessions[ind]->completed = true;
+    }
+    void Join(size_t ind)
+    {
+        SessionUPtr session(new Session);
+        RWLocker lk(m_rwm, true);
+        m_sessions[ind] = std::move(session);
+    }
+
+private:
+    RWAccessManager m_rwm;
+    std::vector<SessionUPtr> m_sessions;
+};
+
+// Table as in server: immutable snapshots read under EpochGuard
+class SnapshotTable
+{
+public:
+    struct Snapshot
+    {
+        std::vector<Session*> sessions;
+    };
+
+    SnapshotTable()
+    {
+        for (size_t i = 0; i < TABLE_SIZE; ++i)
+            m_sessions.emplace_back(new Session);
+        m_snapshot = nullptr;
+        Publish();
+    }
+    ~SnapshotTable()
+    {
+        delete m_snapshot.load();
+    }
+    void Broadcast()
+    {
+        EpochGuard guard(m_epochs);
+        for (auto session : m_snapshot.load()->sessions)
+        {
+            if (!session->completed)
+                session->Post();
+        }
+    }
+    void Leave(size_t ind)
+    {
+        m_sessions[ind]->completed = true;
+    }
+    void Join(size_t ind)
+    {
+        m_epochs.Retire(m_sessions[ind].release());
+        m_sessions[ind].reset(new Session);
+        Publish();
+    }
+    size_t GetRetiredCount()
+    {
+        return m_epochs.GetRetiredCount();
+    }
+
+private:
+    void Publish()
+    {
+        std::unique_ptr<Snapshot> snapshot(new Snapshot);
+        snapshot->sessions.reserve(m_sessions.size());
+        for (const auto& session : m_sessions)
+            snapshot->sessions.push_back(session.get());
+        m_epochs.Retire(m_snapshot.exchange(snapshot.release()));
+    }
+
+private:
+    EpochManager m_epochs;
+    std::vector<SessionUPtr> m_sessions;  // changed only by storm thread
+    std::atomic<const Snapshot*> m_snapshot;
+};
+
+template <typename Table>
+Result Run(size_t nBroadcasters, bool storm)
+{
+    Table table;
+    std::atomic<bool> start(false), stop(false);
+    std::vector<uint64_t> nBroadcasts(nBroadcasters);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nBroadcasters; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            while (!start)
+                std::this_thread::yield();
+            uint64_t n = 0;
+            while (!stop)
+            {
+                table.Broadcast();
+                ++n;
+            }
+            nBroadcasts[i] = n;
+        });
+    }
+
+    Result result;
+    std::thread stormThread;
+    if (storm)
+    {
+        stormThread = std::thread([&]()
+        {
+            std::mt19937 rnd(42);
+            std::uniform_int_distribution<size_t> slot(0, TABLE_SIZE - 1);
+            while (!start)
+                std::this_thread::yield();
+            while (!stop)
+            {
+                size_t ind = slot(rnd);
+                table.Leave(ind);
+                table.Join(ind);
+                result.nChanges += 2;
+            }
+        });
+    }
+
+    BenchTimer timer;
+    start = true;
+    std::this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    for (auto& thr : threads)
+        thr.join();
+    if (stormThread.joinable())
+        stormThread.join();
+    result.ns = timer.ElapsedNs();
+
+    for (auto n : nBroadcasts)
+        result.nBroadcasts += n;
+    return result;
+}
+
+std::string PerSecond(uint64_t n, uint64_t ns)
+{
+    return ns ? FormatDouble(double(n) * 1e6 / ns, 1) + "K/s" : "-";
+}
+
+} // namespace
+
+bool RunClientTableBench()
+{
+    std::cout << TABLE_SIZE << " clients, " << std::thread::hardware_concurrency() << " hardware threads\n";
+    PrintRow({ "broadcasters", "storm", "table", "broadcasts", "posts", "joins+leaves" });
+
+    for (auto nBroadcasters : broadcasterCounts)
+    {
+        for (bool storm : { false, true })
+        {
+            Result results[] = { Run<LockedTable>(nBroadcasters, storm), Run<SnapshotTable>(nBroadcasters, storm) };
+            const char* names[] = { "rwlock", "snapshot" };
+            for (size_t i = 0; i < _countof(results); ++i)
+            {
+                PrintRow({
+                    std::to_string(nBroadcasters),
+                    storm ? "yes" : "no",
+                    names[i],
+                    PerSecond(results[i].nBroadcasts, results[i].ns),
+                    PerSecond(results[i].nBroadcasts * TABLE_SIZE, results[i].ns),
+                    storm ? PerSecond(results[i].nChanges, results[i].ns) : "-" });
+            }
+        }
+    }
+
+    // Retired sessions must be reclaimed once readers are gone
+    SnapshotTable table;
+    for (size_t i = 0; i < TABLE_SIZE; ++i)
+        table.Join(i);
+    table.Broadcast();
+    table.Join(0);
+    if (table.GetRetiredCount() > 2)
+    {
+        std::cout << "Retired objects are not reclaimed: " << table.GetRetiredCount() << '\n';
+        return false;
+    }
+    return true;
+}
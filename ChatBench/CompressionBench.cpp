@@ -0,0 +1,186 @@
+#include "Bench.h"
+#include "../ChatServer/ClientMessage.h"
+#include "../ChatServer/Compression.h"
+#include <random>
+#include <cstring>
+
+using namespace std::literals;
+
+namespace
+{
+
+struct Frame
+{
+    ClientMessage::Data data;
+    uint32_t size;
+};
+
+const wchar_t* const words[] =
+{
+    L"hello", L"the", L"server", L"is", L"down", L"again", L"who", L"can", L"check", L"logs",
+    L"deploy", L"finished", L"build", L"failed", L"on", L"windows", L"agent", L"please", L"retry",
+    L"thanks", L"lunch", L"meeting", L"in", L"five", L"minutes", L"ok", L"sure", L"why", L"not",
+    L"error", L"code", L"connection", L"reset", L"by", L"peer", L"timeout", L"after", L"30s",
+};
+
+class CorpusGenerator
+{
+public:
+    explicit CorpusGenerator(uint32_t seed) : m_rnd(seed) {}
+
+    std::wstring Name()
+    {
+        return L"user"s + std::to_wstring(Uniform(1, 500));
+    }
+    std::wstring Text(size_t nWords)
+    {
+        std::wstring text;
+        for (size_t i = 0; i < nWords; ++i)
+        {
+            if (i)
+                text += L' ';
+            text += words[Uniform(0, _countof(words) - 1)];
+        }
+        return text;
+    }
+    // Short broadcast messages typed by users
+    Frame Chat()
+    {
+        return Make(ClientCommand::BroadcastMessage, Name(), Text(Uniform(2, 15)));
+    }
+    // Long pasted messages (logs, code snippets)
+    Frame Paste()
+    {
+        std::wstring text;
+        size_t nLines = Uniform(10, 60);
+        for (size_t i = 0; i < nLines; ++i)
+            text += L"[12:00:"s + std::to_wstring(Uniform(10, 59)) + L"] " + Text(Uniform(4, 12)) + L'\n';
+        return Make(ClientCommand::BroadcastMessage, Name(), text);
+    }
+    // Server answer to /listusers
+    Frame UserList()
+    {
+        std::wstring text = L"Current active users:\n"s;
+        size_t nUsers = Uniform(20, 400);
+        for (size_t i = 0; i < nUsers; ++i)
+            text += Name() + L'\n';
+        return Make(ClientCommand::ServerMsg, L"Server"s, text);
+    }
+    // Mix of all frames, as seen during history replay
+    Frame Mixed()
+    {
+        auto n = Uniform(0, 99);
+        if (n < 80)
+            return Chat();
+        if (n < 95)
+            return Paste();
+        return UserList();
+    }
+
+private:
+    size_t Uniform(size_t from, size_t to)
+    {
+        return std::uniform_int_distribution<size_t>(from, to)(m_rnd);
+    }
+    Frame Make(ClientCommand command, std::wstring from, std::wstring text)
+    {
+        ClientMessage msg;
+        msg.command = command;
+        msg.from = std::move(from);
+        msg.msg = std::move(text);
+        msg.timeStamp = 1500000000 * TIMESTAMP_UNITS_PER_SECOND + m_time++ * 1000000; // a millisecond apart
+        Frame frame;
+        frame.data = msg.Serialize(&frame.size);
+        return frame;
+    }
+
+private:
+    std::mt19937 m_rnd;
+    uint64_t m_time = 0;
+};
+
+struct Workload
+{
+    const char* name;
+    Frame (CorpusGenerator::*generate)();
+};
+
+const Workload workloads[] =
+{
+    { "chat", &CorpusGenerator::Chat },
+    { "paste", &CorpusGenerator::Paste },
+    { "userlist", &CorpusGenerator::UserList },
+    { "mixed", &CorpusGenerator::Mixed },
+};
+
+const uint32_t thresholds[] = { 0, 64, 128, 256, 512, 1024, 4096 };
+
+constexpr size_t FRAMES_PER_WORKLOAD = 2000;
+
+} // namespace
+
+bool RunCompressionBench()
+{
+    if (!FrameCompressor::IsSupported())
+    {
+        std::cout << "Compression is not supported in this build (define CHAT_USE_ZLIB)\n";
+        return true;
+    }
+
+    PrintRow({ "workload", "threshold", "compressed", "raw KB", "wire KB", "saved %",
+        "deflate us", "inflate us", "ns/saved B" });
+
+    bool ok = true;
+    std::vector<char> compressed, decompressed;
+    for (const auto& workload : workloads)
+    {
+        CorpusGenerator generator(42);
+        std::vector<Frame> frames;
+        for (size_t i = 0; i < FRAMES_PER_WORKLOAD; ++i)
+            frames.push_back((generator.*workload.generate)());
+
+        for (auto threshold : thresholds)
+        {
+            FrameCompressor sender(threshold), receiver(threshold);
+            if (!sender.InitDeflate() || !receiver.InitInflate())
+                return false;
+
+            uint64_t rawBytes = 0, wireBytes = 0, nCompressed = 0;
+            for (const auto& frame : frames)
+            {
+                rawBytes += sizeof(uint32_t) + frame.size;
+                if (!sender.Compress(frame.data.get(), frame.size, compressed))
+                {
+                    wireBytes += sizeof(uint32_t) + frame.size;
+                    continue;
+                }
+                ++nCompressed;
+                wireBytes += sizeof(uint32_t) + compressed.size();
+
+                if (!receiver.Decompress(compressed.data(), static_cast<uint32_t>(compressed.size()), decompressed) ||
+                    decompressed.size() != frame.size ||
+                    memcmp(decompressed.data(), frame.data.get(), frame.size) != 0)
+                {
+                    std::cout << "Roundtrip mismatch in workload " << workload.name << '\n';
+                    ok = false;
+                    break;
+                }
+            }
+
+            auto deflateNs = sender.GetDeflateStats().cpuTimeNs;
+            auto inflateNs = receiver.GetInflateStats().cpuTimeNs;
+            uint64_t saved = rawBytes > wireBytes ? rawBytes - wireBytes : 0;
+            PrintRow({
+                workload.name,
+                std::to_string(threshold),
+                std::to_string(nCompressed) + "/" + std::to_string(frames.size()),
+                FormatDouble(rawBytes / 1024.0),
+                FormatDouble(wireBytes / 1024.0),
+                FormatDouble(rawBytes ? 100.0 * saved / rawBytes : 0.0),
+                FormatDouble(deflateNs / 1000.0, 0),
+                FormatDouble(inflateNs / 1000.0, 0),
+                saved ? FormatDouble(double(deflateNs + inflateNs) / saved) : "-" });
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,83 @@
+#include "Bench.h"
+#include "../ChatServer/Console.h"
+#include "../ChatServer/Format.h"
+#include <sstream>
+
+// Lines per second of a typical server line "Client <name> <id> received <n> of <m>":
+// formatting only, wstringstream as ConsoleProxy used to do vs FormatBuffer,
+// and through Console, where terminal speed is included. Redirect output to NUL or /dev/null
+// to measure Console itself.
+
+namespace
+{
+
+constexpr size_t FORMAT_LINES = 500000;
+constexpr size_t CONSOLE_LINES = 20000;
+
+const std::wstring name = L"client";
+
+std::string LinesPerSecond(const OpStats& stats)
+{
+    return stats.ns ? FormatDouble(1e9 / stats.ns / 1000, 1) + "K/s" : "-";
+}
+
+} // namespace
+
+bool RunConsoleBench()
+{
+    size_t totalSize = 0;
+    OpStats streamStats = MeasureOps(FORMAT_LINES, [&totalSize](size_t i)
+    {
+        std::wstringstream wss;
+        wss << L"Client " << name << L' ' << i % 64 << L" received " << i << L" of " << FORMAT_LINES << L'\n';
+        totalSize += wss.str().size();
+    });
+    OpStats formatStats = MeasureOps(FORMAT_LINES, [&totalSize](size_t i)
+    {
+        StackFormatBuffer<> buffer;
+        buffer.Format(L"Client {} {} received {} of {}\n", name, i % 64, i, FORMAT_LINES);
+        totalSize -= buffer.Size();
+    });
+    bool ok = totalSize == 0;
+
+    Console& console = Console::GetInstance();
+    OpStats consoleStreamStats = MeasureOps(CONSOLE_LINES, [&console](size_t i)
+    {
+        std::wstringstream wss;
+        wss << L"Client " << name << L' ' << i % 64 << L" received " << i << L" of " << CONSOLE_LINES << L'\n';
+        console.Write(wss.str());
+    });
+    OpStats consolePrintStats = MeasureOps(CONSOLE_LINES, [&console](size_t i)
+    {
+        console.Print(L"Client {} {} received {} of {}\n", name, i % 64, i, CONSOLE_LINES);
+    });
+    OpStats consoleWriteStats = MeasureOps(CONSOLE_LINES, [&console](size_t)
+    {
+        console.Write(L"Client client 0 received 0 of 0\n");
+    });
+
+    PrintRow({ "output", "method", "lines/s", "ns/op", "allocs/op", "bytes/op" });
+    struct Row
+    {
+        const char* output;
+        const char* method;
+        const OpStats& stats;
+    };
+    const Row rows[] =
+    {
+        { "memory", "wstringstream", streamStats },
+        { "memory", "Print", formatStats },
+        { "console", "wstringstream", consoleStreamStats },
+        { "console", "Print", consolePrintStats },
+        { "console", "preformatted", consoleWriteStats },
+    };
+    for (const auto& row : rows)
+    {
+        std::vector<std::string> columns = { row.output, row.method, LinesPerSecond(row.stats) };
+        AppendOpStats(columns, row.stats);
+        PrintRow(columns);
+    }
+    if (!ok)
+        std::cout << "FormatBuffer output differs from wstringstream output\n";
+    return ok;
+}
@@ -0,0 +1,391 @@
+#include "Bench.h"
+#include "../ChatServer/Common.h"
+#include "../ChatServer/ClientBase.h"
+#include "../ChatServer/ClientMessage.h"
+#include "../ChatServer/Server.h"
+#include "../ChatServer/Transport.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Server on loopback with a growing number of connected clients: latency from timestamp of sender
+// to receiving of broadcasts and private messages, and deliveries per second.
+// Clients are non-blocking sockets polled by one thread, messages are sent from all of them in turn
+// with a bounded number in flight. Results are printed as JSON to compare builds.
+// Pipe mode connects clients through in-memory pipes instead, so only the server is measured.
+// Pipes have nothing to poll, the client thread scans all of them.
+
+#ifndef DEF_BENCH_E2E_CLIENTS
+#define DEF_BENCH_E2E_CLIENTS 10, 100, 1000, 10000 // connected clients of each run, ascending
+#endif
+
+namespace
+{
+
+using namespace std::literals;
+
+constexpr uint16_t BENCH_PORT = DEF_SERV_PORT + 1;
+constexpr size_t CLIENT_COUNTS[] = { DEF_BENCH_E2E_CLIENTS };
+// Deliveries measured per run and kind of message
+constexpr uint64_t DELIVERIES = 200000;
+// Messages in flight, a broadcast takes a frame of mailbox of every client
+constexpr uint64_t BROADCAST_WINDOW = 16;
+constexpr uint64_t PM_WINDOW = 256;
+constexpr size_t TEXT_SIZE = 64;
+// Clients connected between polls, join notifications to them stay within server mailboxes
+constexpr size_t CONNECT_CHUNK = 32;
+constexpr int POLL_TIMEOUT = 100;       // milliseconds
+constexpr auto QUIET_PERIOD = 200ms;    // nothing received, join and leave notifications are drained
+constexpr auto IDLE_TIMEOUT = 10s;      // nothing received, run fails
+constexpr auto SERVER_START_TIMEOUT = 5s;
+// Bytes of one direction of pipe, every client has two
+constexpr size_t PIPE_BUFFER_SIZE = 16 * 1024;
+
+class BenchClient : public ClientBase
+{
+public:
+    bool joined = false;
+};
+
+class EndToEndBench
+{
+public:
+    explicit EndToEndBench(bool pipes) : m_pipes(pipes) {}
+    bool Run();
+private:
+    bool Connect(size_t count);
+    bool ConnectTransport(BenchClient& client);
+    bool Measure(bool broadcast);
+    void Disconnect();
+    // Waits until all clients joined and nothing is received for quiet period
+    bool Drain();
+    // Processes socket events, received is set if any frame was received
+    bool Poll(int timeout, bool& received);
+    // Pipe mode of Poll, scans pipes until something is received or timeout
+    bool Scan(int timeout, bool& received);
+    bool ProcessEvents(BenchClient& client, bool writable, bool& received);
+    bool ProcessFrame(BenchClient& client, uint64_t now);
+    bool Send(BenchClient& client, ClientMessage& msg);
+    void PrintResult(const char* kind, uint64_t nMessages, uint64_t ns);
+
+private:
+    bool m_pipes;
+    std::shared_ptr<PipeListener> m_pipeListener = std::make_shared<PipeListener>(PIPE_BUFFER_SIZE);
+    CSOCKADDR_IN m_addr = CSOCKADDR_IN(AF_INET, ::htons(BENCH_PORT), ::htonl(INADDR_LOOPBACK));
+    std::vector<std::unique_ptr<BenchClient>> m_clients;
+    size_t m_nJoined = 0;
+    std::vector<WSAPOLLFD> m_fds;
+    std::vector<char> m_frame;
+    std::vector<ClientMessage> m_batchMsgs;
+    size_t m_nResults = 0;
+    // Measured run
+    bool m_measuring = false;
+    ClientCommand m_kind = ClientCommand::Error;
+    uint64_t m_received = 0;
+    std::vector<uint64_t> m_latencies;      // nanoseconds
+};
+
+bool EndToEndBench::Run()
+{
+    Server server(m_pipes ? 0 : BENCH_PORT);
+    if (m_pipes)
+        server.AddListener(m_pipeListener);
+    std::atomic_bool serverOk(true);
+    std::thread serverThread([&server, &serverOk]() { serverOk = server.Run(false); });
+
+    bool ok = true;
+    std::cout << "[";
+    for (size_t count : CLIENT_COUNTS)
+    {
+        ok = Connect(count) && Measure(true) && Measure(false);
+        if (!ok)
+            break;
+    }
+    std::cout << "\n]\n";
+
+    Disconnect();
+    server.Stop();
+    serverThread.join();
+    if (!ok)
+        std::cout << "Clients lost connection or messages weren't delivered\n";
+    return ok && serverOk;
+}
+
+// Adds clients up to count
+bool EndToEndBench::Connect(size_t count)
+{
+    bool received;
+    while (m_clients.size() < count)
+    {
+        std::unique_ptr<BenchClient> client(new BenchClient);
+        client->SetName(L"client"s + std::to_wstring(m_clients.size()));
+        if (!ConnectTransport(*client) || !client->SetNonBlocking(true))
+            return false;
+
+        ClientMessage msg;
+        msg.command = ClientCommand::ClientConnect;
+        msg.protocolVersion = PROTOCOL_VERSION;
+        msg.capabilities = CapBatching;
+        if (!Send(*client, msg))
+            return false;
+        m_clients.push_back(std::move(client));
+
+        if (m_clients.size() % CONNECT_CHUNK == 0 && !Poll(0, received))
+            return false;
+    }
+    return Drain();
+}
+
+// Server may be still starting
+bool EndToEndBench::ConnectTransport(BenchClient& client)
+{
+    // Pipe connection waits for accept in listener
+    if (m_pipes)
+    {
+        client.SetTransport(m_pipeListener->Connect());
+        return !!client;
+    }
+
+    auto deadline = BenchClock::now() + SERVER_START_TIMEOUT;
+    do
+    {
+        client.SetTransport(SocketTransport::ConnectTcp(m_addr));
+        if (client)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(POLL_TIMEOUT));
+    } while (m_clients.empty() && BenchClock::now() < deadline);
+    return false;
+}
+
+bool EndToEndBench::Measure(bool broadcast)
+{
+    size_t nClients = m_clients.size();
+    if (nClients < 2)
+        return true;
+    uint64_t perMessage = broadcast ? nClients - 1 : 1;
+    uint64_t nMessages = (std::max)(DELIVERIES / perMessage, uint64_t(1));
+    uint64_t window = (broadcast ? BROADCAST_WINDOW : PM_WINDOW) * perMessage;
+    uint64_t expected = nMessages * perMessage;
+
+    m_kind = broadcast ? ClientCommand::BroadcastMessage : ClientCommand::PrivateMessage;
+    m_received = 0;
+    m_latencies.clear();
+    m_latencies.reserve(expected);
+    m_measuring = true;
+
+    ClientMessage msg;
+    msg.command = m_kind;
+    msg.msg.assign(TEXT_SIZE, L'x');
+    uint64_t sent = 0;
+    bool ok = true;
+    BenchTimer timer;
+    auto lastReceived = BenchClock::now();
+    while (ok && m_received < expected)
+    {
+        for (; sent < nMessages && sent * perMessage - m_received < window; ++sent)
+        {
+            BenchClient& from = *m_clients[sent % nClients];
+            if (!broadcast)
+                msg.pmTo = *m_clients[(sent + 1) % nClients]->GetName();
+            ok = ok && Send(from, msg);
+        }
+        bool received = false;
+        ok = ok && Poll(POLL_TIMEOUT, received);
+        auto now = BenchClock::now();
+        if (received)
+            lastReceived = now;
+        else if (now - lastReceived > IDLE_TIMEOUT)
+            ok = false;
+    }
+    uint64_t ns = timer.ElapsedNs();
+    m_measuring = false;
+    if (!ok)
+        return false;
+
+    PrintResult(broadcast ? "broadcast" : "pm", nMessages, ns);
+    return true;
+}
+
+// Leave notifications are received by remaining clients, so server doesn't fail posting to them
+void EndToEndBench::Disconnect()
+{
+    bool received;
+    while (!m_clients.empty())
+    {
+        size_t nLeft = m_clients.size() - (std::min)(m_clients.size(), CONNECT_CHUNK);
+        m_clients.resize(nLeft);
+        if (!m_clients.empty())
+            Poll(0, received);
+    }
+    m_nJoined = 0;
+}
+
+bool EndToEndBench::Drain()
+{
+    auto lastReceived = BenchClock::now();
+    for (;;)
+    {
+        bool received = false;
+        if (!Poll(POLL_TIMEOUT, received))
+            return false;
+        auto now = BenchClock::now();
+        if (received)
+            lastReceived = now;
+        else if (m_nJoined == m_clients.size() && now - lastReceived >= QUIET_PERIOD)
+            return true;
+        else if (now - lastReceived > IDLE_TIMEOUT)
+            return false;
+    }
+}
+
+bool EndToEndBench::Poll(int timeout, bool& received)
+{
+    if (m_pipes)
+        return Scan(timeout, received);
+
+    m_fds.clear();
+    for (auto& client : m_clients)
+    {
+        short events = POLLRDNORM;
+        if (client->HasPendingSend())
+            events |= POLLWRNORM;
+        m_fds.push_back({ client->GetTransport()->Handle(), events, 0 });
+    }
+    int result = ::WSAPoll(m_fds.data(), static_cast<ULONG>(m_fds.size()), timeout);
+    if (result == SOCKET_ERROR)
+        return false;
+
+    for (size_t i = 0; result > 0 && i < m_fds.size(); ++i)
+    {
+        short revents = m_fds[i].revents;
+        if (!revents)
+            continue;
+        --result;
+        if (!(revents & (POLLRDNORM | POLLHUP | POLLERR)))
+        {
+            if ((revents & POLLWRNORM) && !m_clients[i]->SendPending())
+                return false;
+            continue;
+        }
+        if (!ProcessEvents(*m_clients[i], (revents & POLLWRNORM) != 0, received))
+            return false;
+    }
+    return true;
+}
+
+bool EndToEndBench::Scan(int timeout, bool& received)
+{
+    auto deadline = BenchClock::now() + std::chrono::milliseconds(timeout);
+    do
+    {
+        for (auto& client : m_clients)
+        {
+            if (!ProcessEvents(*client, client->HasPendingSend(), received))
+                return false;
+        }
+        if (received)
+            break;
+        std::this_thread::yield();
+    } while (BenchClock::now() < deadline);
+    return true;
+}
+
+bool EndToEndBench::ProcessEvents(BenchClient& client, bool writable, bool& received)
+{
+    if (writable && !client.SendPending())
+        return false;
+
+    bool closed = false;
+    if (!client.RecvAvailable(closed) || closed)
+        return false;
+    uint64_t now = ClientMessage::Now();
+    for (bool ready = true;;)
+    {
+        if (!client.NextFrame(m_frame, ready))
+            return false;
+        if (!ready)
+            break;
+        if (!ProcessFrame(client, now))
+            return false;
+        received = true;
+    }
+    return true;
+}
+
+bool EndToEndBench::ProcessFrame(BenchClient& client, uint64_t now)
+{
+    uint32_t size = static_cast<uint32_t>(m_frame.size());
+    m_batchMsgs.clear();
+    if (MessageBatch::IsBatch(m_frame.data(), size))
+    {
+        if (!MessageBatch::Unserialize(m_frame.data(), size, m_batchMsgs))
+            return false;
+    }
+    else
+    {
+        m_batchMsgs.emplace_back();
+        m_batchMsgs.back().Unserialize(m_frame.data(), size);
+    }
+
+    for (const auto& msg : m_batchMsgs)
+    {
+        if (msg.command == ClientCommand::ConnectAccept && !client.joined)
+        {
+            client.SetConnectionOptions(msg.protocolVersion, msg.capabilities);
+            client.joined = true;
+            ++m_nJoined;
+        }
+        else if (m_measuring && msg.command == m_kind)
+        {
+            m_latencies.push_back(now > msg.timeStamp ? now - msg.timeStamp : 0);
+            ++m_received;
+        }
+    }
+    return true;
+}
+
+bool EndToEndBench::Send(BenchClient& client, ClientMessage& msg)
+{
+    uint32_t size = 0;
+    msg.from = *client.GetName();
+    msg.timeStamp = ClientMessage::Now();
+    auto data = msg.Serialize(&size);
+    return data && client.SendData(data.get(), size);
+}
+
+void EndToEndBench::PrintResult(const char* kind, uint64_t nMessages, uint64_t ns)
+{
+    std::sort(m_latencies.begin(), m_latencies.end());
+    auto percentile = [this](double q)
+    {
+        size_t i = (std::min)(static_cast<size_t>(m_latencies.size() * q), m_latencies.size() - 1);
+        return FormatDouble(double(m_latencies[i]) / 1000, 1);
+    };
+    std::cout << (m_nResults++ ? ",\n" : "\n")
+        << "  { \"transport\": \"" << (m_pipes ? "pipe" : "tcp") << '"'
+        << ", \"clients\": " << m_clients.size()
+        << ", \"kind\": \"" << kind << '"'
+        << ", \"messages\": " << nMessages
+        << ", \"deliveries\": " << m_received
+        << ", \"seconds\": " << FormatDouble(double(ns) / 1e9, 3)
+        << ", \"deliveries_per_sec\": " << FormatDouble(m_received * 1e9 / ns, 0)
+        << ", \"p50_us\": " << percentile(0.5)
+        << ", \"p99_us\": " << percentile(0.99)
+        << ", \"p999_us\": " << percentile(0.999) << " }";
+    std::cout.flush();
+}
+
+} // namespace
+
+bool RunEndToEndBench()
+{
+    EndToEndBench bench(false);
+    return bench.Run();
+}
+
+bool RunEndToEndPipeBench()
+{
+    EndToEndBench bench(true);
+    return bench.Run();
+}
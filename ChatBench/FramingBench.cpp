@@ -0,0 +1,107 @@
+#include "Bench.h"
+#include "../ChatServer/Common.h"
+#include "../ChatServer/ClientBase.h"
+#include <algorithm>
+#include <thread>
+
+// Cost of ClientBase framing per frame size over a connected loopback socket pair:
+// one thread sends frames with SendData, the measured thread receives them with RecvData.
+// Allocations of both ends are counted. Compressed frames are measured when zlib is built in.
+// Received frames are checked for size and contents.
+
+namespace
+{
+
+constexpr size_t FRAME_SIZES[] = { 16, 256, 4096, 65536, 1 << 20 };
+constexpr size_t MAX_FRAMES = 100000;
+constexpr size_t BYTES_PER_RUN = 256 << 20;
+
+// Windows has no socketpair, sockets are connected through a listener on a free loopback port
+bool MakeSocketPair(CSOCKET& first, CSOCKET& second)
+{
+    CSOCKET listener;
+    CSOCKADDR_IN addr(AF_INET, 0, ::htonl(INADDR_LOOPBACK));
+    int addrSize = addr.Size();
+    if (!listener.Init(PF_INET, SOCK_STREAM, IPPROTO_TCP) ||
+        ::bind(listener, addr, addr.Size()) != 0 ||
+        ::listen(listener, 1) != 0 ||
+        ::getsockname(listener, addr, &addrSize) != 0)
+        return false;
+    if (!first.Init(PF_INET, SOCK_STREAM, IPPROTO_TCP) || ::connect(first, addr, addr.Size()) != 0)
+        return false;
+    second.Reset(::accept(listener, nullptr, nullptr));
+    return !!second;
+}
+
+bool RunFraming(size_t frameSize, bool compressed, OpStats& stats)
+{
+    ClientBase sender, receiver;
+    CSOCKET first, second;
+    if (!MakeSocketPair(first, second))
+        return false;
+    sender.SetTransport(TransportUPtr(new SocketTransport(first.Release())));
+    receiver.SetTransport(TransportUPtr(new SocketTransport(second.Release())));
+    if (compressed && !(receiver.InitDecompression() && sender.InitDecompression() && sender.InitCompression()))
+        return false;
+
+    // Text like payload, so compression has something to do
+    std::vector<char> frame(frameSize);
+    for (size_t i = 0; i < frameSize; ++i)
+        frame[i] = "chat message text "[i % 18];
+    size_t nFrames = (std::min)(MAX_FRAMES, BYTES_PER_RUN / frameSize);
+
+    bool sent = true;
+    std::thread senderThread([&]()
+    {
+        for (size_t i = 0; i < nFrames && sent; ++i)
+            sent = sender.SendData(frame.data(), static_cast<uint32_t>(frameSize));
+        // Receiver waiting for lost frames gets end of stream
+        if (!sent)
+            sender.CloseTransport();
+    });
+
+    bool received = true;
+    std::vector<char> data;
+    stats = MeasureOps(nFrames, [&](size_t)
+    {
+        uint32_t size = 0;
+        received = received && receiver.RecvData(data, &size) && size == frameSize;
+    });
+    // Sender blocked on full socket fails
+    if (!received)
+        receiver.CloseTransport();
+    senderThread.join();
+    return sent && received && data == frame;
+}
+
+} // namespace
+
+bool RunFramingBench()
+{
+    WSAInit wsaInit;
+    bool ok = true;
+    std::vector<bool> compressionModes = { false };
+    if (FrameCompressor::IsSupported())
+        compressionModes.push_back(true);
+
+    PrintRow({ "frame", "compressed", "ns/op", "allocs/op", "bytes/op", "MB/s" });
+    for (bool compressed : compressionModes)
+    {
+        for (size_t frameSize : FRAME_SIZES)
+        {
+            OpStats stats;
+            if (!RunFraming(frameSize, compressed, stats))
+            {
+                ok = false;
+                continue;
+            }
+            std::vector<std::string> row = { std::to_string(frameSize), compressed ? "yes" : "no" };
+            AppendOpStats(row, stats);
+            row.push_back(FormatDouble(frameSize * 1e3 / stats.ns, 1));
+            PrintRow(row);
+        }
+    }
+    if (!ok)
+        std::cout << "Frames were lost or differ from sent ones\n";
+    return ok;
+}
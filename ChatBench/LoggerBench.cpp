@@ -0,0 +1,110 @@
+#include "Bench.h"
+#include "../ChatServer/Logger.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+
+// Cost of a log call on the calling thread: disabled level, asynchronous logger
+// and formatting with wstringstream under a mutex, as ConsoleProxy does, for 1-8 threads.
+// Sink only counts lines, so terminal speed doesn't matter. Every record must be written or counted as dropped.
+
+namespace
+{
+
+const size_t threadCounts[] = { 1, 2, 4, 8 };
+constexpr size_t RECORDS_PER_THREAD = 200000;
+
+template <typename Fn>
+uint64_t RunThreads(size_t nThreads, Fn fn)
+{
+    std::atomic<bool> start(false);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            while (!start)
+                std::this_thread::yield();
+            fn(i);
+        });
+    }
+    BenchTimer timer;
+    start = true;
+    for (auto& thr : threads)
+        thr.join();
+    return timer.ElapsedNs();
+}
+
+std::string NsPerCall(uint64_t ns, uint64_t nCalls)
+{
+    return FormatDouble(double(ns) / nCalls, 1) + "ns";
+}
+
+} // namespace
+
+bool RunLoggerBench()
+{
+    std::atomic<uint64_t> nLines(0);
+    Logger& logger = Logger::GetInstance();
+    logger.Start([&nLines](const std::wstring& text)
+    {
+        // Lines about dropped records aren't counted
+        for (size_t pos = text.find(L" received "); pos != text.npos; pos = text.find(L" received ", pos + 1))
+            ++nLines;
+    });
+    const std::wstring name = L"client";
+    LogLevel savedLevel = Logger::GetLevel();
+
+    std::cout << "Ring of " << DEF_LOG_RING_SIZE << " records per thread, flush interval " << DEF_LOG_FLUSH_INTERVAL << " ms\n";
+    PrintRow({ "threads", "disabled", "async", "dropped", "wstringstream" });
+
+    bool ok = true;
+    for (auto nThreads : threadCounts)
+    {
+        uint64_t nCalls = RECORDS_PER_THREAD * nThreads;
+
+        Logger::SetLevel(LogLevel::Info);
+        uint64_t disabledNs = RunThreads(nThreads, [&name](size_t id)
+        {
+            for (size_t i = 0; i < RECORDS_PER_THREAD; ++i)
+                CHAT_LOG(Trace, L"Client {} {} received {} of {}", name, id, i, RECORDS_PER_THREAD);
+        });
+
+        Logger::SetLevel(LogLevel::Trace);
+        logger.Flush();
+        nLines = 0;
+        uint64_t droppedBefore = Logger::GetDroppedCount();
+        uint64_t asyncNs = RunThreads(nThreads, [&name](size_t id)
+        {
+            for (size_t i = 0; i < RECORDS_PER_THREAD; ++i)
+                CHAT_LOG(Trace, L"Client {} {} received {} of {}", name, id, i, RECORDS_PER_THREAD);
+        });
+        logger.Flush();
+        uint64_t nDropped = Logger::GetDroppedCount() - droppedBefore;
+        if (nLines + nDropped != nCalls)
+            ok = false;
+
+        std::mutex mtx;
+        std::wstring out;
+        uint64_t streamNs = RunThreads(nThreads, [&](size_t id)
+        {
+            for (size_t i = 0; i < RECORDS_PER_THREAD; ++i)
+            {
+                std::wstringstream wss;
+                wss << L"Client " << name << L" " << id << L" received " << i << L" of " << RECORDS_PER_THREAD << L"\n";
+                std::unique_lock<std::mutex> lk(mtx);
+                out = wss.str();
+            }
+        });
+
+        PrintRow({ std::to_string(nThreads), NsPerCall(disabledNs * nThreads, nCalls), NsPerCall(asyncNs * nThreads, nCalls),
+            FormatDouble(nDropped * 100.0 / nCalls, 1) + "%", NsPerCall(streamNs * nThreads, nCalls) });
+    }
+    Logger::SetLevel(savedLevel);
+    logger.Stop();
+
+    if (!ok)
+        std::cout << "Log records were lost\n";
+    return ok;
+}
@@ -0,0 +1,222 @@
+#include "Bench.h"
+#include "../ChatServer/Mailbox.h"
+#include "../ChatServer/Event.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// Throughput and correctness of Mailbox with 1-64 producers:
+// - consumer thread woken through wakeup hook, as event loop would use it;
+// - combining, producers that find mailbox idle consume themselves, as ServerClient::PostData does;
+// - mutex and condition variable queue for comparison.
+// Every item carries producer index and its number, consumer checks that items of each producer
+// come in order and none is lost or duplicated.
+
+namespace
+{
+
+const size_t producerCounts[] = { 1, 2, 4, 8, 16, 32, 64 };
+constexpr size_t ITEMS_PER_RUN = 2000000;
+constexpr size_t MAILBOX_CAPACITY = 1024;
+constexpr size_t BATCH_SIZE = 256;
+
+typedef uint64_t Item;  // [producer:16][number:48]
+
+Item MakeItem(size_t producer, uint64_t number)
+{
+    return (static_cast<uint64_t>(producer) << 48) | number;
+}
+
+// Checks order of items of every producer
+class ItemChecker
+{
+public:
+    explicit ItemChecker(size_t nProducers) : m_next(nProducers, 0) {}
+
+    void operator () (Item item)
+    {
+        size_t producer = static_cast<size_t>(item >> 48);
+        uint64_t number = item & ((uint64_t(1) << 48) - 1);
+        if (producer >= m_next.size() || m_next[producer] != number)
+            m_ok = false;
+        else
+            ++m_next[producer];
+        ++m_count;
+    }
+    size_t Count() const { return m_count; }
+    bool Ok(size_t itemsPerProducer) const
+    {
+        for (auto next : m_next)
+        {
+            if (next != itemsPerProducer)
+                return false;
+        }
+        return m_ok;
+    }
+
+private:
+    std::vector<uint64_t> m_next;
+    size_t m_count = 0;
+    bool m_ok = true;
+};
+
+struct Result
+{
+    uint64_t ns = 0;
+    bool ok = false;
+};
+
+template <typename Produce>
+uint64_t RunProducers(size_t nProducers, size_t itemsPerProducer, Produce produce)
+{
+    std::atomic<bool> start(false);
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i < nProducers; ++i)
+    {
+        producers.emplace_back([&, i]()
+        {
+            while (!start)
+                std::this_thread::yield();
+            for (uint64_t n = 0; n < itemsPerProducer; ++n)
+                produce(MakeItem(i, n));
+        });
+    }
+    BenchTimer timer;
+    start = true;
+    for (auto& thr : producers)
+        thr.join();
+    return timer.ElapsedNs();
+}
+
+Result RunWakeup(size_t nProducers, size_t itemsPerProducer)
+{
+    Mailbox<Item> mailbox(MAILBOX_CAPACITY);
+    Event wakeup;
+    mailbox.SetWakeup([&wakeup]() { wakeup.Signal(); });
+    ItemChecker checker(nProducers);
+    size_t total = nProducers * itemsPerProducer;
+
+    mailbox.Claim();
+    std::thread consumer([&]()
+    {
+        while (checker.Count() < total)
+        {
+            if (mailbox.PopBatch([&checker](Item& item) { checker(item); }, BATCH_SIZE))
+                continue;
+            // Producer that claims released mailbox signals wakeup
+            if (mailbox.Release() || !mailbox.Claim())
+                wakeup.Wait();
+        }
+    });
+
+    Result result;
+    result.ns = RunProducers(nProducers, itemsPerProducer, [&mailbox](Item item)
+    {
+        while (!mailbox.Push(item))
+            std::this_thread::yield();
+    });
+    consumer.join();
+    result.ok = checker.Ok(itemsPerProducer);
+    return result;
+}
+
+Result RunCombining(size_t nProducers, size_t itemsPerProducer)
+{
+    Mailbox<Item> mailbox(MAILBOX_CAPACITY);
+    ItemChecker checker(nProducers);
+    std::atomic<int> nConsumers(0);
+    std::atomic<bool> overlapped(false);
+
+    Result result;
+    result.ns = RunProducers(nProducers, itemsPerProducer, [&](Item item)
+    {
+        while (!mailbox.Push(item))
+            std::this_thread::yield();
+        if (!mailbox.Claim())
+            return;
+        do
+        {
+            if (++nConsumers != 1)
+                overlapped = true;
+            while (mailbox.PopBatch([&checker](Item& item) { checker(item); }, BATCH_SIZE)) {}
+            --nConsumers;
+        } while (!mailbox.Release() && mailbox.Claim());
+    });
+    result.ok = !overlapped && checker.Ok(itemsPerProducer);
+    return result;
+}
+
+Result RunMutexQueue(size_t nProducers, size_t itemsPerProducer)
+{
+    std::mutex mtx;
+    std::condition_variable notEmpty, notFull;
+    std::vector<Item> queue, taken;
+    ItemChecker checker(nProducers);
+    size_t total = nProducers * itemsPerProducer;
+
+    std::thread consumer([&]()
+    {
+        while (checker.Count() < total)
+        {
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                notEmpty.wait(lk, [&queue]() { return !queue.empty(); });
+                taken.swap(queue);
+            }
+            notFull.notify_all();
+            for (auto item : taken)
+                checker(item);
+            taken.clear();
+        }
+    });
+
+    Result result;
+    result.ns = RunProducers(nProducers, itemsPerProducer, [&](Item item)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        notFull.wait(lk, [&queue]() { return queue.size() < MAILBOX_CAPACITY; });
+        queue.push_back(item);
+        if (queue.size() == 1)
+            notEmpty.notify_one();
+    });
+    consumer.join();
+    result.ok = checker.Ok(itemsPerProducer);
+    return result;
+}
+
+std::string PerSecond(uint64_t n, uint64_t ns)
+{
+    return ns ? FormatDouble(double(n) * 1e3 / ns, 2) + "M/s" : "-";
+}
+
+} // namespace
+
+bool RunMailboxBench()
+{
+    std::cout << std::thread::hardware_concurrency() << " hardware threads, capacity " << MAILBOX_CAPACITY << '\n';
+    PrintRow({ "producers", "wakeup", "combining", "mutex queue" });
+
+    bool ok = true;
+    for (auto nProducers : producerCounts)
+    {
+        size_t itemsPerProducer = ITEMS_PER_RUN / nProducers;
+        size_t total = itemsPerProducer * nProducers;
+        Result results[] =
+        {
+            RunWakeup(nProducers, itemsPerProducer),
+            RunCombining(nProducers, itemsPerProducer),
+            RunMutexQueue(nProducers, itemsPerProducer),
+        };
+        std::vector<std::string> row = { std::to_string(nProducers) };
+        for (const auto& result : results)
+        {
+            row.push_back(result.ok ? PerSecond(total, result.ns) : "FAILED");
+            ok = ok && result.ok;
+        }
+        PrintRow(row);
+    }
+    if (!ok)
+        std::cout << "Items were lost, duplicated, reordered or consumed concurrently\n";
+    return ok;
+}
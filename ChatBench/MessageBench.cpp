@@ -0,0 +1,90 @@
+#include "Bench.h"
+#include "../ChatServer/ClientMessage.h"
+#include <algorithm>
+
+// Cost of ClientMessage serialization per text size: serialize, unserialize into a reused
+// message and into a new one, append to batch and unpack a batch of BATCH_MESSAGES messages
+// (fewer for long texts, batch is limited in size).
+// Unpacked messages are checked against the serialized one.
+
+namespace
+{
+
+constexpr size_t TEXT_SIZES[] = { 16, 256, 4096, 65536 };
+constexpr size_t MAX_OPS = 200000;
+constexpr size_t BYTES_PER_RUN = 64 << 20;
+constexpr size_t BATCH_MESSAGES = 16;
+constexpr size_t COLUMN_WIDTH = 18;
+
+} // namespace
+
+bool RunMessageBench()
+{
+    bool ok = true;
+    PrintRow({ "operation", "chars", "ns/op", "allocs/op", "bytes/op" }, COLUMN_WIDTH);
+    for (size_t textSize : TEXT_SIZES)
+    {
+        size_t nOps = (std::min)(MAX_OPS, BYTES_PER_RUN / (textSize * sizeof(wchar_t)));
+
+        ClientMessage msg;
+        msg.command = ClientCommand::BroadcastMessage;
+        msg.from = L"client";
+        msg.msg.assign(textSize, L'x');
+        msg.timeStamp = ClientMessage::Now();
+        uint32_t size = 0;
+        auto frame = msg.Serialize(&size);
+
+        std::vector<std::pair<const char*, OpStats>> results;
+        results.emplace_back("serialize", MeasureOps(nOps, [&msg](size_t)
+        {
+            uint32_t frameSize = 0;
+            auto data = msg.Serialize(&frameSize);
+            DoNotOptimize(data);
+        }));
+
+        ClientMessage received;
+        results.emplace_back("unserialize", MeasureOps(nOps, [&](size_t)
+        {
+            received.Unserialize(frame.get(), size);
+        }));
+        ok = ok && received.command == msg.command && received.msg == msg.msg && received.from == msg.from;
+
+        results.emplace_back("unserialize new", MeasureOps(nOps, [&](size_t)
+        {
+            ClientMessage newMsg;
+            newMsg.Unserialize(frame.get(), size);
+            DoNotOptimize(newMsg);
+        }));
+
+        MessageBatch batch;
+        results.emplace_back("batch append", MeasureOps(nOps, [&](size_t)
+        {
+            if (batch.Count() == BATCH_MESSAGES || !batch.Append(frame.get(), size))
+            {
+                batch.Clear();
+                batch.Append(frame.get(), size);
+            }
+        }));
+
+        batch.Clear();
+        for (size_t i = 0; i < BATCH_MESSAGES; ++i)
+            batch.Append(frame.get(), size);
+        std::vector<ClientMessage> msgs;
+        results.emplace_back("unbatch", MeasureOps((std::max)(nOps / BATCH_MESSAGES, size_t(1)), [&](size_t)
+        {
+            msgs.clear();
+            MessageBatch::Unserialize(batch.Data(), batch.Size(), msgs);
+        }));
+        ok = ok && msgs.size() == batch.Count() && msgs.back().msg == msg.msg && msgs.back().timeStamp == msg.timeStamp;
+
+        for (const auto& result : results)
+        {
+            std::vector<std::string> row = { result.first, std::to_string(textSize) };
+            AppendOpStats(row, result.second);
+            PrintRow(row, COLUMN_WIDTH);
+        }
+    }
+    if (!ok)
+        std::cout << "Unserialized messages differ from serialized ones\n";
+    return ok;
+}
@@ -0,0 +1,72 @@
+#include "Bench.h"
+#include "../ChatClient/Scrollback.h"
+#include <deque>
+
+// Client joining a backlog of received messages: memory of Scrollback after each backlog size,
+// time of adding a message and of copying a screen window, which must not grow with the backlog.
+// Window contents are checked against the newest added lines.
+
+namespace
+{
+
+constexpr size_t BACKLOGS[] = { 1000, 10000, 100000 };
+constexpr size_t WINDOWS = 10000;
+constexpr uint16_t WIDTH = 120;
+constexpr uint16_t ROWS = 48;
+
+const std::wstring name = L"client";
+const std::wstring timeStr = L"[12:00:00] ";
+
+std::string Kilobytes(size_t size)
+{
+    return FormatDouble(double(size) / 1024, 0) + "KB";
+}
+
+} // namespace
+
+bool RunScrollbackBench()
+{
+    bool ok = true;
+    PrintRow({ "backlog", "kept", "memory", "add ns", "window ns" });
+    for (size_t backlog : BACKLOGS)
+    {
+        Scrollback scrollback;
+        std::deque<std::wstring> lastLines;
+        std::wstring text(64, L'x');
+
+        BenchTimer timer;
+        for (size_t i = 0; i < backlog; ++i)
+        {
+            text.resize(16 + i % 96, L'x');
+            const std::wstring& line = scrollback.Add(i % 3 ? Console::Yellow : Console::Cyan, L"{}{}{}: {}\n",
+                timeStr, name, i % 64, text);
+            lastLines.push_back(line);
+            if (lastLines.size() > ROWS)
+                lastLines.pop_front();
+        }
+        uint64_t addNs = timer.ElapsedNs();
+
+        std::wstring window;
+        std::vector<Console::ColorRun> runs;
+        timer.Restart();
+        for (size_t i = 0; i < WINDOWS; ++i)
+        {
+            scrollback.CopyWindow(i % ROWS, WIDTH, ROWS, window, runs);
+            DoNotOptimize(window);
+        }
+        uint64_t windowNs = timer.ElapsedNs();
+
+        // Last window ends with the newest lines
+        size_t nLines = scrollback.CopyWindow(0, WIDTH, ROWS, window, runs);
+        std::wstring expected;
+        for (auto it = lastLines.end() - (std::min)(nLines, lastLines.size()); it != lastLines.end(); ++it)
+            expected += *it;
+        ok = ok && nLines && window == expected && scrollback.MemorySize() <= DEF_CLIENT_SCROLLBACK_MEMORY + 1024 * sizeof(wchar_t);
+
+        PrintRow({ std::to_string(backlog), std::to_string(scrollback.Size()), Kilobytes(scrollback.MemorySize()),
+            FormatDouble(double(addNs) / backlog, 1), FormatDouble(double(windowNs) / WINDOWS, 1) });
+    }
+    if (!ok)
+        std::cout << "Scrollback window differs from added lines or memory exceeds the cap\n";
+    return ok;
+}
@@ -0,0 +1,192 @@
+#include "Bench.h"
+#include "../ChatServer/RWAccessManager.h"
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+
+#if defined(_MSC_VER) || __cplusplus >= 201703L
+typedef std::shared_mutex SharedMutex;
+#else
+typedef std::shared_timed_mutex SharedMutex;
+#endif
+
+// Lock and unlock throughput of RWAccessManager implementations and std::shared_mutex
+// for mixes of readers and writers, and wakeup latency of Event implementations.
+
+namespace
+{
+
+constexpr auto RUN_TIME = std::chrono::milliseconds(200);
+const size_t threadCounts[] = { 1, 2, 4, 8, 16 };
+const uint32_t writePercents[] = { 0, 1, 10, 50 };
+constexpr size_t PROTECTED_VALUES = 8;
+
+// Adapters with same interface for all locks
+template <typename AccessManager>
+struct AccessManagerLock
+{
+    AccessManager rwm;
+
+    void Lock(bool write) { write ? rwm.LockWrite() : rwm.LockRead(); }
+    void Unlock(bool) { rwm.Unlock(); }
+};
+
+struct SharedMutexLock
+{
+    SharedMutex mtx;
+
+    void Lock(bool write) { write ? mtx.lock() : mtx.lock_shared(); }
+    void Unlock(bool write) { write ? mtx.unlock() : mtx.unlock_shared(); }
+};
+
+struct RWResult
+{
+    uint64_t nOps = 0;
+    uint64_t ns = 0;
+    bool consistent = true;
+};
+
+// Writers increment all protected values, readers check they are equal
+template <typename Lock>
+RWResult RunRW(size_t nThreads, uint32_t writePercent)
+{
+    Lock lock;
+    uint64_t values[PROTECTED_VALUES] = {};
+    std::atomic<bool> start(false), stop(false), consistent(true);
+    std::vector<uint64_t> nOps(nThreads), nWrites(nThreads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            uint32_t rnd = static_cast<uint32_t>(i) * 2654435761u + 1;
+            uint64_t n = 0, writes = 0;
+            while (!start)
+                std::this_thread::yield();
+            while (!stop)
+            {
+                rnd = rnd * 1664525u + 1013904223u;
+                bool write = (rnd >> 8) % 100 < writePercent;
+                lock.Lock(write);
+                if (write)
+                {
+                    for (auto& value : values)
+                        ++value;
+                    ++writes;
+                }
+                else
+                {
+                    for (auto& value : values)
+                    {
+                        if (value != values[0])
+                            consistent = false;
+                    }
+                }
+                lock.Unlock(write);
+                ++n;
+            }
+            nOps[i] = n;
+            nWrites[i] = writes;
+        });
+    }
+
+    BenchTimer timer;
+    start = true;
+    std::this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    for (auto& thr : threads)
+        thr.join();
+
+    RWResult result;
+    result.ns = timer.ElapsedNs();
+    uint64_t totalWrites = 0;
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        result.nOps += nOps[i];
+        totalWrites += nWrites[i];
+    }
+    result.consistent = consistent && values[0] == totalWrites;
+    return result;
+}
+
+// Two threads pass the turn to each other through a pair of auto reset events
+template <typename EventType>
+double RunPingPong(size_t nRoundTrips)
+{
+    EventType ping, pong;
+    std::thread partner([&]()
+    {
+        for (size_t i = 0; i < nRoundTrips; ++i)
+        {
+            ping.Wait();
+            pong.Signal();
+        }
+    });
+    BenchTimer timer;
+    for (size_t i = 0; i < nRoundTrips; ++i)
+    {
+        ping.Signal();
+        pong.Wait();
+    }
+    auto ns = timer.ElapsedNs();
+    partner.join();
+    return double(ns) / nRoundTrips;
+}
+
+std::string PerSecond(uint64_t n, uint64_t ns)
+{
+    return ns ? FormatDouble(double(n) * 1e3 / ns, 2) + "M/s" : "-";
+}
+
+} // namespace
+
+bool RunSyncBench()
+{
+    std::cout << std::thread::hardware_concurrency() << " hardware threads, RWAccessManager is " <<
+#ifdef CHAT_USE_FUTEX
+        "futex"
+#else
+        "portable"
+#endif
+        " version\n";
+
+    std::vector<std::string> header = { "threads", "writes", "portable" };
+#ifdef __linux__
+    header.push_back("futex");
+#endif
+    header.push_back("shared_mutex");
+    PrintRow(header);
+
+    bool ok = true;
+    for (auto nThreads : threadCounts)
+    {
+        for (auto writePercent : writePercents)
+        {
+            std::vector<RWResult> results;
+            results.push_back(RunRW<AccessManagerLock<PortableRWAccessManager>>(nThreads, writePercent));
+#ifdef __linux__
+            results.push_back(RunRW<AccessManagerLock<FutexRWAccessManager>>(nThreads, writePercent));
+#endif
+            results.push_back(RunRW<SharedMutexLock>(nThreads, writePercent));
+
+            std::vector<std::string> row = { std::to_string(nThreads), std::to_string(writePercent) + "%" };
+            for (const auto& result : results)
+            {
+                row.push_back(PerSecond(result.nOps, result.ns));
+                ok = ok && result.consistent;
+            }
+            PrintRow(row);
+        }
+    }
+    if (!ok)
+        std::cout << "Readers saw partial writes or writes were lost\n";
+
+    constexpr size_t ROUND_TRIPS = 20000;
+    std::cout << "\nEvent ping-pong round trip: portable " << FormatDouble(RunPingPong<PortableEvent>(ROUND_TRIPS) / 1000) << " us";
+#ifdef __linux__
+    std::cout << ", futex " << FormatDouble(RunPingPong<FutexEvent>(ROUND_TRIPS) / 1000) << " us";
+#endif
+    std::cout << '\n';
+    return ok;
+}
@@ -0,0 +1,152 @@
+#include "Bench.h"
+#include "../ChatServer/TextCodec.h"
+#include <random>
+#include <algorithm>
+
+namespace
+{
+
+const char* const simdLevelNames[] = { "scalar", "sse2", "avx2" };
+
+const wchar_t* const words[] =
+{
+    L"hello", L"the", L"server", L"is", L"down", L"again", L"who", L"can", L"check", L"logs",
+    L"deploy", L"finished", L"build", L"failed", L"on", L"windows", L"agent", L"please", L"retry",
+    L"thanks", L"lunch", L"meeting", L"in", L"five", L"minutes", L"ok", L"sure", L"why", L"not",
+};
+
+struct Workload
+{
+    const char* name;
+    size_t textLength;
+    size_t nonAsciiPercent;
+    size_t nTexts;
+};
+
+// Realistic messages are short, long ones are pastes of logs and code
+const Workload workloads[] =
+{
+    { "chat ascii", 60, 0, 20000 },
+    { "chat cyrillic", 60, 100, 20000 },
+    { "long ascii", 64 * 1024, 0, 32 },
+    { "long mixed", 64 * 1024, 10, 32 },
+};
+
+constexpr uint64_t BYTES_PER_RUN = 256 * 1024 * 1024;
+
+std::vector<std::wstring> MakeTexts(const Workload& workload)
+{
+    std::mt19937 rnd(42);
+    auto uniform = [&rnd](size_t from, size_t to) { return std::uniform_int_distribution<size_t>(from, to)(rnd); };
+
+    std::vector<std::wstring> texts;
+    for (size_t i = 0; i < workload.nTexts; ++i)
+    {
+        std::wstring text;
+        while (text.size() < workload.textLength)
+        {
+            if (!text.empty())
+                text += L' ';
+            if (uniform(1, 100) > workload.nonAsciiPercent)
+            {
+                text += words[uniform(0, _countof(words) - 1)];
+                continue;
+            }
+            // Cyrillic word, 2 bytes per character in UTF-8
+            size_t len = uniform(3, 9);
+            for (size_t j = 0; j < len; ++j)
+                text += static_cast<wchar_t>(uniform(0x430, 0x44F));
+        }
+        text.resize(workload.textLength);
+        texts.push_back(std::move(text));
+    }
+    return texts;
+}
+
+// Runs operation over all texts until BYTES_PER_RUN bytes are processed, returns GB/s
+template <typename Operation>
+double Measure(size_t bytesPerPass, Operation operation)
+{
+    size_t nPasses = static_cast<size_t>((std::max<uint64_t>)(1, BYTES_PER_RUN / bytesPerPass));
+    operation(); // warm up
+    BenchTimer timer;
+    for (size_t i = 0; i < nPasses; ++i)
+        operation();
+    auto ns = timer.ElapsedNs();
+    return ns ? double(bytesPerPass) * nPasses / ns : 0.0;
+}
+
+} // namespace
+
+bool RunTextCodecBench()
+{
+    std::cout << "Max SIMD level: " << simdLevelNames[static_cast<size_t>(TextCodec::GetMaxSimdLevel())]
+        << ", wchar_t is " << sizeof(wchar_t) * 8 << " bit\n";
+    PrintRow({ "workload", "level", "validate", "to utf8", "from utf8" }, 16);
+
+    bool ok = true;
+    auto defaultLevel = TextCodec::GetSimdLevel();
+    for (const auto& workload : workloads)
+    {
+        // Texts are stored with terminators, as they are in frames
+        auto texts = MakeTexts(workload);
+        std::vector<std::string> utf8Texts(texts.size());
+        size_t wideBytes = 0, utf8Bytes = 0;
+        for (size_t i = 0; i < texts.size(); ++i)
+        {
+            if (!TextCodec::WideToUtf8(texts[i], utf8Texts[i]))
+                return false;
+            wideBytes += texts[i].size() * sizeof(wchar_t);
+            utf8Bytes += utf8Texts[i].size();
+        }
+
+        std::string utf8Buff(TextCodec::MaxUtf8Size(workload.textLength), '\0');
+        std::wstring wideBuff(workload.textLength, L'\0');
+        for (int level = 0; level <= static_cast<int>(TextCodec::GetMaxSimdLevel()); ++level)
+        {
+            TextCodec::SetSimdLevel(static_cast<TextCodec::SimdLevel>(level));
+
+            size_t nFailed = 0;
+            double validate = Measure(wideBytes, [&]()
+            {
+                for (const auto& text : texts)
+                {
+                    auto pZero = TextCodec::FindTerminator(text.c_str(), text.c_str() + text.size() + 1);
+                    nFailed += pZero != text.c_str() + text.size();
+                }
+            });
+            double toUtf8 = Measure(wideBytes, [&]()
+            {
+                for (const auto& text : texts)
+                {
+                    auto n = TextCodec::WideToUtf8(text.c_str(), text.size(), &utf8Buff[0]);
+                    nFailed += n == TextCodec::INVALID_TEXT;
+                }
+            });
+            double fromUtf8 = Measure(utf8Bytes, [&]()
+            {
+                for (const auto& text : utf8Texts)
+                {
+                    auto n = TextCodec::Utf8ToWide(text.c_str(), text.size(), &wideBuff[0]);
+                    nFailed += n == TextCodec::INVALID_TEXT;
+                }
+            });
+            DoNotOptimize(utf8Buff);
+            DoNotOptimize(wideBuff);
+
+            if (nFailed)
+            {
+                std::cout << "Valid text rejected in workload " << workload.name << '\n';
+                ok = false;
+            }
+            PrintRow({
+                workload.name,
+                simdLevelNames[level],
+                FormatDouble(validate) + " GB/s",
+                FormatDouble(toUtf8) + " GB/s",
+                FormatDouble(fromUtf8) + " GB/s" }, 16);
+        }
+    }
+    TextCodec::SetSimdLevel(defaultLevel);
+    return ok;
+}
@@ -1,13 +1,16 @@
 #include "Client.h"
 #include <iostream>
+#include <cstring>
 
-int main()
+// ChatClient [--poll], --poll runs the client in one thread
+int main(int argc, char** argv)
 {
     int ret = 1;
     try
     {
+        bool eventLoop = argc > 1 && strcmp(argv[1], "--poll") == 0;
         Client client;
-        ret = !client.Run();
+        ret = !client.Run(eventLoop);
     }
     catch (std::exception& exc)
     {
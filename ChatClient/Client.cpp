@@ -3,34 +3,75 @@
 #include "../ChatServer/ClientBase.h"
 #include "../ChatServer/ClientMessage.h"
 #include "../ChatServer/Console.h"
+#include "RenderQueue.h"
+#include "Scrollback.h"
 #include <thread>
 #include <algorithm>
 #include <sstream>
 #include <atomic>
+#include <mutex>
+#include <chrono>
 
 using namespace std::literals;
 
+typedef std::lock_guard<std::mutex> LockGuard;
+
+// Received sequenced messages are acknowledged after every ACK_INTERVAL messages
+constexpr uint64_t ACK_INTERVAL = 16;
+// Reconnection delay doubles after every failed attempt, attempts cover server grace period
+constexpr uint32_t RECONNECT_ATTEMPTS = 8;
+constexpr auto RECONNECT_INITIAL_DELAY = 250ms;
+constexpr auto RECONNECT_MAX_DELAY = 8s;
+// Frames sent by user while client is reconnecting
+constexpr size_t MAX_OUTBOX_FRAMES = 256;
+
+#ifndef DEF_CLIENT_SCROLLBACK_PAGE
+#define DEF_CLIENT_SCROLLBACK_PAGE 50 // most rows of messages shown by /scroll
+#endif
+
 #define breakable_block_begin do {
 #define breakable_block_end }while(0)
 
 class Client::Impl : public ClientBase
 {
 public:
-    Impl() : m_console(Console::GetInstance()), m_exit(false)
+    Impl() : m_console(Console::GetInstance()), m_render(m_console), m_exit(false)
     {
         WSAData wsaData;
         WSAStartup(MAKEWORD(2, 2), &wsaData);
-        if (!m_console.IsMultiThreaded())
-            m_console.SetMultiThreaded(true);
     }
     ~Impl() { WSACleanup(); }
 
-    bool Run();
+    bool Run(bool eventLoop);
 private:
     bool InitClient();
     bool ReceiveThread();
+    void RenderThread();
+    bool EventLoop();
+    bool ProcessFrame(const std::vector<char>& data, uint32_t size);
+    bool ProcessReceivedMessage(ClientMessage& msg);
+    bool ProcessConnectAccept(const ClientMessage& msg);
     bool ClientRoutine();
+    bool ProcessInputLine(const std::wstring& inpStr);
+    bool SendConnectRequest();
+    bool SendFrameData(ClientMessage::Data data, uint32_t size);
+    bool SendAck();
+    bool Reconnect();
+    bool BeginReconnect();
+    void EndReconnect();
+    bool PrintConnectionLost(int err);
+    bool ConnectToServer();
+    TransportUPtr OpenTransport() const;
     bool ParseInputLine(ClientMessage& msg, const std::wstring& str);
+    void ShowScrollback(const std::wstring& str);
+
+    uint32_t GetClientCapabilities() const noexcept
+    {
+        uint32_t capabilities = CapBatching | CapResume;
+        if (GetCompressor() && GetCompressor()->IsInflateEnabled())
+            capabilities |= CapCompression;
+        return capabilities;
+    }
 
     std::wstring GetTimeStr(uint64_t timestmp) const
     {
@@ -46,9 +87,25 @@ private:
             resStr = L"[Error time] ";
         return resStr;
     }
+    // Received messages of one second share the string, used by receive thread only
+    const std::wstring& GetCachedTimeStr(uint64_t timestmp)
+    {
+        if (timestmp != m_timeStrStamp || m_timeStr.empty())
+        {
+            m_timeStr = GetTimeStr(timestmp);
+            m_timeStrStamp = timestmp;
+        }
+        return m_timeStr;
+    }
 
-    void PrintInputMessage(const ClientMessage& msg, const std::wstring& str) const;
-    void PrintReceivedMessage(const ClientMessage& msg) const;
+    void PrintInputMessage(const ClientMessage& msg);
+    void PrintReceivedMessage(const ClientMessage& msg);
+    // Written after queued messages
+    void PrintStatus(const std::wstring& str)
+    {
+        m_render.Flush();
+        m_console.Write(str, Console::White);
+    }
     void PrintSockError() const
     {
         PrintError(L"Error\n"s + GetErrorMsg() + L"\n"s);
@@ -59,12 +116,35 @@ private:
     }
 private:
     std::thread m_recvThread;
+    std::thread m_renderThread;
     Console& m_console;
+    RenderQueue m_render;           // received messages are written at frame rate
     std::atomic<bool> m_exit;
+    uint64_t m_timeStrStamp = 0;
+    std::wstring m_timeStr;
+
+    // Received messages, added by receive thread and shown by input thread
+    std::mutex m_scrollbackMtx;
+    Scrollback m_scrollback;
+    std::wstring m_windowText;
+    std::vector<Console::ColorRun> m_windowRuns;
+
+    // Input and receive threads both send, and socket is replaced on reconnect
+    std::mutex m_sendMtx;
+    std::vector<std::pair<ClientMessage::Data, uint32_t>> m_outbox;    // frames sent while reconnecting
+    bool m_reconnecting = false;
+    // Resumable session
+    uint64_t m_resumeToken = 0;
+    uint64_t m_lastSequence = 0;    // sequence number of the last received message
+    uint64_t m_ackedSequence = 0;
+    std::string m_unixPath;         // server is connected over Unix domain socket
 };
 
-bool Client::Impl::Run()
+bool Client::Impl::Run(bool eventLoop)
 {
+    // Event loop reads and writes console from one thread only
+    if (m_console.IsMultiThreaded() == eventLoop)
+        m_console.SetMultiThreaded(!eventLoop);
     m_console.SetTextColor(Console::White);
 
     bool error = false;
@@ -74,7 +154,8 @@ bool Client::Impl::Run()
 
     breakable_block_begin;
     
-    if (::connect(m_socket, m_addr, m_addr.Size()) != 0)
+    SetTransport(OpenTransport());
+    if (!*this)
     {
         error = true;
         break;
@@ -82,7 +163,23 @@ bool Client::Impl::Run()
 
     m_console.SetTextColor(Console::Green);
 
+    // Must be able to decompress frames before compression is offered to server
+    InitDecompression();
+
+    if (!SendConnectRequest())
+    {
+        error = true;
+        break;
+    }
+
+    if (eventLoop)
+    {
+        error = !EventLoop();
+        break;
+    }
+
     m_recvThread = std::thread(&Impl::ReceiveThread, this);
+    m_renderThread = std::thread(&Impl::RenderThread, this);
 
     if (!ClientRoutine())
         error = true;
@@ -94,10 +191,16 @@ bool Client::Impl::Run()
     if (error)
         PrintSockError();
 
-    m_socket.Reset();
+    {
+        LockGuard lk(m_sendMtx);
+        ShutdownTransport();
+    }
 
     if (m_recvThread.joinable())
         m_recvThread.join();
+    if (m_renderThread.joinable())
+        m_renderThread.join();
+    CloseTransport();
 
     m_console.SetTextColor(Console::White);
     m_console.Write(L"Press any key"s);
@@ -124,10 +227,16 @@ bool Client::Impl::InitClient()
     std::string tmpStr;
     do
     {
-        m_console.Write(L"Enter server ip address: ");
+        m_console.Write(L"Enter server ip address or unix:<path>: ");
         if (!m_console.ReadLine(tmpStr))
             return false;
 
+        if (tmpStr.compare(0, 5, "unix:") == 0 && tmpStr.size() > 5)
+        {
+            m_unixPath = tmpStr.substr(5);
+            return true;
+        }
+
         m_addr.sin_addr.s_addr = ::inet_addr(tmpStr.c_str());
         if (m_addr.Addr().Addr() != INADDR_NONE)
             break;
@@ -154,109 +263,430 @@ bool Client::Impl::InitClient()
     } while (1);
 
     m_addr.sin_family = AF_INET;
-
-    if (!m_socket.Init(PF_INET, SOCK_STREAM, IPPROTO_TCP))
-    {
-        PrintSockError();
-        return false;
-    }
     return true;
 }
 
 bool Client::Impl::ReceiveThread()
 {
-    ClientMessage msg;
     std::vector<char> data;
     uint32_t recved;
     bool error = false;
 
-    while (!m_exit)
+    while (!m_exit && !error)
     {
         if (!RecvData(data, &recved))
         {
             auto err = WSAGetLastError();
-            if(err == WSAECONNRESET)
-                m_console.Write(L"Server shutdown\n", Console::White);
-            else if(err != WSAECONNABORTED)
-                error = true;              
+            if (!m_exit && Reconnect())
+                continue;
+            error = !PrintConnectionLost(err);
             break;
         }
         if (recved == 0)
         {
-            m_console.Write(L"You was disconnected\n", Console::White);
+            PrintStatus(L"You was disconnected\n");
             break;
         }
-        msg.Unserialize(data.data(), recved);
 
-        if (msg.command == ClientCommand::ServerMsg && msg.msg.compare(0, 22, L"ErrorNameAlreadyExists") == 0)
-        {
-            std::wistringstream iss(msg.msg);
-            std::wstring tmpStr;
-            iss >> tmpStr >> tmpStr;
-            msg.msg = L"User with name '"s + tmpStr + L"' already exists";
-            iss >> tmpStr;
-            m_name = std::move(tmpStr);
-            if (m_name.empty())
-                error = true;
-        }
-        PrintReceivedMessage(msg);     
+        error = !ProcessFrame(data, recved);
     }
 
+    m_exit = true;
+    m_render.Flush();
+
     if (error)
         PrintSockError();
 
-    m_exit = true;
-
     return !error;
 }
-bool Client::Impl::ClientRoutine()
+// One thread waits for console input, socket events, next frame of output and next reconnection attempt.
+// Socket is non-blocking, so neither input nor a slow server stalls the other.
+bool Client::Impl::EventLoop()
 {
-    std::wstring inpStr;
-    ClientMessage msg;
-    uint32_t dataSize = 0;
-    ClientMessage::Data data;
+    constexpr long SOCKET_EVENTS = FD_READ | FD_WRITE | FD_CLOSE;
+    constexpr auto frame = std::chrono::microseconds(1000000 / DEF_CLIENT_FRAME_RATE);
 
-    // Send to server connection request
-    msg.from = m_name;
-    msg.command = ClientCommand::ClientConnect;
-    msg.timeStamp = ::time(nullptr);
-    data = msg.Serialize(&dataSize);
-    if (!data || !SendData(data.get(), dataSize))
+    WSAEVENT sockEvent = WSACreateEvent();
+    if (sockEvent == WSA_INVALID_EVENT)
         return false;
+    HANDLE handles[] = { reinterpret_cast<HANDLE>(m_console.GetInputHandle()), sockEvent };
 
-    while (!m_exit)
+    std::wstring inpStr;
+    std::vector<char> data;
+    bool connected = SetNonBlocking(true) && WSAEventSelect(GetTransport()->Handle(), sockEvent, SOCKET_EVENTS) == 0;
+    bool error = !connected;
+    // Reconnection state
+    int lostErr = 0;
+    uint32_t attempt = 0;
+    std::chrono::milliseconds delay = RECONNECT_INITIAL_DELAY;
+    auto now = std::chrono::steady_clock::now();
+    auto reconnectAt = now;
+    auto lastFrame = now - frame;
+
+    while (!m_exit && !error)
     {
-        m_console.ReadLine(inpStr);
-        if (m_exit)
+        now = std::chrono::steady_clock::now();
+        if (!connected && now >= reconnectAt)
+        {
+            if (ConnectToServer())
+            {
+                connected = WSAEventSelect(GetTransport()->Handle(), sockEvent, SOCKET_EVENTS) == 0;
+                error = !connected;
+                continue;
+            }
+            if (++attempt == RECONNECT_ATTEMPTS)
+            {
+                EndReconnect();
+                error = !PrintConnectionLost(lostErr);
+                break;
+            }
+            delay = (std::min)(delay * 2, std::chrono::milliseconds(RECONNECT_MAX_DELAY));
+            reconnectAt = now + delay;
+        }
+        if (!m_render.Empty() && now - lastFrame >= frame)
+        {
+            m_render.Flush();
+            lastFrame = now;
+        }
+
+        // Wait for the nearest of queued output frame and reconnection attempt
+        auto wakeAt = now + std::chrono::hours(1);
+        if (!m_render.Empty())
+            wakeAt = lastFrame + frame;
+        if (!connected)
+            wakeAt = (std::min)(wakeAt, reconnectAt);
+        DWORD timeout = INFINITE;
+        if (wakeAt - now < std::chrono::hours(1))
+            timeout = static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now).count() + 1);
+        if (WaitForMultipleObjects(connected ? 2 : 1, handles, FALSE, timeout) == WAIT_FAILED)
+        {
+            error = true;
             break;
-        if (inpStr == L"/exit")
+        }
+
+        bool lineRead;
+        if (!m_console.TryReadLine(inpStr, lineRead))
         {
             m_exit = true;
             break;
         }
-        if (!ParseInputLine(msg, inpStr))
+        if (lineRead && !ProcessInputLine(inpStr))
+        {
+            error = true;
+            break;
+        }
+        if (!connected || m_exit)
             continue;
-        PrintInputMessage(msg, inpStr);
-        if (msg.command == ClientCommand::Help)
+
+        WSANETWORKEVENTS events;
+        if (WSAEnumNetworkEvents(GetTransport()->Handle(), sockEvent, &events) != 0)
+        {
+            error = true;
+            break;
+        }
+        if (events.lNetworkEvents & FD_WRITE)
+            SendPending();
+        if (!(events.lNetworkEvents & (FD_READ | FD_CLOSE)))
             continue;
-        msg.from = m_name;
-        data = msg.Serialize(&dataSize);
-        if (!data)
-            PrintError(L"Serialization failed\n");
-        else if (!SendData(data.get(), dataSize))
+
+        bool closed = false;
+        bool received = RecvAvailable(closed);
+        lostErr = WSAGetLastError();
+        // Frames received before connection was lost are processed
+        for (bool ready = true; !error && ready;)
         {
-            PrintError(L"Message was not sended\n");
-            PrintSockError();
-            return false;
+            error = !NextFrame(data, ready);
+            if (!error && ready)
+                error = !ProcessFrame(data, static_cast<uint32_t>(data.size()));
         }
-        if (msg.command == ClientCommand::ChangeName)
+        if (error)
+            break;
+        if (!received)
         {
-            m_name = msg.msg;
-            msg.from = std::move(msg.msg);
+            if (!BeginReconnect())
+            {
+                error = !PrintConnectionLost(lostErr);
+                break;
+            }
+            connected = false;
+            attempt = 0;
+            delay = RECONNECT_INITIAL_DELAY;
+            reconnectAt = now + delay;
         }
+        else if (closed)
+        {
+            PrintStatus(L"You was disconnected\n");
+            break;
+        }
+    }
+
+    m_render.Flush();
+    WSACloseEvent(sockEvent);
+    return !error;
+}
+// Messages of a frame are processed and acknowledged
+bool Client::Impl::ProcessFrame(const std::vector<char>& data, uint32_t size)
+{
+    bool error = false;
+    if (MessageBatch::IsBatch(data.data(), size))
+    {
+        std::vector<ClientMessage> batchMsgs;
+        if (!MessageBatch::Unserialize(data.data(), size, batchMsgs))
+            error = true;
+        for (auto it = batchMsgs.begin(); !error && it != batchMsgs.end(); ++it)
+        {
+            it->timeStamp = ClientMessage::FromProtocolTimeStamp(it->timeStamp, GetProtocolVersion());
+            error = !ProcessReceivedMessage(*it);
+        }
+    }
+    else
+    {
+        ClientMessage msg;
+        msg.Unserialize(data.data(), size);
+        // Older server sends timestamps in seconds
+        msg.timeStamp = ClientMessage::FromProtocolTimeStamp(msg.timeStamp, GetProtocolVersion());
+        error = !ProcessReceivedMessage(msg);
+    }
+
+    if (!error && m_lastSequence - m_ackedSequence >= ACK_INTERVAL)
+        SendAck();
+    return !error;
+}
+// Returns false when error must be printed
+bool Client::Impl::PrintConnectionLost(int err)
+{
+    if (err == WSAECONNRESET)
+        PrintStatus(L"Server shutdown\n");
+    else if (err != WSAECONNABORTED)
+        return false;
+    return true;
+}
+void Client::Impl::RenderThread()
+{
+    constexpr auto frame = std::chrono::microseconds(1000000 / DEF_CLIENT_FRAME_RATE);
+    auto next = std::chrono::steady_clock::now();
+    while (!m_exit)
+    {
+        // Slow console delays next frame instead of writing frames back to back
+        auto now = std::chrono::steady_clock::now();
+        next = next + frame < now ? now + frame : next + frame;
+        std::this_thread::sleep_until(next);
+        m_render.Flush();
+    }
+}
+bool Client::Impl::ProcessReceivedMessage(ClientMessage& msg)
+{
+    if (msg.sequence)
+    {
+        if (msg.sequence <= m_lastSequence) // resent after reconnect, but was already received
+            return true;
+        m_lastSequence = msg.sequence;
+    }
+    if (msg.command == ClientCommand::ConnectAccept)
+        return ProcessConnectAccept(msg);
+    if (msg.command == ClientCommand::ServerMsg && msg.msg.compare(0, 22, L"ErrorNameAlreadyExists") == 0)
+    {
+        std::wistringstream iss(msg.msg);
+        std::wstring tmpStr;
+        iss >> tmpStr >> tmpStr;
+        msg.msg = L"User with name '"s + tmpStr + L"' already exists";
+        iss >> tmpStr;
+        m_name = std::move(tmpStr);
+        if (m_name.empty())
+            return false;
+    }
+    PrintReceivedMessage(msg);
+    return true;
+}
+bool Client::Impl::ProcessConnectAccept(const ClientMessage& msg)
+{
+    LockGuard lk(m_sendMtx);
+    SetConnectionOptions(msg.protocolVersion, msg.capabilities);
+    if (HasCapability(CapCompression))
+        InitCompression();
+
+    bool resumed = m_resumeToken && msg.resumeToken == m_resumeToken;
+    m_resumeToken = HasCapability(CapResume) ? msg.resumeToken : 0;
+    if (!resumed)
+        m_lastSequence = m_ackedSequence = 0;
+    if (!m_reconnecting)
+        return true;
+
+    PrintStatus(resumed ? L"Connection restored\n"s : L"Reconnected, previous session has expired\n"s);
+
+    // Send frames entered while connection was lost
+    auto it = m_outbox.begin();
+    for (; it != m_outbox.end(); ++it)
+    {
+        if (!SendData(it->first.get(), it->second))
+            break;
+    }
+    m_outbox.erase(m_outbox.begin(), it);
+    m_reconnecting = !m_outbox.empty();
+    return true;
+}
+bool Client::Impl::ClientRoutine()
+{
+    std::wstring inpStr;
+
+    while (!m_exit)
+    {
+        m_console.ReadLine(inpStr);
+        if (m_exit)
+            break;
+        if (!ProcessInputLine(inpStr))
+            return false;
     };
     return true;
 }
+// Returns false when message can't be sent, m_exit is set by /exit
+bool Client::Impl::ProcessInputLine(const std::wstring& inpStr)
+{
+    ClientMessage msg;
+    uint32_t dataSize = 0;
+    ClientMessage::Data data;
+
+    if (inpStr == L"/exit")
+    {
+        m_exit = true;
+        return true;
+    }
+    if (inpStr.compare(0, 7, L"/scroll") == 0)
+    {
+        ShowScrollback(inpStr);
+        return true;
+    }
+    if (!ParseInputLine(msg, inpStr))
+        return true;
+    PrintInputMessage(msg);
+    if (msg.command == ClientCommand::Help)
+        return true;
+    msg.from = m_name;
+    data = msg.Serialize(&dataSize);
+    if (!data)
+        PrintError(L"Serialization failed\n");
+    else if (!SendFrameData(std::move(data), dataSize))
+    {
+        PrintError(L"Message was not sended\n");
+        PrintSockError();
+        return false;
+    }
+    if (msg.command == ClientCommand::ChangeName)
+        m_name = msg.msg;
+    return true;
+}
+// Called before receive thread is started or with locked m_sendMtx
+bool Client::Impl::SendConnectRequest()
+{
+    ClientMessage msg;
+    uint32_t dataSize = 0;
+    msg.from = m_name;
+    msg.command = ClientCommand::ClientConnect;
+    msg.timeStamp = ClientMessage::Now();
+    msg.protocolVersion = PROTOCOL_VERSION;
+    msg.capabilities = GetClientCapabilities();
+    msg.resumeToken = m_resumeToken;
+    msg.sequence = m_lastSequence;
+    auto data = msg.Serialize(&dataSize);
+    return data && SendData(data.get(), dataSize);
+}
+bool Client::Impl::SendFrameData(ClientMessage::Data data, uint32_t size)
+{
+    LockGuard lk(m_sendMtx);
+    if (!m_reconnecting && SendData(data.get(), size))
+        return true;
+
+    // Connection is lost, frame will be sent after receive thread reconnects
+    if (!m_resumeToken || m_outbox.size() >= MAX_OUTBOX_FRAMES)
+        return false;
+    try { m_outbox.emplace_back(std::move(data), size); }
+    catch (std::exception&) { return false; }
+    m_reconnecting = true;
+    return true;
+}
+bool Client::Impl::SendAck()
+{
+    ClientMessage msg;
+    uint32_t dataSize = 0;
+    msg.from = m_name;
+    msg.command = ClientCommand::Ack;
+    msg.timeStamp = ClientMessage::Now();
+    msg.sequence = m_lastSequence;
+    auto data = msg.Serialize(&dataSize);
+    if (!data)
+        return false;
+
+    LockGuard lk(m_sendMtx);
+    if (m_reconnecting || !SendData(data.get(), dataSize))
+        return false;
+    m_ackedSequence = m_lastSequence;
+    return true;
+}
+bool Client::Impl::Reconnect()
+{
+    if (!BeginReconnect())
+        return false;
+
+    std::chrono::milliseconds delay = RECONNECT_INITIAL_DELAY;
+    for (uint32_t attempt = 0; attempt < RECONNECT_ATTEMPTS && !m_exit; ++attempt)
+    {
+        // Sleep in short steps to exit quickly
+        for (auto slept = 0ms; slept < delay && !m_exit; slept += 100ms)
+            std::this_thread::sleep_for((std::min)(delay - slept, std::chrono::milliseconds(100)));
+        if (m_exit)
+            break;
+        if (ConnectToServer())
+            return true;
+        delay = (std::min)(delay * 2, std::chrono::milliseconds(RECONNECT_MAX_DELAY));
+    }
+
+    EndReconnect();
+    return false;
+}
+// Frames sent by user are kept in outbox from now, false if session can't be resumed
+bool Client::Impl::BeginReconnect()
+{
+    {
+        LockGuard lk(m_sendMtx);
+        if (!m_resumeToken)
+            return false;
+        m_reconnecting = true;
+    }
+    PrintStatus(L"Connection lost, reconnecting\n"s);
+    return true;
+}
+// All attempts failed
+void Client::Impl::EndReconnect()
+{
+    LockGuard lk(m_sendMtx);
+    m_reconnecting = false;
+    m_outbox.clear();
+}
+bool Client::Impl::ConnectToServer()
+{
+    // Connect without lock, so input thread can queue frames meanwhile
+    TransportUPtr transport = OpenTransport();
+    if (!transport)
+        return false;
+
+    LockGuard lk(m_sendMtx);
+    if (m_exit)
+        return false;
+    SetTransport(std::move(transport));
+    // Bytes buffered for previous transport are dropped
+    SetNonBlocking(IsNonBlocking());
+    m_compressor.reset();
+    SetConnectionOptions(1, CapNone);
+    InitDecompression();
+    // Frames are sent after ConnectAccept restores session
+    return SendConnectRequest();
+}
+TransportUPtr Client::Impl::OpenTransport() const
+{
+    if (!m_unixPath.empty())
+        return SocketTransport::ConnectUnix(m_unixPath);
+    return SocketTransport::ConnectTcp(m_addr);
+}
 bool Client::Impl::ParseInputLine(ClientMessage& msg, const std::wstring& str)
 {
     if (str.empty())
@@ -281,7 +711,7 @@ bool Client::Impl::ParseInputLine(ClientMessage& msg, const std::wstring& str)
         }
     }
 
-    msg.timeStamp = ::time(nullptr);
+    msg.timeStamp = ClientMessage::Now();
 
     if (msg.command == ClientCommand::Help)
     {
@@ -289,6 +719,7 @@ bool Client::Impl::ParseInputLine(ClientMessage& msg, const std::wstring& str)
             L"/pm (user name)- private message\n"
             L"/setname (new name) - change name\n"
             L"/listusers - show current active users\n"
+            L"/scroll (n) - show received messages ending n messages back\n"
             L"/exit - exit program";
         return true;
     }
@@ -326,9 +757,9 @@ bool Client::Impl::ParseInputLine(ClientMessage& msg, const std::wstring& str)
     return true;
 }
 
-void Client::Impl::PrintInputMessage(const ClientMessage & msg, const std::wstring& inpStr) const
+void Client::Impl::PrintInputMessage(const ClientMessage & msg)
 {
-    std::wstring str = GetTimeStr(msg.timeStamp);
+    std::wstring str = GetTimeStr(msg.timeStamp / TIMESTAMP_UNITS_PER_SECOND);
     Console::Color color = Console::Green;
 
     if (msg.command == ClientCommand::PrivateMessage)
@@ -348,53 +779,64 @@ void Client::Impl::PrintInputMessage(const ClientMessage & msg, const std::wstri
     else
         str.clear();
 
-    m_console.LockWrite();
-
-    uint32_t conSize = m_console.GetConsoleSize();
-    uint16_t width = conSize & 0xFFFF;
-    uint32_t nErase = ((inpStr.size() + width - 1) / width) * width;
-    m_console.EraseChars(nErase);
-
-    if (!str.empty())
-        m_console.Write(str, color);
-
-    m_console.UnlockWrite();
+    // Echoed input line is replaced by the message, received messages stay above it
+    m_render.Flush();
+    m_console.ReplaceLastInput(str, color);
 }
 
-void Client::Impl::PrintReceivedMessage(const ClientMessage & msg) const
+void Client::Impl::PrintReceivedMessage(const ClientMessage & msg)
 {
     if (msg.command == ClientCommand::Error)
         return;
 
-    std::wstring resStr;
-
-    resStr = GetTimeStr(msg.timeStamp);
-
-    Console::Color color = Console::White;
+    Console::Color color;
+    const wchar_t* format;
     switch (msg.command)
     {
         case ClientCommand::ServerMsg:
             color = Console::Cyan;
-            resStr += msg.from + L": "s + msg.msg;
+            format = L"{}{}: {}\n";
             break;
         case ClientCommand::BroadcastMessage:
             color = Console::Yellow;
-            resStr += msg.from + L": "s + msg.msg;
+            format = L"{}{}: {}\n";
             break;
         case ClientCommand::PrivateMessage:
             color = Console::Magenta;
-            resStr += L"From "s + msg.from + L": "s + msg.msg;
+            format = L"{}From {}: {}\n";
             break;
         default:
-            resStr.clear();
-            break;
+            return;
     }
-
-    if (!resStr.empty())
+    // Line is changed only by this thread, scrollback keeps it when console falls behind and skips it
+    const std::wstring* line;
+    {
+        LockGuard lk(m_scrollbackMtx);
+        line = &m_scrollback.Add(color, format, GetCachedTimeStr(msg.timeStamp / TIMESTAMP_UNITS_PER_SECOND), msg.from, msg.msg);
+    }
+    m_render.AddLine(color, line->c_str(), line->size());
+}
+void Client::Impl::ShowScrollback(const std::wstring& str)
+{
+    size_t linesBack = 0;
+    std::wistringstream iss(str.substr(7));
+    iss >> linesBack;
+
+    // Only lines of the window are copied, however many are kept
+    uint32_t size = m_console.GetConsoleSize();
+    uint16_t width = size == uint32_t(-1) ? 80 : static_cast<uint16_t>(size);
+    uint16_t nRows = size == uint32_t(-1) ? 25 : static_cast<uint16_t>(size >> 16);
+    nRows = (std::min)(nRows, static_cast<uint16_t>(DEF_CLIENT_SCROLLBACK_PAGE));
+    size_t nKept;
     {
-        resStr += L'\n';
-        m_console.Write(resStr, color);
+        LockGuard lk(m_scrollbackMtx);
+        // Rows for footer and input line
+        m_scrollback.CopyWindow(linesBack, width, nRows > 2 ? nRows - 2 : 1, m_windowText, m_windowRuns);
+        nKept = m_scrollback.Size();
     }
+    m_render.Flush();
+    m_console.Write(m_windowText.c_str(), m_windowText.size(), m_windowRuns.data(), m_windowRuns.size());
+    m_console.Print(Console::White, L"-- {} of {} kept messages below --\n", (std::min)(linesBack, nKept), nKept);
 }
 
 
@@ -406,7 +848,7 @@ Client& Client::operator = (Client&&) = default;
 Client::Client() : m_impl(new Impl) {}
 Client::~Client() {}
 
-bool Client::Run()
+bool Client::Run(bool eventLoop)
 {
-    return m_impl->Run();
+    return m_impl->Run(eventLoop);
 }
\ No newline at end of file
@@ -15,7 +15,9 @@ public:
     Client();
     ~Client();
 
-    bool Run();
+    // Event loop runs the client in one thread that polls console and socket,
+    // otherwise input and receiving have their own threads
+    bool Run(bool eventLoop = false);
 private:
     class Impl;
     std::unique_ptr<Impl> m_impl;
@@ -0,0 +1,128 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include "../ChatServer/Console.h"
+#include "../ChatServer/Format.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef DEF_CLIENT_FRAME_RATE
+#define DEF_CLIENT_FRAME_RATE 30 // frames of received messages written to console per second
+#endif
+
+#ifndef DEF_CLIENT_FRAME_LINES
+#define DEF_CLIENT_FRAME_LINES 1024 // lines queued for one frame, further lines are skipped
+#endif
+
+// Lines of one frame of client output.
+// Producer formats lines into the queue, renderer writes all of them in one console write at frame rate,
+// lines of the same color are merged into one color run. When the frame is full, lines are counted
+// and replaced by "N messages skipped", so producer never waits for console.
+class RenderQueue
+{
+public:
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator = (const RenderQueue&) = delete;
+
+    RenderQueue(Console& console, size_t maxLines = DEF_CLIENT_FRAME_LINES)
+        : m_console(console), m_maxLines(maxLines), m_nLines(0), m_nSkipped(0) {}
+
+    // Returns false if frame is full and line was skipped
+    template <typename... Args>
+    bool Add(Console::Color color, const wchar_t* format, const Args&... args)
+    {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        if (!Reserve())
+            return false;
+        size_t size = m_text.size();
+        StackFormatBuffer<> buffer;
+        buffer.SetFlush(&AppendText, &m_text);
+        buffer.Format(format, args...);
+        buffer.Flush();
+        AddRun(m_runs, m_text.size() - size, color);
+        return true;
+    }
+
+    bool AddLine(Console::Color color, const wchar_t* str, size_t size)
+    {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        if (!Reserve())
+            return false;
+        m_text.append(str, size);
+        AddRun(m_runs, size, color);
+        return true;
+    }
+
+    bool Empty()
+    {
+        std::lock_guard<std::mutex> lk(m_mtx);
+        return m_nLines == 0 && m_nSkipped == 0;
+    }
+
+    // Writes queued lines, called by renderer at frame rate and before output that must follow them
+    bool Flush()
+    {
+        std::lock_guard<std::mutex> flk(m_flushMtx);
+        size_t nSkipped;
+        {
+            std::lock_guard<std::mutex> lk(m_mtx);
+            m_text.swap(m_frameText);
+            m_runs.swap(m_frameRuns);
+            nSkipped = m_nSkipped;
+            m_nLines = m_nSkipped = 0;
+        }
+        if (nSkipped)
+        {
+            StackFormatBuffer<64> buffer;
+            buffer.Format(L"{} messages skipped\n", nSkipped);
+            m_frameText.append(buffer.Data(), buffer.Size());
+            AddRun(m_frameRuns, buffer.Size(), Console::White);
+        }
+        bool ret = m_frameText.empty() ||
+            m_console.Write(m_frameText.c_str(), m_frameText.size(), m_frameRuns.data(), m_frameRuns.size());
+        // Buffers keep their capacity for next frames
+        m_frameText.clear();
+        m_frameRuns.clear();
+        return ret;
+    }
+
+private:
+    // Counts line as skipped when frame is full
+    bool Reserve() noexcept
+    {
+        if (m_nLines == m_maxLines)
+        {
+            ++m_nSkipped;
+            return false;
+        }
+        ++m_nLines;
+        return true;
+    }
+    static void AppendText(void* context, const wchar_t* str, size_t size)
+    {
+        static_cast<std::wstring*>(context)->append(str, size);
+    }
+    static void AddRun(std::vector<Console::ColorRun>& runs, size_t size, Console::Color color)
+    {
+        if (!runs.empty() && runs.back().textColor == color)
+            runs.back().size += size;
+        else
+            runs.push_back({ size, color });
+    }
+
+private:
+    Console& m_console;
+    std::mutex m_mtx;
+    std::mutex m_flushMtx;          // frames are written in order
+    size_t m_maxLines;
+    size_t m_nLines;
+    size_t m_nSkipped;
+    std::wstring m_text;
+    std::vector<Console::ColorRun> m_runs;
+    // Frame being written
+    std::wstring m_frameText;
+    std::vector<Console::ColorRun> m_frameRuns;
+};
+
+#endif // !_RENDER_QUEUE_H_
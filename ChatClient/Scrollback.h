@@ -0,0 +1,155 @@
+#ifndef _SCROLLBACK_H_
+#define _SCROLLBACK_H_
+
+#include "../ChatServer/Console.h"
+#include "../ChatServer/Format.h"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef DEF_CLIENT_SCROLLBACK_MEMORY
+#define DEF_CLIENT_SCROLLBACK_MEMORY (4 << 20) // bytes of received messages kept by client, oldest are evicted
+#endif
+
+#ifndef DEF_CLIENT_SCROLLBACK_LINE_SIZE
+#define DEF_CLIENT_SCROLLBACK_LINE_SIZE 48 // expected characters of a message line, splits memory between text and lines
+#endif
+
+// Received message lines kept for scrolling back.
+// Text of lines is stored in one ring arena of characters, each line in one piece, and lines in a ring of entries,
+// both allocated once. A new line evicts the oldest lines whose text it overwrites or whose entry it needs,
+// so memory stays within the cap however long the client runs. Window of the screen is copied
+// by walking back from the last line, its cost doesn't depend on number of kept lines.
+class Scrollback
+{
+public:
+    Scrollback(const Scrollback&) = delete;
+    Scrollback& operator = (const Scrollback&) = delete;
+
+    Scrollback(size_t memory = DEF_CLIENT_SCROLLBACK_MEMORY)
+        : m_lineCapacity((std::max)(memory / (sizeof(Line) + DEF_CLIENT_SCROLLBACK_LINE_SIZE * sizeof(wchar_t)), size_t(1))),
+        m_textCapacity(m_lineCapacity * DEF_CLIENT_SCROLLBACK_LINE_SIZE),
+        m_lines(new Line[m_lineCapacity]), m_text(new wchar_t[m_textCapacity]),
+        m_firstLine(0), m_nLines(0), m_textEnd(0), m_nEvicted(0) {}
+
+    size_t Size() const noexcept { return m_nLines; }
+    // Lines evicted since the start
+    uint64_t Evicted() const noexcept { return m_nEvicted; }
+    size_t MemorySize() const noexcept
+    {
+        return m_lineCapacity * sizeof(Line) + m_textCapacity * sizeof(wchar_t) + m_line.capacity() * sizeof(wchar_t);
+    }
+
+    // Formats line and stores it, returned line is valid until next Add
+    template <typename... Args>
+    const std::wstring& Add(Console::Color color, const wchar_t* format, const Args&... args)
+    {
+        m_line.clear();
+        StackFormatBuffer<> buffer;
+        buffer.SetFlush(&AppendText, &m_line);
+        buffer.Format(format, args...);
+        buffer.Flush();
+        AddLine(color, m_line.c_str(), m_line.size());
+        return m_line;
+    }
+    // Line longer than the arena keeps its beginning
+    void AddLine(Console::Color color, const wchar_t* str, size_t size)
+    {
+        if (size > m_textCapacity)
+            size = m_textCapacity;
+        size_t offset = m_textEnd;
+        if (offset + size > m_textCapacity)
+        {
+            // Line doesn't fit at the end of arena, lines of previous pass there are the oldest
+            while (m_nLines && Oldest().offset >= m_textEnd)
+                EvictOldest();
+            offset = 0;
+        }
+        // Lines of previous pass start at or after offset, so overwritten ones are the oldest
+        while (m_nLines && Oldest().offset >= offset && Oldest().offset < offset + size)
+            EvictOldest();
+        if (m_nLines == m_lineCapacity)
+            EvictOldest();
+
+        wmemcpy(m_text.get() + offset, str, size);
+        m_lines[(m_firstLine + m_nLines++) % m_lineCapacity] = { static_cast<uint32_t>(offset), static_cast<uint32_t>(size), color };
+        m_textEnd = offset + size;
+    }
+
+    // Copies lines that fill up to nRows rows of width cells and end linesBack lines before the last one,
+    // returns number of copied lines
+    size_t CopyWindow(size_t linesBack, uint16_t width, uint16_t nRows,
+        std::wstring& text, std::vector<Console::ColorRun>& runs) const
+    {
+        text.clear();
+        runs.clear();
+        if (linesBack >= m_nLines || !width)
+            return 0;
+        size_t end = m_nLines - linesBack;
+        size_t first = end;
+        for (uint32_t rows = 0; first; --first)
+        {
+            rows += RowCount(LineAt(first - 1), width);
+            if (rows > nRows)
+                break;
+        }
+        for (size_t i = first; i != end; ++i)
+        {
+            const Line& line = LineAt(i);
+            text.append(m_text.get() + line.offset, line.size);
+            if (!runs.empty() && runs.back().textColor == line.color)
+                runs.back().size += line.size;
+            else
+                runs.push_back({ line.size, line.color });
+        }
+        return end - first;
+    }
+
+private:
+    struct Line
+    {
+        uint32_t offset;
+        uint32_t size;
+        Console::Color color;
+    };
+
+    static void AppendText(void* context, const wchar_t* str, size_t size)
+    {
+        static_cast<std::wstring*>(context)->append(str, size);
+    }
+    // Line feed at the end doesn't take a row
+    uint32_t RowCount(const Line& line, uint16_t width) const noexcept
+    {
+        uint32_t size = line.size && m_text[line.offset + line.size - 1] == L'\n' ? line.size - 1 : line.size;
+        return size ? (size + width - 1) / width : 1;
+    }
+
+    const Line& LineAt(size_t i) const noexcept
+    {
+        return m_lines[(m_firstLine + i) % m_lineCapacity];
+    }
+    const Line& Oldest() const noexcept
+    {
+        return m_lines[m_firstLine];
+    }
+    void EvictOldest() noexcept
+    {
+        m_firstLine = (m_firstLine + 1) % m_lineCapacity;
+        --m_nLines;
+        ++m_nEvicted;
+    }
+
+private:
+    size_t m_lineCapacity;
+    size_t m_textCapacity;
+    std::unique_ptr<Line[]> m_lines;
+    std::unique_ptr<wchar_t[]> m_text;
+    size_t m_firstLine;
+    size_t m_nLines;
+    size_t m_textEnd;       // end of text of the last line
+    uint64_t m_nEvicted;
+    std::wstring m_line;    // line being added
+};
+
+#endif // !_SCROLLBACK_H_
@@ -0,0 +1,365 @@
+#include "../ChatServer/EventLogFormat.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <ctime>
+#include <cstdio>
+#include <iterator>
+
+// Renders binary event log of ChatServer as text or as JSON, one event per line.
+// Usage: ChatEventDecoder [--json] file
+
+using namespace EventLogFormat;
+
+struct EventDefinition
+{
+    std::vector<ArgType> types;
+    std::vector<std::string> names;     // from format, "argN" for unnamed braces
+    uint32_t line = 0;
+    std::string file;
+    std::string format;
+};
+
+struct ArgValue
+{
+    ArgType type;
+    uint64_t u;
+    int64_t i;
+    double d;
+    std::string str;    // UTF-8
+};
+
+// Bounded reader of little endian values
+class Reader
+{
+public:
+    Reader(const char* begin, const char* end) : m_it(begin), m_end(end) {}
+
+    template <typename T>
+    bool Read(T& value)
+    {
+        if (static_cast<size_t>(m_end - m_it) < sizeof(T))
+            return false;
+        memcpy(&value, m_it, sizeof(T));
+        m_it += sizeof(T);
+        return true;
+    }
+    bool ReadBytes(std::string& str, size_t size)
+    {
+        if (static_cast<size_t>(m_end - m_it) < size)
+            return false;
+        str.assign(m_it, size);
+        m_it += size;
+        return true;
+    }
+    bool ReadUtf16(std::string& str, size_t length)
+    {
+        if (static_cast<size_t>(m_end - m_it) < length * sizeof(char16_t))
+            return false;
+        str.clear();
+        for (size_t i = 0; i < length; ++i)
+        {
+            char16_t ch;
+            memcpy(&ch, m_it + i * sizeof(ch), sizeof(ch));
+            uint32_t cp = ch;
+            if (ch >= 0xD800 && ch < 0xDC00 && i + 1 < length)
+            {
+                char16_t low;
+                memcpy(&low, m_it + (i + 1) * sizeof(low), sizeof(low));
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                }
+            }
+            AppendUtf8(str, cp);
+        }
+        m_it += length * sizeof(char16_t);
+        return true;
+    }
+
+private:
+    static void AppendUtf8(std::string& str, uint32_t cp)
+    {
+        if (cp < 0x80)
+            str += static_cast<char>(cp);
+        else if (cp < 0x800)
+        {
+            str += static_cast<char>(0xC0 | (cp >> 6));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            str += static_cast<char>(0xE0 | (cp >> 12));
+            str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            str += static_cast<char>(0xF0 | (cp >> 18));
+            str += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+private:
+    const char* m_it;
+    const char* m_end;
+};
+
+static std::vector<std::string> ParseArgNames(const std::string& format)
+{
+    std::vector<std::string> names;
+    for (size_t pos = format.find('{'); pos != format.npos; pos = format.find('{', pos + 1))
+    {
+        size_t end = format.find('}', pos);
+        if (end == format.npos)
+            break;
+        std::string name = format.substr(pos + 1, end - pos - 1);
+        names.push_back(name.empty() ? "arg" + std::to_string(names.size()) : name);
+        pos = end;
+    }
+    return names;
+}
+
+static bool ReadDefinition(Reader& reader, std::map<uint16_t, EventDefinition>& definitions)
+{
+    uint16_t id;
+    uint8_t nArgs;
+    uint16_t fileLength, formatLength;
+    EventDefinition def;
+    if (!reader.Read(id) || !reader.Read(nArgs))
+        return false;
+    for (uint8_t i = 0; i < nArgs; ++i)
+    {
+        uint8_t type;
+        if (!reader.Read(type) || type > Str)
+            return false;
+        def.types.push_back(static_cast<ArgType>(type));
+    }
+    if (!reader.Read(def.line) ||
+        !reader.Read(fileLength) || !reader.ReadBytes(def.file, fileLength) ||
+        !reader.Read(formatLength) || !reader.ReadBytes(def.format, formatLength))
+        return false;
+    // Only file name of the path
+    size_t slash = def.file.find_last_of("/\\");
+    if (slash != def.file.npos)
+        def.file.erase(0, slash + 1);
+    def.names = ParseArgNames(def.format);
+    while (def.names.size() < def.types.size())
+        def.names.push_back("arg" + std::to_string(def.names.size()));
+    definitions[id] = std::move(def);
+    return true;
+}
+
+static bool ReadArgs(Reader& reader, const EventDefinition& def, std::vector<ArgValue>& args)
+{
+    args.resize(def.types.size());
+    for (size_t i = 0; i < def.types.size(); ++i)
+    {
+        ArgValue& arg = args[i];
+        arg.type = def.types[i];
+        uint16_t length;
+        bool ok = false;
+        switch (arg.type)
+        {
+        case U64:
+            ok = reader.Read(arg.u);
+            break;
+        case I64:
+            ok = reader.Read(arg.i);
+            break;
+        case F64:
+            ok = reader.Read(arg.d);
+            break;
+        case Str:
+            ok = reader.Read(length) && reader.ReadUtf16(arg.str, length);
+            break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static std::string FormatTime(uint64_t ns)
+{
+    time_t seconds = static_cast<time_t>(ns / 1000000000);
+    tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    char buff[64];
+    size_t n = strftime(buff, sizeof(buff), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(buff + n, sizeof(buff) - n, ".%06u", static_cast<unsigned>(ns / 1000 % 1000000));
+    return buff;
+}
+
+static std::string ToString(const ArgValue& arg)
+{
+    switch (arg.type)
+    {
+    case U64:
+        return std::to_string(arg.u);
+    case I64:
+        return std::to_string(arg.i);
+    case F64:
+    {
+        char buff[32];
+        snprintf(buff, sizeof(buff), "%g", arg.d);
+        return buff;
+    }
+    default:
+        return arg.str;
+    }
+}
+
+static std::string JsonString(const std::string& str)
+{
+    std::string out = "\"";
+    for (unsigned char ch : str)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            out += '\\';
+            out += static_cast<char>(ch);
+        }
+        else if (ch < 0x20)
+        {
+            char buff[8];
+            snprintf(buff, sizeof(buff), "\\u%04x", ch);
+            out += buff;
+        }
+        else
+            out += static_cast<char>(ch);
+    }
+    return out + '"';
+}
+
+static void PrintText(uint64_t time, const EventDefinition& def, const std::vector<ArgValue>& args)
+{
+    std::string text = FormatTime(time) + ' ';
+    size_t iArg = 0;
+    for (size_t pos = 0; pos < def.format.size(); ++pos)
+    {
+        size_t end;
+        if (def.format[pos] == '{' && iArg < args.size() && (end = def.format.find('}', pos)) != def.format.npos)
+        {
+            text += ToString(args[iArg++]);
+            pos = end;
+        }
+        else
+            text += def.format[pos];
+    }
+    std::cout << text << '\n';
+}
+
+static void PrintJson(uint64_t time, const EventDefinition& def, const std::vector<ArgValue>& args)
+{
+    std::string json = "{\"time\":" + JsonString(FormatTime(time)) + ",\"ns\":" + std::to_string(time) +
+        ",\"event\":" + JsonString(def.format) + ",\"site\":" + JsonString(def.file + ':' + std::to_string(def.line));
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        json += ',' + JsonString(def.names[i]) + ':';
+        if (args[i].type == Str)
+            json += JsonString(args[i].str);
+        else if (args[i].type == F64 && (args[i].d != args[i].d || args[i].d - args[i].d != 0))
+            json += "null";     // NaN and infinity
+        else
+            json += ToString(args[i]);
+    }
+    std::cout << json << "}\n";
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            json = true;
+        else
+            path = argv[i];
+    }
+    if (!path)
+    {
+        std::cerr << "Usage: ChatEventDecoder [--json] file\n";
+        return 2;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    FileHeader header;
+    if (data.size() < sizeof(header))
+    {
+        std::cerr << "Can't read " << path << '\n';
+        return 1;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+        header.headerSize < sizeof(header) || header.headerSize > data.size())
+    {
+        std::cerr << path << " isn't an event log of supported version\n";
+        return 1;
+    }
+    // Log that wasn't closed ends at first record without size
+    size_t end = header.endOffset && header.endOffset < data.size() ? static_cast<size_t>(header.endOffset) : data.size();
+
+    std::map<uint16_t, EventDefinition> definitions;
+    std::vector<ArgValue> args;
+    uint64_t nEvents = 0, nIncomplete = 0, nUnknown = 0;
+    size_t offset = header.headerSize;
+    while (end - offset >= sizeof(RecordHeader))
+    {
+        RecordHeader record;
+        memcpy(&record, data.data() + offset, sizeof(record));
+        if (record.size < sizeof(record) || record.size > end - offset)
+            break;
+        Reader reader(data.data() + offset + sizeof(record), data.data() + offset + record.size);
+        offset += record.size;
+        if (record.committed != COMMITTED)
+        {
+            ++nIncomplete;
+            continue;
+        }
+
+        if (record.eventId == DEFINITION_ID)
+        {
+            if (!ReadDefinition(reader, definitions))
+                ++nIncomplete;
+            continue;
+        }
+        auto it = definitions.find(record.eventId);
+        if (it == definitions.end())
+        {
+            ++nUnknown;
+            continue;
+        }
+        if (!ReadArgs(reader, it->second, args))
+        {
+            ++nIncomplete;
+            continue;
+        }
+        json ? PrintJson(record.time, it->second, args) : PrintText(record.time, it->second, args);
+        ++nEvents;
+    }
+
+    std::cerr << nEvents << " events";
+    if (nIncomplete)
+        std::cerr << ", " << nIncomplete << " incomplete records";
+    if (nUnknown)
+        std::cerr << ", " << nUnknown << " records of undefined sites";
+    if (header.nDropped)
+        std::cerr << ", " << header.nDropped << " events dropped by full log";
+    if (!header.endOffset)
+        std::cerr << ", log wasn't closed";
+    std::cerr << '\n';
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "LoadGenerator.h"
+#include <iostream>
+#include <cstring>
+#include <string>
+
+// Headless load generator for ChatServer, simulated users run in one event loop.
+// Usage: ChatLoad [options] [address [port]]
+//   --users N        simulated users
+//   --join-rate R    users connecting per second, 0 - all at once
+//   --rate R         messages and commands of one user per second
+//   --size N         mean characters of message text
+//   --max-size N     longest message text
+//   --size-dist D    fixed, uniform or exp
+//   --pm F           fraction of actions that are private messages
+//   --rename F       fraction of actions that change name
+//   --list F         fraction of actions that list users
+//   --compress       offer frame compression
+//   --duration S     seconds of the run including joining
+//   --seed N         seed of random actions, 0 - random
+//   --unix path      connect over Unix domain socket instead of address and port
+
+static void PrintUsage()
+{
+    std::cout << "Usage: ChatLoad [--users N] [--join-rate R] [--rate R] [--size N] [--max-size N]\n"
+        "    [--size-dist fixed|uniform|exp] [--pm F] [--rename F] [--list F] [--compress]\n"
+        "    [--duration S] [--seed N] [--unix path] [address [port]]" << std::endl;
+}
+
+// Returns false on unknown option or invalid value
+static bool ParseArgs(int argc, char** argv, LoadConfig& config) try
+{
+    int nPositional = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--compress") == 0)
+        {
+            config.compression = true;
+            continue;
+        }
+        if (strncmp(arg, "--", 2) != 0)
+        {
+            if (nPositional == 0)
+                config.address = arg;
+            else if (nPositional == 1)
+                config.port = static_cast<uint16_t>(std::stoul(arg));
+            else
+                return false;
+            ++nPositional;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "--users") == 0)
+            config.users = std::stoul(value);
+        else if (strcmp(arg, "--join-rate") == 0)
+            config.joinRate = std::stod(value);
+        else if (strcmp(arg, "--rate") == 0)
+            config.actionRate = std::stod(value);
+        else if (strcmp(arg, "--size") == 0)
+            config.messageSize = std::stoul(value);
+        else if (strcmp(arg, "--max-size") == 0)
+            config.maxMessageSize = std::stoul(value);
+        else if (strcmp(arg, "--pm") == 0)
+            config.pmRatio = std::stod(value);
+        else if (strcmp(arg, "--rename") == 0)
+            config.renameRatio = std::stod(value);
+        else if (strcmp(arg, "--list") == 0)
+            config.listRatio = std::stod(value);
+        else if (strcmp(arg, "--duration") == 0)
+            config.duration = std::stoul(value);
+        else if (strcmp(arg, "--seed") == 0)
+            config.seed = std::stoull(value);
+        else if (strcmp(arg, "--unix") == 0)
+            config.unixPath = value;
+        else if (strcmp(arg, "--size-dist") == 0)
+        {
+            if (strcmp(value, "fixed") == 0)
+                config.sizeDistribution = MessageSizeDistribution::Fixed;
+            else if (strcmp(value, "uniform") == 0)
+                config.sizeDistribution = MessageSizeDistribution::Uniform;
+            else if (strcmp(value, "exp") == 0)
+                config.sizeDistribution = MessageSizeDistribution::Exponential;
+            else
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+catch (std::exception&)
+{
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 1;
+    try
+    {
+        LoadConfig config;
+        if (!ParseArgs(argc, argv, config))
+        {
+            PrintUsage();
+            return 1;
+        }
+        LoadGenerator generator(config);
+        ret = !generator.Run();
+    }
+    catch (std::exception& exc)
+    {
+        std::cout << exc.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cout << "Unknown exception" << std::endl;
+    }
+    return ret;
+}
@@ -0,0 +1,384 @@
+#include "LoadGenerator.h"
+#include "../ChatServer/Common.h"
+#include "../ChatServer/BotPoller.h"
+#include "../ChatServer/ClientMessage.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+using namespace std::literals;
+
+typedef BotClock LoadClock;
+
+// Action of a user that fell behind its schedule is moved forward, so an overloaded generator
+// reports its achieved rate instead of sending a burst of late actions
+constexpr auto MAX_ACTION_LAG = 1s;
+
+namespace
+{
+
+class LoadBot : public Bot
+{
+public:
+    explicit LoadBot(uint32_t index) : index(index) {}
+
+    const uint32_t index;
+    uint32_t nRenames = 0;
+};
+
+struct Action
+{
+    LoadClock::time_point time;
+    uint32_t bot;
+
+    bool operator > (const Action& other) const noexcept
+    {
+        return time > other.time;
+    }
+};
+
+std::wstring BotName(uint32_t index, uint32_t nRenames)
+{
+    std::wstring name = L"bot"s + std::to_wstring(index);
+    if (nRenames)
+        name += L'_' + std::to_wstring(nRenames);
+    return name;
+}
+
+} // namespace
+
+class LoadGenerator::Impl : private BotHandler
+{
+public:
+    Impl(const LoadConfig& config);
+
+    bool Run();
+    const LoadStats& GetStats() const noexcept
+    {
+        return m_stats;
+    }
+private:
+    LoadClock::time_point JoinTime(LoadClock::time_point start, uint32_t index) const;
+    bool DoAction(uint32_t index);
+    bool Send(LoadBot& bot, ClientMessage& msg);
+
+    // BotHandler
+    bool OnConnected(Bot& bot) override;
+    void OnJoined(Bot& bot) override;
+    void OnMessage(Bot& bot, ClientMessage& msg) override;
+    void OnClose(Bot& bot, BotError error) override;
+    void OnFrame(Bot& bot, uint32_t size) override;
+
+    uint32_t RandomTarget(uint32_t index);
+    uint32_t NextMessageSize();
+    LoadClock::duration NextActionDelay();
+
+    void PrintReport(double seconds, const LoadStats& prev, double interval) const;
+    void PrintTotals(double seconds) const;
+
+private:
+    WSAInit m_wsaInit;
+    LoadConfig m_config;
+    CSOCKADDR_IN m_addr;
+    BotPoller m_poller;
+    std::vector<std::unique_ptr<LoadBot>> m_bots;
+    uint32_t m_nStarted = 0;
+    uint32_t m_nActive = 0;                 // joined and not closed
+    std::priority_queue<Action, std::vector<Action>, std::greater<Action>> m_actions;
+    std::mt19937_64 m_random;
+    std::wstring m_textPool;                // messages are taken from it at random offsets
+    LoadStats m_stats;
+};
+
+LoadGenerator::Impl::Impl(const LoadConfig& config)
+    : m_config(config), m_addr(AF_INET, ::htons(config.port), ::inet_addr(config.address.c_str())),
+    m_poller(*this, m_addr, m_config.unixPath),
+    m_random(config.seed ? config.seed : std::random_device()())
+{
+    m_config.maxMessageSize = (std::max)(m_config.maxMessageSize, 1u);
+    m_config.messageSize = (std::min)((std::max)(m_config.messageSize, 1u), m_config.maxMessageSize);
+
+    static const wchar_t letters[] = L"abcdefghijklmnopqrstuvwxyz     ";
+    std::uniform_int_distribution<size_t> letter(0, sizeof(letters) / sizeof(letters[0]) - 2);
+    m_textPool.resize(m_config.maxMessageSize * 2);
+    for (auto& ch : m_textPool)
+        ch = letters[letter(m_random)];
+
+    m_bots.reserve(m_config.users);
+    for (uint32_t i = 0; i < m_config.users; ++i)
+    {
+        m_bots.emplace_back(new LoadBot(i));
+        m_bots.back()->SetName(BotName(i, 0));
+    }
+}
+
+bool LoadGenerator::Impl::Run()
+{
+    if (m_config.unixPath.empty() && m_addr.Addr().Addr() == INADDR_NONE)
+    {
+        std::cout << "Incorrect address " << m_config.address << std::endl;
+        return false;
+    }
+
+    std::cout << std::left
+        << std::setw(8) << "time" << std::setw(8) << "users"
+        << std::setw(12) << "sent/s" << std::setw(12) << "recv/s"
+        << std::setw(12) << "sent KB/s" << std::setw(12) << "recv KB/s"
+        << "errors" << std::endl;
+
+    auto start = LoadClock::now();
+    auto end = start + std::chrono::seconds(m_config.duration);
+    auto reportTime = start;
+    auto nextReport = start + 1s;
+    LoadStats reported;
+    for (auto now = start; now < end; now = LoadClock::now())
+    {
+        while (m_nStarted < m_bots.size() && JoinTime(start, m_nStarted) <= now)
+            m_poller.Connect(*m_bots[m_nStarted++], now + std::chrono::seconds(DEF_LOAD_CONNECT_TIMEOUT));
+
+        while (!m_actions.empty() && m_actions.top().time <= now)
+        {
+            Action action = m_actions.top();
+            m_actions.pop();
+            if (m_bots[action.bot]->state == BotState::Joined && DoAction(action.bot))
+                m_actions.push({ (std::max)(action.time, now - MAX_ACTION_LAG) + NextActionDelay(), action.bot });
+        }
+
+        if (now >= nextReport)
+        {
+            std::chrono::duration<double> interval = now - reportTime;
+            PrintReport(std::chrono::duration<double>(now - start).count(), reported, interval.count());
+            reported = m_stats;
+            reportTime = now;
+            nextReport += 1s;
+        }
+
+        // Wait for sockets until the next join, action or report
+        auto wake = (std::min)(nextReport, end);
+        if (m_nStarted < m_bots.size())
+            wake = (std::min)(wake, JoinTime(start, m_nStarted));
+        if (!m_actions.empty())
+            wake = (std::min)(wake, m_actions.top().time);
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now + 999us);
+        if (!m_poller.Poll(now, timeout))
+        {
+            std::wcout << GetErrorMsg() << std::endl;
+            return false;
+        }
+    }
+
+    PrintTotals(std::chrono::duration<double>(LoadClock::now() - start).count());
+    return m_stats.joined != 0;
+}
+
+LoadClock::time_point LoadGenerator::Impl::JoinTime(LoadClock::time_point start, uint32_t index) const
+{
+    if (m_config.joinRate <= 0)
+        return start;
+    return start + std::chrono::duration_cast<LoadClock::duration>(std::chrono::duration<double>(index / m_config.joinRate));
+}
+
+bool LoadGenerator::Impl::OnConnected(Bot& bot)
+{
+    ClientMessage msg;
+    msg.command = ClientCommand::ClientConnect;
+    msg.protocolVersion = PROTOCOL_VERSION;
+    msg.capabilities = CapBatching;
+    if (m_config.compression && bot.InitDecompression())
+        msg.capabilities |= CapCompression;
+    return Send(static_cast<LoadBot&>(bot), msg);
+}
+
+void LoadGenerator::Impl::OnJoined(Bot& bot)
+{
+    ++m_stats.joined;
+    ++m_nActive;
+    m_actions.push({ LoadClock::now() + NextActionDelay(), static_cast<LoadBot&>(bot).index });
+}
+
+void LoadGenerator::Impl::OnMessage(Bot& bot, ClientMessage& msg)
+{
+    ++m_stats.messagesReceived;
+    if (msg.command == ClientCommand::ServerMsg && msg.msg.compare(0, 22, L"ErrorNameAlreadyExists") == 0)
+    {
+        // Server keeps previous name, it is the last word
+        ++m_stats.nameConflicts;
+        size_t pos = msg.msg.rfind(L' ');
+        if (pos != std::wstring::npos && pos + 1 < msg.msg.size())
+            bot.SetName(msg.msg.substr(pos + 1));
+    }
+    else if (msg.command == ClientCommand::ServerMsg && msg.msg.compare(0, 26, L"There is no user with name") == 0)
+        ++m_stats.missedPms;
+}
+
+void LoadGenerator::Impl::OnClose(Bot& bot, BotError error)
+{
+    if (bot.state == BotState::Joined)
+        --m_nActive;
+    switch (error)
+    {
+    case BotError::Connect:
+        ++m_stats.connectErrors;
+        break;
+    case BotError::Disconnect:
+        ++m_stats.disconnects;
+        break;
+    case BotError::Send:
+        ++m_stats.sendErrors;
+        break;
+    case BotError::Protocol:
+        ++m_stats.protocolErrors;
+        break;
+    default:
+        break;
+    }
+}
+
+void LoadGenerator::Impl::OnFrame(Bot&, uint32_t size)
+{
+    ++m_stats.framesReceived;
+    m_stats.bytesReceived += size + sizeof(uint32_t);
+}
+
+bool LoadGenerator::Impl::DoAction(uint32_t index)
+{
+    LoadBot& bot = *m_bots[index];
+    ClientMessage msg;
+    double action = std::uniform_real_distribution<double>(0, 1)(m_random);
+    if ((action -= m_config.renameRatio) < 0)
+    {
+        msg.command = ClientCommand::ChangeName;
+        msg.msg = BotName(index, bot.nRenames + 1);
+    }
+    else if ((action -= m_config.listRatio) < 0)
+        msg.command = ClientCommand::ListClients;
+    else
+    {
+        msg.command = (action -= m_config.pmRatio) < 0 ? ClientCommand::PrivateMessage : ClientCommand::BroadcastMessage;
+        if (msg.command == ClientCommand::PrivateMessage)
+            msg.pmTo = *m_bots[RandomTarget(index)]->GetName();
+        uint32_t size = NextMessageSize();
+        size_t offset = std::uniform_int_distribution<size_t>(0, m_textPool.size() - size)(m_random);
+        msg.msg.assign(m_textPool, offset, size);
+    }
+    if (!Send(bot, msg))
+        return false;
+    // Name is changed at once like ChatClient does, conflict restores it
+    if (msg.command == ClientCommand::ChangeName)
+    {
+        ++bot.nRenames;
+        bot.SetName(std::move(msg.msg));
+    }
+    return true;
+}
+
+bool LoadGenerator::Impl::Send(LoadBot& bot, ClientMessage& msg)
+{
+    uint32_t size = 0;
+    msg.from = *bot.GetName();
+    msg.timeStamp = ClientMessage::Now();
+    auto data = msg.Serialize(&size);
+    if (!data || !bot.SendData(data.get(), size))
+    {
+        m_poller.Close(bot, BotError::Send);
+        return false;
+    }
+    ++m_stats.framesSent;
+    m_stats.bytesSent += size + sizeof(uint32_t);
+    return true;
+}
+
+// Random joined user other than index, index itself if none was found in a few tries
+uint32_t LoadGenerator::Impl::RandomTarget(uint32_t index)
+{
+    std::uniform_int_distribution<uint32_t> target(0, m_nStarted - 1);
+    for (int i = 0; i < 4; ++i)
+    {
+        uint32_t candidate = target(m_random);
+        if (candidate != index && m_bots[candidate]->state == BotState::Joined)
+            return candidate;
+    }
+    return index;
+}
+
+uint32_t LoadGenerator::Impl::NextMessageSize()
+{
+    double mean = m_config.messageSize;
+    double size = mean;
+    switch (m_config.sizeDistribution)
+    {
+    case MessageSizeDistribution::Uniform:
+        size = std::uniform_real_distribution<double>(1, 2 * mean)(m_random);
+        break;
+    case MessageSizeDistribution::Exponential:
+        size = 1 + std::exponential_distribution<double>(1 / mean)(m_random);
+        break;
+    default:
+        break;
+    }
+    return static_cast<uint32_t>((std::min)((std::max)(size, 1.0), double(m_config.maxMessageSize)));
+}
+
+// Actions of a user are a Poisson process
+LoadClock::duration LoadGenerator::Impl::NextActionDelay()
+{
+    double seconds = m_config.actionRate > 0 ?
+        std::exponential_distribution<double>(m_config.actionRate)(m_random) : double(m_config.duration);
+    return std::chrono::duration_cast<LoadClock::duration>(std::chrono::duration<double>(seconds));
+}
+
+void LoadGenerator::Impl::PrintReport(double seconds, const LoadStats& prev, double interval) const
+{
+    auto errors = [](const LoadStats& s)
+    {
+        return s.connectErrors + s.disconnects + s.sendErrors + s.protocolErrors + s.nameConflicts + s.missedPms;
+    };
+    auto rate = [interval](uint64_t cur, uint64_t prev, double unit = 1)
+    {
+        return interval > 0 ? double(cur - prev) / unit / interval : 0.0;
+    };
+    std::cout << std::left << std::fixed << std::setprecision(0)
+        << std::setw(8) << seconds << std::setw(8) << m_nActive
+        << std::setw(12) << rate(m_stats.framesSent, prev.framesSent)
+        << std::setw(12) << rate(m_stats.messagesReceived, prev.messagesReceived)
+        << std::setprecision(1)
+        << std::setw(12) << rate(m_stats.bytesSent, prev.bytesSent, 1024)
+        << std::setw(12) << rate(m_stats.bytesReceived, prev.bytesReceived, 1024)
+        << errors(m_stats) - errors(prev) << std::endl;
+}
+
+void LoadGenerator::Impl::PrintTotals(double seconds) const
+{
+    double interval = seconds > 0 ? seconds : 1;
+    std::cout << std::fixed << std::setprecision(1)
+        << "\nDuration:          " << seconds << " s"
+        << "\nJoined users:      " << m_stats.joined << " of " << m_config.users << ", " << m_nActive << " connected at the end"
+        << "\nSent frames:       " << m_stats.framesSent << ", " << m_stats.framesSent / interval << "/s, "
+        << m_stats.bytesSent / interval / 1024 << " KB/s"
+        << "\nReceived frames:   " << m_stats.framesReceived << ", " << m_stats.framesReceived / interval << "/s"
+        << "\nReceived messages: " << m_stats.messagesReceived << ", " << m_stats.messagesReceived / interval << "/s, "
+        << m_stats.bytesReceived / interval / 1024 << " KB/s"
+        << "\nConnect errors:    " << m_stats.connectErrors
+        << "\nDisconnects:       " << m_stats.disconnects
+        << "\nSend errors:       " << m_stats.sendErrors
+        << "\nProtocol errors:   " << m_stats.protocolErrors
+        << "\nName conflicts:    " << m_stats.nameConflicts
+        << "\nMissed PMs:        " << m_stats.missedPms << std::endl;
+}
+
+LoadGenerator::LoadGenerator(const LoadConfig& config) : m_impl(new Impl(config)) {}
+LoadGenerator::~LoadGenerator() = default;
+
+bool LoadGenerator::Run()
+{
+    return m_impl->Run();
+}
+
+const LoadStats& LoadGenerator::GetStats() const noexcept
+{
+    return m_impl->GetStats();
+}
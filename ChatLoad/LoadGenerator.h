@@ -0,0 +1,81 @@
+#ifndef _LOAD_GENERATOR_H_
+#define _LOAD_GENERATOR_H_
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include "../ChatServer/Server.h"
+
+#ifndef DEF_LOAD_USERS
+#define DEF_LOAD_USERS 100 // simulated users
+#endif
+
+#ifndef DEF_LOAD_CONNECT_TIMEOUT
+#define DEF_LOAD_CONNECT_TIMEOUT 10 // seconds a user waits for ConnectAccept
+#endif
+
+enum class MessageSizeDistribution
+{
+    Fixed,          // every message has mean size
+    Uniform,        // sizes from 1 to twice the mean
+    Exponential,    // many short messages and a few long ones
+};
+
+struct LoadConfig
+{
+    std::string address = "127.0.0.1";
+    uint16_t port = DEF_SERV_PORT;
+    std::string unixPath;           // Unix domain socket used instead of address and port
+    uint32_t users = DEF_LOAD_USERS;
+    double joinRate = 50;           // users connecting per second
+    double actionRate = 1;          // messages and commands of one user per second
+    MessageSizeDistribution sizeDistribution = MessageSizeDistribution::Exponential;
+    uint32_t messageSize = 64;      // mean characters of message text
+    uint32_t maxMessageSize = 1024;
+    // Fractions of actions, the rest are broadcast messages
+    double pmRatio = 0.1;
+    double renameRatio = 0.01;
+    double listRatio = 0.01;
+    bool compression = false;       // offer frame compression
+    uint32_t duration = 60;         // seconds of the run including joining
+    uint64_t seed = 0;              // 0 - random
+};
+
+struct LoadStats
+{
+    uint64_t joined = 0;            // users got ConnectAccept
+    uint64_t framesSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t framesReceived = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t bytesReceived = 0;
+    // Errors
+    uint64_t connectErrors = 0;     // connect failed or timed out
+    uint64_t disconnects = 0;       // server closed connection of joined user
+    uint64_t sendErrors = 0;
+    uint64_t protocolErrors = 0;    // invalid frames
+    uint64_t nameConflicts = 0;     // ErrorNameAlreadyExists
+    uint64_t missedPms = 0;         // target of private message has left or renamed
+};
+
+// Simulated users of a chat server driven by one event loop.
+// Users join at join rate, then every user sends messages and commands as a Poisson process
+// of action rate. Received frames are counted and discarded.
+class LoadGenerator
+{
+public:
+    LoadGenerator(const LoadGenerator&) = delete;
+    LoadGenerator& operator = (const LoadGenerator&) = delete;
+
+    LoadGenerator(const LoadConfig& config);
+    ~LoadGenerator();
+
+    // Runs for configured duration printing throughput every second, false if no user could join
+    bool Run();
+    const LoadStats& GetStats() const noexcept;
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_LOAD_GENERATOR_H_
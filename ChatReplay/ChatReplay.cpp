@@ -0,0 +1,87 @@
+#include "Replayer.h"
+#include <iostream>
+#include <cstring>
+#include <string>
+
+// Replays traffic captured by "ChatServer --capture file" against a server.
+// Usage: ChatReplay [options] capture [address [port]]
+//   --speed N        replay N times faster than captured, 1 - captured pace
+//   --max            send frames as fast as server takes them
+//   --unix path      connect over Unix domain socket instead of address and port
+
+static void PrintUsage()
+{
+    std::cout << "Usage: ChatReplay [--speed N | --max] [--unix path] capture [address [port]]" << std::endl;
+}
+
+// Returns false on unknown option or invalid value
+static bool ParseArgs(int argc, char** argv, ReplayConfig& config) try
+{
+    int nPositional = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--max") == 0)
+        {
+            config.speed = 0;
+            continue;
+        }
+        if (strncmp(arg, "--", 2) != 0)
+        {
+            if (nPositional == 0)
+                config.capturePath = arg;
+            else if (nPositional == 1)
+                config.address = arg;
+            else if (nPositional == 2)
+                config.port = static_cast<uint16_t>(std::stoul(arg));
+            else
+                return false;
+            ++nPositional;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "--speed") == 0)
+        {
+            config.speed = std::stod(value);
+            if (config.speed <= 0)
+                return false;
+        }
+        else if (strcmp(arg, "--unix") == 0)
+            config.unixPath = value;
+        else
+            return false;
+    }
+    return nPositional != 0;
+}
+catch (std::exception&)
+{
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 1;
+    try
+    {
+        ReplayConfig config;
+        if (!ParseArgs(argc, argv, config))
+        {
+            PrintUsage();
+            return 1;
+        }
+        Replayer replayer(config);
+        ret = !replayer.Run();
+    }
+    catch (std::exception& exc)
+    {
+        std::cout << exc.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cout << "Unknown exception" << std::endl;
+    }
+    return ret;
+}
@@ -0,0 +1,522 @@
+#include "Replayer.h"
+#include "../ChatServer/Common.h"
+#include "../ChatServer/CaptureFormat.h"
+#include "../ChatServer/BotPoller.h"
+#include "../ChatServer/ClientMessage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::literals;
+
+typedef BotClock ReplayClock;
+
+namespace
+{
+
+// Record of capture, data points into loaded file
+struct ReplayRecord
+{
+    uint64_t time;          // ns since the first record
+    uint32_t session;       // index of session
+    CaptureFormat::RecordKind kind;
+    const char* data;
+    uint32_t size;
+};
+
+class Session : public Bot
+{
+public:
+    const ReplayRecord* connect = nullptr;
+    std::deque<const ReplayRecord*> pending;    // frames due and not sent yet
+    bool closeDue = false;                      // captured session ended, close after pending frames
+};
+
+} // namespace
+
+class Replayer::Impl : private BotHandler
+{
+public:
+    Impl(const ReplayConfig& config);
+
+    bool Run();
+    const ReplayStats& GetStats() const noexcept
+    {
+        return m_stats;
+    }
+private:
+    bool Load();
+    ReplayClock::time_point DueTime(const ReplayRecord& record) const;
+    void Dispatch(const ReplayRecord& record, ReplayClock::time_point now);
+    // Sends pending frames while transport takes them
+    void Flush(Session& session);
+    bool Send(Session& session, const ReplayRecord& record);
+    bool IsIdle() const;
+
+    // BotHandler
+    bool OnConnected(Bot& bot) override;
+    void OnJoined(Bot& bot) override;
+    void OnMessage(Bot& bot, ClientMessage& msg) override;
+    void OnClose(Bot& bot, BotError error) override;
+    void OnWritable(Bot& bot) override;
+
+    double Percentile(std::vector<uint64_t>& latencies, double q) const;
+    void PrintReport(double seconds, const ReplayStats& prev, double interval);
+    void PrintTotals(double seconds);
+
+private:
+    WSAInit m_wsaInit;
+    ReplayConfig m_config;
+    CSOCKADDR_IN m_addr;
+    BotPoller m_poller;
+    std::vector<char> m_capture;
+    uint64_t m_captureDropped = 0;
+    std::vector<ReplayRecord> m_records;
+    size_t m_next = 0;                      // record to dispatch
+    std::vector<std::unique_ptr<Session>> m_sessions;
+    uint32_t m_nActive = 0;                 // joined and not closed
+    uint32_t m_nJoining = 0;                // connecting or waiting for ConnectAccept
+    bool m_holdFrames = false;              // at max speed frames wait until all sessions have joined
+    ReplayClock::time_point m_start;
+    std::vector<ClientMessage> m_sendMsgs;  // of batch being sent
+    MessageBatch m_sendBatch;
+    std::vector<uint64_t> m_latencies;      // ns of all deliveries
+    std::vector<uint64_t> m_intervalLatencies;
+    ReplayStats m_stats;
+};
+
+Replayer::Impl::Impl(const ReplayConfig& config)
+    : m_config(config), m_addr(AF_INET, ::htons(config.port), ::inet_addr(config.address.c_str())),
+    m_poller(*this, m_addr, m_config.unixPath)
+{
+}
+
+bool Replayer::Impl::Run()
+{
+    if (m_config.unixPath.empty() && m_addr.Addr().Addr() == INADDR_NONE)
+    {
+        std::cout << "Incorrect address " << m_config.address << std::endl;
+        return false;
+    }
+    if (!Load())
+        return false;
+
+    std::cout << std::left
+        << std::setw(8) << "time" << std::setw(10) << "sessions"
+        << std::setw(12) << "sent/s" << std::setw(12) << "recv/s"
+        << std::setw(14) << "delivered/s" << std::setw(12) << "p99 us"
+        << "errors" << std::endl;
+
+    m_holdFrames = m_config.speed <= 0;
+    m_start = ReplayClock::now();
+    auto reportTime = m_start;
+    auto nextReport = m_start + 1s;
+    auto drainEnd = ReplayClock::time_point::max();
+    ReplayStats reported;
+    for (auto now = m_start; now < drainEnd; now = ReplayClock::now())
+    {
+        while (m_next < m_records.size() && DueTime(m_records[m_next]) <= now)
+            Dispatch(m_records[m_next++], now);
+        if (m_holdFrames && m_nJoining == 0)
+        {
+            m_holdFrames = false;
+            for (auto& session : m_sessions)
+                Flush(*session);
+        }
+        if (drainEnd == ReplayClock::time_point::max() && IsIdle())
+            drainEnd = now + std::chrono::seconds(DEF_REPLAY_DRAIN_TIME);
+
+        if (now >= nextReport)
+        {
+            std::chrono::duration<double> interval = now - reportTime;
+            PrintReport(std::chrono::duration<double>(now - m_start).count(), reported, interval.count());
+            reported = m_stats;
+            reportTime = now;
+            nextReport += 1s;
+        }
+
+        // Wait for sockets until the next record or report
+        auto wake = (std::min)(nextReport, drainEnd);
+        if (m_next < m_records.size())
+            wake = (std::min)(wake, DueTime(m_records[m_next]));
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now + 999us);
+        if (!m_poller.Poll(now, timeout))
+        {
+            std::wcout << GetErrorMsg() << std::endl;
+            return false;
+        }
+    }
+
+    for (auto& session : m_sessions)
+        m_poller.Close(*session, BotError::None);
+    PrintTotals(std::chrono::duration<double>(ReplayClock::now() - m_start).count());
+    return m_stats.joined != 0;
+}
+
+// Reads committed records, sessions begun before capture was opened are left out
+bool Replayer::Impl::Load()
+{
+    using namespace CaptureFormat;
+
+    std::ifstream file(m_config.capturePath, std::ios::binary);
+    if (!file)
+    {
+        std::cout << "Can't open " << m_config.capturePath << std::endl;
+        return false;
+    }
+    m_capture.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    FileHeader header;
+    if (m_capture.size() < sizeof(header) ||
+        (memcpy(&header, m_capture.data(), sizeof(header)), memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) ||
+        header.version != VERSION || header.headerSize < sizeof(FileHeader))
+    {
+        std::cout << m_config.capturePath << " isn't a traffic capture" << std::endl;
+        return false;
+    }
+    m_captureDropped = header.nDropped;
+    // Capture of a server that didn't close it ends at the first record that isn't committed
+    uint64_t end = header.endOffset ? (std::min)(header.endOffset, uint64_t(m_capture.size())) : m_capture.size();
+
+    std::unordered_map<uint64_t, uint32_t> sessions;
+    uint64_t firstTime = 0;
+    for (uint64_t offset = header.headerSize; offset + sizeof(RecordHeader) <= end;)
+    {
+        RecordHeader rh;
+        memcpy(&rh, m_capture.data() + offset, sizeof(rh));
+        size_t size = RecordSize(rh.dataSize);
+        if (rh.kind == 0 || rh.committed != COMMITTED || offset + size > end)
+            break;
+        const char* data = m_capture.data() + offset + sizeof(RecordHeader);
+        offset += size;
+        if (m_records.empty())
+            firstTime = rh.time;
+
+        auto it = sessions.find(rh.session);
+        if (rh.kind == Connect)
+        {
+            // Server ids are unique within its run, a repeated one starts a new session anyway
+            sessions[rh.session] = static_cast<uint32_t>(m_sessions.size());
+            it = sessions.find(rh.session);
+            m_sessions.emplace_back(new Session);
+            ++m_stats.sessions;
+        }
+        else if (it == sessions.end())
+        {
+            if (rh.kind == Frame)
+                ++m_stats.skippedFrames;
+            continue;
+        }
+        m_records.push_back({ rh.time > firstTime ? rh.time - firstTime : 0, it->second,
+            static_cast<RecordKind>(rh.kind), data, rh.dataSize });
+        if (rh.kind == CaptureFormat::Close)
+            sessions.erase(it);
+    }
+
+    // Concurrent sessions may have reserved records out of time order, pointers are taken after sort
+    std::stable_sort(m_records.begin(), m_records.end(),
+        [](const ReplayRecord& a, const ReplayRecord& b) { return a.time < b.time; });
+    for (const auto& record : m_records)
+    {
+        if (record.kind == Connect)
+            m_sessions[record.session]->connect = &record;
+    }
+
+    std::cout << m_config.capturePath << ": " << m_stats.sessions << " sessions, " << m_records.size() << " records, "
+        << std::fixed << std::setprecision(1)
+        << (m_records.empty() ? 0.0 : m_records.back().time / 1e9) << " s";
+    if (m_stats.skippedFrames)
+        std::cout << ", " << m_stats.skippedFrames << " frames of sessions begun before capture";
+    if (m_captureDropped)
+        std::cout << ", " << m_captureDropped << " records didn't fit";
+    std::cout << std::endl;
+    if (m_records.empty())
+    {
+        std::cout << "Nothing to replay" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+ReplayClock::time_point Replayer::Impl::DueTime(const ReplayRecord& record) const
+{
+    if (m_config.speed <= 0)
+        return m_start;
+    return m_start + std::chrono::duration_cast<ReplayClock::duration>(
+        std::chrono::duration<double, std::nano>(record.time / m_config.speed));
+}
+
+void Replayer::Impl::Dispatch(const ReplayRecord& record, ReplayClock::time_point now)
+{
+    Session& session = *m_sessions[record.session];
+    switch (record.kind)
+    {
+    case CaptureFormat::Connect:
+        ++m_nJoining;
+        m_poller.Connect(session, now + std::chrono::seconds(DEF_REPLAY_CONNECT_TIMEOUT));
+        break;
+    case CaptureFormat::Frame:
+        if (session.state == BotState::Closed)
+        {
+            ++m_stats.skippedFrames;
+            return;
+        }
+        try { session.pending.push_back(&record); }
+        catch (std::exception&) { m_poller.Close(session, BotError::Send); return; }
+        break;
+    case CaptureFormat::Close:
+        session.closeDue = true;
+        break;
+    }
+    Flush(session);
+}
+
+// Captured request without resume, it has to be answered by the replayed server
+bool Replayer::Impl::OnConnected(Bot& bot)
+{
+    Session& session = static_cast<Session&>(bot);
+    const ReplayRecord& record = *session.connect;
+    ClientMessage msg;
+    msg.Unserialize(record.data, record.size);
+    session.SetName(msg.from);
+    msg.capabilities &= ~CapResume;
+    msg.resumeToken = 0;
+    msg.sequence = 0;
+    if ((msg.capabilities & CapCompression) && !session.InitDecompression())
+        msg.capabilities &= ~CapCompression;
+    msg.timeStamp = ClientMessage::Now();
+    uint32_t size = 0;
+    auto data = msg.Serialize(&size);
+    if (!data || !session.SendData(data.get(), size))
+        return false;
+    ++m_stats.framesSent;
+    m_stats.bytesSent += size + sizeof(uint32_t);
+    return true;
+}
+
+void Replayer::Impl::OnJoined(Bot& bot)
+{
+    --m_nJoining;
+    ++m_stats.joined;
+    ++m_nActive;
+    Flush(static_cast<Session&>(bot));
+}
+
+void Replayer::Impl::OnMessage(Bot& bot, ClientMessage& msg)
+{
+    ++m_stats.messagesReceived;
+    switch (msg.command)
+    {
+    case ClientCommand::BroadcastMessage:
+    case ClientCommand::PrivateMessage:
+    {
+        // Timestamps are seconds before protocol version 4
+        uint64_t now = ClientMessage::Now();
+        uint64_t sent = ClientMessage::FromProtocolTimeStamp(msg.timeStamp, bot.GetProtocolVersion());
+        uint64_t latency = now > sent ? now - sent : 0;
+        ++m_stats.deliveries;
+        try
+        {
+            m_latencies.push_back(latency);
+            m_intervalLatencies.push_back(latency);
+        }
+        catch (std::exception&) {}
+        break;
+    }
+    case ClientCommand::ServerMsg:
+        if (msg.msg.compare(0, 22, L"ErrorNameAlreadyExists") == 0)
+            ++m_stats.nameConflicts;
+        break;
+    default:
+        break;
+    }
+}
+
+void Replayer::Impl::OnClose(Bot& bot, BotError error)
+{
+    Session& session = static_cast<Session&>(bot);
+    if (session.state == BotState::Joined)
+        --m_nActive;
+    else if (session.state == BotState::Connecting || session.state == BotState::Joining)
+        --m_nJoining;
+    m_stats.skippedFrames += session.pending.size();
+    session.pending.clear();
+    switch (error)
+    {
+    case BotError::Connect:
+        ++m_stats.connectErrors;
+        break;
+    case BotError::Disconnect:
+        ++m_stats.disconnects;
+        break;
+    case BotError::Send:
+        ++m_stats.sendErrors;
+        break;
+    case BotError::Protocol:
+        ++m_stats.protocolErrors;
+        break;
+    default:
+        break;
+    }
+}
+
+void Replayer::Impl::OnWritable(Bot& bot)
+{
+    Flush(static_cast<Session&>(bot));
+}
+
+// At max speed captured closes are left to the end of replay, so sessions stay to receive messages
+void Replayer::Impl::Flush(Session& session)
+{
+    if (session.state != BotState::Joined || m_holdFrames)
+        return;
+    while (!session.pending.empty() && !session.HasPendingSend())
+    {
+        const ReplayRecord& record = *session.pending.front();
+        session.pending.pop_front();
+        if (!Send(session, record))
+            return;
+    }
+    if (session.closeDue && m_config.speed > 0 && session.pending.empty() && !session.HasPendingSend())
+        m_poller.Close(session, BotError::None);
+}
+
+// Messages get time of sending, so latency is measured in the replayed run.
+// Acks are left out, batches are packed again without them.
+bool Replayer::Impl::Send(Session& session, const ReplayRecord& record)
+{
+    bool sent;
+    uint32_t size = record.size;
+    if (MessageBatch::IsBatch(record.data, record.size))
+    {
+        m_sendMsgs.clear();
+        m_sendBatch.Clear();
+        m_sendBatch.SetProtocolVersion(session.GetProtocolVersion());
+        try
+        {
+            sent = MessageBatch::Unserialize(record.data, record.size, m_sendMsgs);
+            for (auto& msg : m_sendMsgs)
+            {
+                if (!sent || msg.command == ClientCommand::Ack)
+                    continue;
+                // Batch converts timestamps to version of connection itself
+                msg.timeStamp = ClientMessage::Now();
+                auto data = msg.Serialize(&size);
+                sent = data && m_sendBatch.Append(data.get(), size);
+            }
+        }
+        catch (std::exception&) { sent = false; }
+        if (sent && m_sendBatch.Count() == 0)
+            return true;
+        size = m_sendBatch.Size();
+        sent = sent && session.SendData(m_sendBatch.Data(), size);
+    }
+    else
+    {
+        ClientMessage msg;
+        msg.Unserialize(record.data, record.size);
+        if (msg.command == ClientCommand::Ack)
+            return true;
+        msg.timeStamp = ClientMessage::ToProtocolTimeStamp(ClientMessage::Now(), session.GetProtocolVersion());
+        auto data = msg.Serialize(&size);
+        sent = data && session.SendData(data.get(), size);
+    }
+    if (!sent)
+    {
+        m_poller.Close(session, BotError::Send);
+        return false;
+    }
+    ++m_stats.framesSent;
+    m_stats.bytesSent += size + sizeof(uint32_t);
+    return true;
+}
+
+// All records are dispatched and sessions have nothing left to send
+bool Replayer::Impl::IsIdle() const
+{
+    if (m_next < m_records.size())
+        return false;
+    return std::none_of(m_sessions.begin(), m_sessions.end(), [](const std::unique_ptr<Session>& session)
+        {
+            return session->state == BotState::Connecting || session->state == BotState::Joining ||
+                (session->state == BotState::Joined && (!session->pending.empty() || session->HasPendingSend()));
+        });
+}
+
+double Replayer::Impl::Percentile(std::vector<uint64_t>& latencies, double q) const
+{
+    if (latencies.empty())
+        return 0;
+    size_t i = (std::min)(static_cast<size_t>(latencies.size() * q), latencies.size() - 1);
+    std::nth_element(latencies.begin(), latencies.begin() + i, latencies.end());
+    return latencies[i] / 1000.0;
+}
+
+void Replayer::Impl::PrintReport(double seconds, const ReplayStats& prev, double interval)
+{
+    auto errors = [](const ReplayStats& s)
+    {
+        return s.connectErrors + s.disconnects + s.sendErrors + s.protocolErrors + s.nameConflicts;
+    };
+    auto rate = [interval](uint64_t cur, uint64_t prev)
+    {
+        return interval > 0 ? double(cur - prev) / interval : 0.0;
+    };
+    std::cout << std::left << std::fixed << std::setprecision(0)
+        << std::setw(8) << seconds << std::setw(10) << m_nActive
+        << std::setw(12) << rate(m_stats.framesSent, prev.framesSent)
+        << std::setw(12) << rate(m_stats.messagesReceived, prev.messagesReceived)
+        << std::setw(14) << rate(m_stats.deliveries, prev.deliveries)
+        << std::setw(12) << Percentile(m_intervalLatencies, 0.99)
+        << errors(m_stats) - errors(prev) << std::endl;
+    m_intervalLatencies.clear();
+}
+
+void Replayer::Impl::PrintTotals(double seconds)
+{
+    double interval = seconds > 0 ? seconds : 1;
+    double p50 = Percentile(m_latencies, 0.5);
+    double p99 = Percentile(m_latencies, 0.99);
+    double p999 = Percentile(m_latencies, 0.999);
+    double max = m_latencies.empty() ? 0 : *std::max_element(m_latencies.begin(), m_latencies.end()) / 1000.0;
+    std::ostringstream speed;
+    if (m_config.speed > 0)
+        speed << m_config.speed << "x";
+    else
+        speed << "max";
+    std::cout << std::fixed << std::setprecision(1)
+        << "\nDuration:          " << seconds << " s, capture " << (m_records.empty() ? 0.0 : m_records.back().time / 1e9)
+        << " s, speed " << speed.str()
+        << "\nSessions:          " << m_stats.joined << " of " << m_stats.sessions << " joined"
+        << "\nSent frames:       " << m_stats.framesSent << ", " << m_stats.framesSent / interval << "/s, "
+        << m_stats.bytesSent / interval / 1024 << " KB/s"
+        << "\nSkipped frames:    " << m_stats.skippedFrames
+        << "\nReceived messages: " << m_stats.messagesReceived << ", " << m_stats.messagesReceived / interval << "/s"
+        << "\nDeliveries:        " << m_stats.deliveries << ", " << m_stats.deliveries / interval << "/s"
+        << "\nLatency:           p50 " << p50 << " us, p99 " << p99 << " us, p99.9 " << p999 << " us, max " << max << " us"
+        << "\nConnect errors:    " << m_stats.connectErrors
+        << "\nDisconnects:       " << m_stats.disconnects
+        << "\nSend errors:       " << m_stats.sendErrors
+        << "\nProtocol errors:   " << m_stats.protocolErrors
+        << "\nName conflicts:    " << m_stats.nameConflicts << std::endl;
+}
+
+Replayer::Replayer(const ReplayConfig& config) : m_impl(new Impl(config)) {}
+Replayer::~Replayer() = default;
+
+bool Replayer::Run()
+{
+    return m_impl->Run();
+}
+
+const ReplayStats& Replayer::GetStats() const noexcept
+{
+    return m_impl->GetStats();
+}
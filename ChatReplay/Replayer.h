@@ -0,0 +1,67 @@
+#ifndef _REPLAYER_H_
+#define _REPLAYER_H_
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include "../ChatServer/Server.h"
+
+#ifndef DEF_REPLAY_CONNECT_TIMEOUT
+#define DEF_REPLAY_CONNECT_TIMEOUT 10 // seconds a session waits for ConnectAccept
+#endif
+
+#ifndef DEF_REPLAY_DRAIN_TIME
+#define DEF_REPLAY_DRAIN_TIME 2 // seconds deliveries are awaited after the last frame is sent
+#endif
+
+struct ReplayConfig
+{
+    std::string capturePath;
+    std::string address = "127.0.0.1";
+    uint16_t port = DEF_SERV_PORT;
+    std::string unixPath;           // Unix domain socket used instead of address and port
+    double speed = 1;               // times of capture are divided by it, 0 - as fast as server takes frames
+};
+
+struct ReplayStats
+{
+    uint64_t sessions = 0;          // sessions of capture with ClientConnect
+    uint64_t joined = 0;            // sessions got ConnectAccept
+    uint64_t framesSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t deliveries = 0;        // broadcast and private messages received
+    uint64_t skippedFrames = 0;     // of sessions begun before capture or lost by replay
+    // Errors
+    uint64_t connectErrors = 0;     // connect failed or timed out
+    uint64_t disconnects = 0;       // server closed connection of joined session
+    uint64_t sendErrors = 0;
+    uint64_t protocolErrors = 0;    // invalid frames
+    uint64_t nameConflicts = 0;     // ErrorNameAlreadyExists
+};
+
+// Replays sessions of traffic capture against a server from one event loop.
+// Every session connects with its captured ClientConnect and sends its frames at captured times
+// divided by speed. A session sends its next frame only after the previous one was taken by
+// the socket, so an overloaded server slows replay down instead of buffering frames.
+// At max speed all sessions join first, then send frames and stay connected until replay ends.
+// Messages, batched ones too, carry time of sending, so latency is that of the replayed run.
+// Acks aren't replayed, sessions don't offer resume.
+class Replayer
+{
+public:
+    Replayer(const Replayer&) = delete;
+    Replayer& operator = (const Replayer&) = delete;
+
+    Replayer(const ReplayConfig& config);
+    ~Replayer();
+
+    // Returns false if capture can't be read or no session could join
+    bool Run();
+    const ReplayStats& GetStats() const noexcept;
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_REPLAYER_H_
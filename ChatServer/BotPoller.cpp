@@ -0,0 +1,164 @@
+#include "BotPoller.h"
+#include <algorithm>
+#include <thread>
+
+BotPoller::BotPoller(BotHandler& handler, const CSOCKADDR_IN& addr, const std::string& unixPath)
+    : m_handler(handler), m_addr(addr), m_unixPath(unixPath)
+{
+}
+
+void BotPoller::Connect(Bot& bot, BotClock::time_point deadline)
+{
+    bot.state = BotState::Connecting;
+    bot.deadline = deadline;
+    try { m_bots.push_back(&bot); }
+    catch (std::exception&) { Close(bot, BotError::Connect); return; }
+    if (m_unixPath.empty())
+        bot.SetTransport(SocketTransport::ConnectTcp(m_addr, true));
+    else
+        bot.SetTransport(SocketTransport::ConnectUnix(m_unixPath, true));
+    if (!bot || !bot.SetNonBlocking(true))
+        Close(bot, BotError::Connect);
+}
+
+void BotPoller::Close(Bot& bot, BotError error)
+{
+    if (bot.state == BotState::Closed)
+        return;
+    m_handler.OnClose(bot, error);
+    bot.state = BotState::Closed;
+    bot.CloseTransport();
+}
+
+bool BotPoller::Poll(BotClock::time_point now, std::chrono::milliseconds timeout)
+{
+    BuildPollSet(now);
+    if (m_fds.empty())
+    {
+        std::this_thread::sleep_for(timeout);
+        return true;
+    }
+    int result = ::WSAPoll(m_fds.data(), static_cast<ULONG>(m_fds.size()), static_cast<int>(timeout.count()));
+    if (result == SOCKET_ERROR)
+        return false;
+    for (size_t i = 0; result > 0 && i < m_fds.size(); ++i)
+    {
+        if (!m_fds[i].revents)
+            continue;
+        --result;
+        ProcessEvents(*m_fdBots[i], m_fds[i].revents);
+    }
+    return true;
+}
+
+void BotPoller::BuildPollSet(BotClock::time_point now)
+{
+    m_fds.clear();
+    m_fdBots.clear();
+    for (Bot* bot : m_bots)
+    {
+        if (bot->state != BotState::Joined && bot->state != BotState::Closed && bot->deadline <= now)
+            Close(*bot, BotError::Connect);
+    }
+    m_bots.erase(std::remove_if(m_bots.begin(), m_bots.end(),
+        [](const Bot* bot) { return bot->state == BotState::Closed; }), m_bots.end());
+
+    for (Bot* bot : m_bots)
+    {
+        // Connect completes when socket becomes writable
+        short events = POLLRDNORM;
+        if (bot->state == BotState::Connecting || bot->HasPendingSend())
+            events |= POLLWRNORM;
+        m_fds.push_back({ bot->GetTransport()->Handle(), events, 0 });
+        m_fdBots.push_back(bot);
+    }
+}
+
+void BotPoller::ProcessEvents(Bot& bot, short revents)
+{
+    if (bot.state == BotState::Closed)
+        return;
+    if (bot.state == BotState::Connecting)
+    {
+        if (revents & (POLLERR | POLLHUP))
+            Close(bot, BotError::Connect);
+        else if (revents & POLLWRNORM)
+        {
+            bot.state = BotState::Joining;
+            if (!m_handler.OnConnected(bot))
+                Close(bot, BotError::Send);
+        }
+        return;
+    }
+
+    if (revents & POLLWRNORM)
+    {
+        if (!bot.SendPending())
+        {
+            Close(bot, BotError::Send);
+            return;
+        }
+        m_handler.OnWritable(bot);
+        if (bot.state == BotState::Closed)
+            return;
+    }
+    if (!(revents & (POLLRDNORM | POLLHUP | POLLERR)))
+        return;
+
+    // Frames received before connection was closed are processed
+    bool closed = false;
+    if (!bot.RecvAvailable(closed))
+        closed = true;
+    bool ready = true;
+    while (bot.state != BotState::Closed)
+    {
+        if (!bot.NextFrame(m_frame, ready))
+        {
+            Close(bot, BotError::Protocol);
+            return;
+        }
+        if (!ready)
+            break;
+        if (!ProcessFrame(bot, m_frame))
+        {
+            Close(bot, BotError::Protocol);
+            return;
+        }
+    }
+    if (closed && bot.state != BotState::Closed)
+        Close(bot, bot.state == BotState::Joined ? BotError::Disconnect : BotError::Connect);
+}
+
+bool BotPoller::ProcessFrame(Bot& bot, const std::vector<char>& data)
+{
+    uint32_t size = static_cast<uint32_t>(data.size());
+    m_handler.OnFrame(bot, size);
+    if (!MessageBatch::IsBatch(data.data(), size))
+    {
+        ClientMessage msg;
+        msg.Unserialize(data.data(), size);
+        ProcessMessage(bot, msg);
+        return true;
+    }
+
+    m_batchMsgs.clear();
+    if (!MessageBatch::Unserialize(data.data(), size, m_batchMsgs))
+        return false;
+    for (auto& msg : m_batchMsgs)
+        ProcessMessage(bot, msg);
+    return true;
+}
+
+void BotPoller::ProcessMessage(Bot& bot, ClientMessage& msg)
+{
+    m_handler.OnMessage(bot, msg);
+    if (msg.command != ClientCommand::ConnectAccept)
+        return;
+    bot.SetConnectionOptions(msg.protocolVersion, msg.capabilities);
+    if (bot.HasCapability(CapCompression))
+        bot.InitCompression();
+    if (bot.state != BotState::Joining)
+        return;
+    bot.state = BotState::Joined;
+    m_handler.OnJoined(bot);
+}
@@ -0,0 +1,94 @@
+#ifndef _BOT_POLLER_H_
+#define _BOT_POLLER_H_
+
+#include "ClientBase.h"
+#include "ClientMessage.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Simulated users of tools that drive many connections from one thread, ChatLoad and ChatReplay.
+// Poller connects bots without blocking, waits for their sockets with WSAPoll,
+// receives frames, unpacks batches and takes ConnectAccept. What bots send is up to the tool.
+
+typedef std::chrono::steady_clock BotClock;
+
+enum class BotState
+{
+    Idle,
+    Connecting,     // non-blocking connect is in progress
+    Joining,        // ClientConnect is sent
+    Joined,
+    Closed,
+};
+
+enum class BotError
+{
+    None,           // closed by tool
+    Connect,        // connect failed or ConnectAccept didn't come in time
+    Disconnect,     // server closed connection of joined bot
+    Send,
+    Protocol,       // invalid frame
+};
+
+class Bot : public ClientBase
+{
+public:
+    BotState state = BotState::Idle;
+    BotClock::time_point deadline;      // of connect and ConnectAccept
+};
+
+// Events of bots, tool keeps its statistics in them
+class BotHandler
+{
+public:
+    virtual ~BotHandler() {}
+
+    // Connection is established, returns false if ClientConnect wasn't sent
+    virtual bool OnConnected(Bot& bot) = 0;
+    virtual void OnJoined(Bot& bot) = 0;
+    // Every received message, ConnectAccept too
+    virtual void OnMessage(Bot& bot, ClientMessage& msg) = 0;
+    // Called before bot is closed, its state is still the previous one
+    virtual void OnClose(Bot& bot, BotError error) = 0;
+    virtual void OnFrame(Bot&, uint32_t /*size*/) {}
+    // Socket took bytes that were pending
+    virtual void OnWritable(Bot&) {}
+};
+
+class BotPoller
+{
+public:
+    BotPoller(const BotPoller&) = delete;
+    BotPoller& operator = (const BotPoller&) = delete;
+
+    // Bots connect to Unix domain socket if unixPath isn't empty
+    BotPoller(BotHandler& handler, const CSOCKADDR_IN& addr, const std::string& unixPath);
+
+    // Bot stays owned by tool, it's polled from Connect until Close and isn't connected again
+    void Connect(Bot& bot, BotClock::time_point deadline);
+    // Closing a closed bot does nothing
+    void Close(Bot& bot, BotError error);
+    // Waits up to timeout for sockets and processes their events.
+    // Sleeps if no bot has a connection. Returns false if WSAPoll failed.
+    bool Poll(BotClock::time_point now, std::chrono::milliseconds timeout);
+
+private:
+    void BuildPollSet(BotClock::time_point now);
+    void ProcessEvents(Bot& bot, short revents);
+    bool ProcessFrame(Bot& bot, const std::vector<char>& data);
+    void ProcessMessage(Bot& bot, ClientMessage& msg);
+
+private:
+    BotHandler& m_handler;
+    CSOCKADDR_IN m_addr;
+    std::string m_unixPath;
+    std::vector<Bot*> m_bots;           // connected, closed ones are removed on next poll
+    // Poll set, rebuilt every iteration
+    std::vector<WSAPOLLFD> m_fds;
+    std::vector<Bot*> m_fdBots;
+    std::vector<char> m_frame;
+    std::vector<ClientMessage> m_batchMsgs;
+};
+
+#endif // !_BOT_POLLER_H_
@@ -0,0 +1,99 @@
+#include "Capture.h"
+#include "MappedFile.h"
+#include <cstring>
+
+std::atomic<bool> TrafficCapture::s_open(false);
+
+class TrafficCapture::Impl : public MappedFile
+{
+};
+
+TrafficCapture::TrafficCapture()
+    : m_base(nullptr),
+    m_size(0),
+    m_offset(0),
+    m_nDropped(0),
+    m_impl(new Impl)
+{
+}
+TrafficCapture::~TrafficCapture()
+{
+    Close();
+}
+
+TrafficCapture& TrafficCapture::GetInstance()
+{
+    static TrafficCapture instance;
+    return instance;
+}
+
+bool TrafficCapture::Open(const char* path, uint64_t size)
+{
+    using namespace CaptureFormat;
+
+    Close();
+    if (size < sizeof(FileHeader))
+        return false;
+    m_base = m_impl->Map(path, size);
+    if (!m_base)
+        return false;
+
+    FileHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.headerSize = sizeof(FileHeader);
+    header.fileSize = size;
+    header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(m_base, &header, sizeof(header));
+
+    m_size = size;
+    m_offset = sizeof(FileHeader);
+    m_nDropped = 0;
+    m_start = std::chrono::steady_clock::now();
+    s_open = true;
+    return true;
+}
+
+void TrafficCapture::Close()
+{
+    using namespace CaptureFormat;
+
+    if (!m_base)
+        return;
+    s_open = false;
+    uint64_t end = m_offset < m_size ? m_offset.load() : m_size;
+    uint64_t nDropped = m_nDropped;
+    memcpy(m_base + offsetof(FileHeader, endOffset), &end, sizeof(end));
+    memcpy(m_base + offsetof(FileHeader, nDropped), &nDropped, sizeof(nDropped));
+    m_impl->Unmap(end);
+    m_base = nullptr;
+    m_size = 0;
+}
+
+void TrafficCapture::Write(CaptureFormat::RecordKind kind, uint64_t session, const void* data, uint32_t size) noexcept
+{
+    using namespace CaptureFormat;
+
+    if (!IsOpen())
+        return;
+    size_t recordSize = RecordSize(size);
+    uint64_t offset = m_offset.fetch_add(recordSize, std::memory_order_relaxed);
+    if (offset + recordSize > m_size)
+    {
+        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    char* record = m_base + offset;
+    RecordHeader header = {};
+    header.dataSize = size;
+    header.kind = kind;
+    header.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+    header.session = session;
+    memcpy(record, &header, sizeof(header));
+    if (size)
+        memcpy(record + sizeof(RecordHeader), data, size);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(record + offsetof(RecordHeader, committed), &COMMITTED, sizeof(COMMITTED));
+}
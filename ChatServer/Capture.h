@@ -0,0 +1,57 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "CaptureFormat.h"
+
+#ifndef DEF_CAPTURE_SIZE
+#define DEF_CAPTURE_SIZE (256ull << 20) // bytes, records are dropped when file is full
+#endif
+
+// Capture of frames clients send to server, replayed by ChatReplay.
+// Records are written into memory mapped file by threads of sessions without locks.
+class TrafficCapture
+{
+private:
+    TrafficCapture();
+public:
+    static TrafficCapture& GetInstance();
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator = (const TrafficCapture&) = delete;
+
+    ~TrafficCapture();
+
+    // Creates file of given size, existing file is overwritten
+    bool Open(const char* path, uint64_t size = DEF_CAPTURE_SIZE);
+    // Writes end of capture to file header and unmaps it, no thread may write records at that time
+    void Close();
+
+    static bool IsOpen() noexcept
+    {
+        return s_open.load(std::memory_order_relaxed);
+    }
+
+    void Write(CaptureFormat::RecordKind kind, uint64_t session, const void* data, uint32_t size) noexcept;
+
+    uint64_t GetDroppedCount() const noexcept
+    {
+        return m_nDropped;
+    }
+
+private:
+    static std::atomic<bool> s_open;
+
+    char* m_base;
+    uint64_t m_size;
+    std::atomic<uint64_t> m_offset;
+    std::atomic<uint64_t> m_nDropped;
+    std::chrono::steady_clock::time_point m_start;
+
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_CAPTURE_H_
@@ -0,0 +1,62 @@
+#ifndef _CAPTURE_FORMAT_H_
+#define _CAPTURE_FORMAT_H_
+
+#include <cinttypes>
+#include <cstddef>
+
+// Layout of traffic capture file, shared by TrafficCapture and ChatReplay.
+//
+// File starts with FileHeader followed by records aligned to RECORD_ALIGNMENT.
+// Every record starts with RecordHeader followed by dataSize bytes:
+//   Connect - ClientConnect message of a new session
+//   Frame - frame received from session, decompressed
+//   Close - session ended, no data
+// Records are in order of reservation, times of concurrent sessions may be slightly out of order.
+// All values are little endian.
+
+namespace CaptureFormat
+{
+
+constexpr char MAGIC[8] = { 'C', 'H', 'A', 'T', 'C', 'A', 'P', 'T' };
+constexpr uint32_t VERSION = 1;
+constexpr uint16_t COMMITTED = 0x4D43;      // record is completely written
+constexpr size_t RECORD_ALIGNMENT = 8;
+
+enum RecordKind : uint16_t
+{
+    Connect = 1,
+    Frame,
+    Close,
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    uint64_t startTime;     // ns since system clock epoch
+    uint64_t endOffset;     // written when capture is closed, 0 if writer didn't close it
+    uint64_t nDropped;      // records that didn't fit, written when capture is closed
+};
+
+struct RecordHeader
+{
+    uint32_t dataSize;      // record takes header and data rounded up to alignment
+    uint16_t kind;          // 0 - no more records
+    uint16_t committed;
+    uint64_t time;          // ns since capture was opened, steady clock
+    uint64_t session;       // id of server client of the session
+};
+
+static_assert(sizeof(FileHeader) % RECORD_ALIGNMENT == 0, "FileHeader must keep records aligned");
+static_assert(sizeof(RecordHeader) == 24, "RecordHeader must be packed");
+
+inline size_t RecordSize(uint32_t dataSize) noexcept
+{
+    return (sizeof(RecordHeader) + dataSize + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+} // namespace CaptureFormat
+
+#endif // !_CAPTURE_FORMAT_H_
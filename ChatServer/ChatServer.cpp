@@ -1,14 +1,87 @@
+#include "Capture.h"
+#include "EventLog.h"
 #include "Server.h"
+#include "Shaping.h"
+#include "Transport.h"
 #include <iostream>
+#include <cstring>
+#include <string>
 
+// Usage: ChatServer [--unix path] [--shape file] [--capture file] [port]
+//   --unix path      also accept connections on Unix domain socket, port 0 - only on it
+//   --shape file     impair accepted connections as shaping config says, see Shaping.h
+//   --capture file   record frames clients send for ChatReplay
 
-int main()
+int main(int argc, char** argv)
 {
     int ret = 1;
     try
     {
-        Server serv;
+        uint16_t port = DEF_SERV_PORT;
+        const char* unixPath = nullptr;
+        const char* shapePath = nullptr;
+        const char* capturePath = nullptr;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc)
+                unixPath = argv[++i];
+            else if (strcmp(argv[i], "--shape") == 0 && i + 1 < argc)
+                shapePath = argv[++i];
+            else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+                capturePath = argv[++i];
+            else
+                port = static_cast<uint16_t>(std::stoul(argv[i]));
+        }
+
+        ShapingConfig shaping;
+        if (shapePath)
+        {
+            std::string error;
+            if (!shaping.Load(shapePath, error))
+            {
+                std::cerr << error << std::endl;
+                return ret;
+            }
+        }
+        // Listeners are wrapped when shaping, so server gets TCP listener from here too
+        Server serv(shapePath ? 0 : port);
+        auto addListener = [&](std::shared_ptr<Listener> listener)
+        {
+            if (shapePath)
+                listener = std::make_shared<ShapingListener>(std::move(listener), shaping);
+            serv.AddListener(std::move(listener));
+        };
+        if (shapePath && port)
+        {
+            std::shared_ptr<SocketListener> listener(new SocketListener);
+            if (!listener->ListenTcp(port))
+            {
+                std::cerr << "Can't listen on port " << port << std::endl;
+                return ret;
+            }
+            addListener(std::move(listener));
+        }
+        if (unixPath)
+        {
+            std::shared_ptr<SocketListener> listener(new SocketListener);
+            if (!listener->ListenUnix(unixPath))
+            {
+                std::cerr << "Can't listen on " << unixPath << std::endl;
+                return ret;
+            }
+            addListener(std::move(listener));
+        }
+        if (capturePath && !TrafficCapture::GetInstance().Open(capturePath))
+        {
+            std::cerr << "Can't create " << capturePath << std::endl;
+            return ret;
+        }
+        // Server of this process records to event log, servers of tests and benchmarks don't
+        if (!EventLog::GetInstance().Open(DEF_EVENT_LOG_FILE))
+            std::cerr << "Event log " DEF_EVENT_LOG_FILE " isn't written" << std::endl;
         ret = !serv.Run();
+        EventLog::GetInstance().Close();
+        TrafficCapture::GetInstance().Close();
         return ret;
     }
     catch (std::exception& exc)
@@ -21,4 +94,3 @@ int main()
     }
     return ret;
 }
-
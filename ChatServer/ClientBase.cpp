@@ -1,30 +1,107 @@
+
 #include "ClientBase.h"
 #include <algorithm>
+#include <string.h>
+
+// Bytes of frames waiting for non-blocking socket, sending fails beyond it
+constexpr size_t MAX_PENDING_SEND_SIZE = 1 << 20;
+// Bytes received by one RecvAvailable call, so event loop gets to its other events during a flood
+constexpr size_t MAX_RECV_AVAILABLE_SIZE = 64 * 1024;
+
+// Client without transport fails like a closed socket
+static bool NoTransport() noexcept
+{
+    WSASetLastError(WSAENOTSOCK);
+    return false;
+}
+
+bool ClientBase::InitCompression() noexcept
+{
+    // Compressor object is created by InitDecompression before compression is offered,
+    // so here we only enable the deflate stream of the existing one
+    if (!m_compressor)
+        m_compressor.reset(new (std::nothrow) FrameCompressor);
+    return m_compressor && m_compressor->InitDeflate();
+}
+
+bool ClientBase::InitDecompression() noexcept
+{
+    if (!FrameCompressor::IsSupported())
+        return false;
+    if (!m_compressor)
+        m_compressor.reset(new (std::nothrow) FrameCompressor);
+    return m_compressor && m_compressor->InitInflate();
+}
 
 bool ClientBase::SendData(const void* data, uint32_t size) const noexcept
 {
-    int result = 0;
+    if (!m_compressor || !m_compressor->IsDeflateEnabled())
+        return SendFrame(data, size, size);
+
+    // Compressed frames must be sent in the same order they were compressed
+    auto lk = m_compressor->LockDeflate();
+    std::vector<char> compressed;
+    if (!m_compressor->Compress(data, size, compressed))
+        return SendFrame(data, size, size);
+
+    return SendFrame(
+        compressed.data(),
+        static_cast<uint32_t>(compressed.size()),
+        static_cast<uint32_t>(compressed.size()) | COMPRESSED_FRAME_FLAG);
+}
+
+bool ClientBase::SendFrame(const void* data, uint32_t size, uint32_t header) const noexcept
+{
+    if (!m_transport)
+        return NoTransport();
+    if (m_nonBlocking)
+    {
+        if (m_sendBuffer.size() - m_sendOffset + size > MAX_PENDING_SEND_SIZE)
+        {
+            WSASetLastError(WSAENOBUFS);
+            return false;
+        }
+        try
+        {
+            auto pHeader = reinterpret_cast<const char*>(&header);
+            m_sendBuffer.insert(m_sendBuffer.end(), pHeader, pHeader + sizeof(uint32_t));
+            m_sendBuffer.insert(m_sendBuffer.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        }
+        catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
+        return SendPending();
+    }
+
+    // Small frames are sent with a single call together with size prefix
+    if (size <= MAX_SEND_RECV_DATA_SIZE - sizeof(uint32_t))
+    {
+        char buff[MAX_SEND_RECV_DATA_SIZE];
+        *reinterpret_cast<uint32_t*>(buff) = header;
+        memcpy(buff + sizeof(uint32_t), data, size);
+        return SendFrameData(buff, static_cast<uint32_t>(size + sizeof(uint32_t)));
+    }
+
     // send sended data size
-    result = ::send(m_socket, reinterpret_cast<const char*>(&size), sizeof(uint32_t), 0);
-    if (result == SOCKET_ERROR)
+    if (!SendFrameData(reinterpret_cast<const char*>(&header), sizeof(uint32_t)))
         return false;
 
     // send data
-    uint32_t nSends = (size + MAX_SEND_RECV_DATA_SIZE - 1) / MAX_SEND_RECV_DATA_SIZE;
-    const char* dataToSend = static_cast<const char*>(data);
-    for (uint32_t i = 0; i < nSends; ++i)
+    return SendFrameData(static_cast<const char*>(data), size);
+}
+
+// Transport may take fewer bytes than asked
+bool ClientBase::SendFrameData(const char* data, uint32_t size) const noexcept
+{
+    while (size > 0)
     {
-        result = ::send(
-            m_socket, 
-            dataToSend,
-            (std::min)(size, MAX_SEND_RECV_DATA_SIZE),
-            0);
+        int result = m_transport->Send(
+            data,
+            (std::min)(size, MAX_SEND_RECV_DATA_SIZE));
         if (result == SOCKET_ERROR)
             return false;
-        dataToSend += result;
+        data += result;
         size -= result;
     }
-    return size == 0;
+    return true;
 }
 
 bool ClientBase::RecvData(std::vector<char>& data, uint32_t* recved) const noexcept
@@ -32,36 +109,164 @@ bool ClientBase::RecvData(std::vector<char>& data, uint32_t* recved) const noexc
     data.clear();
     if (recved)
         *recved = 0;
+    if (!m_transport)
+        return NoTransport();
 
     int result;
-    uint32_t recvSize = 0;
-    result = ::recv(m_socket, reinterpret_cast<char*>(&recvSize), sizeof(uint32_t), 0);
+    uint32_t header = 0;
+    result = m_transport->Recv(reinterpret_cast<char*>(&header), sizeof(uint32_t));
     if (result == SOCKET_ERROR)
         return false;
     else if (result == 0)
         return true;
+    else if (result < static_cast<int>(sizeof(uint32_t)) &&
+        !RecvFrameData(reinterpret_cast<char*>(&header) + result, sizeof(uint32_t) - result))
+        return false;
+
+    uint32_t recvSize = header & FRAME_SIZE_MASK;
+    bool compressed = (header & COMPRESSED_FRAME_FLAG) != 0;
+    if (compressed && (!m_compressor || !m_compressor->IsInflateEnabled()))
+    {
+        WSASetLastError(ERROR_INVALID_DATA);
+        return false;
+    }
 
-    try { data.resize(recvSize); }
+    std::vector<char> compressedData;
+    std::vector<char>& frameData = compressed ? compressedData : data;
+    try { frameData.resize(recvSize); }
     catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
 
-    uint32_t nRecvs = (recvSize + MAX_SEND_RECV_DATA_SIZE - 1) / MAX_SEND_RECV_DATA_SIZE;
-    char* dataToRecv = data.data();
-    for(uint32_t i = 0; i < nRecvs; ++i)
+    if (!RecvFrameData(frameData.data(), recvSize))
     {
-        result = ::recv(
-            m_socket,
-            dataToRecv,
-            (std::min)(recvSize, MAX_SEND_RECV_DATA_SIZE),
-            0);
+        data.clear();
+        return false;
+    }
+
+    if (compressed && !UnpackFrame(compressedData.data(), recvSize, true, data))
+        return false;
+
+    if (recved)
+        *recved = static_cast<uint32_t>(data.size());
+    return true;
+}
+
+bool ClientBase::RecvFrameData(char* data, uint32_t size) const noexcept
+{
+    // Transport may return fewer bytes than asked
+    while (size > 0)
+    {
+        int result = m_transport->Recv(
+            data,
+            (std::min)(size, MAX_SEND_RECV_DATA_SIZE));
         if (result == SOCKET_ERROR)
-            break;
-        dataToRecv += result;
-        recvSize -= result;
+            return false;
+        if (result == 0)
+        {
+            // Peer closed connection in the middle of frame
+            WSASetLastError(WSAECONNRESET);
+            return false;
+        }
+        data += result;
+        size -= result;
     }
-    if(result == SOCKET_ERROR) 
-        data.clear();
-    else if (recved)
-        *recved = dataToRecv - data.data();
+    return true;
+}
+
+bool ClientBase::UnpackFrame(const char* frame, uint32_t size, bool compressed, std::vector<char>& data) const noexcept
+{
+    if (!compressed)
+    {
+        try { data.assign(frame, frame + size); }
+        catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
+        return true;
+    }
+    if (!m_compressor || !m_compressor->IsInflateEnabled() || !m_compressor->Decompress(frame, size, data))
+    {
+        WSASetLastError(ERROR_INVALID_DATA);
+        return false;
+    }
+    return true;
+}
+
+bool ClientBase::SetNonBlocking(bool nonBlocking) noexcept
+{
+    m_sendBuffer.clear();
+    m_sendOffset = 0;
+    m_recvBuffer.clear();
+    m_recvOffset = 0;
+
+    if (!m_transport)
+        return NoTransport();
+    if (!m_transport->SetNonBlocking(nonBlocking))
+        return false;
+    m_nonBlocking = nonBlocking;
+    return true;
+}
+
+bool ClientBase::SendPending() const noexcept
+{
+    if (HasPendingSend() && !m_transport)
+        return NoTransport();
+    while (m_sendOffset != m_sendBuffer.size())
+    {
+        int result = m_transport->Send(
+            m_sendBuffer.data() + m_sendOffset,
+            static_cast<int>(m_sendBuffer.size() - m_sendOffset));
+        if (result == SOCKET_ERROR)
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        m_sendOffset += result;
+    }
+    m_sendBuffer.clear();
+    m_sendOffset = 0;
+    return true;
+}
 
-    return recvSize == 0;
-}
\ No newline at end of file
+bool ClientBase::RecvAvailable(bool& closed) noexcept
+{
+    closed = false;
+    if (!m_transport)
+        return NoTransport();
+
+    // Drop taken frames before buffer grows
+    m_recvBuffer.erase(m_recvBuffer.begin(), m_recvBuffer.begin() + m_recvOffset);
+    m_recvOffset = 0;
+
+    for (size_t total = 0; total < MAX_RECV_AVAILABLE_SIZE;)
+    {
+        size_t size = m_recvBuffer.size();
+        try { m_recvBuffer.resize(size + MAX_SEND_RECV_DATA_SIZE); }
+        catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
+
+        int result = m_transport->Recv(m_recvBuffer.data() + size, MAX_SEND_RECV_DATA_SIZE);
+        m_recvBuffer.resize(size + (result > 0 ? result : 0));
+        if (result == SOCKET_ERROR)
+            return WSAGetLastError() == WSAEWOULDBLOCK;
+        if (result == 0)
+        {
+            closed = true;
+            return true;
+        }
+        total += result;
+    }
+    return true;
+}
+
+bool ClientBase::NextFrame(std::vector<char>& data, bool& ready) noexcept
+{
+    data.clear();
+    ready = false;
+
+    uint32_t header;
+    size_t available = m_recvBuffer.size() - m_recvOffset;
+    if (available < sizeof(uint32_t))
+        return true;
+    memcpy(&header, m_recvBuffer.data() + m_recvOffset, sizeof(uint32_t));
+    uint32_t size = header & FRAME_SIZE_MASK;
+    if (available - sizeof(uint32_t) < size)
+        return true;
+
+    const char* frame = m_recvBuffer.data() + m_recvOffset + sizeof(uint32_t);
+    m_recvOffset += sizeof(uint32_t) + size;
+    ready = true;
+    return UnpackFrame(frame, size, (header & COMPRESSED_FRAME_FLAG) != 0, data);
+}
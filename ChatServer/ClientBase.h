@@ -2,6 +2,8 @@
 #define _CLIENT_BASE_H_
 
 #include "Common.h"
+#include "Compression.h"
+#include "Transport.h"
 #include <vector>
 
 class ClientBase
@@ -25,25 +27,104 @@ public:
         m_name = std::move(name);
     }
 
-    CSOCKET* GetSocket() noexcept
+    Transport* GetTransport() noexcept
     {
-        return &m_socket;
+        return m_transport.get();
+    }
+    // Replaces connection, bytes buffered for the previous one are dropped by SetNonBlocking
+    void SetTransport(TransportUPtr transport) noexcept
+    {
+        m_transport = std::move(transport);
+    }
+    // Must not race with other calls on transport, see Transport
+    void CloseTransport() noexcept
+    {
+        if (m_transport)
+            m_transport->Close();
+    }
+    // Can be called from another thread to break blocking calls, handle is kept until CloseTransport
+    void ShutdownTransport() noexcept
+    {
+        if (m_transport)
+            m_transport->Shutdown();
     }
     CSOCKADDR_IN* GetAddr() noexcept
     {
         return &m_addr;
     }
 
+    // Connection options agreed during handshake
+    uint32_t GetProtocolVersion() const noexcept
+    {
+        return m_protocolVersion;
+    }
+    uint32_t GetCapabilities() const noexcept
+    {
+        return m_capabilities;
+    }
+    bool HasCapability(uint32_t cap) const noexcept
+    {
+        return (m_capabilities & cap) == cap;
+    }
+    void SetConnectionOptions(uint32_t version, uint32_t capabilities) noexcept
+    {
+        m_protocolVersion = version;
+        m_capabilities = capabilities;
+    }
+
+    // Compression of frames: peers enable inflate before offering compression
+    // and deflate after compression was agreed
+    bool InitCompression() noexcept;
+    bool InitDecompression() noexcept;
+    const FrameCompressor* GetCompressor() const noexcept
+    {
+        return m_compressor.get();
+    }
+
     bool SendData(const void* data, uint32_t size) const noexcept;
     bool RecvData(std::vector<char>& data, uint32_t* recved) const noexcept;
 
+    // Non-blocking transport for event loops: frames transport can't take yet wait in send buffer
+    // and received bytes are gathered until frames are complete.
+    // Buffered bytes belong to the transport, they are dropped when mode is set again for a new one.
+    bool SetNonBlocking(bool nonBlocking) noexcept;
+    bool IsNonBlocking() const noexcept
+    {
+        return m_nonBlocking;
+    }
+    bool HasPendingSend() const noexcept
+    {
+        return m_sendOffset != m_sendBuffer.size();
+    }
+    // Sends buffered bytes transport can take now
+    bool SendPending() const noexcept;
+    // Receives bytes transport has now, closed is set when peer has closed connection
+    bool RecvAvailable(bool& closed) noexcept;
+    // Takes next received frame if it is complete
+    bool NextFrame(std::vector<char>& data, bool& ready) noexcept;
+
     explicit operator bool() const noexcept { return !!*this; }
-    bool operator !() const noexcept { return !m_socket; }
+    bool operator !() const noexcept { return !m_transport || !m_transport->IsOpen(); }
+
+protected:
+    bool SendFrame(const void* data, uint32_t size, uint32_t header) const noexcept;
+    bool SendFrameData(const char* data, uint32_t size) const noexcept;
+    bool RecvFrameData(char* data, uint32_t size) const noexcept;
+    bool UnpackFrame(const char* frame, uint32_t size, bool compressed, std::vector<char>& data) const noexcept;
 
 protected:
-    CSOCKET m_socket;
+    TransportUPtr m_transport;
     CSOCKADDR_IN m_addr;
     std::wstring m_name;
+    std::unique_ptr<FrameCompressor> m_compressor;
+    uint32_t m_protocolVersion = 1;
+    uint32_t m_capabilities = 0;
+    // Non-blocking mode
+    bool m_nonBlocking = false;
+    mutable std::vector<char> m_sendBuffer;
+    mutable size_t m_sendOffset = 0;
+    std::vector<char> m_recvBuffer;
+    size_t m_recvOffset = 0;
 };
 
 #endif // !_CLIENT_BASE_H_
@@ -1,90 +1,93 @@
 #include <wchar.h>
+#include <string.h>
+#include <chrono>
 #include "ClientMessage.h"
+#include "MessageSchema.h"
 
 #define breakable_block_begin do {
 #define breakable_block_end }while(0)
 
+using MessageSchema::codecTable;
+
 constexpr uint32_t COMMAND_OFFSET = sizeof(uint64_t);
 constexpr uint32_t MESSAGE_OFFSET = sizeof(uint64_t) + sizeof(uint32_t);
 constexpr uint32_t MIN_MSG_SIZE = MESSAGE_OFFSET + sizeof(wchar_t) * 2;
+constexpr uint32_t BODY_MESSAGE_OFFSET = MESSAGE_OFFSET - COMMAND_OFFSET;
+
+constexpr uint32_t BATCH_COUNT_OFFSET = MESSAGE_OFFSET;
+constexpr uint32_t BATCH_HEADER_SIZE = BATCH_COUNT_OFFSET + sizeof(uint32_t);
+constexpr uint32_t BATCH_SEQUENCE_OFFSET = BATCH_HEADER_SIZE;
+constexpr uint32_t SEQUENCED_BATCH_HEADER_SIZE = BATCH_SEQUENCE_OFFSET + sizeof(uint64_t);
+constexpr uint32_t BATCH_ENTRY_HEADER_SIZE = sizeof(uint32_t) * 2;
+constexpr uint32_t MAX_BATCH_SIZE = 1024 * 1024;
 
-/*
-inline const wchar_t* FindCh(const wchar_t* beg, const wchar_t* end, wchar_t ch) noexcept
+ClientCommand ClientMessage::GetCommandId(const std::wstring& command) noexcept
 {
-    beg = wmemchr(beg, ch, end - beg);
-    return (beg == nullptr) ? end : beg;
+    return MessageSchema::nameTable.Find(command.c_str(), command.size());
 }
-*/
 
-inline bool IsCommand(ClientCommand cmd) noexcept
+uint64_t ClientMessage::Now() noexcept
 {
-    return (ClientCommand::Error < cmd && cmd < ClientCommand::COMMAND_COUNT);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
-ClientCommand ClientMessage::GetCommandId(const std::wstring& command) noexcept
+uint64_t ClientMessage::FromProtocolTimeStamp(uint64_t timeStamp, uint32_t version) noexcept
+{
+    return version < NANOSECOND_TIMESTAMP_VERSION ? timeStamp * TIMESTAMP_UNITS_PER_SECOND : timeStamp;
+}
+
+uint64_t ClientMessage::ToProtocolTimeStamp(uint64_t timeStamp, uint32_t version) noexcept
 {
-    if (command == L"/pm")
-        return ClientCommand::PrivateMessage;
-    else if (command == L"/setname")
-        return ClientCommand::ChangeName;
-    else if (command == L"/listusers")
-        return ClientCommand::ListClients;
-    else if (command == L"/help")
-        return ClientCommand::Help;
-    else
-        return ClientCommand::Error;
+    return version < NANOSECOND_TIMESTAMP_VERSION ? timeStamp / TIMESTAMP_UNITS_PER_SECOND : timeStamp;
+}
+
+void ClientMessage::ConvertFrameTimeStamp(void* frame, uint32_t size, uint32_t version) noexcept
+{
+    if (size < COMMAND_OFFSET)
+        return;
+    auto pTimeStamp = static_cast<uint64_t*>(frame);
+    *pTimeStamp = ToProtocolTimeStamp(*pTimeStamp, version);
 }
 
 void ClientMessage::Unserialize(const void* data, uint32_t size) noexcept
+{
+    if (size <= MIN_MSG_SIZE)
+    {
+        command = ClientCommand::Error;
+        return;
+    }
+    auto pBegin = reinterpret_cast<const char*>(data);
+    UnserializeBody(pBegin + COMMAND_OFFSET, size - COMMAND_OFFSET, *reinterpret_cast<const uint64_t*>(pBegin));
+}
+
+void ClientMessage::UnserializeBody(const void* data, uint32_t size, uint64_t timeStamp) noexcept
 {
     // break on error or invalid data format and set Error message type
     breakable_block_begin;
 
-    if (size <= MIN_MSG_SIZE)
+    if (size + COMMAND_OFFSET <= MIN_MSG_SIZE)
         break;
 
     auto pBegin = reinterpret_cast<const char*>(data);
 
-    // Get timestamp
-    timeStamp = *reinterpret_cast<const uint64_t*>(pBegin);
+    this->timeStamp = timeStamp;
+    sequence = 0;
 
     //Get requested command
-    command = *reinterpret_cast<const ClientCommand*>(pBegin + COMMAND_OFFSET);
+    command = *reinterpret_cast<const ClientCommand*>(pBegin);
 
-    if (!IsCommand(command))
+    auto codec = codecTable.Find(command);
+    if (!codec)
         break;
 
-    auto pMsg = reinterpret_cast<const wchar_t*>(pBegin + MESSAGE_OFFSET);
-    auto pEnd = pMsg + (size - MESSAGE_OFFSET) / sizeof(wchar_t);
-    if (pMsg == pEnd || *(pEnd - 1) != L'\0')
+    // Odd trailing byte isn't a part of text
+    auto pBody = pBegin + BODY_MESSAGE_OFFSET;
+    auto pEnd = pBody + (size - BODY_MESSAGE_OFFSET) / sizeof(wchar_t) * sizeof(wchar_t);
+    if (*reinterpret_cast<const wchar_t*>(pEnd - sizeof(wchar_t)) != L'\0')
         break;
 
-    // Get sender name
-    from.assign(pMsg);
-    if (from.empty())
-        break;
-    
-    if (command == ClientCommand::ListClients ||
-        command == ClientCommand::ClientConnect) // We get all data needed 
-        return;
-
-    pMsg += from.size() + 1;
-    if (pMsg == pEnd)
-        break;
-
-    if (command == ClientCommand::PrivateMessage) // need client name
-    {
-        pmTo.assign(pMsg);
-        if (pmTo.empty())
-            break;
-
-        pMsg += pmTo.size() + 1;
-        if (pMsg == pEnd)
-            break;
-    }
-
-    msg.assign(pMsg, pEnd - 1);
-    if (msg.empty())
+    if (!codec->read(*this, pBody, pEnd))
         break;
 
     return;
@@ -104,18 +107,13 @@ ClientMessage::Data ClientMessage::Serialize(uint32_t* size) noexcept
         break;
     *size = 0;
 
-    if (command == ClientCommand::Error || from.empty())
+    auto codec = codecTable.Find(command);
+    if (!codec || !codec->isValid(*this))
         break;
 
-    uint32_t dataSize =
-        sizeof(uint64_t) +
-        sizeof(uint32_t) +
-        (from.size() + 1) * sizeof(wchar_t) +
-        (msg.size() + 1) * sizeof(wchar_t) +
-        (pmTo.size() + 1) * sizeof(wchar_t);
-    uint32_t actualSize = 0;
+    uint32_t dataSize = MESSAGE_OFFSET + codec->size(*this);
 
-    retData.reset(new (std::nothrow) char[dataSize]());
+    retData.reset(new (std::nothrow) char[dataSize]);
     if (!retData)
         break;
 
@@ -123,43 +121,108 @@ ClientMessage::Data ClientMessage::Serialize(uint32_t* size) noexcept
 
     // write timestamp
     *reinterpret_cast<uint64_t*>(data) = timeStamp;
-    actualSize += sizeof(uint64_t);
 
     // write command
     *reinterpret_cast<ClientCommand*>(data + COMMAND_OFFSET) = command;
-    actualSize += sizeof(uint32_t);
 
-    auto pIt = reinterpret_cast<wchar_t*>(data + MESSAGE_OFFSET);
+    // write command fields
+    codec->write(*this, data + MESSAGE_OFFSET);
 
-    // write sender
-    wmemcpy(pIt, from.c_str(), from.size() + 1);
-    pIt += from.size() + 1;
-    actualSize += (from.size() + 1) * sizeof(wchar_t);
+    *size = dataSize;
+    return retData;
 
-    // write receiver
-    if (command == ClientCommand::PrivateMessage)
-    {
-        if (pmTo.empty())
-            break;
-        wmemcpy(pIt, pmTo.c_str(), pmTo.size() + 1);
-        pIt += pmTo.size() + 1;
-        actualSize += (pmTo.size() + 1) * sizeof(wchar_t);
-    }
+    breakable_block_end;
+
+    return nullptr;
+}
+
+
+// MessageBatch -------------------------------------------------------------------
+
+bool MessageBatch::Append(const void* frame, uint32_t size)
+{
+    if (size <= MIN_MSG_SIZE)
+        return false;
+
+    auto pFrame = static_cast<const char*>(frame);
+    uint64_t timeStamp = ClientMessage::ToProtocolTimeStamp(*reinterpret_cast<const uint64_t*>(pFrame), m_version);
+    uint32_t bodySize = size - COMMAND_OFFSET;
+    int64_t delta = static_cast<int64_t>(timeStamp - m_baseTimeStamp);
 
-    if (!(command == ClientCommand::ClientConnect ||
-        command == ClientCommand::ListClients))
+    if (m_count == 0)
     {
-        if (msg.empty())
-            break;
-        // write message
-        wmemcpy(pIt, msg.c_str(), msg.size() + 1);
-        actualSize += (msg.size() + 1) * sizeof(wchar_t);
+        m_baseTimeStamp = timeStamp;
+        m_data.resize(m_firstSequence ? SEQUENCED_BATCH_HEADER_SIZE : BATCH_HEADER_SIZE);
+        *reinterpret_cast<uint64_t*>(m_data.data()) = m_baseTimeStamp;
+        *reinterpret_cast<ClientCommand*>(m_data.data() + COMMAND_OFFSET) =
+            m_firstSequence ? ClientCommand::SequencedBatch : ClientCommand::Batch;
+        if (m_firstSequence)
+            *reinterpret_cast<uint64_t*>(m_data.data() + BATCH_SEQUENCE_OFFSET) = m_firstSequence;
     }
+    // Messages of different senders come slightly out of order, delta is signed
+    else if ((m_version < NANOSECOND_TIMESTAMP_VERSION ?
+            timeStamp < m_baseTimeStamp || timeStamp - m_baseTimeStamp > UINT32_MAX :
+            delta < INT32_MIN || delta > INT32_MAX) ||
+        m_data.size() + BATCH_ENTRY_HEADER_SIZE + bodySize > MAX_BATCH_SIZE)
+        return false;
+
+    size_t offset = m_data.size();
+    m_data.resize(offset + BATCH_ENTRY_HEADER_SIZE + bodySize);
+
+    auto pEntry = reinterpret_cast<uint32_t*>(m_data.data() + offset);
+    pEntry[0] = static_cast<uint32_t>(timeStamp - m_baseTimeStamp);
+    pEntry[1] = bodySize;
+    memcpy(pEntry + 2, pFrame + COMMAND_OFFSET, bodySize);
+
+    *reinterpret_cast<uint32_t*>(m_data.data() + BATCH_COUNT_OFFSET) = ++m_count;
+    return true;
+}
 
-    *size = actualSize;
-    return retData;
+void MessageBatch::Clear() noexcept
+{
+    m_data.clear();
+    m_baseTimeStamp = 0;
+    m_firstSequence = 0;
+    m_count = 0;
+}
 
-    breakable_block_end;
+bool MessageBatch::IsBatch(const void* data, uint32_t size) noexcept
+{
+    if (size < BATCH_HEADER_SIZE)
+        return false;
+    auto command = *reinterpret_cast<const ClientCommand*>(static_cast<const char*>(data) + COMMAND_OFFSET);
+    return command == ClientCommand::Batch ||
+        (command == ClientCommand::SequencedBatch && size >= SEQUENCED_BATCH_HEADER_SIZE);
+}
 
-    return nullptr;
+bool MessageBatch::Unserialize(const void* data, uint32_t size, std::vector<ClientMessage>& msgs)
+{
+    if (!IsBatch(data, size))
+        return false;
+
+    auto pBegin = static_cast<const char*>(data);
+    auto pEnd = pBegin + size;
+    uint64_t baseTimeStamp = *reinterpret_cast<const uint64_t*>(pBegin);
+    uint32_t count = *reinterpret_cast<const uint32_t*>(pBegin + BATCH_COUNT_OFFSET);
+    bool sequenced = *reinterpret_cast<const ClientCommand*>(pBegin + COMMAND_OFFSET) == ClientCommand::SequencedBatch;
+    uint64_t firstSequence = sequenced ? *reinterpret_cast<const uint64_t*>(pBegin + BATCH_SEQUENCE_OFFSET) : 0;
+
+    auto pEntry = pBegin + (sequenced ? SEQUENCED_BATCH_HEADER_SIZE : BATCH_HEADER_SIZE);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (static_cast<size_t>(pEnd - pEntry) < BATCH_ENTRY_HEADER_SIZE)
+            return false;
+        int32_t delta = reinterpret_cast<const int32_t*>(pEntry)[0];
+        uint32_t bodySize = reinterpret_cast<const uint32_t*>(pEntry)[1];
+        pEntry += BATCH_ENTRY_HEADER_SIZE;
+        if (static_cast<size_t>(pEnd - pEntry) < bodySize)
+            return false;
+
+        msgs.emplace_back();
+        msgs.back().UnserializeBody(pEntry, bodySize, baseTimeStamp + delta);
+        if (sequenced)
+            msgs.back().sequence = firstSequence + i;
+        pEntry += bodySize;
+    }
+    return pEntry == pEnd;
 }
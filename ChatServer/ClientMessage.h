@@ -4,6 +4,7 @@
 #include <cinttypes>
 #include <string>
 #include <memory>
+#include <vector>
 
 
 enum class ClientCommand : uint32_t
@@ -16,9 +17,34 @@ enum class ClientCommand : uint32_t
     ClientConnect,
     ServerMsg,
     Help,
+    ConnectAccept,  // server answer to ClientConnect with agreed connection options
+    Batch,          // frame with several messages, see MessageBatch
+    SequencedBatch, // batch of sequence numbered messages of resumable session
+    Ack,            // client acknowledges messages received up to sequence number
     COMMAND_COUNT,
 };
 
+// Version 1 - original protocol, ClientConnect carries only sender name
+// Version 2 - ClientConnect and ConnectAccept carry protocol version and capabilities
+// Version 3 - connection options also carry resume token and sequence number
+// Version 4 - timestamps are nanoseconds, batch timestamp deltas are signed
+constexpr uint32_t PROTOCOL_VERSION = 4;
+
+// Message timestamps are nanoseconds since Unix epoch,
+// frames of older protocol versions carry seconds and are converted per connection
+constexpr uint64_t TIMESTAMP_UNITS_PER_SECOND = 1000000000;
+constexpr uint32_t NANOSECOND_TIMESTAMP_VERSION = 4;
+
+// Optional protocol features, negotiated per connection
+enum ClientCapability : uint32_t
+{
+    CapNone             = 0x0000,
+    CapBatching         = 0x0001,   // multi-message batch frames
+    CapCompression      = 0x0002,   // deflate compressed frames
+    CapPresenceDelta    = 0x0004,   // join/leave notifications instead of full user list
+    CapResume           = 0x0008,   // resumable sessions after reconnect
+};
+
 enum class MsgSerializeError
 {
 
@@ -30,7 +56,16 @@ public:
     typedef std::unique_ptr<char[]> Data;
 
     static ClientCommand GetCommandId(const std::wstring& command) noexcept;
+    // Current time in timestamp units
+    static uint64_t Now() noexcept;
+    // Timestamp of frame of given protocol version to timestamp units and back
+    static uint64_t FromProtocolTimeStamp(uint64_t timeStamp, uint32_t version) noexcept;
+    static uint64_t ToProtocolTimeStamp(uint64_t timeStamp, uint32_t version) noexcept;
+    // Converts timestamp of serialized message frame to given protocol version
+    static void ConvertFrameTimeStamp(void* frame, uint32_t size, uint32_t version) noexcept;
     void Unserialize(const void* data, uint32_t size) noexcept;
+    // Unserialize message frame without leading timestamp
+    void UnserializeBody(const void* data, uint32_t size, uint64_t timeStamp) noexcept;
     Data Serialize(uint32_t* size) noexcept; // returned data need to be released with delete[]
 
     std::wstring msg;
@@ -38,6 +73,54 @@ public:
     std::wstring pmTo;
     uint64_t timeStamp = 0;
     ClientCommand command = ClientCommand::Error;
+    // ClientConnect - version and capabilities supported by client
+    // ConnectAccept - agreed version and capabilities
+    uint32_t protocolVersion = 1;
+    uint32_t capabilities = CapNone;
+    // ClientConnect - token of session to resume, 0 for a new session
+    // ConnectAccept - token of the session, equal to requested one if session was resumed
+    uint64_t resumeToken = 0;
+    // ClientConnect, Ack - sequence number of the last received message
+    // Messages of SequencedBatch - sequence number of the message
+    uint64_t sequence = 0;
+};
+
+// Packs several serialized messages into one frame.
+// Frame layout:
+//   [uint64 base timestamp][uint32 ClientCommand::Batch][uint32 messages count]
+//   count * ([int32 timestamp delta][uint32 body size][message frame without timestamp])
+// Before protocol version 4 timestamps are seconds and deltas are unsigned.
+// Batch of resumable session has ClientCommand::SequencedBatch command and
+// [uint64 first sequence] after count, sequence numbers of messages are consecutive.
+class MessageBatch
+{
+public:
+    MessageBatch() noexcept {}
+
+    // Returns false if message can't be added to this batch,
+    // then batch should be sent and a new one started
+    bool Append(const void* frame, uint32_t size);
+    void Clear() noexcept;
+    // Makes empty batch sequenced, 0 - plain batch
+    void SetFirstSequence(uint64_t sequence) noexcept { m_firstSequence = sequence; }
+    // Timestamp format of batches made for connection of given version, kept by Clear
+    void SetProtocolVersion(uint32_t version) noexcept { m_version = version; }
+
+    uint64_t FirstSequence() const noexcept { return m_firstSequence; }
+    uint32_t Count() const noexcept { return m_count; }
+    const char* Data() const noexcept { return m_data.data(); }
+    uint32_t Size() const noexcept { return static_cast<uint32_t>(m_data.size()); }
+
+    static bool IsBatch(const void* data, uint32_t size) noexcept;
+    // Appends unpacked messages to msgs. Returns false on invalid frame format.
+    static bool Unserialize(const void* data, uint32_t size, std::vector<ClientMessage>& msgs);
+
+private:
+    std::vector<char> m_data;
+    uint64_t m_baseTimeStamp = 0;
+    uint64_t m_firstSequence = 0;
+    uint32_t m_count = 0;
+    uint32_t m_version = PROTOCOL_VERSION;
 };
 
 #endif // !_CLIENT_MESSAGE_H_
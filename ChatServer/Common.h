@@ -63,6 +63,29 @@ struct CSOCKADDR_IN : SOCKADDR_IN
     constexpr static int Size() { return sizeof(CSOCKADDR_IN); }
 };
 
+// Layout of sockaddr_un, afunix.h is missing in older SDKs
+struct CSOCKADDR_UN
+{
+    static constexpr size_t MAX_PATH_SIZE = 108;
+
+    ADDRESS_FAMILY sun_family;
+    char sun_path[MAX_PATH_SIZE];
+
+    CSOCKADDR_UN() : sun_family(AF_UNIX), sun_path{} {}
+
+    // Path with terminating zero must fit
+    bool SetPath(const std::string& path)
+    {
+        if (path.empty() || path.size() >= MAX_PATH_SIZE)
+            return false;
+        sun_path[path.copy(sun_path, path.size())] = '\0';
+        return true;
+    }
+
+    operator SOCKADDR* () { return reinterpret_cast<SOCKADDR*>(this); }
+    constexpr static int Size() { return sizeof(CSOCKADDR_UN); }
+};
+
 class CSOCKET
 {
 public:
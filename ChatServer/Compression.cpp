@@ -0,0 +1,246 @@
+
+#include "Compression.h"
+#include <chrono>
+
+#ifdef CHAT_USE_ZLIB
+#include <zlib.h>
+#pragma comment(lib, "zlib.lib")
+#endif
+
+#ifndef DEF_COMPRESSION_LEVEL
+#define DEF_COMPRESSION_LEVEL 6
+#endif
+
+#define breakable_block_begin do {
+#define breakable_block_end }while(0)
+
+typedef std::chrono::steady_clock Clock;
+
+constexpr uint32_t MAX_DECOMPRESSED_FRAME_SIZE = 64 * 1024 * 1024;
+constexpr int RAW_DEFLATE_WINDOW_BITS = -15;
+
+// Strings that are very likely to appear in chat traffic. Stored as wchar_t, the same
+// way they go over the wire. Most frequent strings are placed at the end of dictionary,
+// because deflate encodes closer matches with shorter distances.
+static const wchar_t PRESET_DICTIONARY[] =
+    L"There is no user with name "
+    L"ErrorNameAlreadyExists "
+    L" changed his name to "
+    L"there are no active users"
+    L" leaves the chat."
+    L" joined to the chat."
+    L"Current active users:\n"
+    L"Server";
+
+inline uint64_t ElapsedNs(Clock::time_point start) noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+
+// FrameCompressor::Impl ------------------------------------------------------------------
+
+class FrameCompressor::Impl
+{
+public:
+    Impl() noexcept {}
+    ~Impl()
+    {
+#ifdef CHAT_USE_ZLIB
+        if (deflateReady)
+            deflateEnd(&deflateStream);
+        if (inflateReady)
+            inflateEnd(&inflateStream);
+#endif
+    }
+
+#ifdef CHAT_USE_ZLIB
+    z_stream deflateStream = {};
+    z_stream inflateStream = {};
+    bool deflateReady = false;
+    bool inflateReady = false;
+#endif
+};
+
+
+// FrameCompressor ------------------------------------------------------------------------
+
+FrameCompressor::FrameCompressor(uint32_t threshold) noexcept
+    : m_impl(new (std::nothrow) Impl),
+    m_deflateEnabled(false),
+    m_inflateEnabled(false),
+    m_threshold(threshold)
+{
+}
+FrameCompressor::~FrameCompressor() = default;
+
+bool FrameCompressor::IsSupported() noexcept
+{
+#ifdef CHAT_USE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FrameCompressor::InitDeflate() noexcept
+{
+    auto lk = LockDeflate();
+    if (m_deflateEnabled)
+        return true;
+#ifdef CHAT_USE_ZLIB
+    if (!m_impl)
+        return false;
+    z_stream& z = m_impl->deflateStream;
+    if (deflateInit2(&z, DEF_COMPRESSION_LEVEL, Z_DEFLATED, RAW_DEFLATE_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    m_impl->deflateReady = true;
+    if (deflateSetDictionary(&z,
+        reinterpret_cast<const Bytef*>(PRESET_DICTIONARY),
+        sizeof(PRESET_DICTIONARY) - sizeof(wchar_t)) != Z_OK)
+        return false;
+    m_deflateEnabled = true;
+    return true;
+#else
+    return false;
+#endif
+}
+bool FrameCompressor::InitInflate() noexcept
+{
+    if (m_inflateEnabled)
+        return true;
+#ifdef CHAT_USE_ZLIB
+    if (!m_impl)
+        return false;
+    z_stream& z = m_impl->inflateStream;
+    if (inflateInit2(&z, RAW_DEFLATE_WINDOW_BITS) != Z_OK)
+        return false;
+    m_impl->inflateReady = true;
+    if (inflateSetDictionary(&z,
+        reinterpret_cast<const Bytef*>(PRESET_DICTIONARY),
+        sizeof(PRESET_DICTIONARY) - sizeof(wchar_t)) != Z_OK)
+        return false;
+    m_inflateEnabled = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FrameCompressor::Compress([[maybe_unused]] const void* data, uint32_t size, std::vector<char>& out) noexcept
+{
+    out.clear();
+
+    ++m_deflateStats.nFrames;
+    m_deflateStats.rawBytes += size;
+
+    breakable_block_begin;
+
+    if (!m_deflateEnabled || size == 0 || size < m_threshold)
+        break;
+
+#ifdef CHAT_USE_ZLIB
+    auto start = Clock::now();
+    z_stream& z = m_impl->deflateStream;
+    int ret = Z_OK;
+    size_t written = sizeof(uint32_t);
+    try
+    {
+        out.resize(written + deflateBound(&z, size) + 16);
+        *reinterpret_cast<uint32_t*>(out.data()) = size;
+
+        z.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+        z.avail_in = size;
+        do
+        {
+            if (written == out.size())
+                out.resize(out.size() * 2);
+            z.next_out = reinterpret_cast<Bytef*>(out.data() + written);
+            z.avail_out = static_cast<uInt>(out.size() - written);
+            ret = deflate(&z, Z_SYNC_FLUSH);
+            written = out.size() - z.avail_out;
+        } while (ret == Z_OK && (z.avail_in != 0 || z.avail_out == 0));
+    }
+    catch (std::exception&)
+    {
+        ret = Z_MEM_ERROR;
+    }
+    m_deflateStats.cpuTimeNs += ElapsedNs(start);
+
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        // stream state is undefined now, all next frames go uncompressed
+        m_deflateEnabled = false;
+        out.clear();
+        return false;
+    }
+    out.resize(written);
+
+    ++m_deflateStats.nCompressedFrames;
+    m_deflateStats.wireBytes += out.size();
+    return true;
+#endif
+
+    breakable_block_end;
+
+    m_deflateStats.wireBytes += size;
+    return false;
+}
+
+bool FrameCompressor::Decompress([[maybe_unused]] const void* data, uint32_t size, std::vector<char>& out) noexcept
+{
+    out.clear();
+
+    ++m_inflateStats.nFrames;
+    m_inflateStats.wireBytes += size;
+
+    if (!m_inflateEnabled || size <= sizeof(uint32_t))
+        return false;
+
+#ifdef CHAT_USE_ZLIB
+    uint32_t rawSize = *static_cast<const uint32_t*>(data);
+    if (rawSize == 0 || rawSize > MAX_DECOMPRESSED_FRAME_SIZE)
+        return false;
+
+    auto start = Clock::now();
+    z_stream& z = m_impl->inflateStream;
+    int ret = Z_OK;
+    try
+    {
+        // one extra byte to detect frames larger than announced
+        out.resize(rawSize + 1);
+        z.next_in = static_cast<Bytef*>(const_cast<void*>(data)) + sizeof(uint32_t);
+        z.avail_in = size - sizeof(uint32_t);
+        z.next_out = reinterpret_cast<Bytef*>(out.data());
+        z.avail_out = static_cast<uInt>(out.size());
+        do
+        {
+            ret = inflate(&z, Z_SYNC_FLUSH);
+        } while (ret == Z_OK && z.avail_in != 0 && z.avail_out != 0);
+    }
+    catch (std::exception&)
+    {
+        ret = Z_MEM_ERROR;
+    }
+    m_inflateStats.cpuTimeNs += ElapsedNs(start);
+
+    if ((ret != Z_OK && ret != Z_BUF_ERROR) || z.avail_in != 0 || z.avail_out != 1)
+    {
+        m_inflateEnabled = false;
+        out.clear();
+        return false;
+    }
+    out.resize(rawSize);
+    ++m_inflateStats.nCompressedFrames;
+    m_inflateStats.rawBytes += rawSize;
+    return true;
+#else
+    return false;
+#endif
+}
+
+FrameCompressor::Stats FrameCompressor::GetDeflateStats() const noexcept
+{
+    auto lk = LockDeflate();
+    return m_deflateStats;
+}
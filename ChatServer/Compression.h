@@ -0,0 +1,80 @@
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <cinttypes>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// Frame compression is available only when built with zlib (CHAT_USE_ZLIB defined
+// and zlib.lib reachable by the linker). Otherwise IsSupported() returns false and
+// compression is never offered during the handshake.
+
+#ifndef DEF_COMPRESSION_THRESHOLD
+#define DEF_COMPRESSION_THRESHOLD 256
+#endif
+
+// Set in frame size prefix when frame payload is compressed
+constexpr uint32_t COMPRESSED_FRAME_FLAG = 0x80000000;
+constexpr uint32_t FRAME_SIZE_MASK = ~COMPRESSED_FRAME_FLAG;
+
+// Per connection deflate/inflate streams.
+// Each direction keeps a single raw deflate stream flushed with Z_SYNC_FLUSH on every frame,
+// so the stream window (last 32Kb of compressed traffic) works as a dictionary primed with
+// recent messages. Both streams start with the same preset dictionary of protocol strings.
+// Compressed payload layout: [uint32 uncompressed size][deflate data]
+class FrameCompressor
+{
+public:
+    typedef std::unique_lock<std::mutex> MutexLock;
+
+    struct Stats
+    {
+        uint64_t nFrames = 0;           // frames passed through Compress/Decompress
+        uint64_t nCompressedFrames = 0; // frames that were actually (de)compressed
+        uint64_t rawBytes = 0;          // uncompressed size of all frames
+        uint64_t wireBytes = 0;         // size of all frames as sent/received
+        uint64_t cpuTimeNs = 0;         // time spent in zlib
+    };
+
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator = (const FrameCompressor&) = delete;
+
+    explicit FrameCompressor(uint32_t threshold = DEF_COMPRESSION_THRESHOLD) noexcept;
+    ~FrameCompressor();
+
+    static bool IsSupported() noexcept;
+
+    bool InitDeflate() noexcept;
+    bool InitInflate() noexcept;
+    bool IsDeflateEnabled() const noexcept { return m_deflateEnabled; }
+    bool IsInflateEnabled() const noexcept { return m_inflateEnabled; }
+
+    // Deflate stream is shared by all threads sending to the connection.
+    // Lock must be held from Compress call until compressed frame is sent.
+    MutexLock LockDeflate() const { return MutexLock(m_deflateMtx); }
+
+    // Returns false if frame must be sent as is (deflate disabled or frame is below threshold)
+    // or on compression error (out is empty in that case)
+    bool Compress(const void* data, uint32_t size, std::vector<char>& out) noexcept;
+    bool Decompress(const void* data, uint32_t size, std::vector<char>& out) noexcept;
+
+    uint32_t GetThreshold() const noexcept { return m_threshold; }
+    void SetThreshold(uint32_t threshold) noexcept { m_threshold = threshold; }
+
+    Stats GetDeflateStats() const noexcept;
+    Stats GetInflateStats() const noexcept { return m_inflateStats; }
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+    mutable std::mutex m_deflateMtx;
+    std::atomic<bool> m_deflateEnabled;
+    std::atomic<bool> m_inflateEnabled;
+    uint32_t m_threshold;
+    Stats m_deflateStats;
+    Stats m_inflateStats;
+};
+
+#endif // !_COMPRESSION_H_
@@ -1,8 +1,21 @@
 #include "Console.h"
-#include <Windows.h>
+#include "ConsoleScreen.h"
+#include "LockStats.h"
 #include <algorithm>
 #include <mutex>
 
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
 struct MutexLock;
 
 
@@ -20,6 +33,9 @@ struct MutexLock
     MutexLock& operator = (const MutexLock&) = delete;
 
     MutexLock(MutexLock&& lk) : mtx(lk.mtx), locked(lk.locked)
+#ifdef CHAT_LOCK_STATS
+        , stats(lk.stats), site(lk.site), acquireTime(lk.acquireTime)
+#endif
     {
         lk.mtx = nullptr;
         lk.locked = false;
@@ -32,47 +48,180 @@ struct MutexLock
                 Unlock();
             mtx = lk.mtx;
             locked = lk.locked;
+#ifdef CHAT_LOCK_STATS
+            stats = lk.stats;
+            site = lk.site;
+            acquireTime = lk.acquireTime;
+#endif
             lk.mtx = nullptr;
             lk.locked = false;
         }
         return *this;
     }
 
-    MutexLock(Mutex* mtx) : mtx(mtx), locked(false) { Lock(); }
+#ifdef CHAT_LOCK_STATS
+    MutexLock(Mutex* mtx, LockStats& stats, LockSiteRef site) : mtx(mtx), locked(false), stats(&stats), site(site) { Lock(); }
+#else
+    MutexLock(Mutex* mtx, LockStats&, LockSiteRef) : mtx(mtx), locked(false) { Lock(); }
+#endif
     ~MutexLock() { Unlock(); }
     void Lock()
     {
         if (mtx)
+        {
+#ifdef CHAT_LOCK_STATS
+            acquireTime = stats->Acquire([this] { return mtx->try_lock(); }, [this] { mtx->lock(); }, site);
+#else
             mtx->lock();
+#endif
+        }
         locked = true;
     }
     void Unlock()
     {
         if (locked && mtx)
+        {
+#ifdef CHAT_LOCK_STATS
+            stats->Release(acquireTime);
+#endif
             mtx->unlock();
+        }
         locked = false;
     }
 
     Mutex* mtx;
     bool locked;
+#ifdef CHAT_LOCK_STATS
+    LockStats* stats;
+    LockSiteRef site;
+    uint64_t acquireTime;
+#endif
 };
 
 
 
 
 
-// Console::Impl ----------------------------------------------------------------------
+// Console locks ----------------------------------------------------------------------
 
-class Console::Impl
+// Read and write locks shared by console implementations, they exist only in multithreaded mode
+class ConsoleLocks
 {
 private:
-    static const uint16_t BK_COLOR_SHIFT = 4;
-
     enum Flags : uint32_t
     {
         Multithreaded = 0x00000001,
     };
 
+public:
+    ConsoleLocks(bool multithreaded)
+        : m_writeStats("console.write"),
+        m_readStats("console.read"),
+        m_flags(0)
+    {
+        SetMultiThreaded(multithreaded);
+    }
+
+    bool IsMultiThreaded() const noexcept
+    {
+        return m_flags & Multithreaded;
+    }
+    void SetMultiThreaded(bool b)
+    {
+        if (b && !IsMultiThreaded())
+        {
+            m_writeMtx = std::make_unique<Mutex>();
+            m_readMtx = std::make_unique<Mutex>();
+            m_flags |= Multithreaded;
+        }
+        else if (!b && IsMultiThreaded())
+        {
+            auto wlk = GetRWLock(LOCK_SITE);
+            auto wrtmp = std::move(m_writeMtx);
+            auto rdtmp = std::move(m_readMtx);
+            m_flags &= ~Multithreaded;
+        }
+    }
+
+    // Lock console operations
+    void LockIO() const
+    {
+        LockRead();
+        LockWrite();
+    }
+    void UnlockIO() const
+    {
+        UnlockWrite();
+        UnlockRead();
+    }
+    // Explicit locks are instrumented only for wait time
+    void LockWrite() const
+    {
+        if (m_writeMtx)
+            AcquireInstrumented(*m_writeMtx, m_writeStats);
+    }
+    void UnlockWrite() const
+    {
+        if (m_writeMtx)
+            m_writeMtx->unlock();
+    }
+    void LockRead() const
+    {
+        if (m_readMtx)
+            AcquireInstrumented(*m_readMtx, m_readStats);
+    }
+    void UnlockRead() const
+    {
+        if (m_readMtx)
+            m_readMtx->unlock();
+    }
+
+protected:
+    MutexLock GetWriteLock(LockSiteRef site) const
+    {
+        return MutexLock(m_writeMtx.get(), m_writeStats, site);
+    }
+    MutexLock GetReadLock(LockSiteRef site) const
+    {
+        return MutexLock(m_readMtx.get(), m_readStats, site);
+    }
+    RWLock GetRWLock(LockSiteRef site) const
+    {
+        return { GetReadLock(site), GetWriteLock(site) };
+    }
+
+private:
+    static void AcquireInstrumented(Mutex& mtx, [[maybe_unused]] LockStats& stats)
+    {
+#ifdef CHAT_LOCK_STATS
+        stats.Acquire([&mtx] { return mtx.try_lock(); }, [&mtx] { mtx.lock(); }, nullptr);
+#else
+        mtx.lock();
+#endif
+    }
+
+private:
+    std::unique_ptr<Mutex> m_writeMtx;
+    std::unique_ptr<Mutex> m_readMtx;
+    mutable LockStats m_writeStats;
+    mutable LockStats m_readStats;
+    uint32_t m_flags;
+};
+
+
+
+
+
+#ifdef _WIN32
+
+// Console::Impl, Win32 console ---------------------------------------------------------
+
+class Console::Impl : public ConsoleLocks
+{
+private:
+    static const uint16_t BK_COLOR_SHIFT = 4;
+    static const uint16_t NO_COLOR = 0xFFFF;
+
 public:
     Impl(bool multithreaded);
     ~Impl() {}
@@ -81,7 +230,7 @@ public:
     bool ReadChar(char& ch) const
     {
         DWORD tmp;
-        auto rlk = GetReadLock();
+        auto rlk = GetReadLock(LOCK_SITE);
         tmp = ReadConsoleA(m_hIn, &ch, 1, &tmp, nullptr);
         if (ch == '\r')
             ch = '\n';
@@ -91,14 +240,15 @@ public:
     {
         if (!ReadChar(ch))
             return false;
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
         DWORD dw;
+        m_lastInputShown = false;
         return WriteConsoleA(m_hOut, &ch, 1, &dw, nullptr);
     }
     bool ReadChar(wchar_t& ch) const
     {
         DWORD tmp;
-        auto rlk = GetReadLock();
+        auto rlk = GetReadLock(LOCK_SITE);
         tmp = ReadConsoleW(m_hIn, &ch, 1, &tmp, nullptr);
         if (ch == L'\r')
             ch = L'\n';
@@ -108,15 +258,15 @@ public:
     {
         if (!ReadChar(ch))
             return false;
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
         DWORD dw;
+        m_lastInputShown = false;
         return WriteConsoleW(m_hOut, &ch, 1, &dw, nullptr);
     }
 
-    bool ReadLine(char* buff, size_t buffSize);
     bool ReadLine(std::string& str);
-    bool ReadLine(wchar_t* buff, size_t buffSize);
     bool ReadLine(std::wstring& str);
+    bool TryReadLine(std::wstring& str, bool& lineRead);
 
 
     // Write operations
@@ -125,28 +275,30 @@ public:
 
     bool Write(const wchar_t* str, size_t nChars);
     bool Write(const wchar_t* str, size_t nChars, Color textColor, Color bkColor);
+    bool Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns);
+    bool ReplaceLastInput(const wchar_t* str, size_t nChars, Color textColor);
     
     bool EraseNPrevChars(uint32_t nChars) const;
 
     // Color operations
     Color GetTextColor() const
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
         return m_textColor;
     }
     Color GetBackGroundColor() const
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
         return m_bkColor;    
     }
     Color GetConsoleFillColor() const
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
         return static_cast<Color>(m_fillColor & Color::ColorMask);
     }
     bool SetTextColor(Color textColor)
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
         if (textColor == Color::UseCurrent || (textColor & Color::ColorMask) == m_textColor)
             return true;
         m_textColor = static_cast<Color>(textColor & Color::ColorMask);
@@ -154,7 +306,7 @@ public:
     }
     bool SetBkColor(Color bkColor, bool redrawBkGnd)
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
         if (bkColor == Color::UseCurrent || (bkColor & Color::ColorMask) == m_bkColor)
             return true;
         m_bkColor = static_cast<Color>(bkColor & Color::ColorMask);
@@ -165,7 +317,7 @@ public:
     }
     bool SetColor(Color textColor, Color bkColor, bool redrawBkGnd)
     {
-        auto lk = GetWriteLock();
+        auto lk = GetWriteLock(LOCK_SITE);
 
         if (textColor == Color::UseCurrent)
             textColor = m_textColor;
@@ -189,58 +341,39 @@ public:
     // Code page operations
     uint32_t GetConsoleInputCP() const
     {
-        auto rlk = GetReadLock();
+        auto rlk = GetReadLock(LOCK_SITE);
         return ::GetConsoleCP();
     }
     uint32_t GetConsoleOutputCP() const
     {
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
         return ::GetConsoleOutputCP();
     }
     bool SetConsoleInputCP(uint32_t cp) const
     {
-        auto rlk = GetReadLock();
+        auto rlk = GetReadLock(LOCK_SITE);
         return ::SetConsoleCP(cp);
     }
     bool SetConsoleOutputCP(uint32_t cp) const
     {
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
         return ::SetConsoleOutputCP(cp);
     }
 
 
     // Other ops
-    bool IsMultiThreaded() const noexcept
-    {
-        return m_flags & Multithreaded;
-    }
-    void SetMultiThreaded(bool b)
-    {
-        if (b && !IsMultiThreaded())
-        {
-            m_writeMtx = std::make_unique<Mutex>();
-            m_readMtx = std::make_unique<Mutex>();
-            m_flags |= Multithreaded;
-        }
-        else if (!b && IsMultiThreaded())
-        {
-            auto wlk = GetRWLock();
-            auto wrtmp = std::move(m_writeMtx);
-            auto rdtmp = std::move(m_readMtx);
-            m_flags &= ~Multithreaded;
-        }
-    }
-
     bool SetPos(uint16_t x, uint16_t y)
     {
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
+        m_lastInputShown = false;
         return ::SetConsoleCursorPosition(m_hOut, COORD{
             static_cast<SHORT>(x), 
             static_cast<SHORT>(y) });
     }
     bool SetPosInd(uint32_t ind)
     {
-        auto wlk = GetWriteLock();
+        auto wlk = GetWriteLock(LOCK_SITE);
+        m_lastInputShown = false;
         auto size = GetConsoleSize();
         return ::SetConsoleCursorPosition(m_hOut, COORD{
             static_cast<SHORT>(ind % LOWORD(size)),
@@ -267,38 +400,9 @@ public:
             return -1;
         return MAKELONG(csbi.dwSize.X, csbi.dwSize.Y);
     }
-
-
-    // Lock console operations
-    void LockIO() const
-    {
-        LockRead();
-        LockWrite();
-    }
-    void UnlockIO() const
-    {
-        UnlockWrite();
-        UnlockRead();
-    }
-    void LockWrite() const
-    {
-        if (m_writeMtx)
-            m_writeMtx->lock();
-    }
-    void UnlockWrite() const
-    {
-        if (m_writeMtx)
-            m_writeMtx->unlock();
-    }
-    void LockRead() const
-    {
-        if (m_readMtx)
-            m_readMtx->lock();
-    }
-    void UnlockRead() const
+    intptr_t GetInputHandle() const
     {
-        if (m_readMtx)
-            m_readMtx->unlock();
+        return reinterpret_cast<intptr_t>(m_hIn);
     }
 
 private:
@@ -314,21 +418,133 @@ private:
     //       2 | Output 2
     //       3 | SomeText
     //       4 | 1234567    // our current input 
-    bool WriteWithInputWrap(const wchar_t* str, size_t size) const
+    // When input starts a row, its rows are moved down and only str is written, see ScreenPlan
+    bool WriteWithInputWrap(const wchar_t* str, size_t size, const ColorRun* runs = nullptr, size_t nRuns = 0)
+    {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(m_hOut, &csbi))
+            return false;
+        ScreenPlan plan(csbi.dwSize.X, csbi.srWindow.Bottom - csbi.srWindow.Top + 1, true);
+        plan.WriteAboveInput(str, size, m_inputColumn, m_inputBuffer.size());
+        return RenderPlan(plan, m_inputBuffer, false, runs, nRuns);
+    }
+    // Text of plan is written in colors of runs when they are passed
+    bool RenderPlan(const ScreenPlan& plan, const std::wstring& input, bool lineEnded,
+        const ColorRun* runs = nullptr, size_t nRuns = 0)
     {
-        // try wrap inputted data and write passed data
+        static const wchar_t newLines[] = L"\n\n\n\n\n\n\n\n";
         DWORD dw;
-        // Erase text that was echoed from keyboard input
-        BOOL ret = EraseNPrevChars(m_inputBuffer.size());               
-        // Write passed data
-        ret = ret && WriteConsoleW(m_hOut, str, size, &dw, nullptr);
-        // Set color of input text
-        if(m_oldColor != -1)
-            ret = ret && SetConsoleColor(m_oldColor);    
-        // Write previously erased data immidiatly after passed data
-        ret = ret && WriteConsoleW(m_hOut, m_inputBuffer.c_str(), m_inputBuffer.size(), &dw, nullptr);  
-        return ret;
+        BOOL ret = TRUE;
+        for (const ScreenStep& step : plan)
+        {
+            CONSOLE_SCREEN_BUFFER_INFO csbi;
+            if (!ret || !GetConsoleScreenBufferInfo(m_hOut, &csbi))
+                return false;
+            COORD cursor = csbi.dwCursorPosition;
+            switch (step.kind)
+            {
+            case ScreenStep::InputStart:
+                if (lineEnded)
+                {
+                    // Cursor moved to next row right after a full row, line feed moved it once more
+                    cursor.Y -= static_cast<SHORT>((m_inputColumn + input.size()) / csbi.dwSize.X + 1);
+                    cursor.X = m_inputColumn;
+                }
+                else
+                {
+                    dw = cursor.X + cursor.Y * csbi.dwSize.X - static_cast<DWORD>(input.size());
+                    cursor.X = static_cast<SHORT>(dw % csbi.dwSize.X);
+                    cursor.Y = static_cast<SHORT>(dw / csbi.dwSize.X);
+                }
+                ret = SetConsoleCursorPosition(m_hOut, cursor);
+                break;
+            case ScreenStep::Up:
+                cursor.Y -= static_cast<SHORT>(step.n);
+                ret = SetConsoleCursorPosition(m_hOut, cursor);
+                break;
+            case ScreenStep::Down:
+                cursor.Y += static_cast<SHORT>(step.n);
+                ret = SetConsoleCursorPosition(m_hOut, cursor);
+                break;
+            case ScreenStep::Column:
+                cursor.X = static_cast<SHORT>(step.n);
+                ret = SetConsoleCursorPosition(m_hOut, cursor);
+                break;
+            case ScreenStep::NewLines:
+                for (uint32_t n = step.n, nWrite; ret && n; n -= nWrite)
+                {
+                    nWrite = (std::min)(n, static_cast<uint32_t>(_countof(newLines) - 1));
+                    ret = WriteConsoleW(m_hOut, newLines, nWrite, &dw, nullptr);
+                }
+                break;
+            case ScreenStep::InsertRows:
+            {
+                // Rows from cursor to the end of buffer move down, rows moved out of buffer are lost
+                SMALL_RECT rows = { 0, cursor.Y, static_cast<SHORT>(csbi.dwSize.X - 1), static_cast<SHORT>(csbi.dwSize.Y - 1) };
+                CHAR_INFO fill;
+                fill.Char.UnicodeChar = L' ';
+                fill.Attributes = m_fillColor;
+                ret = ScrollConsoleScreenBuffer(m_hOut, &rows, &rows, COORD{ 0, static_cast<SHORT>(cursor.Y + step.n) }, &fill);
+                break;
+            }
+            case ScreenStep::EraseDown:
+                ret = FillConsoleOutputCharacterW(m_hOut, L' ', step.n, cursor, &dw) &&
+                    FillConsoleOutputAttribute(m_hOut, m_fillColor, step.n, cursor, &dw);
+                break;
+            case ScreenStep::Text:
+                if (runs)
+                    ret = WriteRuns(step.text, step.n, runs, nRuns);
+                else
+                    ret = WriteConsoleW(m_hOut, step.text, step.n, &dw, nullptr);
+                break;
+            case ScreenStep::Input:
+            {
+                // Set color of input text
+                if (m_oldColor != NO_COLOR)
+                    ret = SetConsoleColor(m_oldColor);
+                if (!step.n)
+                    m_inputColumn = cursor.X;
+                size_t n = step.n ? step.n : input.size();
+                ret = ret && WriteConsoleW(m_hOut, input.c_str() + input.size() - n, static_cast<DWORD>(n), &dw, nullptr);
+                break;
+            }
+            }
+        }
+        return ret != FALSE;
+    }
+    // Runs are written in their text colors over current background
+    bool WriteRuns(const wchar_t* str, size_t size, const ColorRun* runs, size_t nRuns)
+    {
+        DWORD dw;
+        BOOL ret = TRUE;
+        for (size_t i = 0; ret && size && i < nRuns; ++i)
+        {
+            size_t n = (std::min)(runs[i].size, size);
+            uint8_t textColor = runs[i].textColor == Color::UseCurrent ? m_textColor : runs[i].textColor & Color::ColorMask;
+            ret = SetConsoleTextAttribute(m_hOut, MakeColor(textColor, m_bkColor)) &&
+                WriteConsoleW(m_hOut, str, static_cast<DWORD>(n), &dw, nullptr);
+            str += n;
+            size -= n;
+        }
+        return ret != FALSE;
+    }
+    // Handle is signaled by mouse, focus and key release events too, they are discarded
+    bool InputAvailable() const
+    {
+        INPUT_RECORD record;
+        DWORD n;
+        while (PeekConsoleInputW(m_hIn, &record, 1, &n) && n)
+        {
+            if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown && record.Event.KeyEvent.uChar.UnicodeChar)
+                return true;
+            ReadConsoleInputW(m_hIn, &record, 1, &n);
+        }
+        return false;
     }
+    // Echoes read character, returns true when it ends the line
+    bool InputChar(wchar_t ch);
+    // Ended line is moved to str
+    void EndLine(std::wstring& str);
     // Change color of console entire background
     bool RedrawBackGround();
     // Set text and text BkGnd
@@ -346,28 +562,16 @@ private:
         return (c | (c >> BK_COLOR_SHIFT)) & 0x00FF;
     }
 
-    MutexLock GetWriteLock() const
-    {
-        return MutexLock(m_writeMtx.get());
-    }
-    MutexLock GetReadLock() const
-    {
-        return MutexLock(m_readMtx.get());
-    }
-    RWLock GetRWLock() const
-    {
-        return { GetReadLock(), GetWriteLock() };
-    }
 
 
 private:
-    std::unique_ptr<Mutex> m_writeMtx;
-    std::unique_ptr<Mutex> m_readMtx;   
     HANDLE m_hOut;
     HANDLE m_hIn;
     HANDLE m_hErr;
     std::wstring m_inputBuffer;
-    uint32_t m_flags;
+    std::wstring m_lastInput;
+    uint16_t m_inputColumn;         // where echo of input or of last input line starts
+    mutable bool m_lastInputShown;  // nothing was written after last input line
     union
     {
         struct
@@ -383,10 +587,8 @@ private:
 };
 
 
-Console::Impl::Impl(bool multithreaded)
+Console::Impl::Impl(bool multithreaded) : ConsoleLocks(multithreaded)
 {
-    SetMultiThreaded(multithreaded);
-
     m_hOut = GetStdHandle(STD_OUTPUT_HANDLE);
     m_hIn = GetStdHandle(STD_INPUT_HANDLE);
     m_hErr = GetStdHandle(STD_ERROR_HANDLE);
@@ -396,7 +598,9 @@ Console::Impl::Impl(bool multithreaded)
     m_textColor = static_cast<Color>(csbi.wAttributes & Color::ColorMask);
     m_bkColor = static_cast<Color>((csbi.wAttributes >> BK_COLOR_SHIFT) & Color::ColorMask);
     m_fillColor = m_bkColor | (m_bkColor << BK_COLOR_SHIFT);
-    m_oldColor = m_textColor;
+    m_oldColor = NO_COLOR;
+    m_inputColumn = 0;
+    m_lastInputShown = false;
 
     DWORD dw;
     GetConsoleMode(m_hIn, &dw);
@@ -404,22 +608,6 @@ Console::Impl::Impl(bool multithreaded)
     SetConsoleMode(m_hIn, dw);
 }
 
-bool Console::Impl::ReadLine(char * buff, size_t buffSize)
-{
-    if (!buff || buffSize == 0)
-        return false;
-    *buff = '\0';
-
-    std::string tmpStr;
-    auto ret = ReadLine(tmpStr);
-    if (ret)
-    {
-        size_t nCharsToWrite = (std::min)(buffSize - 1, tmpStr.size());
-        memcpy(buff, tmpStr.c_str(), nCharsToWrite);
-        buff[nCharsToWrite] = '\0';
-    }
-    return ret;
-}
 bool Console::Impl::ReadLine(std::string & str)
 {
     str.clear();
@@ -459,57 +647,69 @@ bool Console::Impl::ReadLine(std::string & str)
     } while (1);
     return true;
 }
-bool Console::Impl::ReadLine(wchar_t * buff, size_t buffSize)
+bool Console::Impl::ReadLine(std::wstring & str)
 {
-    if (!buff || buffSize == 0)
-        return false;
-    *buff = L'\0';
-
-    std::wstring tmpStr;
-    auto ret = ReadLine(tmpStr);
-    if (ret)
+    str.clear();
+    auto rlk = GetReadLock(LOCK_SITE);
+    wchar_t ch = 0;
+    do
     {
-        size_t nCharsToWrite = (std::min)(buffSize - 1, tmpStr.size());
-        wmemcpy(buff, tmpStr.c_str(), nCharsToWrite);
-        buff[nCharsToWrite] = L'\0';
-    }
-    return ret;
+        if (!ReadChar(ch))
+            return false;
+    } while (!InputChar(ch));
+
+    EndLine(str);
+    return true;
 }
-bool Console::Impl::ReadLine(std::wstring & str)
+bool Console::Impl::TryReadLine(std::wstring& str, bool& lineRead)
 {
     str.clear();
-    auto rlk = GetReadLock();
-    DWORD dw = 0;
+    lineRead = false;
+    auto rlk = GetReadLock(LOCK_SITE);
     wchar_t ch = 0;
-    while (true)
+    while (!lineRead && InputAvailable())
     {
         if (!ReadChar(ch))
             return false;
-        if (ch == L'\b')
+        lineRead = InputChar(ch);
+    }
+    if (lineRead)
+        EndLine(str);
+    return true;
+}
+bool Console::Impl::InputChar(wchar_t ch)
+{
+    if (ch == L'\b')
+    {
+        if (!m_inputBuffer.empty())
         {
-            if (!m_inputBuffer.empty())
-            {
-                m_inputBuffer.pop_back();
-                auto wlk = GetWriteLock();
-                EraseNPrevChars(1);
-            }
-            continue;
+            m_inputBuffer.pop_back();
+            auto wlk = GetWriteLock(LOCK_SITE);
+            EraseNPrevChars(1);
         }
-
-        m_inputBuffer.push_back(ch);
-
-        // echo char
-        auto wlk = GetWriteLock();
-        WriteConsoleW(m_hOut, &ch, 1, &dw, nullptr);
-
-        if (ch == L'\n')
-            break;
+        return false;
     }
 
+    // echo char
+    auto wlk = GetWriteLock(LOCK_SITE);
+    DWORD dw = 0;
+    if (m_inputBuffer.empty())
+        m_inputColumn = LOWORD(GetPos());
+    m_inputBuffer.push_back(ch);
+    m_lastInputShown = false;
+    WriteConsoleW(m_hOut, &ch, 1, &dw, nullptr);
+    return ch == L'\n';
+}
+void Console::Impl::EndLine(std::wstring& str)
+{
     m_inputBuffer.pop_back();
 
+    // Kept until something else is written, so the line can be replaced
+    auto wlk = GetWriteLock(LOCK_SITE);
+    m_lastInput = m_inputBuffer;
+    m_lastInputShown = true;
     str = std::move(m_inputBuffer);
-    return true;
+    m_inputBuffer.clear();
 }
 
 bool Console::Impl::Write(const char * str, size_t nChars)
@@ -517,32 +717,38 @@ bool Console::Impl::Write(const char * str, size_t nChars)
     if (!nChars)
         return true;
 
-    // First convert to wchat_t
-    std::unique_ptr<wchar_t[]> buff(new (std::nothrow) wchar_t[nChars]());
-    if (!buff)
-        return false;
+    // First convert to wchar_t, short strings on stack, long ones in reused buffer of the thread
+    wchar_t stackBuff[DEF_FORMAT_BUFFER_SIZE];
+    wchar_t* buff = stackBuff;
+    if (nChars > _countof(stackBuff))
+    {
+        thread_local std::wstring threadBuff;
+        if (threadBuff.size() < nChars)
+            threadBuff.resize(nChars);
+        buff = &threadBuff[0];
+    }
     auto n = ::MultiByteToWideChar(
         this->GetConsoleOutputCP(),
         0, 
         str,
         nChars, 
-        buff.get(), 
+        buff, 
         nChars);
     if (!n)
         return false;
 
-    return Write(buff.get(), n);
+    return Write(buff, n);
 }
 bool Console::Impl::Write(const char* str, size_t nChars, Color textColor, Color bkColor)
 {
-    auto lk = GetWriteLock();
+    auto lk = GetWriteLock(LOCK_SITE);
     m_oldColor = m_currColor;
     bool ret = true;
     ret = SetColor(textColor, bkColor, false);
     ret = ret && Write(str, nChars);
     ret = ret && SetConsoleColor(m_oldColor);
     m_currColor = m_oldColor;
-    m_oldColor = -1;
+    m_oldColor = NO_COLOR;
     return ret;
 }
 bool Console::Impl::Write(const wchar_t * str, size_t nChars)
@@ -550,8 +756,9 @@ bool Console::Impl::Write(const wchar_t * str, size_t nChars)
     if (!nChars)
         return true;
 
-    auto lk = GetWriteLock();
+    auto lk = GetWriteLock(LOCK_SITE);
 
+    m_lastInputShown = false;
     if (!m_inputBuffer.empty())
         return WriteWithInputWrap(str, nChars);
     else
@@ -562,20 +769,56 @@ bool Console::Impl::Write(const wchar_t * str, size_t nChars)
 }
 bool Console::Impl::Write(const wchar_t* str, size_t nChars, Color textColor, Color bkColor)
 {
-    auto lk = GetWriteLock();
+    auto lk = GetWriteLock(LOCK_SITE);
     m_oldColor = m_currColor;
     bool ret = true;
     ret = SetColor(textColor, bkColor, false);
     ret = ret && Write(str, nChars);
     ret = ret && SetConsoleColor(m_oldColor);
     m_currColor = m_oldColor;
-    m_oldColor = -1;
+    m_oldColor = NO_COLOR;
+    return ret;
+}
+bool Console::Impl::Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns)
+{
+    if (!nChars)
+        return true;
+
+    auto lk = GetWriteLock(LOCK_SITE);
+    m_lastInputShown = false;
+    m_oldColor = m_currColor;
+    bool ret = m_inputBuffer.empty() ? WriteRuns(str, nChars, runs, nRuns) : WriteWithInputWrap(str, nChars, runs, nRuns);
+    ret = SetConsoleColor(m_oldColor) && ret;
+    m_oldColor = NO_COLOR;
+    return ret;
+}
+bool Console::Impl::ReplaceLastInput(const wchar_t* str, size_t nChars, Color textColor)
+{
+    auto lk = GetWriteLock(LOCK_SITE);
+    if (!m_lastInputShown)
+        return Write(str, nChars, textColor, Color::UseCurrent);
+
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(m_hOut, &csbi))
+        return false;
+    ScreenPlan plan(csbi.dwSize.X, csbi.srWindow.Bottom - csbi.srWindow.Top + 1, true);
+    plan.ReplaceLine(m_lastInput.c_str(), m_lastInput.size(), m_inputColumn, str, nChars);
+    m_lastInputShown = false;
+
+    m_oldColor = m_currColor;
+    bool ret = true;
+    ret = SetColor(textColor, Color::UseCurrent, false);
+    ret = ret && RenderPlan(plan, m_lastInput, true);
+    ret = ret && SetConsoleColor(m_oldColor);
+    m_currColor = m_oldColor;
+    m_oldColor = NO_COLOR;
     return ret;
 }
 
 bool Console::Impl::EraseNPrevChars(uint32_t nChars) const
 {
-    auto wlk = GetWriteLock();
+    auto wlk = GetWriteLock(LOCK_SITE);
+    m_lastInputShown = false;
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     if (!GetConsoleScreenBufferInfo(m_hOut, &csbi))
         return false;
@@ -601,7 +844,7 @@ bool Console::Impl::EraseNPrevChars(uint32_t nChars) const
 }
 bool Console::Impl::RedrawBackGround()
 {
-    auto wlk = GetRWLock();
+    auto wlk = GetRWLock(LOCK_SITE);
 
     DWORD dw = 0;
     CONSOLE_SCREEN_BUFFER_INFO csbi;
@@ -637,14 +880,747 @@ bool Console::Impl::RedrawBackGround()
     return needToWrite == written;
 }
 
+#else
 
+// Console::Impl, POSIX terminal --------------------------------------------------------
 
+// Terminal is switched to non-canonical mode without echo, signals of Ctrl+C and output
+// processing stay enabled. Colors and cursor movement are ANSI escapes, output of every operation
+// is gathered in m_output and written with one write call. Cursor column is tracked from written text,
+// terminal size is queried again only after SIGWINCH.
+class Console::Impl : public ConsoleLocks
+{
+private:
+    static const uint16_t BK_COLOR_SHIFT = 4;
+    static const uint16_t NO_COLOR = 0xFFFF;
+    static const uint32_t UTF8_CP = 65001;
+    static const uint16_t DEFAULT_WIDTH = 80;
+    static const uint16_t DEFAULT_HEIGHT = 24;
 
+public:
+    Impl(bool multithreaded);
+    ~Impl();
 
-// Console ----------------------------------------------------------------------------------
-
-Console& Console::GetInstance()
-{
+    // Read operations
+    bool ReadChar(char& ch) const
+    {
+        auto rlk = GetReadLock(LOCK_SITE);
+        if (!ReadByte(ch))
+            return false;
+        if (ch == '\r')
+            ch = '\n';
+        return true;
+    }
+    bool ReadCharEcho(char& ch) const
+    {
+        if (!ReadChar(ch))
+            return false;
+        auto wlk = GetWriteLock(LOCK_SITE);
+        m_lastInputShown = false;
+        AppendText(&ch, 1);
+        return Flush();
+    }
+    // Decodes one UTF-8 sequence
+    bool ReadChar(wchar_t& ch) const
+    {
+        auto rlk = GetReadLock(LOCK_SITE);
+        char byte;
+        if (!ReadByte(byte))
+            return false;
+        uint32_t cp = static_cast<unsigned char>(byte);
+        int nTrail = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+        if (nTrail)
+            cp &= 0x3F >> nTrail;
+        for (; nTrail; --nTrail)
+        {
+            if (!ReadByte(byte))
+                return false;
+            cp = (cp << 6) | (static_cast<unsigned char>(byte) & 0x3F);
+        }
+        ch = static_cast<wchar_t>(cp);
+        if (ch == L'\r')
+            ch = L'\n';
+        return true;
+    }
+    bool ReadCharEcho(wchar_t& ch) const
+    {
+        if (!ReadChar(ch))
+            return false;
+        auto wlk = GetWriteLock(LOCK_SITE);
+        m_lastInputShown = false;
+        AppendText(&ch, 1);
+        return Flush();
+    }
+
+    bool ReadLine(std::string& str);
+    bool ReadLine(std::wstring& str);
+    bool TryReadLine(std::wstring& str, bool& lineRead);
+
+
+    // Write operations, narrow strings are UTF-8
+    bool Write(const char* str, size_t nChars);
+    bool Write(const char* str, size_t nChars, Color textColor, Color bkColor);
+
+    bool Write(const wchar_t* str, size_t nChars);
+    bool Write(const wchar_t* str, size_t nChars, Color textColor, Color bkColor);
+    bool Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns);
+    bool ReplaceLastInput(const wchar_t* str, size_t nChars, Color textColor);
+
+    bool EraseNPrevChars(uint32_t nChars) const;
+
+    // Color operations
+    Color GetTextColor() const
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        return m_textColor;
+    }
+    Color GetBackGroundColor() const
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        return m_bkColor;
+    }
+    Color GetConsoleFillColor() const
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        return static_cast<Color>(m_fillColor & Color::ColorMask);
+    }
+    bool SetTextColor(Color textColor)
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        if (textColor == Color::UseCurrent || (textColor & Color::ColorMask) == m_textColor)
+            return true;
+        m_textColor = static_cast<Color>(textColor & Color::ColorMask);
+        AppendColor(MakeColor(m_textColor, m_bkColor));
+        return Flush();
+    }
+    bool SetBkColor(Color bkColor, bool redrawBkGnd)
+    {
+        return SetColor(Color::UseCurrent, bkColor, redrawBkGnd);
+    }
+    // Terminal keeps colors of written cells, new background applies to following output
+    bool SetColor(Color textColor, Color bkColor, bool redrawBkGnd)
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        SelectColor(textColor, bkColor);
+        if (redrawBkGnd)
+            m_fillColor = m_bkColor;
+        AppendColor(MakeColor(m_textColor, m_bkColor));
+        return Flush();
+    }
+
+    // Code page operations, terminal text is UTF-8
+    uint32_t GetConsoleInputCP() const
+    {
+        return UTF8_CP;
+    }
+    uint32_t GetConsoleOutputCP() const
+    {
+        return UTF8_CP;
+    }
+    bool SetConsoleInputCP(uint32_t cp) const
+    {
+        return cp == UTF8_CP;
+    }
+    bool SetConsoleOutputCP(uint32_t cp) const
+    {
+        return cp == UTF8_CP;
+    }
+
+
+    // Other ops
+    bool SetPos(uint16_t x, uint16_t y)
+    {
+        auto wlk = GetWriteLock(LOCK_SITE);
+        UpdateSize();
+        m_lastInputShown = false;
+        AppendEscape(y + 1, x + 1, 'H');
+        m_column = (std::min)(x, m_width);
+        return Flush();
+    }
+    bool SetPosInd(uint32_t ind)
+    {
+        auto wlk = GetWriteLock(LOCK_SITE);
+        UpdateSize();
+        return SetPos(static_cast<uint16_t>(ind % m_width), static_cast<uint16_t>(ind / m_width));
+    }
+    // Row of the cursor isn't tracked, it is reported as 0
+    uint32_t GetPos() const
+    {
+        auto wlk = GetWriteLock(LOCK_SITE);
+        return m_column;
+    }
+    uint32_t GetPosInd() const
+    {
+        auto wlk = GetWriteLock(LOCK_SITE);
+        return m_column;
+    }
+    uint32_t GetConsoleSize() const
+    {
+        auto wlk = GetWriteLock(LOCK_SITE);
+        UpdateSize();
+        return m_width | (static_cast<uint32_t>(m_height) << 16);
+    }
+    intptr_t GetInputHandle() const
+    {
+        return m_in;
+    }
+
+private:
+    // Output of a write, when input is echoed passed text goes above it, see WriteWithInputWrap of Win32 console
+    void AppendWithInputWrap(const wchar_t* str, size_t size, const ColorRun* runs = nullptr, size_t nRuns = 0)
+    {
+        UpdateSize();
+        m_lastInputShown = false;
+        if (m_inputBuffer.empty())
+        {
+            if (runs)
+                AppendRuns(str, size, runs, nRuns);
+            else
+                AppendText(str, size);
+            return;
+        }
+        ScreenPlan plan(m_width, m_height);
+        plan.WriteAboveInput(str, size, m_inputColumn, m_inputBuffer.size());
+        AppendPlan(plan, m_inputBuffer, false, runs, nRuns);
+    }
+    // Output of append is written in passed colors, input keeps current colors
+    template <typename Fn>
+    bool WriteColored(Color textColor, Color bkColor, Fn append)
+    {
+        auto lk = GetWriteLock(LOCK_SITE);
+        m_oldColor = MakeColor(m_textColor, m_bkColor);
+        SelectColor(textColor, bkColor);
+        AppendColor(MakeColor(m_textColor, m_bkColor));
+        append();
+        m_textColor = static_cast<Color>(m_oldColor & Color::ColorMask);
+        m_bkColor = static_cast<Color>(m_oldColor >> BK_COLOR_SHIFT);
+        AppendColor(m_oldColor);
+        m_oldColor = NO_COLOR;
+        return Flush();
+    }
+    // Text of plan is written in colors of runs when they are passed
+    void AppendPlan(const ScreenPlan& plan, const std::wstring& input, bool lineEnded,
+        const ColorRun* runs = nullptr, size_t nRuns = 0)
+    {
+        for (const ScreenStep& step : plan)
+        {
+            switch (step.kind)
+            {
+            case ScreenStep::InputStart:
+            {
+                uint32_t nRows = plan.RowsToInputStart(m_inputColumn, input.size(), lineEnded);
+                if (nRows)
+                    AppendEscape(nRows, 'A');
+                AppendColumn(m_inputColumn);
+                break;
+            }
+            case ScreenStep::Up:
+                AppendEscape(step.n, 'A');
+                break;
+            case ScreenStep::Down:
+                AppendEscape(step.n, 'B');
+                break;
+            case ScreenStep::Column:
+                AppendColumn(step.n);
+                break;
+            case ScreenStep::NewLines:
+                m_output.append(step.n, '\n');
+                m_column = 0;
+                break;
+            case ScreenStep::InsertRows:
+                AppendEscape(step.n, 'L');
+                break;
+            case ScreenStep::EraseDown:
+                m_output += "\x1b[J";
+                break;
+            case ScreenStep::Text:
+                if (runs)
+                    AppendRuns(step.text, step.n, runs, nRuns);
+                else
+                    AppendText(step.text, step.n);
+                break;
+            case ScreenStep::Input:
+            {
+                // Input is echoed in its own color
+                if (m_oldColor != NO_COLOR)
+                    AppendColor(m_oldColor);
+                if (!step.n)
+                    m_inputColumn = m_column < m_width ? m_column : 0;
+                size_t n = step.n ? step.n : input.size();
+                AppendText(input.c_str() + input.size() - n, n);
+                break;
+            }
+            }
+        }
+    }
+    // Runs are written in their text colors over current background
+    void AppendRuns(const wchar_t* str, size_t size, const ColorRun* runs, size_t nRuns) const
+    {
+        for (size_t i = 0; size && i < nRuns; ++i)
+        {
+            size_t n = (std::min)(runs[i].size, size);
+            Color textColor = runs[i].textColor == Color::UseCurrent ? m_textColor :
+                static_cast<Color>(runs[i].textColor & Color::ColorMask);
+            AppendColor(MakeColor(textColor, m_bkColor));
+            AppendText(str, n);
+            str += n;
+            size -= n;
+        }
+    }
+    void AppendColumn(uint32_t column) const
+    {
+        m_output += '\r';
+        if (column)
+            AppendEscape(column, 'C');
+        m_column = static_cast<uint16_t>(column);
+    }
+
+    void AppendText(const char* str, size_t size) const
+    {
+        m_output.append(str, size);
+        for (const char* end = str + size; str != end; ++str)
+        {
+            // Continuation bytes of UTF-8 don't move cursor
+            if ((*str & 0xC0) != 0x80)
+                Advance(static_cast<unsigned char>(*str));
+        }
+    }
+    void AppendText(const wchar_t* str, size_t size) const
+    {
+        for (const wchar_t* end = str + size; str != end; ++str)
+        {
+            AppendUtf8(m_output, static_cast<uint32_t>(*str));
+            Advance(static_cast<uint32_t>(*str));
+        }
+    }
+    // Moves cursor back over nChars cells and erases everything after it
+    void AppendErase(uint32_t nChars) const
+    {
+        if (!nChars)
+            return;
+        int64_t ind = static_cast<int64_t>(m_column) - nChars;
+        int64_t nRowsUp = ind < 0 ? (m_width - 1 - ind) / m_width : 0;
+        m_column = static_cast<uint16_t>(ind + nRowsUp * m_width);
+        m_output += '\r';
+        if (nRowsUp)
+            AppendEscape(static_cast<uint32_t>(nRowsUp), 'A');
+        if (m_column)
+            AppendEscape(m_column, 'C');
+        m_output += "\x1b[J";
+    }
+    // Default colors of terminal are kept for colors the console started with
+    void AppendColor(uint16_t color) const
+    {
+        if (!m_ansiColors || color == m_shownColor)
+            return;
+        m_shownColor = color;
+        Color textColor = static_cast<Color>(color & Color::ColorMask);
+        Color bkColor = static_cast<Color>(color >> BK_COLOR_SHIFT);
+        AppendEscape(textColor == m_defaultTextColor ? 39 : AnsiColor(textColor),
+            bkColor == m_defaultBkColor ? 49 : AnsiColor(bkColor) + 10, 'm');
+    }
+    void AppendEscape(uint32_t n, char command) const
+    {
+        char buff[16];
+        int len = snprintf(buff, sizeof(buff), "\x1b[%u%c", n, command);
+        m_output.append(buff, len);
+    }
+    void AppendEscape(uint32_t n1, uint32_t n2, char command) const
+    {
+        char buff[24];
+        int len = snprintf(buff, sizeof(buff), "\x1b[%u;%u%c", n1, n2, command);
+        m_output.append(buff, len);
+    }
+    // Short text is decoded into stackBuff, long text into reused buffer of the thread, size becomes number of characters
+    static const wchar_t* DecodeUtf8(const char* str, size_t& size, wchar_t* stackBuff, size_t stackSize)
+    {
+        wchar_t* buff = stackBuff;
+        if (size > stackSize)
+        {
+            thread_local std::wstring threadBuff;
+            if (threadBuff.size() < size)
+                threadBuff.resize(size);
+            buff = &threadBuff[0];
+        }
+        size_t n = 0;
+        for (const char* end = str + size; str != end; ++n)
+        {
+            uint32_t cp = static_cast<unsigned char>(*str++);
+            int nTrail = cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 0;
+            if (nTrail)
+                cp &= 0x3F >> nTrail;
+            for (; nTrail && str != end && (*str & 0xC0) == 0x80; --nTrail)
+                cp = (cp << 6) | (static_cast<unsigned char>(*str++) & 0x3F);
+            buff[n] = static_cast<wchar_t>(cp);
+        }
+        size = n;
+        return buff;
+    }
+    static void AppendUtf8(std::string& str, uint32_t cp)
+    {
+        if (cp < 0x80)
+            str += static_cast<char>(cp);
+        else if (cp < 0x800)
+        {
+            str += static_cast<char>(0xC0 | (cp >> 6));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            str += static_cast<char>(0xE0 | (cp >> 12));
+            str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            str += static_cast<char>(0xF0 | (cp >> 18));
+            str += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            str += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            str += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+    // Writes gathered output
+    bool Flush() const
+    {
+        const char* data = m_output.data();
+        size_t size = m_output.size();
+        bool ret = true;
+        while (size)
+        {
+            ssize_t n = write(m_out, data, size);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ret = false;
+                break;
+            }
+            data += n;
+            size -= n;
+        }
+        m_output.clear();
+        return ret;
+    }
+
+    // Cursor stays after the last column until next character wraps it
+    void Advance(uint32_t ch) const
+    {
+        if (ch == '\n' || ch == '\r')
+            m_column = 0;
+        else if (ch == '\b')
+            m_column -= m_column ? 1 : 0;
+        else if (ch == '\t')
+            m_column = (std::min)(static_cast<uint16_t>((m_column / 8 + 1) * 8), m_width);
+        else if (ch >= 0x20)
+        {
+            if (m_column >= m_width)
+                m_column = 0;
+            ++m_column;
+        }
+    }
+    void UpdateSize() const
+    {
+        if (!s_resized.exchange(false))
+            return;
+        winsize ws;
+        if (ioctl(m_out, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row)
+        {
+            m_width = ws.ws_col;
+            m_height = ws.ws_row;
+        }
+    }
+    bool InputAvailable() const
+    {
+        pollfd fd = { m_in, POLLIN, 0 };
+        int n;
+        while ((n = poll(&fd, 1, 0)) < 0 && errno == EINTR);
+        return n > 0;
+    }
+    // Echoes read character, returns true when it ends the line
+    bool InputChar(wchar_t ch);
+    // Ended line is moved to str
+    void EndLine(std::wstring& str);
+    bool ReadByte(char& ch) const
+    {
+        while (true)
+        {
+            ssize_t n = read(m_in, &ch, 1);
+            if (n == 1)
+                return true;
+            if (n == 0 || errno != EINTR)
+                return false;
+        }
+    }
+    void SelectColor(Color textColor, Color bkColor)
+    {
+        if (textColor != Color::UseCurrent)
+            m_textColor = static_cast<Color>(textColor & Color::ColorMask);
+        if (bkColor != Color::UseCurrent)
+            m_bkColor = static_cast<Color>(bkColor & Color::ColorMask);
+    }
+    static uint16_t MakeColor(Color textColor, Color bkColor)
+    {
+        return textColor | (bkColor << BK_COLOR_SHIFT);
+    }
+    // Console colors are Win32 attributes of blue, green, red and intensity bits
+    static uint32_t AnsiColor(Color color)
+    {
+        uint32_t rgb = (color & Color::Darkred ? 1 : 0) | (color & Color::Darkgreen ? 2 : 0) |
+            (color & Color::Darkblue ? 4 : 0);
+        return (color & Color::Gray ? 90 : 30) + rgb;
+    }
+
+    static void OnResize(int)
+    {
+        s_resized = true;
+    }
+    // Restores terminal and lets default action of the signal end the process
+    static void OnTerminate(int sig)
+    {
+        static const char reset[] = "\x1b[0m";
+        tcsetattr(STDIN_FILENO, TCSANOW, &s_savedMode);
+        (void)write(STDOUT_FILENO, reset, sizeof(reset) - 1);
+        raise(sig);
+    }
+
+private:
+    static std::atomic<bool> s_resized;
+    static termios s_savedMode;
+
+    int m_in;
+    int m_out;
+    bool m_rawMode;
+    bool m_ansiColors;
+    std::wstring m_inputBuffer;
+    std::wstring m_lastInput;
+    uint16_t m_inputColumn;         // where echo of input or of last input line starts
+    mutable bool m_lastInputShown;  // nothing was written after last input line
+    mutable std::string m_output;
+    mutable uint16_t m_column;
+    mutable uint16_t m_width;
+    mutable uint16_t m_height;
+    Color m_textColor;
+    Color m_bkColor;
+    Color m_defaultTextColor;
+    Color m_defaultBkColor;
+    uint16_t m_fillColor;
+    uint16_t m_oldColor;
+    mutable uint16_t m_shownColor;
+};
+
+std::atomic<bool> Console::Impl::s_resized(true);
+termios Console::Impl::s_savedMode;
+
+
+Console::Impl::Impl(bool multithreaded)
+    : ConsoleLocks(multithreaded),
+    m_in(STDIN_FILENO),
+    m_out(STDOUT_FILENO),
+    m_rawMode(false),
+    m_ansiColors(isatty(STDOUT_FILENO)),
+    m_inputColumn(0),
+    m_lastInputShown(false),
+    m_column(0),
+    m_width(DEFAULT_WIDTH),
+    m_height(DEFAULT_HEIGHT),
+    m_textColor(Color::Darkgray),
+    m_bkColor(Color::Black),
+    m_defaultTextColor(m_textColor),
+    m_defaultBkColor(m_bkColor),
+    m_fillColor(m_bkColor),
+    m_oldColor(NO_COLOR),
+    m_shownColor(MakeColor(m_textColor, m_bkColor))
+{
+    struct sigaction action = {};
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = &OnResize;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &action, nullptr);
+
+    if (!isatty(m_in) || tcgetattr(m_in, &s_savedMode) != 0)
+        return;
+    termios mode = s_savedMode;
+    mode.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    mode.c_iflag &= ~(ICRNL | IXON);
+    mode.c_cc[VMIN] = 1;
+    mode.c_cc[VTIME] = 0;
+    m_rawMode = tcsetattr(m_in, TCSAFLUSH, &mode) == 0;
+    if (!m_rawMode)
+        return;
+
+    action.sa_handler = &OnTerminate;
+    action.sa_flags = SA_RESETHAND;
+    for (int sig : { SIGINT, SIGTERM, SIGHUP, SIGQUIT })
+        sigaction(sig, &action, nullptr);
+}
+Console::Impl::~Impl()
+{
+    AppendColor(MakeColor(m_defaultTextColor, m_defaultBkColor));
+    Flush();
+    if (m_rawMode)
+        tcsetattr(m_in, TCSAFLUSH, &s_savedMode);
+}
+
+bool Console::Impl::ReadLine(std::string& str)
+{
+    str.clear();
+
+    std::wstring tmpStr;
+    if (!ReadLine(tmpStr))
+        return false;
+    for (wchar_t ch : tmpStr)
+        AppendUtf8(str, static_cast<uint32_t>(ch));
+    return true;
+}
+bool Console::Impl::ReadLine(std::wstring& str)
+{
+    str.clear();
+    auto rlk = GetReadLock(LOCK_SITE);
+    wchar_t ch = 0;
+    do
+    {
+        if (!ReadChar(ch))
+            return false;
+    } while (!InputChar(ch));
+
+    EndLine(str);
+    return true;
+}
+bool Console::Impl::TryReadLine(std::wstring& str, bool& lineRead)
+{
+    str.clear();
+    lineRead = false;
+    auto rlk = GetReadLock(LOCK_SITE);
+    wchar_t ch = 0;
+    while (!lineRead && InputAvailable())
+    {
+        if (!ReadChar(ch))
+            return false;
+        lineRead = InputChar(ch);
+    }
+    if (lineRead)
+        EndLine(str);
+    return true;
+}
+bool Console::Impl::InputChar(wchar_t ch)
+{
+    // Terminal sends DEL for backspace
+    if (ch == L'\b' || ch == 0x7F)
+    {
+        if (!m_inputBuffer.empty())
+        {
+            m_inputBuffer.pop_back();
+            EraseNPrevChars(1);
+        }
+        return false;
+    }
+    // Skip escape sequences of arrows and function keys, terminal sends them at once
+    if (ch == 0x1B)
+    {
+        if (ReadChar(ch) && ch == L'[')
+            while (ReadChar(ch) && (ch < 0x40 || ch > 0x7E));
+        return false;
+    }
+
+    // echo char
+    auto wlk = GetWriteLock(LOCK_SITE);
+    if (m_inputBuffer.empty())
+    {
+        UpdateSize();
+        m_inputColumn = m_column < m_width ? m_column : 0;
+    }
+    m_inputBuffer.push_back(ch);
+    m_lastInputShown = false;
+    AppendText(&ch, 1);
+    Flush();
+    return ch == L'\n';
+}
+void Console::Impl::EndLine(std::wstring& str)
+{
+    m_inputBuffer.pop_back();
+
+    // Kept until something else is written, so the line can be replaced
+    auto wlk = GetWriteLock(LOCK_SITE);
+    m_lastInput = m_inputBuffer;
+    m_lastInputShown = true;
+    str = std::move(m_inputBuffer);
+    m_inputBuffer.clear();
+}
+
+bool Console::Impl::Write(const char* str, size_t nChars)
+{
+    wchar_t stackBuff[DEF_FORMAT_BUFFER_SIZE];
+    const wchar_t* buff = DecodeUtf8(str, nChars, stackBuff, sizeof(stackBuff) / sizeof(stackBuff[0]));
+    return Write(buff, nChars);
+}
+bool Console::Impl::Write(const char* str, size_t nChars, Color textColor, Color bkColor)
+{
+    wchar_t stackBuff[DEF_FORMAT_BUFFER_SIZE];
+    const wchar_t* buff = DecodeUtf8(str, nChars, stackBuff, sizeof(stackBuff) / sizeof(stackBuff[0]));
+    return Write(buff, nChars, textColor, bkColor);
+}
+bool Console::Impl::Write(const wchar_t* str, size_t nChars)
+{
+    if (!nChars)
+        return true;
+
+    auto lk = GetWriteLock(LOCK_SITE);
+    AppendWithInputWrap(str, nChars);
+    return Flush();
+}
+bool Console::Impl::Write(const wchar_t* str, size_t nChars, Color textColor, Color bkColor)
+{
+    return WriteColored(textColor, bkColor, [this, str, nChars]
+    {
+        if (nChars)
+            AppendWithInputWrap(str, nChars);
+    });
+}
+bool Console::Impl::Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns)
+{
+    return WriteColored(Color::UseCurrent, Color::UseCurrent, [this, str, nChars, runs, nRuns]
+    {
+        if (nChars)
+            AppendWithInputWrap(str, nChars, runs, nRuns);
+    });
+}
+bool Console::Impl::ReplaceLastInput(const wchar_t* str, size_t nChars, Color textColor)
+{
+    return WriteColored(textColor, Color::UseCurrent, [this, str, nChars]
+    {
+        if (!m_lastInputShown)
+        {
+            if (nChars)
+                AppendWithInputWrap(str, nChars);
+            return;
+        }
+        UpdateSize();
+        ScreenPlan plan(m_width, m_height);
+        plan.ReplaceLine(m_lastInput.c_str(), m_lastInput.size(), m_inputColumn, str, nChars);
+        AppendPlan(plan, m_lastInput, true);
+        m_lastInputShown = false;
+    });
+}
+
+bool Console::Impl::EraseNPrevChars(uint32_t nChars) const
+{
+    auto wlk = GetWriteLock(LOCK_SITE);
+    UpdateSize();
+    m_lastInputShown = false;
+    AppendErase(nChars);
+    return Flush();
+}
+
+#endif // _WIN32
+
+
+
+
+
+// Console ----------------------------------------------------------------------------------
+
+Console& Console::GetInstance()
+{
     static Console instance;
     return instance;
 }
@@ -675,7 +1651,19 @@ bool Console::ReadCharEcho(wchar_t & ch) const
 
 bool Console::ReadLine(char* buff, size_t buffSize)
 {
-    return m_impl->ReadLine(buff, buffSize);
+    if (!buff || buffSize == 0)
+        return false;
+    *buff = '\0';
+
+    std::string tmpStr;
+    auto ret = m_impl->ReadLine(tmpStr);
+    if (ret)
+    {
+        size_t nCharsToWrite = (std::min)(buffSize - 1, tmpStr.size());
+        memcpy(buff, tmpStr.c_str(), nCharsToWrite);
+        buff[nCharsToWrite] = '\0';
+    }
+    return ret;
 }
 bool Console::ReadLine(std::string& str)
 {
@@ -683,12 +1671,32 @@ bool Console::ReadLine(std::string& str)
 }
 bool Console::ReadLine(wchar_t* buff, size_t buffSize)
 {
-    return m_impl->ReadLine(buff, buffSize);
+    if (!buff || buffSize == 0)
+        return false;
+    *buff = L'\0';
+
+    std::wstring tmpStr;
+    auto ret = m_impl->ReadLine(tmpStr);
+    if (ret)
+    {
+        size_t nCharsToWrite = (std::min)(buffSize - 1, tmpStr.size());
+        wmemcpy(buff, tmpStr.c_str(), nCharsToWrite);
+        buff[nCharsToWrite] = L'\0';
+    }
+    return ret;
 }
 bool Console::ReadLine(std::wstring & str)
 {
     return m_impl->ReadLine(str);
 }
+bool Console::TryReadLine(std::wstring& str, bool& lineRead)
+{
+    return m_impl->TryReadLine(str, lineRead);
+}
+intptr_t Console::GetInputHandle() const
+{
+    return m_impl->GetInputHandle();
+}
 
 bool Console::Write(const char* str, size_t nChars)
 {
@@ -706,6 +1714,15 @@ bool Console::Write(const wchar_t* str, size_t nChars, Color textColor, Color bk
 {
     return m_impl->Write(str, nChars, textColor, bkColor);
 }
+bool Console::Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns)
+{
+    return m_impl->Write(str, nChars, runs, nRuns);
+}
+
+bool Console::ReplaceLastInput(const std::wstring& str, Color textColor)
+{
+    return m_impl->ReplaceLastInput(str.c_str(), str.size(), textColor);
+}
 
 bool Console::EraseChars(uint32_t nChars)
 {
@@ -3,6 +3,7 @@
 
 #include <sstream>
 #include <memory>
+#include "Format.h"
 
 class Console
 {
@@ -30,6 +31,12 @@ public:
         ColorMask       = 0x0F,
         UseCurrent      = 0x10,
     };
+    // Part of text written in its own color
+    struct ColorRun
+    {
+        size_t size;
+        Color textColor;
+    };
 
     static Console& GetInstance();
 
@@ -50,6 +57,12 @@ public:
     bool ReadLine(std::string& str);
     bool ReadLine(wchar_t* buff, size_t buffSize);
     bool ReadLine(std::wstring& str);
+    // Reads only characters that are already available, returns false on read error.
+    // lineRead is set when the line is ended and moved to str, otherwise characters stay in
+    // echoed input and reading continues with next call, so input can be polled by an event loop.
+    bool TryReadLine(std::wstring& str, bool& lineRead);
+    // Console input to wait for with other events: HANDLE on Windows, file descriptor elsewhere
+    intptr_t GetInputHandle() const;
 
     // Write operations
     bool Write(const char* str)
@@ -93,7 +106,31 @@ public:
     {
         return Write(str.c_str(), str.size(), textColor, bkColor);
     }
+    // Runs cover nChars of str, text of all runs is written as one output
+    bool Write(const wchar_t* str, size_t nChars, const ColorRun* runs, size_t nRuns);
 
+    // Formatted output without heap allocation, "{}" in format is replaced by next argument
+    template <typename... Args>
+    bool Print(const wchar_t* format, const Args&... args)
+    {
+        return Print(UseCurrent, format, args...);
+    }
+    template <typename... Args>
+    bool Print(Color textColor, const wchar_t* format, const Args&... args)
+    {
+        PrintContext context = { this, textColor, true };
+        StackFormatBuffer<> buffer;
+        buffer.SetFlush(&FlushPrintBuffer, &context);
+        LockWrite();
+        buffer.Format(format, args...);
+        buffer.Flush();
+        UnlockWrite();
+        return context.ok;
+    }
+
+    // Replaces line last read by ReadLine with str, only changed cells are written.
+    // If anything was written after the line, str is written like Write does.
+    bool ReplaceLastInput(const std::wstring& str, Color textColor = UseCurrent);
     bool EraseChars(uint32_t nChars);
 
     // Color operations
@@ -127,69 +164,102 @@ public:
     void UnlockWrite() const;
     void LockRead() const;
     void UnlockRead() const;
+private:
+    struct PrintContext
+    {
+        Console* console;
+        Color textColor;
+        bool ok;
+    };
+    static void FlushPrintBuffer(void* context, const wchar_t* str, size_t size)
+    {
+        auto print = static_cast<PrintContext*>(context);
+        bool ok = print->textColor == UseCurrent ? print->console->Write(str, size) :
+            print->console->Write(str, size, print->textColor);
+        print->ok = print->ok && ok;
+    }
+
 private:
     class Impl;
     std::unique_ptr<Impl> m_impl;
 };
 
 
+// Formats output of chained operator << into stack buffer and writes it when destroyed.
+// Output longer than the buffer is written in parts under console write lock.
 class ConsoleProxy
 {
 public:
-    ConsoleProxy(ConsoleProxy&&) = default;
-    ConsoleProxy& operator = (ConsoleProxy&&) = default;
-    ConsoleProxy(Console& con) : console(&con)
+    ConsoleProxy& operator = (ConsoleProxy&&) = delete;
+    ConsoleProxy(ConsoleProxy&& proxy) : console(proxy.console), locked(proxy.locked)
     {
+        buffer.Append(proxy.buffer.Data(), proxy.buffer.Size());
+        buffer.SetFlush(&FlushBuffer, this);
+        proxy.buffer.Clear();
+        proxy.console = nullptr;
+        proxy.locked = false;
+    }
+    ConsoleProxy(Console& con) : console(&con), locked(false)
+    {
+        buffer.SetFlush(&FlushBuffer, this);
     }
     ~ConsoleProxy()
     {
-        Flush();
+        try
+        {
+            buffer.Flush();
+        }
+        catch (...)
+        {
+
+        }
+        if (locked)
+            console->UnlockWrite();
     }
 
     template<typename T>
     ConsoleProxy& operator << (const T& var)
     {
-        wss << var;
+        buffer << var;
         return *this;
     }
     template<typename T>
     ConsoleProxy& operator >> (T& var)
     {
-        std::wstring tmp = wss.str();
-        if (!tmp.empty())
-            console->Write(tmp);
+        buffer.Flush();
+        if (locked)
+        {
+            console->UnlockWrite();
+            locked = false;
+        }
 
+        std::wstring tmp;
         console->ReadLine(tmp);
-
-        Reset(tmp);
+        std::wistringstream wss(tmp);
         wss >> var;
-        Reset(L""s);
 
         return *this;
     }
 
 private:
-    void Flush() const
+    static void FlushBuffer(void* context, const wchar_t* str, size_t size)
     {
-        try
-        {
-            auto wstr = wss.str();
-            if(!wstr.empty())
-                console->Write(wstr);
-        }
-        catch (...)
+        auto proxy = static_cast<ConsoleProxy*>(context);
+        if (!proxy->console)
+            return;
+        // Keep parts of one output together
+        if (!proxy->locked)
         {
-
+            proxy->console->LockWrite();
+            proxy->locked = true;
         }
+        proxy->console->Write(str, size);
     }
-    void Reset(const std::wstring& str)
-    {
-        wss.str(str);
-        wss.clear();
-    }
+
 private:
-    std::wstringstream wss;
+    StackFormatBuffer<> buffer;
     Console* console;
+    bool locked;
 };
 
 template <typename T>
@@ -0,0 +1,195 @@
+#ifndef _CONSOLE_SCREEN_H_
+#define _CONSOLE_SCREEN_H_
+
+#include <cinttypes>
+#include <cstddef>
+
+// Model of console rows that hold echoed input.
+// Plan translates an update of these rows into a short sequence of cursor movements and text,
+// console implementations render the steps. Rows are laid out like terminals do:
+// after the last column of a row the cursor stays on the row until the next character wraps it,
+// with eager wrap, as in Win32 console, cursor moves to the next row at once.
+
+struct ScreenStep
+{
+    enum Kind : uint8_t
+    {
+        InputStart,     // cursor to first cell of echoed input or of last input line
+        Up,             // n rows up, column is kept
+        Down,           // n rows down, column is kept
+        Column,         // cursor to column n of its row
+        NewLines,       // n line feeds, screen scrolls at the bottom
+        InsertRows,     // n blank rows at cursor row, rows below move down
+        EraseDown,      // from cursor to the end of screen, n cells had content
+        Text,           // n characters of text
+        Input,          // echo n last characters of input, whole input starting at cursor when n is 0
+    };
+
+    Kind kind;
+    uint32_t n;
+    const wchar_t* text;
+};
+
+class ScreenPlan
+{
+public:
+    static const size_t MAX_STEPS = 16;
+
+    ScreenPlan(const ScreenPlan&) = delete;
+    ScreenPlan& operator = (const ScreenPlan&) = delete;
+
+    ScreenPlan(uint16_t width, uint16_t height, bool eagerWrap = false) noexcept
+        : m_width(width ? width : 1), m_height(height), m_eagerWrap(eagerWrap), m_nSteps(0) {}
+
+    const ScreenStep* begin() const noexcept { return m_steps; }
+    const ScreenStep* end() const noexcept { return m_steps + m_nSteps; }
+
+    // Rows above the cursor to the first row of input of inputSize characters starting at inputColumn,
+    // cursor is right after the input or at the start of next row when lineEnded
+    uint32_t RowsToInputStart(uint16_t inputColumn, size_t inputSize, bool lineEnded) const noexcept
+    {
+        size_t nCells = inputColumn + inputSize;
+        uint32_t nRows = nCells ? static_cast<uint32_t>((nCells - 1) / m_width) : 0;
+        return lineEnded ? nRows + 1 : nRows;
+    }
+
+    // str is written while input is echoed, input moves below str.
+    // When input starts a row and str is whole lines that fit on screen with input, input rows move down
+    // by inserted rows and only str is written, otherwise input is erased and echoed again after str.
+    void WriteAboveInput(const wchar_t* str, size_t size, uint16_t inputColumn, size_t inputSize) noexcept
+    {
+        uint32_t nRows;
+        uint32_t lastRow = RowsToInputStart(inputColumn, inputSize, false);
+        if (inputColumn == 0 && inputSize && CountLines(str, size, nRows) && nRows + lastRow < m_height)
+        {
+            // Make room below input first, so screen scrolls when input is at the bottom
+            Add(ScreenStep::InputStart);
+            Add(ScreenStep::Down, lastRow);
+            Add(ScreenStep::NewLines, nRows);
+            Add(ScreenStep::Up, nRows + lastRow);
+            Add(ScreenStep::InsertRows, nRows);
+            Add(ScreenStep::Text, static_cast<uint32_t>(size), str);
+            Add(ScreenStep::Down, lastRow);
+            MoveAfter(inputSize, lastRow);
+        }
+        else
+        {
+            Add(ScreenStep::InputStart);
+            Add(ScreenStep::EraseDown, static_cast<uint32_t>(inputSize));
+            Add(ScreenStep::Text, static_cast<uint32_t>(size), str);
+            Add(ScreenStep::Input);
+        }
+    }
+
+    // Line of oldSize characters starting at column and ended by line feed is replaced by str.
+    // Common prefix is kept, cells of the old line past the end of str are erased.
+    void ReplaceLine(const wchar_t* oldLine, size_t oldSize, uint16_t column, const wchar_t* str, size_t size) noexcept
+    {
+        Add(ScreenStep::InputStart);
+        if (!IsLine(str, size))
+        {
+            Add(ScreenStep::EraseDown, static_cast<uint32_t>(oldSize));
+            Add(ScreenStep::Text, static_cast<uint32_t>(size), str);
+            return;
+        }
+
+        size_t newSize = size - 1;
+        size_t nSame = 0;
+        while (nSame < newSize && nSame < oldSize && str[nSame] == oldLine[nSame])
+            ++nSame;
+        if (nSame)
+        {
+            size_t cell = column + nSame;
+            Add(ScreenStep::Down, static_cast<uint32_t>(cell / m_width));
+            Add(ScreenStep::Column, static_cast<uint32_t>(cell % m_width));
+        }
+        Add(ScreenStep::Text, static_cast<uint32_t>(newSize - nSame), str + nSame);
+        if (newSize >= oldSize)
+            Add(ScreenStep::NewLines, 1);
+        // Cursor after the last column would erase the last character
+        else if (!m_eagerWrap && newSize > nSame && (column + newSize) % m_width == 0)
+        {
+            Add(ScreenStep::NewLines, 1);
+            Add(ScreenStep::EraseDown, static_cast<uint32_t>(oldSize - newSize));
+        }
+        else
+        {
+            Add(ScreenStep::EraseDown, static_cast<uint32_t>(oldSize - newSize));
+            Add(ScreenStep::NewLines, 1);
+        }
+    }
+
+private:
+    // str is one line of printable characters ended by line feed
+    static bool IsLine(const wchar_t* str, size_t size) noexcept
+    {
+        if (!size || str[size - 1] != L'\n')
+            return false;
+        for (const wchar_t* end = str + size - 1; str != end; ++str)
+        {
+            if (static_cast<uint32_t>(*str) < 0x20 || *str == 0x7F)
+                return false;
+        }
+        return true;
+    }
+    // Number of rows taken by str if it is whole lines of printable characters
+    bool CountLines(const wchar_t* str, size_t size, uint32_t& nRows) const noexcept
+    {
+        if (!size || str[size - 1] != L'\n')
+            return false;
+        uint32_t column = 0;
+        nRows = 0;
+        for (const wchar_t* end = str + size; str != end; ++str)
+        {
+            if (*str == L'\n')
+            {
+                nRows += m_eagerWrap && column == m_width ? 2 : 1;
+                column = 0;
+            }
+            else if (static_cast<uint32_t>(*str) < 0x20 || *str == 0x7F)
+                return false;
+            else
+            {
+                if (column == m_width)
+                {
+                    ++nRows;
+                    column = 0;
+                }
+                ++column;
+            }
+        }
+        return true;
+    }
+
+    // Cursor from column 0 of last row of input starting at column 0 to the cell after it
+    void MoveAfter(size_t inputSize, uint32_t lastRow) noexcept
+    {
+        uint32_t column = static_cast<uint32_t>(inputSize - size_t(lastRow) * m_width);
+        if (column < m_width)
+            Add(ScreenStep::Column, column);
+        else
+        {
+            // Cursor after the last column is restored by writing the last character again
+            Add(ScreenStep::Column, m_width - 1u);
+            Add(ScreenStep::Input, 1);
+        }
+    }
+
+    void Add(ScreenStep::Kind kind, uint32_t n = 0, const wchar_t* text = nullptr) noexcept
+    {
+        bool isMove = kind == ScreenStep::Up || kind == ScreenStep::Down || kind == ScreenStep::NewLines ||
+            kind == ScreenStep::InsertRows || kind == ScreenStep::Text;
+        if ((isMove && n == 0) || m_nSteps == MAX_STEPS)
+            return;
+        m_steps[m_nSteps++] = { kind, n, text };
+    }
+
+private:
+    uint16_t m_width;
+    uint16_t m_height;
+    bool m_eagerWrap;
+    size_t m_nSteps;
+    ScreenStep m_steps[MAX_STEPS];
+};
+
+#endif // !_CONSOLE_SCREEN_H_
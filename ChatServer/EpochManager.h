@@ -0,0 +1,179 @@
+#ifndef _EPOCH_MANAGER_H_
+#define _EPOCH_MANAGER_H_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <cinttypes>
+
+// Epoch based reclamation.
+// Readers enter current epoch without locks and read shared objects until they leave it.
+// Writers replace shared objects and retire old ones, retired object is deleted
+// after global epoch advanced twice, when no reader can see it anymore.
+// Epoch advances only when no reader stays in the previous one, so readers never wait
+// and slow readers only delay deletion.
+class EpochManager
+{
+public:
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator = (const EpochManager&) = delete;
+
+    EpochManager() noexcept : m_epoch(0) {}
+    ~EpochManager()
+    {
+        // No readers are possible at this point
+        for (auto& retired : m_retired)
+            retired.deleter(retired.ptr);
+    }
+
+    // Returns epoch that must be passed to Leave
+    uint64_t Enter() noexcept
+    {
+        Stripe& stripe = m_stripes[GetStripeIndex()];
+        for (;;)
+        {
+            uint64_t epoch = m_epoch.load();
+            stripe.readers[epoch & 1].fetch_add(1);
+            // Epoch could advance before reader was counted, then reader must join the new one
+            if (m_epoch.load() == epoch)
+                return epoch;
+            stripe.readers[epoch & 1].fetch_sub(1);
+        }
+    }
+    void Leave(uint64_t epoch) noexcept
+    {
+        m_stripes[GetStripeIndex()].readers[epoch & 1].fetch_sub(1);
+    }
+
+    // Deletes object when readers that could get it leave their epochs.
+    // Object must be unreachable for new readers.
+    template <typename T>
+    void Retire(T* ptr) noexcept
+    {
+        if (!ptr)
+            return;
+        std::unique_lock<std::mutex> lk(m_retireMtx);
+        try
+        {
+            m_retired.push_back({ ptr, &Delete<T>, m_epoch.load() });
+        }
+        catch (std::exception&)
+        {
+            // Can't defer deletion, wait until current readers leave
+            uint64_t retireEpoch = m_epoch.load();
+            while (m_epoch.load() < retireEpoch + 2)
+            {
+                if (!TryAdvance())
+                    std::this_thread::yield();
+            }
+            delete ptr;
+        }
+        ReclaimRetired();
+    }
+    // Deletes retired objects that aren't visible to readers anymore
+    void Reclaim() noexcept
+    {
+        std::unique_lock<std::mutex> lk(m_retireMtx);
+        ReclaimRetired();
+    }
+
+    uint64_t GetEpoch() const noexcept
+    {
+        return m_epoch.load();
+    }
+    size_t GetRetiredCount() noexcept
+    {
+        std::unique_lock<std::mutex> lk(m_retireMtx);
+        return m_retired.size();
+    }
+
+private:
+    static constexpr uint32_t STRIPE_COUNT = 32;
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    // Readers are counted in stripes to keep them from contending on one cache line
+    struct Stripe
+    {
+        std::atomic<uint32_t> readers[2] = {};  // by parity of epoch
+        char padding[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>) * 2];
+    };
+
+    struct RetiredObject
+    {
+        const void* ptr;
+        void (*deleter)(const void*);
+        uint64_t epoch;
+    };
+
+    template <typename T>
+    static void Delete(const void* ptr)
+    {
+        delete static_cast<const T*>(ptr);
+    }
+
+    static uint32_t GetStripeIndex() noexcept
+    {
+        static std::atomic<uint32_t> nextIndex(0);
+        static thread_local uint32_t index = nextIndex++ % STRIPE_COUNT;
+        return index;
+    }
+
+    // Epoch e may become e + 1 when readers of epoch e - 1 have left
+    bool TryAdvance() noexcept
+    {
+        uint64_t epoch = m_epoch.load();
+        for (const auto& stripe : m_stripes)
+        {
+            if (stripe.readers[(epoch + 1) & 1].load())
+                return false;
+        }
+        return m_epoch.compare_exchange_strong(epoch, epoch + 1);
+    }
+
+    // Must be called with locked m_retireMtx
+    void ReclaimRetired() noexcept
+    {
+        if (m_retired.empty())
+            return;
+        // Objects retired in epoch e are unreachable since epoch e + 2
+        for (int i = 0; i < 2 && TryAdvance(); ++i) {}
+
+        uint64_t epoch = m_epoch.load();
+        auto it = m_retired.begin();
+        for (; it != m_retired.end() && it->epoch + 2 <= epoch; ++it)
+            it->deleter(it->ptr);
+        m_retired.erase(m_retired.begin(), it);
+    }
+
+private:
+    Stripe m_stripes[STRIPE_COUNT];
+    std::atomic<uint64_t> m_epoch;
+    std::mutex m_retireMtx;
+    std::vector<RetiredObject> m_retired; // ordered by epoch
+};
+
+// Keeps reader in epoch while in scope
+class EpochGuard
+{
+public:
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator = (const EpochGuard&) = delete;
+
+    explicit EpochGuard(EpochManager& manager) noexcept
+        : m_manager(manager),
+        m_epoch(manager.Enter())
+    {
+    }
+    ~EpochGuard()
+    {
+        m_manager.Leave(m_epoch);
+    }
+
+private:
+    EpochManager& m_manager;
+    uint64_t m_epoch;
+};
+
+#endif // !_EPOCH_MANAGER_H_
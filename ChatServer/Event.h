@@ -2,9 +2,13 @@
 #define _EVENT_H_
 
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include "Futex.h"
 
-class Event
+// Event on mutex and condition variable
+class PortableEvent
 {
 public:
     typedef std::unique_lock<std::mutex> MutexLock;
@@ -16,14 +20,14 @@ public:
         bool signalType = false;
     };
 
-    Event(bool manualReset = false, bool initialState = false) 
+    PortableEvent(bool manualReset = false, bool initialState = false) 
         : manualReset(manualReset),
         signalData(new SignalData()),
         nWaits(0)
     {
         signalData->state = initialState;
     }
-    ~Event() { delete signalData; }
+    ~PortableEvent() { delete signalData; }
 
     void Signal(bool bAll = false)
     {
@@ -95,6 +99,129 @@ private:
     bool manualReset;
 };
 
+#ifdef __linux__
+
+// Event on single futex word without allocations.
+// Word holds signaled state, number of waiting threads and number of them allowed to leave,
+// up to 32767 threads can wait at once.
+class FutexEvent
+{
+public:
+    typedef std::unique_lock<std::mutex> MutexLock;
+
+    FutexEvent(bool manualReset = false, bool initialState = false)
+        : manualReset(manualReset),
+        word(initialState ? STATE : 0)
+    {
+    }
+
+    void Signal(bool bAll = false)
+    {
+        uint32_t v = word.load();
+        uint32_t newV;
+        uint32_t nWake;
+        do
+        {
+            uint32_t nWaits = Waiters(v) - Tokens(v);  // waiters not signaled yet
+            nWake = 0;
+            if (manualReset)
+            {
+                newV = (v & ~TOKEN_MASK) | (Waiters(v) << TOKEN_SHIFT) | STATE;
+                nWake = nWaits;
+            }
+            else if (nWaits != 0)
+            {
+                nWake = bAll ? nWaits : 1;
+                newV = v + nWake * TOKEN;
+            }
+            else  // leave notified
+                newV = v | STATE;
+        } while (!word.compare_exchange_weak(v, newV));
+
+        if (nWake == 1)
+            Futex::Wake(word, 1);
+        else if (nWake)
+            Futex::WakeAll(word);
+    }
+    void Reset()
+    {
+        word &= ~STATE;
+    }
+
+    void Wait()
+    {
+        Wait((std::chrono::milliseconds::max)());
+    }
+    template<class _Rep, class _Period>
+    bool Wait(std::chrono::duration<_Rep, _Period> timeout)
+    {
+        typedef std::chrono::steady_clock Clock;
+        bool infinite = timeout == (timeout.max)();
+        auto deadline = infinite ? Clock::time_point() : Clock::now() + timeout;
+
+        uint32_t v = word.load();
+        for (;;)
+        {
+            if (v & STATE)
+            {
+                if (manualReset || word.compare_exchange_weak(v, v & ~STATE))
+                    return true;
+            }
+            else if (word.compare_exchange_weak(v, v + WAITER))
+                break;
+        }
+
+        for (;;)
+        {
+            v = word.load();
+            while (Tokens(v))
+            {
+                if (word.compare_exchange_weak(v, v - TOKEN - WAITER))
+                    return true;
+            }
+            auto left = infinite ? (std::chrono::nanoseconds::max)() :
+                std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now());
+            if (!Futex::Wait(word, v, left))
+                break;
+        }
+
+        // Timed out, but signal could come before waiter is removed
+        v = word.load();
+        for (;;)
+        {
+            if (Tokens(v))
+            {
+                if (word.compare_exchange_weak(v, v - TOKEN - WAITER))
+                    return true;
+            }
+            else if (word.compare_exchange_weak(v, v - WAITER))
+                return false;
+        }
+    }
+
+private:
+    static constexpr uint32_t STATE = 1;
+    static constexpr uint32_t TOKEN_SHIFT = 1;
+    static constexpr uint32_t TOKEN = 1 << TOKEN_SHIFT;
+    static constexpr uint32_t TOKEN_MASK = 0x7FFF << TOKEN_SHIFT;
+    static constexpr uint32_t WAITER_SHIFT = 16;
+    static constexpr uint32_t WAITER = 1 << WAITER_SHIFT;
+
+    static uint32_t Tokens(uint32_t v) { return (v & TOKEN_MASK) >> TOKEN_SHIFT; }
+    static uint32_t Waiters(uint32_t v) { return v >> WAITER_SHIFT; }
+
+private:
+    bool manualReset;
+    std::atomic<uint32_t> word;  // [waiters:16][signaled waiters:15][state:1]
+};
+
+#endif // __linux__
+
+#ifdef CHAT_USE_FUTEX
+typedef FutexEvent Event;
+#else
+typedef PortableEvent Event;
+#endif
 
 #endif // !_EVENT_H_
 
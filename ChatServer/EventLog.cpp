@@ -0,0 +1,160 @@
+#include "EventLog.h"
+#include "MappedFile.h"
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+std::atomic<bool> EventLog::s_open(false);
+
+// Memory mapped file and registered call sites
+class EventLog::Impl : public MappedFile
+{
+public:
+    struct RegisteredSite
+    {
+        EventSite* site;
+        const EventLogFormat::ArgType* types;
+        size_t nArgs;
+    };
+
+    std::mutex& GetRegisterMutex() noexcept { return m_registerMtx; }
+    uint16_t NextId() noexcept { return m_nextId == UINT16_MAX ? 0 : ++m_nextId; }
+    // Sites keep their ids, so they are defined again in every opened file
+    std::vector<RegisteredSite>& GetSites() noexcept { return m_sites; }
+
+private:
+    std::mutex m_registerMtx;
+    std::vector<RegisteredSite> m_sites;
+    uint16_t m_nextId = EventLogFormat::DEFINITION_ID;
+};
+
+EventLog::EventLog()
+    : m_base(nullptr),
+    m_size(0),
+    m_offset(0),
+    m_nDropped(0),
+    m_impl(new Impl)
+{
+}
+EventLog::~EventLog()
+{
+    Close();
+}
+
+EventLog& EventLog::GetInstance()
+{
+    static EventLog instance;
+    return instance;
+}
+
+// Keeps log of the previous run as path.1, older one is removed
+static void RotateFile(const char* path)
+{
+    std::string previous = std::string(path) + ".1";
+    std::remove(previous.c_str());
+    std::rename(path, previous.c_str());
+}
+
+bool EventLog::Open(const char* path, uint64_t size)
+{
+    using namespace EventLogFormat;
+
+    Close();
+    if (size < sizeof(FileHeader))
+        return false;
+    RotateFile(path);
+    m_base = m_impl->Map(path, size);
+    if (!m_base)
+        return false;
+
+    FileHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.headerSize = sizeof(FileHeader);
+    header.fileSize = size;
+    header.startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(m_base, &header, sizeof(header));
+
+    m_size = size;
+    m_offset = sizeof(FileHeader);
+    m_nDropped = 0;
+    {
+        std::unique_lock<std::mutex> lk(m_impl->GetRegisterMutex());
+        for (const auto& registered : m_impl->GetSites())
+            WriteDefinition(*registered.site, registered.site->id, registered.types, registered.nArgs);
+    }
+    s_open = true;
+    return true;
+}
+
+void EventLog::Close()
+{
+    using namespace EventLogFormat;
+
+    if (!m_base)
+        return;
+    s_open = false;
+    uint64_t end = m_offset < m_size ? m_offset.load() : m_size;
+    uint64_t nDropped = m_nDropped;
+    memcpy(m_base + offsetof(FileHeader, endOffset), &end, sizeof(end));
+    memcpy(m_base + offsetof(FileHeader, nDropped), &nDropped, sizeof(nDropped));
+    m_impl->Unmap(end);
+    m_base = nullptr;
+    m_size = 0;
+}
+
+uint16_t EventLog::Register(EventSite& site, const EventLogFormat::ArgType* types, size_t nArgs) noexcept
+{
+    std::unique_lock<std::mutex> lk(m_impl->GetRegisterMutex());
+    uint16_t id = site.id.load(std::memory_order_relaxed);
+    if (id)
+        return id;
+    id = m_impl->NextId();
+    if (!id)
+        return 0;
+    try
+    {
+        m_impl->GetSites().push_back({ &site, types, nArgs });
+    }
+    catch (...)
+    {
+        return 0;
+    }
+    WriteDefinition(site, id, types, nArgs);
+    // Definition precedes records of the site in file
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+void EventLog::WriteDefinition(const EventSite& site, uint16_t id, const EventLogFormat::ArgType* types, size_t nArgs) noexcept
+{
+    using namespace EventLogFormat;
+
+    uint16_t fileLength = static_cast<uint16_t>(strlen(site.file));
+    uint16_t formatLength = static_cast<uint16_t>(strlen(site.format));
+    size_t size = sizeof(RecordHeader) + sizeof(id) + sizeof(uint8_t) + nArgs + sizeof(site.line) +
+        sizeof(fileLength) + fileLength + sizeof(formatLength) + formatLength;
+    char* record = Reserve(size);
+    if (!record)
+        return;
+    char* pIt = record + sizeof(RecordHeader);
+    uint8_t nArgs8 = static_cast<uint8_t>(nArgs);
+    memcpy(pIt, &id, sizeof(id));
+    pIt += sizeof(id);
+    memcpy(pIt, &nArgs8, sizeof(nArgs8));
+    pIt += sizeof(nArgs8);
+    memcpy(pIt, types, nArgs);
+    pIt += nArgs;
+    memcpy(pIt, &site.line, sizeof(site.line));
+    pIt += sizeof(site.line);
+    memcpy(pIt, &fileLength, sizeof(fileLength));
+    pIt += sizeof(fileLength);
+    memcpy(pIt, site.file, fileLength);
+    pIt += fileLength;
+    memcpy(pIt, &formatLength, sizeof(formatLength));
+    pIt += sizeof(formatLength);
+    memcpy(pIt, site.format, formatLength);
+    Commit(record, DEFINITION_ID);
+}
@@ -0,0 +1,215 @@
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <cwchar>
+#include <type_traits>
+#include <initializer_list>
+#include "EventLogFormat.h"
+
+#ifndef DEF_EVENT_LOG_FILE
+#define DEF_EVENT_LOG_FILE "ChatServer.events"
+#endif
+
+#ifndef DEF_EVENT_LOG_SIZE
+#define DEF_EVENT_LOG_SIZE (64ull << 20) // bytes, events are dropped when file is full
+#endif
+
+// Binary structured event log.
+// Each call site is registered once with its format and argument types, after that
+// the site writes only its id, time and raw arguments into memory mapped file.
+// Use ChatEventDecoder to render the file as text or JSON.
+
+// Call site of an event, defined by EVENT_LOG
+struct EventSite
+{
+    constexpr EventSite(const char* format, const char* file, uint32_t line) noexcept
+        : format(format), file(file), line(line), id(0) {}
+
+    const char* format;
+    const char* file;
+    uint32_t line;
+    std::atomic<uint16_t> id;   // 0 - not registered yet
+};
+
+// Arguments aren't evaluated if log isn't open
+#define EVENT_LOG(format, ...) \
+    do { if (EventLog::IsOpen()) { static EventSite site(format, __FILE__, __LINE__); \
+        EventLog::GetInstance().Write(site, __VA_ARGS__); } } while (false)
+
+template <typename T, typename = void>
+struct EventArgTraits;
+
+template <typename T>
+struct EventArgTraits<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type>
+{
+    static constexpr EventLogFormat::ArgType type = EventLogFormat::I64;
+    static size_t Size(T) noexcept { return sizeof(int64_t); }
+    static char* Write(char* pIt, T value) noexcept
+    {
+        int64_t v = value;
+        memcpy(pIt, &v, sizeof(v));
+        return pIt + sizeof(v);
+    }
+};
+template <typename T>
+struct EventArgTraits<T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type>
+{
+    static constexpr EventLogFormat::ArgType type = EventLogFormat::U64;
+    static size_t Size(T) noexcept { return sizeof(uint64_t); }
+    static char* Write(char* pIt, T value) noexcept
+    {
+        uint64_t v = value;
+        memcpy(pIt, &v, sizeof(v));
+        return pIt + sizeof(v);
+    }
+};
+template <typename T>
+struct EventArgTraits<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static constexpr EventLogFormat::ArgType type = EventLogFormat::F64;
+    static size_t Size(T) noexcept { return sizeof(double); }
+    static char* Write(char* pIt, T value) noexcept
+    {
+        double v = value;
+        memcpy(pIt, &v, sizeof(v));
+        return pIt + sizeof(v);
+    }
+};
+// Strings are written as UTF-16, wchar_t is UTF-16 on Windows, elsewhere characters out of BMP are cut
+struct EventStringArg
+{
+    static constexpr EventLogFormat::ArgType type = EventLogFormat::Str;
+    static size_t Size(const wchar_t*, size_t length) noexcept
+    {
+        return sizeof(uint16_t) + Truncate(length) * sizeof(char16_t);
+    }
+    static char* Write(char* pIt, const wchar_t* str, size_t length) noexcept
+    {
+        uint16_t length16 = static_cast<uint16_t>(Truncate(length));
+        memcpy(pIt, &length16, sizeof(length16));
+        pIt += sizeof(length16);
+        for (size_t i = 0; i < length16; ++i, pIt += sizeof(char16_t))
+        {
+            char16_t ch = static_cast<char16_t>(str[i]);
+            memcpy(pIt, &ch, sizeof(ch));
+        }
+        return pIt;
+    }
+    static size_t Truncate(size_t length) noexcept
+    {
+        return length < EventLogFormat::MAX_STRING_SIZE ? length : EventLogFormat::MAX_STRING_SIZE;
+    }
+};
+template <>
+struct EventArgTraits<std::wstring> : EventStringArg
+{
+    static size_t Size(const std::wstring& str) noexcept { return EventStringArg::Size(str.c_str(), str.size()); }
+    static char* Write(char* pIt, const std::wstring& str) noexcept { return EventStringArg::Write(pIt, str.c_str(), str.size()); }
+};
+template <>
+struct EventArgTraits<const wchar_t*> : EventStringArg
+{
+    static size_t Size(const wchar_t* str) noexcept { return EventStringArg::Size(str, wcslen(str)); }
+    static char* Write(char* pIt, const wchar_t* str) noexcept { return EventStringArg::Write(pIt, str, wcslen(str)); }
+};
+template <>
+struct EventArgTraits<wchar_t*> : EventArgTraits<const wchar_t*> {};
+template <size_t N>
+struct EventArgTraits<wchar_t[N]> : EventArgTraits<const wchar_t*> {};
+
+class EventLog
+{
+private:
+    EventLog();
+public:
+    static EventLog& GetInstance();
+
+    EventLog(const EventLog&) = delete;
+    EventLog& operator = (const EventLog&) = delete;
+
+    ~EventLog();
+
+    // Creates file of given size, existing file is renamed to path.1 replacing the older one
+    bool Open(const char* path, uint64_t size = DEF_EVENT_LOG_SIZE);
+    // Writes end of log to file header and unmaps it, no thread may write events at that time
+    void Close();
+
+    static bool IsOpen() noexcept
+    {
+        return s_open.load(std::memory_order_relaxed);
+    }
+
+    template <typename... Args>
+    void Write(EventSite& site, const Args&... args) noexcept
+    {
+        uint16_t id = site.id.load(std::memory_order_acquire);
+        if (!id)
+        {
+            static const EventLogFormat::ArgType types[] = { EventArgTraits<Args>::type... };
+            id = Register(site, types, sizeof...(Args));
+            if (!id)
+                return;
+        }
+        size_t size = sizeof(EventLogFormat::RecordHeader);
+        (void)std::initializer_list<int>{ 0, (size += EventArgTraits<Args>::Size(args), 0)... };
+        char* record = Reserve(size);
+        if (!record)
+            return;
+        char* pIt = record + sizeof(EventLogFormat::RecordHeader);
+        (void)std::initializer_list<int>{ 0, (pIt = EventArgTraits<Args>::Write(pIt, args), 0)... };
+        Commit(record, id);
+    }
+
+    uint64_t GetDroppedCount() const noexcept
+    {
+        return m_nDropped;
+    }
+
+private:
+    // Returns space for record of size bytes with size field set, nullptr if log is full
+    char* Reserve(size_t size) noexcept
+    {
+        size = (size + EventLogFormat::RECORD_ALIGNMENT - 1) & ~(EventLogFormat::RECORD_ALIGNMENT - 1);
+        uint64_t offset = m_offset.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size > m_size)
+        {
+            m_nDropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        char* record = m_base + offset;
+        uint16_t size16 = static_cast<uint16_t>(size);
+        memcpy(record + offsetof(EventLogFormat::RecordHeader, size), &size16, sizeof(size16));
+        return record;
+    }
+    void Commit(char* record, uint16_t id) noexcept
+    {
+        uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        memcpy(record + offsetof(EventLogFormat::RecordHeader, eventId), &id, sizeof(id));
+        memcpy(record + offsetof(EventLogFormat::RecordHeader, time), &time, sizeof(time));
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(record + offsetof(EventLogFormat::RecordHeader, committed), &EventLogFormat::COMMITTED, sizeof(uint32_t));
+    }
+    // Assigns id to site and writes its definition, returns 0 if there are no free ids
+    uint16_t Register(EventSite& site, const EventLogFormat::ArgType* types, size_t nArgs) noexcept;
+    void WriteDefinition(const EventSite& site, uint16_t id, const EventLogFormat::ArgType* types, size_t nArgs) noexcept;
+
+private:
+    static std::atomic<bool> s_open;
+
+    char* m_base;
+    uint64_t m_size;
+    std::atomic<uint64_t> m_offset;
+    std::atomic<uint64_t> m_nDropped;
+
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_EVENT_LOG_H_
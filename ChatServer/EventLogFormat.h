@@ -0,0 +1,60 @@
+#ifndef _EVENT_LOG_FORMAT_H_
+#define _EVENT_LOG_FORMAT_H_
+
+#include <cinttypes>
+#include <cstddef>
+
+// Layout of binary event log file, shared by EventLog and the decoder.
+//
+// File starts with FileHeader followed by records aligned to RECORD_ALIGNMENT.
+// Every record starts with RecordHeader. Records with DEFINITION_ID describe a call site:
+//   uint16_t eventId, uint8_t nArgs, ArgType[nArgs], uint32_t line,
+//   file and format as uint16_t length and UTF-8 characters.
+// Other records carry arguments of the event in order of definition:
+//   U64, I64 and F64 as 8 bytes, Str as uint16_t length and UTF-16 characters.
+// Format names arguments in braces, "Client {session} connected", names are used as JSON keys.
+// All values are little endian.
+
+namespace EventLogFormat
+{
+
+constexpr char MAGIC[8] = { 'C', 'H', 'A', 'T', 'E', 'V', 'T', 'S' };
+constexpr uint32_t VERSION = 1;
+constexpr uint16_t DEFINITION_ID = 0;
+constexpr uint32_t COMMITTED = 0x54494D43;  // record is completely written
+constexpr size_t RECORD_ALIGNMENT = 8;
+constexpr size_t MAX_STRING_SIZE = 256;   // longer strings are truncated
+
+enum ArgType : uint8_t
+{
+    U64,
+    I64,
+    F64,
+    Str,
+};
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    uint64_t startTime;     // ns since system clock epoch
+    uint64_t endOffset;     // written when log is closed, 0 if writer didn't close it
+    uint64_t nDropped;      // records that didn't fit, written when log is closed
+};
+
+struct RecordHeader
+{
+    uint16_t size;          // with header and padding, 0 - no more records
+    uint16_t eventId;
+    uint32_t committed;
+    uint64_t time;          // ns since system clock epoch
+};
+
+static_assert(sizeof(FileHeader) % RECORD_ALIGNMENT == 0, "FileHeader must keep records aligned");
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must be packed");
+
+} // namespace EventLogFormat
+
+#endif // !_EVENT_LOG_FORMAT_H_
@@ -0,0 +1,217 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <string>
+#include <cstring>
+#include <cwchar>
+#include <cstdio>
+#include <type_traits>
+
+#ifndef DEF_FORMAT_BUFFER_SIZE
+#define DEF_FORMAT_BUFFER_SIZE 512 // characters formatted on stack before flush or truncation
+#endif
+
+// Formatting of text into fixed buffer without heap allocation.
+// "{}" in format is replaced by next argument, "{{" and "}}" are literal braces.
+// When buffer is full its content is passed to flush function if it is set, otherwise the rest is truncated.
+class FormatBuffer
+{
+public:
+    typedef void (*FlushFn)(void* context, const wchar_t* str, size_t size);
+
+    FormatBuffer(const FormatBuffer&) = delete;
+    FormatBuffer& operator = (const FormatBuffer&) = delete;
+
+    FormatBuffer(wchar_t* storage, size_t capacity) noexcept
+        : m_data(storage), m_capacity(capacity), m_size(0), m_truncated(false), m_flush(nullptr), m_context(nullptr) {}
+
+    void SetFlush(FlushFn flush, void* context) noexcept
+    {
+        m_flush = flush;
+        m_context = context;
+    }
+
+    const wchar_t* Data() const noexcept { return m_data; }
+    size_t Size() const noexcept { return m_size; }
+    bool Empty() const noexcept { return m_size == 0; }
+    bool IsTruncated() const noexcept { return m_truncated; }
+    void Clear() noexcept
+    {
+        m_size = 0;
+        m_truncated = false;
+    }
+    // Passes content to flush function
+    void Flush()
+    {
+        if (m_flush && m_size)
+            m_flush(m_context, m_data, m_size);
+        m_size = 0;
+    }
+
+    template <typename... Args>
+    FormatBuffer& Format(const wchar_t* format, const Args&... args)
+    {
+        const Arg argList[] = { MakeArg(args)..., Arg() };
+        return FormatArgs(format, argList, sizeof...(Args));
+    }
+
+    FormatBuffer& Append(const wchar_t* str, size_t size)
+    {
+        while (size)
+        {
+            if (m_size == m_capacity && !Overflow())
+                return *this;
+            size_t n = size < m_capacity - m_size ? size : m_capacity - m_size;
+            wmemcpy(m_data + m_size, str, n);
+            m_size += n;
+            str += n;
+            size -= n;
+        }
+        return *this;
+    }
+    FormatBuffer& Append(wchar_t ch)
+    {
+        if (m_size < m_capacity || Overflow())
+            m_data[m_size++] = ch;
+        return *this;
+    }
+    FormatBuffer& Append(const wchar_t* str) { return Append(str, wcslen(str)); }
+    FormatBuffer& Append(const std::wstring& str) { return Append(str.c_str(), str.size()); }
+    // Narrow strings are expected to be ASCII
+    FormatBuffer& Append(const char* str)
+    {
+        for (; *str; ++str)
+            Append(static_cast<wchar_t>(static_cast<unsigned char>(*str)));
+        return *this;
+    }
+    FormatBuffer& Append(const std::string& str) { return Append(str.c_str()); }
+    FormatBuffer& Append(bool value) { return Append(value ? L"true" : L"false"); }
+    FormatBuffer& Append(double value)
+    {
+        wchar_t buff[32];
+        int n = swprintf(buff, sizeof(buff) / sizeof(buff[0]), L"%g", value);
+        return Append(buff, n > 0 ? n : 0);
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+        !std::is_same<T, wchar_t>::value && !std::is_same<T, char>::value, FormatBuffer&>::type
+        Append(T value)
+    {
+        typedef typename std::make_unsigned<T>::type Unsigned;
+        wchar_t buff[24];
+        wchar_t* pIt = buff + sizeof(buff) / sizeof(buff[0]);
+        bool negative = value < 0;
+        Unsigned u = negative ? Unsigned(0) - static_cast<Unsigned>(value) : static_cast<Unsigned>(value);
+        do
+        {
+            *--pIt = static_cast<wchar_t>(L'0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (negative)
+            *--pIt = L'-';
+        return Append(pIt, buff + sizeof(buff) / sizeof(buff[0]) - pIt);
+    }
+    FormatBuffer& Append(char ch) { return Append(static_cast<wchar_t>(static_cast<unsigned char>(ch))); }
+
+    template <typename T>
+    FormatBuffer& operator << (const T& value)
+    {
+        return Append(value);
+    }
+
+private:
+    // Type erased argument
+    struct Arg
+    {
+        void (*append)(FormatBuffer& buffer, const void* value);
+        const void* value;
+    };
+
+    template <typename T>
+    static void AppendArg(FormatBuffer& buffer, const void* value)
+    {
+        buffer.Append(*static_cast<const T*>(value));
+    }
+    template <typename T>
+    static Arg MakeArg(const T& value) noexcept
+    {
+        return { &AppendArg<T>, &value };
+    }
+    // String literals are passed by address of the first character
+    static void AppendWideString(FormatBuffer& buffer, const void* value)
+    {
+        buffer.Append(static_cast<const wchar_t*>(value));
+    }
+    static void AppendString(FormatBuffer& buffer, const void* value)
+    {
+        buffer.Append(static_cast<const char*>(value));
+    }
+    template <size_t N>
+    static Arg MakeArg(const wchar_t (&value)[N]) noexcept
+    {
+        return { &AppendWideString, value };
+    }
+    template <size_t N>
+    static Arg MakeArg(const char (&value)[N]) noexcept
+    {
+        return { &AppendString, value };
+    }
+
+    FormatBuffer& FormatArgs(const wchar_t* format, const Arg* args, size_t nArgs)
+    {
+        size_t iArg = 0;
+        const wchar_t* literal = format;
+        const wchar_t* pIt = format;
+        for (; *pIt; ++pIt)
+        {
+            if ((pIt[0] == L'{' && pIt[1] == L'{') || (pIt[0] == L'}' && pIt[1] == L'}'))
+            {
+                Append(literal, pIt - literal + 1);
+                literal = ++pIt + 1;
+            }
+            else if (pIt[0] == L'{' && pIt[1] == L'}')
+            {
+                Append(literal, pIt - literal);
+                if (iArg < nArgs)
+                {
+                    args[iArg].append(*this, args[iArg].value);
+                    ++iArg;
+                }
+                literal = ++pIt + 1;
+            }
+        }
+        return Append(literal, pIt - literal);
+    }
+
+    bool Overflow()
+    {
+        if (!m_flush)
+        {
+            m_truncated = true;
+            return false;
+        }
+        Flush();
+        return true;
+    }
+
+private:
+    wchar_t* m_data;
+    size_t m_capacity;
+    size_t m_size;
+    bool m_truncated;
+    FlushFn m_flush;
+    void* m_context;
+};
+
+// FormatBuffer with storage of N characters inside
+template <size_t N = DEF_FORMAT_BUFFER_SIZE>
+class StackFormatBuffer : public FormatBuffer
+{
+public:
+    StackFormatBuffer() noexcept : FormatBuffer(m_storage, N) {}
+
+private:
+    wchar_t m_storage[N];
+};
+
+#endif // !_FORMAT_H_
@@ -0,0 +1,59 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+// Linux futex calls on 32-bit atomics, used by futex versions of Event and RWAccessManager.
+// Define CHAT_NO_FUTEX to use portable versions on Linux too.
+
+#if defined(__linux__) && !defined(CHAT_NO_FUTEX)
+#define CHAT_USE_FUTEX
+#endif
+
+#ifdef __linux__
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be plain 32-bit integer");
+
+namespace Futex
+{
+
+// Sleeps while *addr == expected. Returns false on timeout, spurious and value mismatch wakeups return true.
+inline bool Wait(std::atomic<uint32_t>& addr, uint32_t expected, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) noexcept
+{
+    timespec ts;
+    timespec* pts = nullptr;
+    if (timeout != std::chrono::nanoseconds::max())
+    {
+        if (timeout.count() <= 0)
+            return false;
+        ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        pts = &ts;
+    }
+    long res = ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&addr), FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+    return res == 0 || errno != ETIMEDOUT;
+}
+
+inline void Wake(std::atomic<uint32_t>& addr, int count) noexcept
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+inline void WakeAll(std::atomic<uint32_t>& addr) noexcept
+{
+    Wake(addr, INT_MAX);
+}
+
+} // namespace Futex
+
+#endif // __linux__
+
+#endif // !_FUTEX_H_
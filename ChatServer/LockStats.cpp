@@ -0,0 +1,215 @@
+#include "LockStats.h"
+
+#ifdef CHAT_LOCK_STATS
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+
+constexpr size_t TOP_SITES = 5;
+
+// Registry of existing locks
+static std::mutex& GetRegistryMutex()
+{
+    static std::mutex mtx;
+    return mtx;
+}
+static LockStats*& GetRegistryHead()
+{
+    static LockStats* head = nullptr;
+    return head;
+}
+
+static std::wstring FormatNs(uint64_t ns)
+{
+    wchar_t buff[32];
+    if (ns < 1000)
+        swprintf(buff, _countof(buff), L"%uns", static_cast<unsigned>(ns));
+    else if (ns < 1000000)
+        swprintf(buff, _countof(buff), L"%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        swprintf(buff, _countof(buff), L"%.1fms", ns / 1e6);
+    else
+        swprintf(buff, _countof(buff), L"%.1fs", ns / 1e9);
+    return buff;
+}
+
+static std::wstring ToWide(const char* str)
+{
+    return std::wstring(str, str + strlen(str));
+}
+
+LockStats::LockStats(const char* name) noexcept
+    : m_name(name),
+    m_prev(nullptr)
+{
+    Reset();
+    for (auto& slot : m_sites)
+        slot.site = nullptr;
+
+    std::unique_lock<std::mutex> lk(GetRegistryMutex());
+    LockStats*& head = GetRegistryHead();
+    m_next = head;
+    if (head)
+        head->m_prev = this;
+    head = this;
+}
+LockStats::~LockStats()
+{
+    std::unique_lock<std::mutex> lk(GetRegistryMutex());
+    if (m_prev)
+        m_prev->m_next = m_next;
+    else
+        GetRegistryHead() = m_next;
+    if (m_next)
+        m_next->m_prev = m_prev;
+}
+
+void LockStats::AddWait(uint64_t ns, LockSiteRef site) noexcept
+{
+    ++m_nAcquires;
+    ++m_nContended;
+    m_waitNs += ns;
+    ++m_waitHistogram[Bucket(ns)];
+    uint64_t maxWait = m_maxWaitNs.load(std::memory_order_relaxed);
+    while (ns > maxWait && !m_maxWaitNs.compare_exchange_weak(maxWait, ns)) {}
+
+    if (site)
+    {
+        // Open addressing by site address, slots are never freed
+        size_t start = (reinterpret_cast<uintptr_t>(site) >> 4) % SITE_SLOTS;
+        for (size_t i = 0; i < SITE_SLOTS; ++i)
+        {
+            SiteSlot& slot = m_sites[(start + i) % SITE_SLOTS];
+            LockSiteRef slotSite = slot.site.load();
+            if (!slotSite && slot.site.compare_exchange_strong(slotSite, site))
+                slotSite = site;
+            if (slotSite == site)
+            {
+                ++slot.nWaits;
+                slot.waitNs += ns;
+                return;
+            }
+        }
+    }
+    ++m_nOtherSiteWaits;
+    m_otherSiteWaitNs += ns;
+}
+
+void LockStats::Reset() noexcept
+{
+    m_nAcquires = 0;
+    m_nContended = 0;
+    m_waitNs = 0;
+    m_maxWaitNs = 0;
+    for (auto& count : m_waitHistogram)
+        count = 0;
+    for (auto& count : m_holdHistogram)
+        count = 0;
+    // Sites stay in their slots
+    for (auto& slot : m_sites)
+    {
+        slot.nWaits = 0;
+        slot.waitNs = 0;
+    }
+    m_nOtherSiteWaits = 0;
+    m_otherSiteWaitNs = 0;
+}
+
+void LockStats::AppendReport(std::wstring& report) const
+{
+    uint64_t nAcquires = m_nAcquires, nContended = m_nContended;
+    report += L"Lock " + ToWide(m_name) + L": " + std::to_wstring(nAcquires) + L" acquisitions, " +
+        std::to_wstring(nContended) + L" contended";
+    if (nAcquires)
+    {
+        wchar_t buff[32];
+        swprintf(buff, _countof(buff), L" (%.2f%%)", nContended * 100.0 / nAcquires);
+        report += buff;
+    }
+    report += L", wait " + FormatNs(m_waitNs) + L", max " + FormatNs(m_maxWaitNs) + L'\n';
+
+    auto appendHistogram = [&report](const wchar_t* title, const std::atomic<uint64_t>* histogram)
+    {
+        report += title;
+        bool empty = true;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            uint64_t count = histogram[i];
+            if (!count)
+                continue;
+            report += L" <" + FormatNs(uint64_t(2) << i) + L':' + std::to_wstring(count);
+            empty = false;
+        }
+        report += empty ? L" -\n" : L"\n";
+    };
+    appendHistogram(L"  wait", m_waitHistogram);
+    appendHistogram(L"  hold", m_holdHistogram);
+
+    struct SiteWaits
+    {
+        LockSiteRef site;
+        uint64_t nWaits;
+        uint64_t waitNs;
+    };
+    std::vector<SiteWaits> sites;
+    for (const auto& slot : m_sites)
+    {
+        LockSiteRef site = slot.site;
+        if (site && slot.nWaits)
+            sites.push_back({ site, slot.nWaits, slot.waitNs });
+    }
+    if (m_nOtherSiteWaits)
+        sites.push_back({ nullptr, m_nOtherSiteWaits, m_otherSiteWaitNs });
+    std::sort(sites.begin(), sites.end(),
+        [](const SiteWaits& l, const SiteWaits& r) { return l.waitNs > r.waitNs; });
+    if (sites.size() > TOP_SITES)
+        sites.resize(TOP_SITES);
+
+    for (const auto& site : sites)
+    {
+        report += L"  ";
+        if (site.site)
+        {
+            // Only file name of the path
+            const char* file = site.site->file;
+            for (const char* p = file; *p; ++p)
+            {
+                if (*p == '/' || *p == '\\')
+                    file = p + 1;
+            }
+            report += ToWide(file) + L':' + std::to_wstring(site.site->line) + L' ' + ToWide(site.site->function);
+        }
+        else
+            report += L"unknown sites";
+        report += L": " + std::to_wstring(site.nWaits) + L" waits, " + FormatNs(site.waitNs) + L'\n';
+    }
+}
+
+std::wstring LockStats::Report()
+{
+    std::unique_lock<std::mutex> lk(GetRegistryMutex());
+    std::vector<const LockStats*> locks;
+    for (auto lock = GetRegistryHead(); lock; lock = lock->m_next)
+        locks.push_back(lock);
+    std::stable_sort(locks.begin(), locks.end(),
+        [](const LockStats* l, const LockStats* r) { return l->m_waitNs > r->m_waitNs; });
+
+    std::wstring report;
+    for (auto lock : locks)
+        lock->AppendReport(report);
+    if (report.empty())
+        report = L"There are no instrumented locks\n";
+    return report;
+}
+
+void LockStats::ResetAll() noexcept
+{
+    std::unique_lock<std::mutex> lk(GetRegistryMutex());
+    for (auto lock = GetRegistryHead(); lock; lock = lock->m_next)
+        lock->Reset();
+}
+
+#endif // CHAT_LOCK_STATS
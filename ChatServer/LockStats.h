@@ -0,0 +1,191 @@
+#ifndef _LOCK_STATS_H_
+#define _LOCK_STATS_H_
+
+#include <cinttypes>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+// Contention statistics of named locks.
+// Defining CHAT_LOCK_STATS enables collection of wait and hold time histograms and of call sites
+// that waited longest for every named lock. Without it LockStats is empty and lockers don't read clock.
+// Call site is passed to lockers with LOCK_SITE, acquisitions without site are counted as unknown.
+// StatsLock locks standard mutexes with stats.
+
+#ifdef CHAT_LOCK_STATS
+
+#include <atomic>
+#include <chrono>
+
+struct LockSite
+{
+    const char* file;
+    int line;
+    const char* function;
+};
+
+typedef const LockSite* LockSiteRef;
+
+// Each use is a distinct static site
+#define LOCK_SITE ([function = __FUNCTION__]() -> LockSiteRef \
+    { static const LockSite site = { __FILE__, __LINE__, function }; return &site; }())
+
+class LockStats
+{
+public:
+    LockStats(const LockStats&) = delete;
+    LockStats& operator = (const LockStats&) = delete;
+
+    explicit LockStats(const char* name) noexcept;
+    ~LockStats();
+
+    static uint64_t Now() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Locks with tryLock or, if lock is busy, with lock and records wait time.
+    // Returns time of acquisition to pass to Release.
+    template <typename TryLock, typename Lock>
+    uint64_t Acquire(TryLock tryLock, Lock lock, LockSiteRef site)
+    {
+        if (tryLock())
+        {
+            ++m_nAcquires;
+            return Now();
+        }
+        uint64_t start = Now();
+        lock();
+        uint64_t now = Now();
+        AddWait(now - start, site);
+        return now;
+    }
+    void Release(uint64_t acquireTime) noexcept
+    {
+        ++m_holdHistogram[Bucket(Now() - acquireTime)];
+    }
+
+    // Text report of all existing locks, sorted by total wait time
+    static std::wstring Report();
+    static void ResetAll() noexcept;
+
+private:
+    static constexpr size_t BUCKET_COUNT = 40;   // powers of two of nanoseconds
+    static constexpr size_t SITE_SLOTS = 32;
+
+    struct SiteSlot
+    {
+        std::atomic<LockSiteRef> site;
+        std::atomic<uint64_t> nWaits;
+        std::atomic<uint64_t> waitNs;
+    };
+
+    static size_t Bucket(uint64_t ns) noexcept
+    {
+        size_t bucket = 0;
+        while (ns > 1 && bucket + 1 < BUCKET_COUNT)
+        {
+            ns >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+
+    void AddWait(uint64_t ns, LockSiteRef site) noexcept;
+    void Reset() noexcept;
+    void AppendReport(std::wstring& report) const;
+
+private:
+    const char* m_name;
+    std::atomic<uint64_t> m_nAcquires;
+    std::atomic<uint64_t> m_nContended;
+    std::atomic<uint64_t> m_waitNs;
+    std::atomic<uint64_t> m_maxWaitNs;
+    std::atomic<uint64_t> m_waitHistogram[BUCKET_COUNT];
+    std::atomic<uint64_t> m_holdHistogram[BUCKET_COUNT];
+    SiteSlot m_sites[SITE_SLOTS];
+    std::atomic<uint64_t> m_nOtherSiteWaits;   // sites that didn't fit in m_sites or unknown
+    std::atomic<uint64_t> m_otherSiteWaitNs;
+    LockStats* m_prev;
+    LockStats* m_next;
+};
+
+#else // CHAT_LOCK_STATS
+
+typedef std::nullptr_t LockSiteRef;
+
+#define LOCK_SITE nullptr
+
+class LockStats
+{
+public:
+    explicit LockStats(const char*) noexcept {}
+
+    static std::wstring Report()
+    {
+        return L"Lock statistics are not compiled in, define CHAT_LOCK_STATS to collect them\n";
+    }
+    static void ResetAll() noexcept {}
+};
+
+#endif // CHAT_LOCK_STATS
+
+// Lock of mutex that records its waits and hold time in stats, used like std::unique_lock
+template <typename Mutex>
+class StatsLock
+{
+public:
+    StatsLock(const StatsLock&) = delete;
+    StatsLock& operator = (const StatsLock&) = delete;
+
+#ifdef CHAT_LOCK_STATS
+    StatsLock(Mutex& mtx, LockStats& stats, LockSiteRef site) : m_lock(mtx, std::defer_lock), m_stats(stats), m_site(site) { lock(); }
+#else
+    StatsLock(Mutex& mtx, LockStats&, LockSiteRef) : m_lock(mtx) {}
+#endif
+    ~StatsLock()
+    {
+        if (m_lock.owns_lock())
+            unlock();
+    }
+
+    void lock()
+    {
+#ifdef CHAT_LOCK_STATS
+        m_acquireTime = m_stats.Acquire([this] { return m_lock.try_lock(); }, [this] { m_lock.lock(); }, m_site);
+#else
+        m_lock.lock();
+#endif
+    }
+    void unlock()
+    {
+#ifdef CHAT_LOCK_STATS
+        m_stats.Release(m_acquireTime);
+#endif
+        m_lock.unlock();
+    }
+    // Time of waiting for condition isn't counted as hold time
+    template <typename Predicate>
+    void Wait(std::condition_variable& cv, Predicate pred)
+    {
+#ifdef CHAT_LOCK_STATS
+        m_stats.Release(m_acquireTime);
+        cv.wait(m_lock, pred);
+        m_acquireTime = LockStats::Now();
+#else
+        cv.wait(m_lock, pred);
+#endif
+    }
+
+private:
+    std::unique_lock<Mutex> m_lock;
+#ifdef CHAT_LOCK_STATS
+    LockStats& m_stats;
+    LockSiteRef m_site;
+    uint64_t m_acquireTime = 0;
+#endif
+};
+
+#endif // !_LOCK_STATS_H_
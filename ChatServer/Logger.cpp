@@ -0,0 +1,237 @@
+#include "Logger.h"
+#include "Event.h"
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+
+std::atomic<LogLevel> Logger::s_level(LogLevel::DEF_LOG_LEVEL);
+std::atomic<uint64_t> Logger::s_nDropped(0);
+
+static const wchar_t* const levelNames[] = { L"error", L"warning", L"info", L"debug", L"trace" };
+static_assert(_countof(levelNames) == static_cast<size_t>(LogLevel::LEVEL_COUNT), "Wrong number of level names");
+
+class Logger::Impl
+{
+public:
+    typedef std::unique_lock<std::mutex> MutexLock;
+
+    Impl() : m_running(false), m_nReportedDrops(0) {}
+
+    std::shared_ptr<LogRing> AddRing()
+    {
+        auto ring = std::make_shared<LogRing>();
+        MutexLock lk(m_ringsMtx);
+        m_rings.push_back(ring);
+        return ring;
+    }
+
+    bool Start(Sink sink)
+    {
+        MutexLock lk(m_drainMtx);
+        if (m_running)
+            return false;
+        m_sink = std::move(sink);
+        m_running = true;
+        m_thread = std::thread(&Impl::ThreadFunction, this);
+        return true;
+    }
+    void Stop()
+    {
+        {
+            MutexLock lk(m_drainMtx);
+            if (!m_running)
+                return;
+            m_running = false;
+        }
+        m_wakeup.Signal();
+        if (m_thread.joinable())
+            m_thread.join();
+        Drain();
+    }
+    void Flush()
+    {
+        Drain();
+    }
+    void WakeUp() noexcept
+    {
+        m_wakeup.Signal();
+    }
+
+private:
+    void ThreadFunction()
+    {
+        while (m_running)
+        {
+            m_wakeup.Wait(std::chrono::milliseconds(DEF_LOG_FLUSH_INTERVAL));
+            Drain();
+        }
+    }
+
+    // Reads all rings, sorts records by time and passes formatted batch to sink
+    void Drain()
+    {
+        MutexLock lk(m_drainMtx);
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            MutexLock ringsLk(m_ringsMtx);
+            // Rings of exited threads are removed once read
+            m_rings.erase(std::remove_if(m_rings.begin(), m_rings.end(),
+                [](const std::shared_ptr<LogRing>& ring) { return ring->IsClosed() && ring->Empty(); }),
+                m_rings.end());
+            rings = m_rings;
+        }
+
+        m_batch.clear();
+        for (const auto& ring : rings)
+            ring->Read([this](const LogRecord& record) { m_batch.push_back(record); });
+        std::stable_sort(m_batch.begin(), m_batch.end(),
+            [](const LogRecord& l, const LogRecord& r) { return l.time < r.time; });
+
+        m_text.clear();
+        for (const auto& record : m_batch)
+            Format(record, m_text);
+        uint64_t nDropped = s_nDropped;
+        if (nDropped != m_nReportedDrops)
+        {
+            m_text += L"Log: " + std::to_wstring(nDropped - m_nReportedDrops) + L" records dropped\n";
+            m_nReportedDrops = nDropped;
+        }
+        if (!m_text.empty() && m_sink)
+            m_sink(m_text);
+    }
+
+    static void Format(const LogRecord& record, std::wstring& out)
+    {
+        wchar_t buff[64];
+        time_t seconds = static_cast<time_t>(record.time / 1000000000);
+        tm local = {};
+#ifdef _WIN32
+        localtime_s(&local, &seconds);
+#else
+        localtime_r(&seconds, &local);
+#endif
+        swprintf(buff, _countof(buff), L"%02d:%02d:%02d.%03u %ls: ", local.tm_hour, local.tm_min, local.tm_sec,
+            static_cast<unsigned>(record.time / 1000000 % 1000), GetLevelName(record.level));
+        out += buff;
+
+        size_t iArg = 0;
+        for (const wchar_t* p = record.format; *p; ++p)
+        {
+            if (p[0] != L'{' || p[1] != L'}' || iArg == record.nArgs)
+            {
+                out += *p;
+                continue;
+            }
+            const LogRecord::Arg& arg = record.args[iArg++];
+            switch (arg.type)
+            {
+            case LogRecord::Int:
+                out += std::to_wstring(arg.i);
+                break;
+            case LogRecord::UInt:
+                out += std::to_wstring(arg.u);
+                break;
+            case LogRecord::Double:
+                swprintf(buff, _countof(buff), L"%g", arg.d);
+                out += buff;
+                break;
+            case LogRecord::Text:
+                out.append(record.text + arg.text.offset, arg.text.size);
+                break;
+            }
+            ++p;
+        }
+        out += L'\n';
+    }
+
+private:
+    std::mutex m_ringsMtx;
+    std::vector<std::shared_ptr<LogRing>> m_rings;
+    std::mutex m_drainMtx;   // one reader of rings at a time
+    std::vector<LogRecord> m_batch;
+    std::wstring m_text;
+    Sink m_sink;
+    Event m_wakeup;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    uint64_t m_nReportedDrops;
+};
+
+// Owns ring of the thread and closes it when thread exits
+struct ThreadRingHolder
+{
+    std::shared_ptr<LogRing> ring;
+
+    ~ThreadRingHolder()
+    {
+        if (ring)
+            ring->Close();
+    }
+};
+
+Logger::Logger() : m_impl(new Impl)
+{
+}
+Logger::~Logger()
+{
+}
+
+Logger& Logger::GetInstance()
+{
+    static Logger instance;
+    return instance;
+}
+
+LogRing* Logger::GetThreadRing() noexcept
+{
+    static thread_local ThreadRingHolder holder;
+    if (!holder.ring)
+    {
+        try
+        {
+            holder.ring = GetInstance().m_impl->AddRing();
+        }
+        catch (...)
+        {
+        }
+    }
+    return holder.ring.get();
+}
+
+void Logger::WakeUp() noexcept
+{
+    GetInstance().m_impl->WakeUp();
+}
+
+bool Logger::SetLevel(const std::wstring& name) noexcept
+{
+    for (size_t i = 0; i < _countof(levelNames); ++i)
+    {
+        if (name == levelNames[i])
+        {
+            SetLevel(static_cast<LogLevel>(i));
+            return true;
+        }
+    }
+    return false;
+}
+
+const wchar_t* Logger::GetLevelName(LogLevel level) noexcept
+{
+    return level < LogLevel::LEVEL_COUNT ? levelNames[static_cast<size_t>(level)] : L"?";
+}
+
+bool Logger::Start(Sink sink)
+{
+    return m_impl->Start(std::move(sink));
+}
+void Logger::Stop()
+{
+    m_impl->Stop();
+}
+void Logger::Flush()
+{
+    m_impl->Flush();
+}
@@ -0,0 +1,251 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <initializer_list>
+#include <cinttypes>
+#include <cwchar>
+
+#ifndef DEF_LOG_LEVEL
+#define DEF_LOG_LEVEL Info
+#endif
+
+#ifndef DEF_LOG_RING_SIZE
+#define DEF_LOG_RING_SIZE 128 // records per thread, records are dropped when ring is full
+#endif
+
+#ifndef DEF_LOG_FLUSH_INTERVAL
+#define DEF_LOG_FLUSH_INTERVAL 50 // milliseconds
+#endif
+
+// Asynchronous logger.
+// Threads record format string and raw arguments into their own lock-free ring,
+// background thread formats records of all threads and passes them to sink in batches.
+// Format string must be a literal, "{}" in it is replaced by next argument.
+
+enum class LogLevel : uint8_t
+{
+    Error,
+    Warning,
+    Info,
+    Debug,
+    Trace,
+    LEVEL_COUNT
+};
+
+// Arguments are evaluated only if level is enabled
+#define CHAT_LOG(level, ...) \
+    do { if (Logger::IsEnabled(LogLevel::level)) Logger::Log(LogLevel::level, __VA_ARGS__); } while (false)
+
+struct LogRecord
+{
+    static constexpr size_t MAX_ARGS = 6;
+    static constexpr size_t TEXT_SIZE = 128;  // characters of all string arguments
+
+    enum ArgType : uint8_t
+    {
+        Int,
+        UInt,
+        Double,
+        Text,
+    };
+    struct Arg
+    {
+        ArgType type;
+        union
+        {
+            int64_t i;
+            uint64_t u;
+            double d;
+            struct
+            {
+                uint16_t offset;
+                uint16_t size;
+            } text;
+        };
+    };
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type Add(T value) noexcept
+    {
+        args[nArgs].type = Int;
+        args[nArgs++].i = value;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type Add(T value) noexcept
+    {
+        args[nArgs].type = UInt;
+        args[nArgs++].u = value;
+    }
+    void Add(double value) noexcept
+    {
+        args[nArgs].type = Double;
+        args[nArgs++].d = value;
+    }
+    void Add(const wchar_t* str) noexcept
+    {
+        Add(str, wcslen(str));
+    }
+    void Add(const std::wstring& str) noexcept
+    {
+        Add(str.c_str(), str.size());
+    }
+    // Truncated if it doesn't fit in text
+    void Add(const wchar_t* str, size_t size) noexcept
+    {
+        if (size > TEXT_SIZE - textSize)
+            size = TEXT_SIZE - textSize;
+        wmemcpy(text + textSize, str, size);
+        args[nArgs].type = Text;
+        args[nArgs].text.offset = textSize;
+        args[nArgs++].text.size = static_cast<uint16_t>(size);
+        textSize += static_cast<uint16_t>(size);
+    }
+
+    uint64_t time;          // ns since system clock epoch
+    const wchar_t* format;
+    LogLevel level;
+    uint8_t nArgs;
+    uint16_t textSize;
+    Arg args[MAX_ARGS];
+    wchar_t text[TEXT_SIZE];
+};
+
+// Ring of one thread, written by the thread and read by logger thread
+class LogRing
+{
+public:
+    LogRing(const LogRing&) = delete;
+    LogRing& operator = (const LogRing&) = delete;
+
+    LogRing() : m_records(new LogRecord[DEF_LOG_RING_SIZE]), m_head(0), m_tail(0), m_closed(false) {}
+
+    // Returns nullptr if ring is full
+    LogRecord* BeginWrite() noexcept
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == DEF_LOG_RING_SIZE)
+            return nullptr;
+        return &m_records[tail % DEF_LOG_RING_SIZE];
+    }
+    // Returns number of records in ring
+    size_t EndWrite() noexcept
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed) + 1;
+        m_tail.store(tail, std::memory_order_release);
+        return tail - m_head.load(std::memory_order_relaxed);
+    }
+
+    template <typename Fn>
+    size_t Read(Fn fn)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        for (size_t i = head; i != tail; ++i)
+            fn(m_records[i % DEF_LOG_RING_SIZE]);
+        m_head.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+    bool Empty() const noexcept
+    {
+        return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+    }
+
+    // Thread of the ring exited
+    void Close() noexcept { m_closed = true; }
+    bool IsClosed() const noexcept { return m_closed; }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    std::unique_ptr<LogRecord[]> m_records;
+    std::atomic<size_t> m_head;
+    char m_padding[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_tail;
+    std::atomic<bool> m_closed;
+};
+
+class Logger
+{
+private:
+    Logger();
+public:
+    // Receives batch of formatted lines
+    typedef std::function<void(const std::wstring&)> Sink;
+
+    static Logger& GetInstance();
+
+    Logger(const Logger&) = delete;
+    Logger& operator = (const Logger&) = delete;
+
+    ~Logger();
+
+    static bool IsEnabled(LogLevel level) noexcept
+    {
+        return level <= s_level.load(std::memory_order_relaxed);
+    }
+    static void SetLevel(LogLevel level) noexcept
+    {
+        s_level = level;
+    }
+    static LogLevel GetLevel() noexcept
+    {
+        return s_level;
+    }
+    // Level by name, returns false for unknown name
+    static bool SetLevel(const std::wstring& name) noexcept;
+    static const wchar_t* GetLevelName(LogLevel level) noexcept;
+
+    template <typename... Args>
+    static void Log(LogLevel level, const wchar_t* format, const Args&... args) noexcept
+    {
+        static_assert(sizeof...(Args) <= LogRecord::MAX_ARGS, "Too many log arguments");
+        LogRing* ring = GetThreadRing();
+        LogRecord* record = ring ? ring->BeginWrite() : nullptr;
+        if (!record)
+        {
+            s_nDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        record->format = format;
+        record->level = level;
+        record->nArgs = 0;
+        record->textSize = 0;
+        (void)std::initializer_list<int>{ 0, (record->Add(args), 0)... };
+        // Wake logger thread once ring is half full instead of waiting for flush interval
+        if (ring->EndWrite() == DEF_LOG_RING_SIZE / 2)
+            WakeUp();
+    }
+
+    // Starts logger thread, records made before start are written with the first batch
+    bool Start(Sink sink);
+    // Writes remaining records and stops logger thread
+    void Stop();
+    // Writes records made before the call
+    void Flush();
+
+    static uint64_t GetDroppedCount() noexcept
+    {
+        return s_nDropped;
+    }
+
+private:
+    static LogRing* GetThreadRing() noexcept;
+    static void WakeUp() noexcept;
+
+private:
+    static std::atomic<LogLevel> s_level;
+    static std::atomic<uint64_t> s_nDropped;
+
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_LOGGER_H_
@@ -0,0 +1,165 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <cinttypes>
+
+// Bounded lock-free queue for many producers and one consumer.
+// Producers claim cells by position, each cell has sequence number telling whether it is free or filled,
+// so consumer never writes shared indices and producers contend only on the tail.
+//
+// Consumer role is passed between threads with Claim and Release:
+// a producer that pushed an item calls Claim and, if mailbox was idle, becomes consumer
+// or wakes it with wakeup hook. Consumer calls Release when it runs out of items and
+// keeps consuming if Release returns false.
+template <typename T>
+class Mailbox
+{
+public:
+    typedef std::function<void()> Wakeup;
+
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator = (const Mailbox&) = delete;
+
+    // Capacity is rounded up to power of two
+    explicit Mailbox(size_t capacity)
+        : m_capacity(RoundCapacity(capacity)),
+        m_cells(new Cell[m_capacity]),
+        m_tail(0),
+        m_head(0),
+        m_idle(true)
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Hook is called by producer that found consumer idle, must be set before producers start
+    void SetWakeup(Wakeup wakeup)
+    {
+        m_wakeup = std::move(wakeup);
+    }
+
+    // Returns false if mailbox is full
+    bool Push(T item) noexcept(std::is_nothrow_move_assignable<T>::value)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;)
+        {
+            cell = &m_cells[pos & (m_capacity - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)  // consumer hasn't freed the cell yet
+                return false;
+            else
+                pos = m_tail.load(std::memory_order_relaxed);
+        }
+        cell->item = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        if (m_wakeup && Claim())
+            m_wakeup();
+        return true;
+    }
+
+    // Consumer side -------------------------------------------------------------------
+
+    bool Pop(T& item) noexcept(std::is_nothrow_move_assignable<T>::value)
+    {
+        Cell& cell = m_cells[m_head & (m_capacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+            return false;
+        item = std::move(cell.item);
+        cell.sequence.store(m_head + m_capacity, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+    // Passes up to maxCount items to fn(T&), returns number of items
+    template <typename Fn>
+    size_t PopBatch(Fn fn, size_t maxCount = SIZE_MAX)
+    {
+        size_t count = 0;
+        for (; count < maxCount; ++count)
+        {
+            Cell& cell = m_cells[m_head & (m_capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+                break;
+            fn(cell.item);
+            cell.item = T();
+            cell.sequence.store(m_head + m_capacity, std::memory_order_release);
+            ++m_head;
+        }
+        return count;
+    }
+    // Item may be pushed but not published yet, such item is seen by Release
+    bool Empty() const noexcept
+    {
+        return EmptyAt(m_head);
+    }
+
+    // Takes consumer role, returns false if another thread has it
+    bool Claim() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_idle.exchange(false);
+    }
+    // Gives consumer role up. Returns false if mailbox isn't empty,
+    // then caller should Claim again and continue if it succeeds.
+    bool Release() noexcept
+    {
+        // Next consumer may move head as soon as mailbox is idle
+        size_t head = m_head;
+        m_idle.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return EmptyAt(head);
+    }
+
+    size_t Capacity() const noexcept
+    {
+        return m_capacity;
+    }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;   // pos - free for push at pos, pos + 1 - filled
+        T item;
+    };
+
+    // Cell of head that has been taken by next consumer isn't filled for this head
+    bool EmptyAt(size_t head) const noexcept
+    {
+        return m_cells[head & (m_capacity - 1)].sequence.load(std::memory_order_acquire) != head + 1;
+    }
+    static size_t RoundCapacity(size_t capacity) noexcept
+    {
+        size_t rounded = 2;
+        while (rounded < capacity)
+            rounded <<= 1;
+        return rounded;
+    }
+
+private:
+    const size_t m_capacity;
+    std::unique_ptr<Cell[]> m_cells;
+    Wakeup m_wakeup;
+    char m_padding0[CACHE_LINE_SIZE];
+    std::atomic<size_t> m_tail;     // producers
+    char m_padding1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    size_t m_head;                  // consumer
+    char m_padding2[CACHE_LINE_SIZE - sizeof(size_t)];
+    std::atomic<bool> m_idle;
+    char m_padding3[CACHE_LINE_SIZE - sizeof(std::atomic<bool>)];
+};
+
+#endif // !_MAILBOX_H_
@@ -0,0 +1,77 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+char* MappedFile::Map(const char* path, uint64_t size)
+{
+#ifdef _WIN32
+    m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+    if (!m_mapping)
+    {
+        Unmap(0);
+        return nullptr;
+    }
+    m_base = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(size)));
+#else
+    m_file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_file < 0)
+        return nullptr;
+    if (ftruncate(m_file, static_cast<off_t>(size)) != 0)
+    {
+        Unmap(0);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    m_base = base == MAP_FAILED ? nullptr : static_cast<char*>(base);
+#endif
+    m_size = size;
+    if (!m_base)
+        Unmap(0);
+    return m_base;
+}
+
+void MappedFile::Unmap(uint64_t fileSize)
+{
+#ifdef _WIN32
+    if (m_base)
+        UnmapViewOfFile(m_base);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        if (fileSize)
+        {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(fileSize);
+            if (SetFilePointerEx(m_file, pos, nullptr, FILE_BEGIN))
+                SetEndOfFile(m_file);
+        }
+        CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_base)
+        munmap(m_base, m_size);
+    if (m_file >= 0)
+    {
+        if (fileSize)
+            (void)ftruncate(m_file, static_cast<off_t>(fileSize));
+        close(m_file);
+    }
+    m_file = -1;
+#endif
+    m_base = nullptr;
+    m_size = 0;
+}
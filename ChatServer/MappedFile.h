@@ -0,0 +1,35 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <cinttypes>
+
+// File of fixed size mapped for writing, shared by binary logs
+class MappedFile
+{
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    MappedFile() = default;
+    ~MappedFile()
+    {
+        Unmap(0);
+    }
+
+    // Creates file of given size, existing file is overwritten. Returns nullptr on error.
+    char* Map(const char* path, uint64_t size);
+    // Unmaps file and cuts it to fileSize bytes, 0 - keep size
+    void Unmap(uint64_t fileSize);
+
+private:
+#ifdef _WIN32
+    void* m_file = reinterpret_cast<void*>(-1);    // INVALID_HANDLE_VALUE
+    void* m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+    char* m_base = nullptr;
+    uint64_t m_size = 0;
+};
+
+#endif // !_MAPPED_FILE_H_
@@ -0,0 +1,389 @@
+#ifndef _MESSAGE_SCHEMA_H_
+#define _MESSAGE_SCHEMA_H_
+
+#include <wchar.h>
+#include <string.h>
+#include <utility>
+#include <initializer_list>
+#include "ClientMessage.h"
+#include "TextCodec.h"
+
+// Body layout of every command is described once by its list of fields.
+// Encoder, decoder and validator of a command are generated from that list,
+// so each command is (de)serialized by straight-line code that doesn't check other commands.
+// Adding a command requires adding its CommandSchema specialization, otherwise codec table fails to compile.
+
+namespace MessageSchema
+{
+
+constexpr size_t COMMAND_COUNT = static_cast<size_t>(ClientCommand::COMMAND_COUNT);
+
+// Version and capabilities followed by terminating zero, so protocol version 1
+// peers see a valid frame with some trailing data after sender name
+constexpr uint32_t CONNECT_OPTIONS_SIZE = sizeof(uint32_t) * 2 + sizeof(wchar_t);
+// Protocol version 3 options add resume token and sequence number before terminating zero
+constexpr uint32_t RESUME_OPTIONS_SIZE = CONNECT_OPTIONS_SIZE + sizeof(uint64_t) * 2;
+constexpr uint32_t RESUME_OPTIONS_VERSION = 3;
+// Sequence number followed by terminating zero
+constexpr uint32_t SEQUENCE_FIELD_SIZE = sizeof(uint64_t) + sizeof(wchar_t);
+
+
+// Fields ---------------------------------------------------------------------------
+
+// Zero terminated string, text with invalid code units rejects the frame
+template <std::wstring ClientMessage::*member, bool required>
+struct TextField
+{
+    static uint32_t Size(const ClientMessage& msg) noexcept
+    {
+        return static_cast<uint32_t>(((msg.*member).size() + 1) * sizeof(wchar_t));
+    }
+    static bool IsValid(const ClientMessage& msg) noexcept
+    {
+        return !required || !(msg.*member).empty();
+    }
+    static char* Write(const ClientMessage& msg, char* pIt) noexcept
+    {
+        const std::wstring& str = msg.*member;
+        wmemcpy(reinterpret_cast<wchar_t*>(pIt), str.c_str(), str.size() + 1);
+        return pIt + (str.size() + 1) * sizeof(wchar_t);
+    }
+    static bool Read(ClientMessage& msg, const char*& pIt, const char* pEnd)
+    {
+        auto pBegin = reinterpret_cast<const wchar_t*>(pIt);
+        auto pZero = TextCodec::FindTerminator(pBegin, pBegin + (pEnd - pIt) / sizeof(wchar_t));
+        if (!pZero)
+            return false;
+        (msg.*member).assign(pBegin, pZero);
+        pIt = reinterpret_cast<const char*>(pZero + 1);
+        return IsValid(msg);
+    }
+};
+
+// Text up to the terminating zero of the frame, zeros inside it are kept as protocol version 1 did.
+// Must be the last field.
+template <std::wstring ClientMessage::*member, bool required>
+struct TailTextField : TextField<member, required>
+{
+    static bool Read(ClientMessage& msg, const char*& pIt, const char* pEnd)
+    {
+        auto pBegin = reinterpret_cast<const wchar_t*>(pIt);
+        auto pLast = reinterpret_cast<const wchar_t*>(pEnd) - 1;
+        if (pBegin > pLast)
+            return false;
+        // Every part between zeros is validated
+        for (auto p = pBegin; p < pLast; ++p)
+        {
+            p = TextCodec::FindTerminator(p, pLast + 1);
+            if (!p)
+                return false;
+        }
+        (msg.*member).assign(pBegin, pLast);
+        pIt = pEnd;
+        return TextField<member, required>::IsValid(msg);
+    }
+};
+
+// Data after the last field is ignored, so newer protocol versions can append to the command
+struct TrailingDataField
+{
+    static uint32_t Size(const ClientMessage&) noexcept
+    {
+        return 0;
+    }
+    static bool IsValid(const ClientMessage&) noexcept
+    {
+        return true;
+    }
+    static char* Write(const ClientMessage&, char* pIt) noexcept
+    {
+        return pIt;
+    }
+    static bool Read(ClientMessage&, const char*& pIt, const char* pEnd) noexcept
+    {
+        pIt = pEnd;
+        return true;
+    }
+};
+
+// Protocol version and capabilities, absent in protocol version 1 frames.
+// Resume token and sequence number are present since protocol version 3.
+struct ConnectOptionsField
+{
+    static uint32_t Size(const ClientMessage& msg) noexcept
+    {
+        return msg.protocolVersion >= RESUME_OPTIONS_VERSION ? RESUME_OPTIONS_SIZE : CONNECT_OPTIONS_SIZE;
+    }
+    static bool IsValid(const ClientMessage&) noexcept
+    {
+        return true;
+    }
+    static char* Write(const ClientMessage& msg, char* pIt) noexcept
+    {
+        auto pOptions = reinterpret_cast<uint32_t*>(pIt);
+        pOptions[0] = msg.protocolVersion;
+        pOptions[1] = msg.capabilities;
+        pIt += sizeof(uint32_t) * 2;
+        if (msg.protocolVersion >= RESUME_OPTIONS_VERSION)
+        {
+            auto pResume = reinterpret_cast<uint64_t*>(pIt);
+            pResume[0] = msg.resumeToken;
+            pResume[1] = msg.sequence;
+            pIt += sizeof(uint64_t) * 2;
+        }
+        *reinterpret_cast<wchar_t*>(pIt) = L'\0';
+        return pIt + sizeof(wchar_t);
+    }
+    static bool Read(ClientMessage& msg, const char*& pIt, const char* pEnd) noexcept
+    {
+        msg.protocolVersion = 1;
+        msg.capabilities = CapNone;
+        msg.resumeToken = 0;
+        msg.sequence = 0;
+        size_t size = pEnd - pIt;
+        if (size < CONNECT_OPTIONS_SIZE)
+            return true;
+        auto pOptions = reinterpret_cast<const uint32_t*>(pIt);
+        msg.protocolVersion = pOptions[0];
+        msg.capabilities = pOptions[1];
+        if (msg.protocolVersion < RESUME_OPTIONS_VERSION || size < RESUME_OPTIONS_SIZE)
+        {
+            pIt += CONNECT_OPTIONS_SIZE;
+            return true;
+        }
+        auto pResume = reinterpret_cast<const uint64_t*>(pOptions + 2);
+        msg.resumeToken = pResume[0];
+        msg.sequence = pResume[1];
+        pIt += RESUME_OPTIONS_SIZE;
+        return true;
+    }
+};
+
+// Sequence number
+struct SequenceField
+{
+    static uint32_t Size(const ClientMessage&) noexcept
+    {
+        return SEQUENCE_FIELD_SIZE;
+    }
+    static bool IsValid(const ClientMessage&) noexcept
+    {
+        return true;
+    }
+    static char* Write(const ClientMessage& msg, char* pIt) noexcept
+    {
+        *reinterpret_cast<uint64_t*>(pIt) = msg.sequence;
+        *reinterpret_cast<wchar_t*>(pIt + sizeof(uint64_t)) = L'\0';
+        return pIt + SEQUENCE_FIELD_SIZE;
+    }
+    static bool Read(ClientMessage& msg, const char*& pIt, const char* pEnd) noexcept
+    {
+        if (static_cast<size_t>(pEnd - pIt) < SEQUENCE_FIELD_SIZE)
+            return false;
+        msg.sequence = *reinterpret_cast<const uint64_t*>(pIt);
+        pIt += SEQUENCE_FIELD_SIZE;
+        return true;
+    }
+};
+
+typedef TextField<&ClientMessage::from, true> From;
+typedef TextField<&ClientMessage::pmTo, true> PmTo;
+typedef TailTextField<&ClientMessage::msg, true> Msg;
+typedef ConnectOptionsField ConnectOptions;
+typedef SequenceField Sequence;
+typedef TrailingDataField TrailingData;
+
+
+// Field lists ----------------------------------------------------------------------
+
+template <typename... Fields>
+struct FieldList
+{
+    static uint32_t Size(const ClientMessage& msg) noexcept
+    {
+        uint32_t size = 0;
+        (void)std::initializer_list<int>{ 0, (size += Fields::Size(msg), 0)... };
+        return size;
+    }
+    static bool IsValid(const ClientMessage& msg) noexcept
+    {
+        bool valid = true;
+        (void)std::initializer_list<int>{ 0, (valid = valid && Fields::IsValid(msg), 0)... };
+        return valid;
+    }
+    static char* Write(const ClientMessage& msg, char* pIt) noexcept
+    {
+        (void)std::initializer_list<int>{ 0, (pIt = Fields::Write(msg, pIt), 0)... };
+        return pIt;
+    }
+    // Fields must take the whole body
+    static bool Read(ClientMessage& msg, const char* pIt, const char* pEnd)
+    {
+        bool valid = true;
+        (void)std::initializer_list<int>{ 0, (valid = valid && Fields::Read(msg, pIt, pEnd), 0)... };
+        return valid && pIt == pEnd;
+    }
+};
+
+// Command that can't be sent as a single message
+struct NotSerializable {};
+
+
+// Command schemas ------------------------------------------------------------------
+
+template <ClientCommand command>
+struct CommandSchema;
+
+#define DECLARE_COMMAND_SCHEMA(command, ...) \
+    template <> struct CommandSchema<ClientCommand::command> { typedef __VA_ARGS__ Fields; }
+
+DECLARE_COMMAND_SCHEMA(Error, NotSerializable);
+DECLARE_COMMAND_SCHEMA(BroadcastMessage, FieldList<From, Msg>);
+DECLARE_COMMAND_SCHEMA(PrivateMessage, FieldList<From, PmTo, Msg>);
+DECLARE_COMMAND_SCHEMA(ChangeName, FieldList<From, Msg>);
+DECLARE_COMMAND_SCHEMA(ListClients, FieldList<From, TrailingData>);
+DECLARE_COMMAND_SCHEMA(ClientConnect, FieldList<From, ConnectOptions, TrailingData>);
+DECLARE_COMMAND_SCHEMA(ServerMsg, FieldList<From, Msg>);
+DECLARE_COMMAND_SCHEMA(Help, FieldList<From, Msg>);
+DECLARE_COMMAND_SCHEMA(ConnectAccept, FieldList<From, ConnectOptions, TrailingData>);
+DECLARE_COMMAND_SCHEMA(Batch, NotSerializable);
+DECLARE_COMMAND_SCHEMA(SequencedBatch, NotSerializable);
+DECLARE_COMMAND_SCHEMA(Ack, FieldList<From, Sequence>);
+
+#undef DECLARE_COMMAND_SCHEMA
+
+
+// Codec table ----------------------------------------------------------------------
+
+struct CommandCodec
+{
+    uint32_t (*size)(const ClientMessage&);
+    bool (*isValid)(const ClientMessage&);
+    char* (*write)(const ClientMessage&, char*);
+    bool (*read)(ClientMessage&, const char*, const char*);
+};
+
+template <typename Fields>
+struct CodecOf
+{
+    static constexpr CommandCodec Get()
+    {
+        return { &Fields::Size, &Fields::IsValid, &Fields::Write, &Fields::Read };
+    }
+};
+template <>
+struct CodecOf<NotSerializable>
+{
+    static constexpr CommandCodec Get()
+    {
+        return { nullptr, nullptr, nullptr, nullptr };
+    }
+};
+
+struct CodecTable
+{
+    CommandCodec codecs[COMMAND_COUNT];
+
+    const CommandCodec* Find(ClientCommand command) const noexcept
+    {
+        auto ind = static_cast<size_t>(command);
+        return (ind < COMMAND_COUNT && codecs[ind].read) ? &codecs[ind] : nullptr;
+    }
+};
+
+template <size_t... I>
+constexpr CodecTable MakeCodecTable(std::index_sequence<I...>)
+{
+    return CodecTable{ { CodecOf<typename CommandSchema<static_cast<ClientCommand>(I)>::Fields>::Get()... } };
+}
+
+constexpr CodecTable codecTable = MakeCodecTable(std::make_index_sequence<COMMAND_COUNT>());
+
+
+// Command names --------------------------------------------------------------------
+
+struct CommandName
+{
+    const wchar_t* name;
+    ClientCommand command;
+};
+
+constexpr CommandName COMMAND_NAMES[] =
+{
+    { L"/pm", ClientCommand::PrivateMessage },
+    { L"/setname", ClientCommand::ChangeName },
+    { L"/listusers", ClientCommand::ListClients },
+    { L"/help", ClientCommand::Help },
+};
+constexpr size_t COMMAND_NAMES_COUNT = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+
+// Must be a power of 2, at least twice larger than number of names to find seed quickly
+constexpr uint32_t NAME_TABLE_SIZE = 8;
+constexpr uint32_t NAME_TABLE_NO_SEED = ~0u;
+
+constexpr uint32_t HashName(const wchar_t* str, size_t len, uint32_t seed) noexcept
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= static_cast<uint32_t>(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+constexpr size_t NameLength(const wchar_t* str) noexcept
+{
+    size_t len = 0;
+    while (str[len])
+        ++len;
+    return len;
+}
+
+// Perfect hash table of command names: every name has its own slot
+struct NameTable
+{
+    uint32_t seed;
+    int8_t slots[NAME_TABLE_SIZE]; // index in COMMAND_NAMES or -1
+
+    ClientCommand Find(const wchar_t* str, size_t len) const noexcept
+    {
+        auto slot = slots[HashName(str, len, seed) & (NAME_TABLE_SIZE - 1)];
+        if (slot < 0)
+            return ClientCommand::Error;
+        const auto& entry = COMMAND_NAMES[slot];
+        return (NameLength(entry.name) == len && wmemcmp(entry.name, str, len) == 0) ?
+            entry.command : ClientCommand::Error;
+    }
+};
+
+constexpr NameTable MakeNameTable()
+{
+    for (uint32_t seed = 0; seed < 1024; ++seed)
+    {
+        NameTable table = { seed, {} };
+        for (uint32_t i = 0; i < NAME_TABLE_SIZE; ++i)
+            table.slots[i] = -1;
+
+        bool collision = false;
+        for (size_t i = 0; i < COMMAND_NAMES_COUNT && !collision; ++i)
+        {
+            const wchar_t* name = COMMAND_NAMES[i].name;
+            auto slot = HashName(name, NameLength(name), seed) & (NAME_TABLE_SIZE - 1);
+            if (table.slots[slot] != -1)
+                collision = true;
+            else
+                table.slots[slot] = static_cast<int8_t>(i);
+        }
+        if (!collision)
+            return table;
+    }
+    return NameTable{ NAME_TABLE_NO_SEED, {} };
+}
+
+constexpr NameTable nameTable = MakeNameTable();
+static_assert(nameTable.seed != NAME_TABLE_NO_SEED, "No perfect hash for command names, increase NAME_TABLE_SIZE");
+
+} // namespace MessageSchema
+
+#endif // !_MESSAGE_SCHEMA_H_
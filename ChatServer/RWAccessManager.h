@@ -2,30 +2,35 @@
 #define _RW_ACCESS_MANAGER_H_
 
 #include <memory>
+#include <cstdint>
 #include "Event.h"
+#include "LockStats.h"
 
-class RWAccessManager
+// Writer preferring lock on mutex and condition variables
+class PortableRWAccessManager
 {
 public:
     typedef Event::MutexLock MutexLock;
 
-    RWAccessManager()
-        : m_canReadEvent(new Event),
-        m_canWriteEvent(new Event),
+    explicit PortableRWAccessManager(const char* name = "RWAccessManager")
+        : m_stats(name),
         m_nCurrUsers(0),
         m_nPendingWriters(0),
-        m_nPendingReaders(0)
+        m_nPendingReaders(0),
+        m_readGrant(0),
+        m_nWriteGrants(0)
     {
     }
 
+    // Waits are done under m_mtx, grant made before waiter starts waiting isn't lost
     void LockRead()
     {
         MutexLock lk(m_mtx);
-        if (m_nCurrUsers == -1 || m_nPendingWriters)
+        if (m_nCurrUsers == WRITER_USER || m_nPendingWriters)
         {
             ++m_nPendingReaders;
-            lk.unlock();
-            m_canReadEvent->Wait();
+            uint64_t grant = m_readGrant;
+            m_canRead.wait(lk, [this, grant] { return m_readGrant != grant; });
         }
         else
             ++m_nCurrUsers;
@@ -36,17 +41,33 @@ public:
         if (m_nCurrUsers != 0)
         {
             ++m_nPendingWriters;
-            lk.unlock();
-            m_canWriteEvent->Wait();
+            m_canWrite.wait(lk, [this] { return m_nWriteGrants != 0; });
+            --m_nWriteGrants;
         }
         else
-            m_nCurrUsers = -1;
+            m_nCurrUsers = WRITER_USER;
+    }
+    bool TryLockRead()
+    {
+        MutexLock lk(m_mtx);
+        if (m_nCurrUsers == WRITER_USER || m_nPendingWriters)
+            return false;
+        ++m_nCurrUsers;
+        return true;
+    }
+    bool TryLockWrite()
+    {
+        MutexLock lk(m_mtx);
+        if (m_nCurrUsers != 0)
+            return false;
+        m_nCurrUsers = WRITER_USER;
+        return true;
     }
     void Unlock()
     {
         MutexLock lk(m_mtx);
 
-        if (m_nCurrUsers == -1)
+        if (m_nCurrUsers == WRITER_USER)
             m_nCurrUsers = 0;
         else if (m_nCurrUsers)
             --m_nCurrUsers;
@@ -55,51 +76,222 @@ public:
         {
             if (m_nPendingWriters)
             {
-                m_nCurrUsers = -1;
+                m_nCurrUsers = WRITER_USER;
                 --m_nPendingWriters;
-                m_canWriteEvent->Signal(false);
+                ++m_nWriteGrants;
+                m_canWrite.notify_one();
             }
             else if (m_nPendingReaders)
             {
                 m_nCurrUsers = m_nPendingReaders;
                 m_nPendingReaders = 0;
-                m_canReadEvent->Signal(true);
+                ++m_readGrant;
+                m_canRead.notify_all();
             }
         }
     }
 
+    LockStats& GetLockStats() noexcept
+    {
+        return m_stats;
+    }
+
 private:
-    std::unique_ptr<Event> m_canReadEvent;
-    std::unique_ptr<Event> m_canWriteEvent;
+    static constexpr uint32_t WRITER_USER = UINT32_MAX;
+
+    LockStats m_stats;
+    std::condition_variable m_canRead;
+    std::condition_variable m_canWrite;
     std::mutex m_mtx;
-    uint32_t m_nCurrUsers;  // (-1) - 1 writer; (> 0) - N readers; 0 - no users
+    uint32_t m_nCurrUsers;  // WRITER_USER - 1 writer; (> 0) - N readers; 0 - no users
     uint32_t m_nPendingWriters;
     uint32_t m_nPendingReaders;
+    uint64_t m_readGrant;       // incremented when pending readers are let in
+    uint32_t m_nWriteGrants;    // pending writers let in but not woken yet
 };
 
-class RWLocker
+#ifdef __linux__
+
+// Writer preferring lock on futex words without mutexes.
+// State word holds active readers, pending writers and writer flag,
+// waiters sleep on separate sequence words so readers and writers are woken independently.
+class FutexRWAccessManager
 {
 public:
-    RWLocker(RWAccessManager& rwm, bool write = false) : m_rwm(rwm) 
+    typedef Event::MutexLock MutexLock;
+
+    explicit FutexRWAccessManager(const char* name = "RWAccessManager")
+        : m_stats(name),
+        m_state(0),
+        m_readSeq(0),
+        m_writeSeq(0),
+        m_nSleepingReaders(0),
+        m_nSleepingWriters(0)
+    {
+    }
+
+    void LockRead()
+    {
+        uint32_t s = m_state.load();
+        for (;;)
+        {
+            if (!(s & (WRITER | PENDING_WRITERS_MASK)))
+            {
+                if (m_state.compare_exchange_weak(s, s + READER))
+                    return;
+                continue;
+            }
+            Sleep(m_readSeq, m_nSleepingReaders, [](uint32_t s) { return !!(s & (WRITER | PENDING_WRITERS_MASK)); });
+            s = m_state.load();
+        }
+    }
+    void LockWrite()
+    {
+        uint32_t s = 0;
+        if (m_state.compare_exchange_strong(s, WRITER))
+            return;
+
+        // Pending writer stops new readers
+        s = m_state.fetch_add(PENDING_WRITER) + PENDING_WRITER;
+        for (;;)
+        {
+            if (!(s & (WRITER | READERS_MASK)))
+            {
+                if (m_state.compare_exchange_weak(s, s - PENDING_WRITER + WRITER))
+                    return;
+                continue;
+            }
+            Sleep(m_writeSeq, m_nSleepingWriters, [](uint32_t s) { return !!(s & (WRITER | READERS_MASK)); });
+            s = m_state.load();
+        }
+    }
+    bool TryLockRead()
+    {
+        uint32_t s = m_state.load();
+        while (!(s & (WRITER | PENDING_WRITERS_MASK)))
+        {
+            if (m_state.compare_exchange_weak(s, s + READER))
+                return true;
+        }
+        return false;
+    }
+    bool TryLockWrite()
+    {
+        uint32_t s = 0;
+        return m_state.compare_exchange_strong(s, WRITER);
+    }
+    void Unlock()
+    {
+        uint32_t s = m_state.load();
+        if (s & WRITER)
+        {
+            s = m_state.fetch_sub(WRITER) - WRITER;
+            if (s & PENDING_WRITERS_MASK)
+                WakeUp(m_writeSeq, m_nSleepingWriters, 1);
+            else
+                WakeUp(m_readSeq, m_nSleepingReaders, INT_MAX);
+        }
+        else
+        {
+            // Readers wait only for writers, last reader lets pending writer in
+            s = m_state.fetch_sub(READER) - READER;
+            if (!(s & READERS_MASK) && (s & PENDING_WRITERS_MASK))
+                WakeUp(m_writeSeq, m_nSleepingWriters, 1);
+        }
+    }
+
+    LockStats& GetLockStats() noexcept
+    {
+        return m_stats;
+    }
+
+private:
+    static constexpr uint32_t READER = 1;
+    static constexpr uint32_t READERS_MASK = 0xFFFF;
+    static constexpr uint32_t PENDING_WRITER = 1 << 16;
+    static constexpr uint32_t PENDING_WRITERS_MASK = 0x3FFF << 16;
+    static constexpr uint32_t WRITER = 1 << 30;
+
+    // Sequence is read before state is checked again, so wakeup after that check changes sequence
+    // and futex wait returns at once
+    template <typename Blocked>
+    void Sleep(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& nSleeping, Blocked blocked)
+    {
+        uint32_t seqValue = seq.load();
+        ++nSleeping;
+        if (blocked(m_state.load()))
+            Futex::Wait(seq, seqValue);
+        --nSleeping;
+    }
+    void WakeUp(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& nSleeping, int count)
+    {
+        ++seq;
+        if (nSleeping.load())
+            Futex::Wake(seq, count);
+    }
+
+private:
+    LockStats m_stats;
+    std::atomic<uint32_t> m_state;  // [writer:1][pending writers:14][readers:16]
+    std::atomic<uint32_t> m_readSeq;
+    std::atomic<uint32_t> m_writeSeq;
+    std::atomic<uint32_t> m_nSleepingReaders;
+    std::atomic<uint32_t> m_nSleepingWriters;
+};
+
+#endif // __linux__
+
+#ifdef CHAT_USE_FUTEX
+typedef FutexRWAccessManager RWAccessManager;
+#else
+typedef PortableRWAccessManager RWAccessManager;
+#endif
+
+// Pass LOCK_SITE as site to see where contention comes from in lock statistics
+template <typename AccessManager>
+class BasicRWLocker
+{
+public:
+#ifdef CHAT_LOCK_STATS
+    BasicRWLocker(AccessManager& rwm, bool write = false, LockSiteRef site = nullptr) : m_rwm(rwm), m_site(site)
+#else
+    BasicRWLocker(AccessManager& rwm, bool write = false, LockSiteRef = nullptr) : m_rwm(rwm)
+#endif
     {
         Lock(write);
     }
-    ~RWLocker() 
+    ~BasicRWLocker() 
     {
         Unlock();
     }
     void Lock(bool write = false)
     {
+#ifdef CHAT_LOCK_STATS
+        LockStats& stats = m_rwm.GetLockStats();
+        m_acquireTime = write ?
+            stats.Acquire([this] { return m_rwm.TryLockWrite(); }, [this] { m_rwm.LockWrite(); }, m_site) :
+            stats.Acquire([this] { return m_rwm.TryLockRead(); }, [this] { m_rwm.LockRead(); }, m_site);
+#else
         write ? m_rwm.LockWrite() : m_rwm.LockRead();
+#endif
     }
     void Unlock() 
     {
+#ifdef CHAT_LOCK_STATS
+        m_rwm.GetLockStats().Release(m_acquireTime);
+#endif
         m_rwm.Unlock(); 
     }
 
 private:
-    RWAccessManager& m_rwm;
+    AccessManager& m_rwm;
+#ifdef CHAT_LOCK_STATS
+    LockSiteRef m_site;
+    uint64_t m_acquireTime;
+#endif
 };
 
+typedef BasicRWLocker<RWAccessManager> RWLocker;
+
 #endif // !_RW_ACCESS_MANAGER_H_
 
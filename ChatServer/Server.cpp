@@ -4,78 +4,273 @@
 #include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <utility>
+#include <unordered_map>
 
 #include "Server.h"
 #include "ServerClient.h"
+#include "Transport.h"
 #include "ClientMessage.h"
-#include "RWAccessManager.h"
+#include "Compression.h"
+#include "EpochManager.h"
 #include "Console.h"
+#include "LockStats.h"
+#include "Logger.h"
+#include "EventLog.h"
+#include "Capture.h"
+
+#include <bcrypt.h>
+
+#pragma comment(lib, "bcrypt.lib")
 
 using namespace std::literals;
 
 
+typedef std::chrono::steady_clock SessionClock;
+
 struct ClientThread
 {
+    explicit ClientThread(size_t mailboxCapacity) : client(mailboxCapacity) {}
+
     std::atomic<bool> completed = true;
+    std::atomic<bool> detached = false;  // connection was lost, session waits for resume
+    SessionClock::time_point detachTime;
+    bool ready = false;                 // single-threaded mode: queued to be pumped
     std::thread clientThread;
     ServerClient client;
 };
 
 typedef std::unique_ptr<ClientThread> ClientThreadUPtr;
-typedef std::unique_lock<std::mutex> MutexLock;
+
+// Immutable version of client table, readers get it without locks under EpochGuard
+struct ClientTable
+{
+    std::vector<ClientThread*> clients;
+};
 
 
 class Server::Impl
 {
 public:
     Impl(USHORT port) 
-        : m_pair(std::_Zero_then_variadic_args_t()),
-        m_exit(false),
+        : m_exit(false),
         m_port(port),
-        m_clientThreadsAccessManager(new RWAccessManager),
+        m_clientTable(new ClientTable),
         m_console(Console::GetInstance())
     {
         if(!m_console.IsMultiThreaded())
             m_console.SetMultiThreaded(true);
+        Logger::GetInstance().Start([&console = m_console](const std::wstring& text) { console.Write(text); });
     }
     ~Impl()
     {
+        Logger::GetInstance().Stop();
         if (m_consoleInputThread.joinable())
             m_consoleInputThread.detach();
+        delete m_clientTable.load();
+    }
+    bool Run(bool interactive);
+    void Stop() noexcept
+    {
+        m_exit = true;
+    }
+    void AddListener(std::shared_ptr<Listener> listener)
+    {
+        m_listeners.push_back(std::move(listener));
+    }
+    void SetPresenceNotices(bool enabled)
+    {
+        m_presenceNotices = enabled;
+    }
+    void SetMailboxCapacity(size_t capacity)
+    {
+        m_mailboxCapacity = capacity;
     }
-    bool Run();
+    bool Poll(SessionClock::time_point now);
 
 private:
     void Input();
     bool StartListen() noexcept;
-    bool AcceptClient();
-    void ClientFunction(size_t ind);
+    bool AcceptClient(TransportUPtr transport);
+    bool ProcessConnectRequest(ClientThreadUPtr clThr, ClientMessage& msg);
+    void ClientFunction(ClientThread* thr);
+    bool ProcessClientFrame(ServerClient& client, const std::vector<char>& data, ClientMessage& msg,
+        std::vector<ClientMessage>& batchMsgs);
+    void EndClient(ClientThread& thr, bool connectionLost, bool error);
     void AddClient(ClientThreadUPtr clThr);
+    void PublishClientTable();
+    // Single-threaded server publishes changed table when it is read, not on every join
+    const ClientTable* GetClientTable()
+    {
+        if (m_tableChanged)
+        {
+            m_tableChanged = false;
+            PublishClientTable();
+        }
+        return m_clientTable.load();
+    }
+    void CloseSession(ClientThread& thr);
+    void ExpireDetachedSessions();
+    // Runs on timer, busy listeners mustn't keep detached and retired sessions forever
+    void RunMaintenance()
+    {
+        auto now = Now();
+        if (now < m_nextMaintenance)
+            return;
+        ExpireDetachedSessions();
+        m_epochs.Reclaim();
+        m_nextMaintenance = now + std::chrono::milliseconds(DEF_MAINTENANCE_PERIOD);
+    }
+    bool ResumeSession(ClientMessage& msg, ServerClient& connection);
+    // Single-threaded mode
+    bool AcceptConnection(TransportUPtr transport);
+    void PumpClient(ClientThread& thr);
+    void PumpConnection(ClientThread& thr);
+    void SetWakeup(ClientThread& thr);
+    void MarkReady(ClientThread& thr)
+    {
+        if (thr.ready)
+            return;
+        thr.ready = true;
+        m_ready.push_back(&thr);
+    }
+    // Connection is closed and pumped, so session ends as if connection was lost
+    void DropConnection(ClientThread& thr)
+    {
+        thr.client.Close();
+        MarkReady(thr);
+    }
+    SessionClock::time_point Now() const
+    {
+        return m_manual ? m_now : SessionClock::now();
+    }
+    // Timestamp of server messages, given time of single-threaded mode is on the same scale
+    uint64_t TimeStamp() const
+    {
+        if (!m_manual)
+            return ClientMessage::Now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(m_now.time_since_epoch()).count();
+    }
 
     bool ReceiveData(ServerClient& client, std::vector<char>& data);
 
-    bool ProcessClientConnect(ServerClient* client);
+    static constexpr size_t COMMAND_COUNT = static_cast<size_t>(ClientCommand::COMMAND_COUNT);
+    typedef bool (Impl::*CommandHandler)(ClientMessage&, ServerClient*);
+    struct CommandHandlerTable
+    {
+        CommandHandler handlers[COMMAND_COUNT];
+    };
+    static constexpr CommandHandler GetCommandHandler(ClientCommand command);
+    template <size_t... I>
+    static constexpr CommandHandlerTable MakeCommandHandlerTable(std::index_sequence<I...>);
+
+    bool ReceiveConnectRequest(ServerClient& client, ClientMessage& msg);
+    bool ProcessClientConnect(ClientMessage& msg, ClientThread& thr);
+    void CaptureConnect(const ClientMessage& msg, const ServerClient& client);
+    bool ProcessConnectOptions(ClientMessage& msg, ServerClient* client);
+    bool MakeConnectAccept(ClientMessage& msg, ServerClient* client, SharedFrame& frame);
     bool ProcessReceivedClientData(ClientMessage & msg, ServerClient * client);
     bool ProcessBroadcastSend(ClientMessage& msg, ServerClient* client = nullptr); // send to all clients except specified client if not nullptr
     bool ProcessPrivateSend(ClientMessage& msg, ServerClient* from);
     bool ProcessNameChange(ClientMessage& msg, ServerClient * client);
     bool ProcessClientsListRequest(ClientMessage & msg, ServerClient * client);
     bool ProcessNameAlreadyExists(ClientMessage & msg, ServerClient * client);
+    bool ProcessAck(ClientMessage& msg, ServerClient* client);
 
-    bool IsClientNameExists(const std::wstring& name) const
+    // Name stays reserved until session is completed, session is found by it once added to table.
+    // Returns false if name exists.
+    bool ReserveName(const std::wstring& name)
+    {
+        StatsLock<std::mutex> lk(m_namesMtx, m_namesStats, LOCK_SITE);
+        try
+        {
+            return m_names.emplace(name, nullptr).second;
+        }
+        catch (std::exception&)
+        {
+            return false;
+        }
+    }
+    bool RenameClient(const std::wstring& oldName, const std::wstring& newName)
     {
-        RWLocker lk(*m_clientThreadsAccessManager);
-        return std::find_if(m_clientThreads.begin(), m_clientThreads.end(),
-            [&name](const ClientThreadUPtr& thr)
+        StatsLock<std::mutex> lk(m_namesMtx, m_namesStats, LOCK_SITE);
+        auto it = m_names.find(oldName);
+        if (it == m_names.end())
+            return false;
+        try
+        {
+            if (!m_names.emplace(newName, it->second).second)
+                return false;
+        }
+        catch (std::exception&)
         {
-            return !thr->completed && *thr->client.GetName() == name;
-        }) != m_clientThreads.end();
+            return false;
+        }
+        m_names.erase(oldName);
+        return true;
+    }
+    void SetNameOwner(const std::wstring& name, ClientThread* thr)
+    {
+        StatsLock<std::mutex> lk(m_namesMtx, m_namesStats, LOCK_SITE);
+        auto it = m_names.find(name);
+        if (it != m_names.end())
+            it->second = thr;
+    }
+    void ReleaseName(const std::wstring& name)
+    {
+        StatsLock<std::mutex> lk(m_namesMtx, m_namesStats, LOCK_SITE);
+        m_names.erase(name);
+    }
+    // Session of table stays valid while caller holds EpochGuard
+    ClientThread* FindClient(const std::wstring& name)
+    {
+        StatsLock<std::mutex> lk(m_namesMtx, m_namesStats, LOCK_SITE);
+        auto it = m_names.find(name);
+        return it == m_names.end() ? nullptr : it->second;
     }
     void PrintClientError(const ServerClient& client, std::wstring prefix = L"") const
     {
-        m_console << prefix <<
-            L"\nClient " << (client.GetName() ? *client.GetName() : L"Anon"s) << L' ' << client.Id() << L" error.\n" <<
-            GetErrorMsg() << L"\n";
+        int code = WSAGetLastError();
+        EVENT_LOG("Client {session} error {code} {context}", client.Id(), code, prefix);
+        WSASetLastError(code);
+        CHAT_LOG(Error, L"{}Client {} {} error. {}", prefix, client.GetName() ? *client.GetName() : L"Anon"s,
+            client.Id(), GetErrorMsg());
+    }
+    static uint32_t GetServerCapabilities() noexcept
+    {
+        uint32_t capabilities = CapBatching | CapResume;
+        if (FrameCompressor::IsSupported())
+            capabilities |= CapCompression;
+        return capabilities;
+    }
+    void PrintCompressionStats(const ServerClient& client) const
+    {
+        auto compressor = client.GetCompressor();
+        if (!compressor)
+            return;
+        auto out = compressor->GetDeflateStats();
+        auto in = compressor->GetInflateStats();
+        m_console.Print(L"Client {} {} compression:"
+            L"\n  sent {} of {} frames compressed, {} -> {} bytes, {} us"
+            L"\n  received {} compressed frames, {} -> {} bytes, {} us\n",
+            *client.GetName(), client.Id(),
+            out.nCompressedFrames, out.nFrames, out.rawBytes, out.wireBytes, out.cpuTimeNs / 1000,
+            in.nCompressedFrames, in.wireBytes, in.rawBytes, in.cpuTimeNs / 1000);
+    }
+    static bool MakeFrame(ClientMessage& msg, SharedFrame& frame)
+    {
+        frame.data = msg.Serialize(&frame.size);
+        return !!frame.data;
+    }
+    // Token is the only proof of session ownership, so it comes from system CSPRNG. 0 - failed
+    static uint64_t GenerateResumeToken()
+    {
+        uint64_t token = 0;
+        while (!token)
+            if (!BCRYPT_SUCCESS(BCryptGenRandom(nullptr, reinterpret_cast<PUCHAR>(&token), sizeof(token),
+                BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+                return 0;
+        return token;
     }
     void MakeServerMessage(ClientMessage& msg, std::wstring& str)
     {
@@ -83,75 +278,234 @@ private:
         msg.from = L"Server"s;
         msg.pmTo.clear();
         msg.msg = std::move(str);
-        msg.timeStamp = time(nullptr);
+        msg.timeStamp = TimeStamp();
     }
 
 private:
-    std::_Compressed_pair<WSAInit, CSOCKET> m_pair;
+    WSAInit m_wsaInit;
+    std::vector<std::shared_ptr<Listener>> m_listeners;
     std::atomic_bool m_exit;
     std::thread m_consoleInputThread;
     std::vector<std::wstring> m_sendMsgs;
-    std::vector<ClientThreadUPtr> m_clientThreads;
-    std::unique_ptr<RWAccessManager> m_clientThreadsAccessManager;
+    std::vector<ClientThreadUPtr> m_clientThreads;  // changed only by accepting thread
+    std::atomic<const ClientTable*> m_clientTable;  // published copy of m_clientThreads
+    std::atomic<size_t> m_nCompleted{ 0 };          // completed sessions in m_clientThreads
+    std::vector<ClientThreadUPtr> m_replacedThreads; // taken out of m_clientThreads, retired on publish
+    std::mutex m_namesMtx;
+    LockStats m_namesStats{ "server.names" };
+    std::unordered_map<std::wstring, ClientThread*> m_names;    // of sessions that aren't completed
+    bool m_presenceNotices = true;
+    size_t m_mailboxCapacity = DEF_MAILBOX_CAPACITY;
+    SessionClock::time_point m_nextMaintenance;
+    EpochManager m_epochs;
     Console& m_console;
     USHORT m_port;
+    // Single-threaded mode
+    bool m_manual = false;
+    SessionClock::time_point m_now;
+    std::vector<ClientThread*> m_ready;
+    bool m_tableChanged = false;
+    std::unordered_map<ClientThread*, ClientThreadUPtr> m_connecting; // waiting for connect request
+    std::vector<char> m_frame;
+    ClientMessage m_msg;
+    std::vector<ClientMessage> m_batchMsgs;
 };
 
-bool Server::Impl::Run()
+bool Server::Impl::Run(bool interactive)
 {
     if (!StartListen())
         return false;
 
-    m_consoleInputThread = std::thread(&Impl::Input, this);
-
     m_exit = false;
+    if (interactive)
+        m_consoleInputThread = std::thread(&Impl::Input, this);
+
     bool error = false;
-    timeval waitTime = { 0, 0 };
-    fd_set fd;
 
-    while (!m_exit)
+    while (!m_exit && !error)
     {
-        FD_ZERO(&fd);
-        FD_SET(m_pair._Get_second().Get(), &fd);
-        int selectRes = ::select(1, &fd, nullptr, nullptr, &waitTime);
-        if (selectRes == 0)
-        {
-            std::this_thread::sleep_for(100ms);
-        }
-        else if (selectRes < 0)
-        {
-            m_exit = true;
-            error = true;
-            break;
-        }
-        else if (!AcceptClient())
+        RunMaintenance();
+
+        bool accepted = false;
+        for (auto& listener : m_listeners)
         {
-            m_console << L"Client accept error.\n" << GetErrorMsg() << L"\n";
+            TransportUPtr transport;
+            if (!listener->Accept(transport))
+            {
+                EVENT_LOG("Listener error {code}", WSAGetLastError());
+                CHAT_LOG(Error, L"Listener error. {}", GetErrorMsg());
+                m_exit = true;
+                error = true;
+                break;
+            }
+            if (!transport)
+                continue;
+            accepted = true;
+            if (!AcceptClient(std::move(transport)))
+            {
+                EVENT_LOG("Accept error {code}", WSAGetLastError());
+                CHAT_LOG(Error, L"Client accept error. {}", GetErrorMsg());
+            }
         }
+        if (!accepted && !error)
+            std::this_thread::sleep_for(100ms);
     }
 
-    if (error)
+    if (error && interactive)
         m_console.Write(L"Server shutdown, enter to continue\n");
 
     if (m_consoleInputThread.joinable())
         m_consoleInputThread.join();
 
-    RWLocker lk(*m_clientThreadsAccessManager, true);
     // close client sokets
     for (auto& thr : m_clientThreads)
     {
-        if (thr->client.GetSocket())
-            thr->client.GetSocket()->Reset();
+        thr->client.Close();
         if (thr->clientThread.joinable())
             thr->clientThread.join();
     }
     
-    m_console.Write(L"Press any key\n"s);
-    wchar_t ch;
-    m_console.ReadChar(ch);
+    Logger::GetInstance().Flush();
+    if (interactive)
+    {
+        m_console.Write(L"Press any key\n"s);
+        wchar_t ch;
+        m_console.ReadChar(ch);
+    }
     return !error;
 }
 
+bool Server::Impl::Poll(SessionClock::time_point now)
+{
+    if (!m_manual)
+    {
+        m_manual = true;
+        m_exit = false;
+        if (!StartListen())
+            return false;
+    }
+    m_now = now;
+
+    for (auto& listener : m_listeners)
+    {
+        for (;;)
+        {
+            TransportUPtr transport;
+            if (!listener->Accept(transport))
+                return false;
+            if (!transport)
+                break;
+            if (!AcceptConnection(std::move(transport)))
+            {
+                EVENT_LOG("Accept error {code}", WSAGetLastError());
+                CHAT_LOG(Error, L"Client accept error. {}", GetErrorMsg());
+            }
+        }
+    }
+
+    // Pumped clients may drop other connections, those are pumped in the next round
+    std::vector<ClientThread*> ready;
+    while (!m_ready.empty())
+    {
+        ready.swap(m_ready);
+        for (ClientThread* thr : ready)
+        {
+            thr->ready = false;
+            if (m_connecting.count(thr))
+                PumpConnection(*thr);
+            else
+                PumpClient(*thr);
+        }
+        ready.clear();
+    }
+
+    RunMaintenance();
+    return true;
+}
+bool Server::Impl::AcceptConnection(TransportUPtr transport)
+{
+    ClientThreadUPtr clThr(new (std::nothrow) ClientThread(m_mailboxCapacity));
+    if (!clThr)
+    {
+        WSASetLastError(ERROR_OUTOFMEMORY);
+        return false;
+    }
+    if (!clThr->client.Init(std::move(transport)) || !clThr->client.SetNonBlocking(true))
+        return false;
+
+    ClientThread& thr = *clThr;
+    SetWakeup(thr);
+    try { m_connecting.emplace(&thr, std::move(clThr)); }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
+    // Connect request may have arrived already
+    MarkReady(thr);
+    return true;
+}
+void Server::Impl::SetWakeup(ClientThread& thr)
+{
+    if (!thr.client.SetWakeup([this, &thr]() { MarkReady(thr); }))
+    {
+        // Transport without wakeup would never be pumped
+        WSASetLastError(WSAEOPNOTSUPP);
+        PrintClientError(thr.client, L"Single-threaded server: "s);
+        thr.client.Close();
+    }
+}
+// Takes connect request of accepted connection, the connection becomes a session or is dropped
+void Server::Impl::PumpConnection(ClientThread& thr)
+{
+    ServerClient& client = thr.client;
+    bool closed = false;
+    bool ready = false;
+    bool ok = client.FlushSend() && client.RecvAvailable(closed) && client.NextFrame(m_frame, ready);
+    if (ok && !ready && !closed)
+        return;
+
+    auto it = m_connecting.find(&thr);
+    ClientThreadUPtr clThr = std::move(it->second);
+    m_connecting.erase(it);
+    if (!ok || !ready)
+    {
+        PrintClientError(client);
+        return;
+    }
+    m_msg.Unserialize(m_frame.data(), static_cast<uint32_t>(m_frame.size()));
+    if (m_msg.command != ClientCommand::ClientConnect)
+        return;
+    if (m_msg.resumeToken && ResumeSession(m_msg, client))
+        return;
+
+    clThr->completed = false;
+    if (!ProcessClientConnect(m_msg, thr))
+        return;
+    AddClient(std::move(clThr));
+    // Frames that came with connect request wait in buffer of new session
+    MarkReady(thr);
+}
+// Does what client thread does with frames transport has now
+void Server::Impl::PumpClient(ClientThread& thr)
+{
+    ServerClient& client = thr.client;
+    if (thr.completed || thr.detached)
+        return;
+
+    bool error = false;
+    bool closed = false;
+    bool received = client.FlushSend() && client.RecvAvailable(closed);
+    int lostErr = WSAGetLastError();
+    // Frames received before connection was lost are processed
+    for (bool ready = true; !error && ready;)
+    {
+        error = !client.NextFrame(m_frame, ready);
+        if (!error && ready)
+            error = !ProcessClientFrame(client, m_frame, m_msg, m_batchMsgs);
+    }
+    if (!received && !error)
+        error = lostErr != WSAECONNRESET;
+    if (error || !received || closed)
+        EndClient(thr, !received, error);
+}
+
 void Server::Impl::Input()
 {
     std::wstring inp;
@@ -163,67 +517,116 @@ void Server::Impl::Input()
             m_exit = true;
             return;
         }
+        else if (inp == L"locks")
+            m_console.Write(LockStats::Report());
+        else if (inp == L"locks reset")
+        {
+            LockStats::ResetAll();
+            m_console.Write(L"Lock statistics reset\n"s);
+        }
+        else if (inp.compare(0, 4, L"log ") == 0)
+        {
+            if (Logger::SetLevel(inp.substr(4)))
+                m_console.Print(L"Log level {}\n", Logger::GetLevelName(Logger::GetLevel()));
+            else
+                m_console.Write(L"Log levels: error, warning, info, debug, trace\n"s);
+        }
     }
 }
 
 inline bool Server::Impl::StartListen() noexcept
 {
-    CSOCKADDR_IN saddr(AF_INET, htons(m_port), ADDR_ANY);
-    if (!m_pair._Get_second().Init(PF_INET, SOCK_STREAM, IPPROTO_TCP))
-        return false;
-
-    if (::bind(m_pair._Get_second(), saddr, saddr.Size()) != 0)
-        return false;
+    if (m_port == 0)
+        return !m_listeners.empty();
 
-    if (::listen(m_pair._Get_second(), SOMAXCONN) != 0)
+    std::shared_ptr<SocketListener> listener(new (std::nothrow) SocketListener);
+    if (!listener || !listener->ListenTcp(m_port))
         return false;
+    try { m_listeners.insert(m_listeners.begin(), std::move(listener)); }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
     return true;
 }
-bool Server::Impl::AcceptClient()
+bool Server::Impl::AcceptClient(TransportUPtr transport)
 {
-    ClientThreadUPtr clThr(new (std::nothrow) ClientThread);
+    ClientThreadUPtr clThr(new (std::nothrow) ClientThread(m_mailboxCapacity));
     if (!clThr)
     {
-        ::closesocket(::accept(m_pair._Get_second(), nullptr, nullptr));
         WSASetLastError(ERROR_OUTOFMEMORY);
         return false;
     }
-    clThr->client.Init(m_pair._Get_second());
-    if (!clThr->client)
+    if (!clThr->client.Init(std::move(transport)))
         return false;
 
+    ClientMessage msg;
+    if (!ReceiveConnectRequest(clThr->client, msg))
+        return true;
+    return ProcessConnectRequest(std::move(clThr), msg);
+}
+bool Server::Impl::ProcessConnectRequest(ClientThreadUPtr clThr, ClientMessage& msg)
+{
+    if (msg.resumeToken && ResumeSession(msg, clThr->client))
+        return true;
+
     clThr->completed = false;
 
-    if (ProcessClientConnect(&clThr->client))
+    if (ProcessClientConnect(msg, *clThr))
         AddClient(std::move(clThr));
     return true;
 }
 void Server::Impl::AddClient(ClientThreadUPtr clThr)
 {
-    RWLocker rwlk(*m_clientThreadsAccessManager, true);
-
-    auto ind = std::find_if(m_clientThreads.begin(), m_clientThreads.end(),
-        [](const ClientThreadUPtr& cl) { return cl->completed.load(); })
-        - m_clientThreads.begin();
+    ClientThread* thr = clThr.get();
+    // Table isn't searched for completed session while there is none, joins take constant time
+    auto it = m_clientThreads.end();
+    if (m_nCompleted)
+    {
+        it = std::find_if(m_clientThreads.begin(), m_clientThreads.end(),
+            [](const ClientThreadUPtr& cl) { return cl->completed.load(); });
+    }
 
-    if (ind == m_clientThreads.size())
-        m_clientThreads.resize(ind + 1);
-    else if (m_clientThreads[ind]->clientThread.joinable())
-        m_clientThreads[ind]->clientThread.join();
+    if (it == m_clientThreads.end())
+        m_clientThreads.push_back(std::move(clThr));
+    else
+    {
+        if ((*it)->clientThread.joinable())
+            (*it)->clientThread.join();
+        // Published table still has completed session, it's retired after the table
+        m_replacedThreads.push_back(std::move(*it));
+        *it = std::move(clThr);
+        --m_nCompleted;
+    }
+    if (m_manual)
+        m_tableChanged = true;
+    else
+        PublishClientTable();
+    SetNameOwner(*thr->client.GetName(), thr);
 
-    clThr->clientThread = std::thread(&Impl::ClientFunction, this, ind);
+    if (!m_manual)
+        thr->clientThread = std::thread(&Impl::ClientFunction, this, thr);
+}
+void Server::Impl::PublishClientTable()
+{
+    std::unique_ptr<ClientTable> table(new ClientTable);
+    table->clients.reserve(m_clientThreads.size());
+    for (const auto& thr : m_clientThreads)
+        table->clients.push_back(thr.get());
 
-    m_clientThreads[ind] = std::move(clThr);
+    m_epochs.Retire(m_clientTable.exchange(table.release()));
+    // Readers of old table can still use them, both are deleted together
+    for (auto& thr : m_replacedThreads)
+        m_epochs.Retire(thr.release());
+    m_replacedThreads.clear();
 }
 
-void Server::Impl::ClientFunction(size_t ind)
+void Server::Impl::ClientFunction(ClientThread* pThr)
 {
-    RWLocker rwlk(*m_clientThreadsAccessManager);
-    ServerClient& client = m_clientThreads[ind]->client;
-    rwlk.Unlock();
+    ClientThread& thr = *pThr;
+    ServerClient& client = thr.client;
 
     bool error = false;
+    bool connectionLost = false;
     std::vector<char> data;
+    std::vector<ClientMessage> batchMsgs;
     ClientMessage clMsg;
 
     while (!m_exit && !error)
@@ -232,28 +635,155 @@ void Server::Impl::ClientFunction(size_t ind)
         {
             if (data.size() == 0) // Client disconnected
                 break;
-            clMsg.Unserialize(data.data(), data.size());
-
-            if (!ProcessReceivedClientData(clMsg, &client))
-                error = true;
+            error = !ProcessClientFrame(client, data, clMsg, batchMsgs);
         }
         else
         {
+            connectionLost = true;
             if(WSAGetLastError() != WSAECONNRESET)
                 error = true;
             break;
         }
     }
+    EndClient(thr, connectionLost, error);
+}
+bool Server::Impl::ProcessClientFrame(ServerClient& client, const std::vector<char>& data, ClientMessage& msg,
+    std::vector<ClientMessage>& batchMsgs)
+{
+    uint32_t size = static_cast<uint32_t>(data.size());
+    if (TrafficCapture::IsOpen())
+        TrafficCapture::GetInstance().Write(CaptureFormat::Frame, client.Id(), data.data(), size);
+    if (MessageBatch::IsBatch(data.data(), size))
+    {
+        batchMsgs.clear();
+        if (!MessageBatch::Unserialize(data.data(), size, batchMsgs))
+            return false;
+        for (auto& batchMsg : batchMsgs)
+        {
+            batchMsg.timeStamp = ClientMessage::FromProtocolTimeStamp(batchMsg.timeStamp, client.GetProtocolVersion());
+            if (!ProcessReceivedClientData(batchMsg, &client))
+                return false;
+        }
+        return true;
+    }
+    msg.Unserialize(data.data(), size);
+    // Frames are shared by sessions of all versions, so they carry timestamps in current units
+    msg.timeStamp = ClientMessage::FromProtocolTimeStamp(msg.timeStamp, client.GetProtocolVersion());
+    return ProcessReceivedClientData(msg, &client);
+}
+void Server::Impl::EndClient(ClientThread& thr, bool connectionLost, bool error)
+{
+    ServerClient& client = thr.client;
     if (error)
-        PrintClientError(client, L"Terminating client thread");
+        PrintClientError(client, L"Terminating client thread: ");
+    PrintCompressionStats(client);
 
-    MakeServerMessage(clMsg, *client.GetName() + L" leaves the chat."s);
-    ProcessBroadcastSend(clMsg, &client);
-    
-    client.GetSocket()->Reset();
+    if (connectionLost && !m_exit && client.GetResumeToken())
+    {
+        // Session waits for the client to reconnect, frames posted to it are kept for resend
+        client.Detach();
+        EVENT_LOG("Client {session} connection lost", client.Id());
+        CHAT_LOG(Info, L"Client {} {} connection lost, waiting for resume", *client.GetName(), client.Id());
+        thr.detachTime = Now();
+        thr.detached = true;
+        return;
+    }
+
+    CloseSession(thr);
+}
+void Server::Impl::CloseSession(ClientThread& thr)
+{
+    EVENT_LOG("Client {session} {name} disconnected", thr.client.Id(), *thr.client.GetName());
+    if (TrafficCapture::IsOpen())
+        TrafficCapture::GetInstance().Write(CaptureFormat::Close, thr.client.Id(), nullptr, 0);
+    if (m_presenceNotices)
+    {
+        ClientMessage msg;
+        MakeServerMessage(msg, *thr.client.GetName() + L" leaves the chat."s);
+        ProcessBroadcastSend(msg, &thr.client);
+    }
+
+    thr.client.Disconnect();
+    ReleaseName(*thr.client.GetName());
+    thr.completed = true;
+    ++m_nCompleted;
+}
+void Server::Impl::ExpireDetachedSessions()
+{
+    std::vector<ClientThread*> expired;
+    auto deadline = Now() - std::chrono::seconds(DEF_RESUME_GRACE_PERIOD);
+
+    for (const auto& thr : m_clientThreads)
+    {
+        if (thr->detached && thr->detachTime < deadline)
+        {
+            thr->detached = false;
+            expired.push_back(thr.get());
+        }
+    }
+
+    // Slots of expired sessions are reused only by this thread, so pointers stay valid
+    for (auto thr : expired)
+    {
+        if (thr->clientThread.joinable())
+            thr->clientThread.join();
+        EVENT_LOG("Client {session} session expired", thr->client.Id());
+        CHAT_LOG(Info, L"Client {} {} session expired", *thr->client.GetName(), thr->client.Id());
+        CloseSession(*thr);
+    }
+}
+bool Server::Impl::ResumeSession(ClientMessage& msg, ServerClient& connection)
+{
+    // Resumed stream is sequenced, sequence numbers are sent in batch frames only
+    if (msg.protocolVersion < 3 || !(msg.capabilities & CapResume) || !(msg.capabilities & CapBatching))
+        return false;
+
+    // Client table is changed only by this thread
+    auto it = std::find_if(m_clientThreads.begin(), m_clientThreads.end(),
+        [token = msg.resumeToken](const ClientThreadUPtr& thr)
+        {
+            return !thr->completed && thr->client.GetResumeToken() == token;
+        });
+    if (it == m_clientThreads.end())
+        return false;
+    ClientThread& thr = **it;
+
+    // Client reconnected before the old connection failed on server side, drop that connection
+    if (!thr.detached)
+    {
+        thr.client.Close();
+        // Single-threaded server ends the connection here, as client thread would
+        if (m_manual)
+            EndClient(thr, true, false);
+    }
+    if (thr.clientThread.joinable())
+        thr.clientThread.join();
+
+    if (!thr.detached.exchange(false))
+        return false;
+    if (!thr.client.CanResume(msg.sequence))
+    {
+        // Client missed frames that aren't kept anymore, it will join as a new client
+        CloseSession(thr);
+        return false;
+    }
+
+    thr.client.Attach(connection);
+    if (m_manual)
+        SetWakeup(thr);
+    // Connect request becomes ConnectAccept, keep sequence client has received up to
+    uint64_t lastSequence = msg.sequence;
+    SharedFrame frame;
+    if (!MakeConnectAccept(msg, &thr.client, frame) || !thr.client.Resume(lastSequence, frame))
+        PrintClientError(thr.client, L"Session resume: "s);
+    EVENT_LOG("Client {session} resumed from {sequence}", thr.client.Id(), lastSequence);
+    CHAT_LOG(Info, L"Client {} {} resumed session from message {}", *thr.client.GetName(), thr.client.Id(), lastSequence);
 
-    rwlk.Lock(true);
-    m_clientThreads[ind]->completed = true;
+    if (m_manual)
+        MarkReady(thr);
+    else
+        thr.clientThread = std::thread(&Impl::ClientFunction, this, &thr);
+    return true;
 }
 bool Server::Impl::ReceiveData(ServerClient& client, std::vector<char>& data)
 {
@@ -263,104 +793,197 @@ bool Server::Impl::ReceiveData(ServerClient& client, std::vector<char>& data)
     else if (received == 0)
         return true;
 
-    m_console << L"Client " << *client.GetName() << L" " << client.Id() <<
-        L" recieved " << received << L" of " << data.size() << L"\n";
+    CHAT_LOG(Trace, L"Client {} {} received {} of {}", *client.GetName(), client.Id(), received, data.size());
 
     data.resize(received);
     return true;
 }
 
 
-bool Server::Impl::ProcessClientConnect(ServerClient* client)
+bool Server::Impl::ReceiveConnectRequest(ServerClient& client, ClientMessage& msg)
 {
-    ClientMessage msg;
     std::vector<char> rcvData;
-    if (!ReceiveData(*client, rcvData) || rcvData.size() == 0)
+    if (!ReceiveData(client, rcvData) || rcvData.size() == 0)
     {
-        PrintClientError(*client);
+        PrintClientError(client);
         return false;
     }
-    msg.Unserialize(rcvData.data(), rcvData.size());
-    if (msg.command != ClientCommand::ClientConnect)
-        return false;
+    msg.Unserialize(rcvData.data(), static_cast<uint32_t>(rcvData.size()));
+    return msg.command == ClientCommand::ClientConnect;
+}
+bool Server::Impl::ProcessClientConnect(ClientMessage& msg, ClientThread& thr)
+{
+    ServerClient* client = &thr.client;
     client->SetName(msg.from);
+    if (TrafficCapture::IsOpen())
+        CaptureConnect(msg, *client);
 
-    if (!IsClientNameExists(*client->GetName()))
+    if (ReserveName(*client->GetName()))
     {
+        if (!ProcessConnectOptions(msg, client))
+        {
+            PrintClientError(*client);
+            ReleaseName(*client->GetName());
+            return false;
+        }
+        EVENT_LOG("Client {session} {name} connected, protocol {protocol} capabilities {capabilities}",
+            client->Id(), *client->GetName(), msg.protocolVersion, msg.capabilities);
+        if (!m_presenceNotices)
+            return true;
         MakeServerMessage(msg, *client->GetName() + L" joined to the chat."s);
-        return (ProcessBroadcastSend(msg, client) && ProcessClientsListRequest(msg, client));
+        if (ProcessBroadcastSend(msg, client) && ProcessClientsListRequest(msg, client))
+            return true;
+        ReleaseName(*client->GetName());
+        return false;
     }
     else
     {
+        EVENT_LOG("Client {session} {name} rejected, name exists", client->Id(), *client->GetName());
         msg.msg = msg.from;
         ProcessNameAlreadyExists(msg, client);
         return false;
     }
 }
-bool Server::Impl::ProcessReceivedClientData(ClientMessage& msg, ServerClient* client)
+// Resumed sessions aren't captured again, their frames continue those of the session
+void Server::Impl::CaptureConnect(const ClientMessage& msg, const ServerClient& client)
+{
+    ClientMessage connect = msg;
+    uint32_t size = 0;
+    auto data = connect.Serialize(&size);
+    if (data)
+        TrafficCapture::GetInstance().Write(CaptureFormat::Connect, client.Id(), data.get(), size);
+}
+bool Server::Impl::ProcessConnectOptions(ClientMessage& msg, ServerClient* client)
+{
+    if (msg.protocolVersion < 2) // client doesn't support connection options
+        return true;
+
+    SharedFrame frame;
+    if (!MakeConnectAccept(msg, client, frame) || !client->PostData(frame))
+        return false;
+
+    if (client->HasCapability(CapCompression))
+        client->InitCompression();
+    // Frames posted after ConnectAccept belong to the sequenced stream
+    if (client->HasCapability(CapResume))
+        client->EnableResume(msg.resumeToken);
+    return true;
+}
+bool Server::Impl::MakeConnectAccept(ClientMessage& msg, ServerClient* client, SharedFrame& frame)
+{
+    uint32_t version = (std::min)(msg.protocolVersion, PROTOCOL_VERSION);
+    uint32_t capabilities = msg.capabilities & GetServerCapabilities();
+
+    // Client is able to decompress frames since it offered compression,
+    // so we may compress all frames sent after ConnectAccept
+    if ((capabilities & CapCompression) && !client->InitDecompression())
+        capabilities &= ~CapCompression;
+    // Sequence numbers are sent in batch frames
+    if (version < 3 || !(capabilities & CapBatching))
+        capabilities &= ~CapResume;
+
+    uint64_t token = 0;
+    if (capabilities & CapResume)
+        token = client->GetResumeToken() ? client->GetResumeToken() : GenerateResumeToken();
+    if (!token)
+        capabilities &= ~CapResume;
+
+    client->SetConnectionOptions(version, capabilities);
+
+    msg.command = ClientCommand::ConnectAccept;
+    msg.from = L"Server"s;
+    msg.pmTo.clear();
+    msg.msg.clear();
+    msg.protocolVersion = version;
+    msg.capabilities = capabilities;
+    msg.resumeToken = token;
+    msg.sequence = 0;
+    msg.timeStamp = TimeStamp();
+
+    return MakeFrame(msg, frame);
+}
+constexpr Server::Impl::CommandHandler Server::Impl::GetCommandHandler(ClientCommand command)
 {
-    // Process received data
-    switch (msg.command)
+    switch (command)
     {
         case ClientCommand::BroadcastMessage:
-            return ProcessBroadcastSend(msg, client);
+            return &Impl::ProcessBroadcastSend;
         case ClientCommand::PrivateMessage:
-            return ProcessPrivateSend(msg, client);
+            return &Impl::ProcessPrivateSend;
         case ClientCommand::ChangeName:
-            return ProcessNameChange(msg, client);
+            return &Impl::ProcessNameChange;
         case ClientCommand::ListClients:
-            return ProcessClientsListRequest(msg, client);
-        case ClientCommand::Error:
+            return &Impl::ProcessClientsListRequest;
+        case ClientCommand::Ack:
+            return &Impl::ProcessAck;
         default:
-            return false;
+            return nullptr;
     }
 }
+template <size_t... I>
+constexpr Server::Impl::CommandHandlerTable Server::Impl::MakeCommandHandlerTable(std::index_sequence<I...>)
+{
+    return CommandHandlerTable{ { GetCommandHandler(static_cast<ClientCommand>(I))... } };
+}
+bool Server::Impl::ProcessReceivedClientData(ClientMessage& msg, ServerClient* client)
+{
+    // Handlers of commands that can be received from client, indexed by command
+    static constexpr CommandHandlerTable table = MakeCommandHandlerTable(std::make_index_sequence<COMMAND_COUNT>());
+
+    auto ind = static_cast<size_t>(msg.command);
+    if (ind >= COMMAND_COUNT || !table.handlers[ind])
+        return false;
+    return (this->*table.handlers[ind])(msg, client);
+}
 bool Server::Impl::ProcessBroadcastSend(ClientMessage& msg, ServerClient* client)
 {
-    uint32_t size = 0;
-    auto data = msg.Serialize(&size);
-    if (!data)
+    SharedFrame frame;
+    if (!MakeFrame(msg, frame))
         return false;
 
-    RWLocker rwlk(*m_clientThreadsAccessManager);
-    for (const auto& cl : m_clientThreads)
+    EpochGuard guard(m_epochs);
+    for (auto cl : GetClientTable()->clients)
     {
         if (&cl->client != client && !cl->completed)
         {
-            if (!cl->client.SendData(data.get(), size))
-                PrintClientError(cl->client, L"Sending data error\n"s);
+            if (!cl->client.PostData(frame))
+            {
+                PrintClientError(cl->client, L"Sending data: "s);
+                // Slow reader can't block single-threaded server
+                if (m_manual)
+                    DropConnection(*cl);
+            }
         }
     }
     return true;
 }
 bool Server::Impl::ProcessPrivateSend(ClientMessage& msg, ServerClient* receivedFrom)
 {
-    uint32_t size = 0;
-    auto data= msg.Serialize(&size);
-    if (!data)
+    SharedFrame frame;
+    if (!MakeFrame(msg, frame))
         return false;
-    
-    RWLocker rwlk(*m_clientThreadsAccessManager);
-    auto clIt = std::find_if(m_clientThreads.begin(), m_clientThreads.end(),
-        [name = &msg.pmTo](const ClientThreadUPtr& cl) 
-        {
-            return *cl->client.GetName() == *name && !cl->completed; 
-        });
-    if (clIt == m_clientThreads.end())
+
+    EpochGuard guard(m_epochs);
+    ClientThread* recipient = FindClient(msg.pmTo);
+    if (!recipient)
     {
         MakeServerMessage(msg, L"There is no user with name "s + msg.pmTo);
-        data = msg.Serialize(&size);
-        if (!data || !receivedFrom->SendData(data.get(), size))
+        if (!MakeFrame(msg, frame) || !receivedFrom->PostData(frame))
             return false;
     }
-    else if (!(*clIt)->client.SendData(data.get(), size))
-        return false;
+    // Failure of recipient doesn't end the session of sender
+    else if (!recipient->client.PostData(frame))
+    {
+        PrintClientError(recipient->client, L"Sending data: "s);
+        if (m_manual)
+            DropConnection(*recipient);
+    }
     
     return true;
 }
 bool Server::Impl::ProcessNameChange(ClientMessage& msg, ServerClient* client)
 {
-    if (!IsClientNameExists(msg.msg))
+    if (RenameClient(*client->GetName(), msg.msg))
     {
         std::wstring oldName = *client->GetName();
         client->SetName(std::move(msg.msg));
@@ -373,16 +996,17 @@ bool Server::Impl::ProcessNameChange(ClientMessage& msg, ServerClient* client)
 bool Server::Impl::ProcessClientsListRequest(ClientMessage& msg, ServerClient* client)
 {
     std::wstring list;
-    RWLocker rwlk(*m_clientThreadsAccessManager);
-    for (const auto& cl : m_clientThreads)
     {
-        if (!cl->completed)
+        EpochGuard guard(m_epochs);
+        for (auto cl : GetClientTable()->clients)
         {
-            list += *cl->client.GetName();
-            list += L'\n';
+            if (!cl->completed)
+            {
+                list += *cl->client.GetName();
+                list += L'\n';
+            }
         }
     }
-    rwlk.Unlock();
 
     if (list.empty())
         list = L"there are no active users";
@@ -391,24 +1015,28 @@ bool Server::Impl::ProcessClientsListRequest(ClientMessage& msg, ServerClient* c
 
     MakeServerMessage(msg, L"Current active users:\n"s + list);
 
-    uint32_t size = 0;
-    auto data = msg.Serialize(&size);
-    if (!data)
+    SharedFrame frame;
+    if (!MakeFrame(msg, frame))
         return false;
 
-    return client->SendData(data.get(), size);
+    return client->PostData(frame);
 }
 bool Server::Impl::ProcessNameAlreadyExists(ClientMessage& msg, ServerClient * client)
 {
     MakeServerMessage(msg, L"ErrorNameAlreadyExists "s + msg.msg + L' ' + *client->GetName());
-    uint32_t size;
-    auto data = msg.Serialize(&size);
-    if (!data)
+    SharedFrame frame;
+    if (!MakeFrame(msg, frame))
         return false;
-    return client->SendData(data.get(), size);
+    return client->PostData(frame);
 }
 
 
+bool Server::Impl::ProcessAck(ClientMessage& msg, ServerClient* client)
+{
+    client->Ack(msg.sequence);
+    return true;
+}
+
 
 //------------------------------------------------------------------------------
 
@@ -417,7 +1045,27 @@ Server& Server::operator = (Server&&) = default;
 
 Server::Server(uint16_t port) : m_impl(new Impl(port)) {}
 Server::~Server() {}
-bool Server::Run()
+void Server::AddListener(std::shared_ptr<Listener> listener)
+{
+    m_impl->AddListener(std::move(listener));
+}
+bool Server::Run(bool interactive)
+{
+    return m_impl->Run(interactive);
+}
+void Server::Stop()
+{
+    m_impl->Stop();
+}
+void Server::SetPresenceNotices(bool enabled)
+{
+    m_impl->SetPresenceNotices(enabled);
+}
+void Server::SetMailboxCapacity(size_t capacity)
+{
+    m_impl->SetMailboxCapacity(capacity);
+}
+bool Server::Poll(std::chrono::steady_clock::time_point now)
 {
-    return m_impl->Run();
+    return m_impl->Poll(now);
 }
@@ -2,11 +2,22 @@
 #define _SERVER_H_
 
 #include <memory>
+#include <chrono>
 
 #ifndef DEF_SERV_PORT 
 #define DEF_SERV_PORT 51488
 #endif
 
+#ifndef DEF_RESUME_GRACE_PERIOD
+#define DEF_RESUME_GRACE_PERIOD 30 // seconds the session of a lost connection waits for resume
+#endif
+
+#ifndef DEF_MAINTENANCE_PERIOD
+#define DEF_MAINTENANCE_PERIOD 500 // ms between expiring detached sessions and reclaiming retired ones
+#endif
+
+class Listener;
+
 class Server
 {
 public:
@@ -16,10 +27,30 @@ public:
     Server(Server&&);
     Server& operator = (Server&&);
 
+    // Port 0 - no TCP listener, connections come from added listeners only
     Server(uint16_t port = DEF_SERV_PORT);
     ~Server();
 
-    bool Run();
+    // Accepts connections of listener besides TCP port, called before Run
+    void AddListener(std::shared_ptr<Listener> listener);
+
+    // Interactive server reads commands from console and waits for a key after shutdown,
+    // otherwise it runs until Stop
+    bool Run(bool interactive = true);
+    // Can be called from any thread
+    void Stop();
+
+    // Off - joins and leaves aren't announced to everyone and joined client doesn't get user list.
+    // Each of them costs a frame per client, so joining N clients costs N² frames. Called before Run or Poll.
+    void SetPresenceNotices(bool enabled);
+    // Frames posted to a client and not sent yet, DEF_MAILBOX_CAPACITY by default. Called before Run or Poll.
+    void SetMailboxCapacity(size_t capacity);
+
+    // Single-threaded drive instead of Run, used by simulation: no client threads are started
+    // and nothing waits. Each call accepts connections of listeners and processes frames of
+    // connections whose transport called its wakeup hook; other transports can't be used.
+    // now replaces steady clock for expiry of detached sessions and timestamps of server messages.
+    bool Poll(std::chrono::steady_clock::time_point now);
 private:
     class Impl;
     std::unique_ptr<Impl> m_impl;   
@@ -1,6 +1,25 @@
 #include "ServerClient.h"
 #include "ClientBase.h"
+#include "ClientMessage.h"
+#include "LockStats.h"
+#include "Mailbox.h"
 #include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+typedef StatsLock<std::mutex> MutexLock;
+
+struct QueuedFrame
+{
+    SharedFrame frame;
+    uint64_t sequence;  // 0 - frame is sent outside of sequenced stream
+};
+
+constexpr size_t MAX_FRAMES_PER_DRAIN = 256;
+
+// Send locks of all sessions share statistics
+static LockStats postStats("session.post");
 
 
 class ServerClient::Impl : public ClientBase
@@ -12,17 +31,16 @@ public:
     Impl(Impl&&) = default;
     Impl& operator = (Impl&&) = default;
 
-    Impl() noexcept : m_id(idCounter++) {}
-    Impl(SOCKET listenSock) noexcept : Impl()
+    explicit Impl(size_t mailboxCapacity = DEF_MAILBOX_CAPACITY) : m_id(idCounter++), m_mailbox(mailboxCapacity) {}
+    Impl(TransportUPtr transport) noexcept : Impl()
     {
-        Init(listenSock);
+        Init(std::move(transport));
     }
     virtual ~Impl() noexcept {}
 
-    bool Init(SOCKET listenSock) noexcept
+    bool Init(TransportUPtr transport) noexcept
     {
-        int len = m_addr.Size();
-        m_socket.Reset(::accept(listenSock, m_addr, &len));
+        SetTransport(std::move(transport));
         return !!*this;
     }
 
@@ -31,11 +49,263 @@ public:
         return m_id;
     }
 
-    explicit operator bool() const noexcept { return !!*this; }
-    bool operator !() const noexcept { return !m_socket; }
+    bool PostData(const SharedFrame& frame) noexcept
+    {
+        // Sequence number is given when frame is taken from mailbox, here it only marks sequenced frame
+        if (!m_mailbox.Push({ frame, m_resumeToken ? 1u : 0u }))
+        {
+            // Client doesn't keep up and misses the frame, so its session ends instead of resuming
+            MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+            m_resumeToken = 0;
+            ShutdownTransport();
+            WSASetLastError(WSAENOBUFS);
+            return false;
+        }
+        if (!m_mailbox.Claim())   // frame will be sent by the thread that is sending now
+            return true;
+        return SendPending();
+    }
+
+    void EnableResume(uint64_t token) noexcept
+    {
+        m_resumeToken = token;
+    }
+    uint64_t GetResumeToken() const noexcept
+    {
+        return m_resumeToken;
+    }
+    void Ack(uint64_t sequence) noexcept
+    {
+        MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+        ReleaseFrames((std::min)(sequence, m_lastSequence));
+    }
+    bool CanResume(uint64_t lastSequence) noexcept
+    {
+        MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+        return CanResumeFrom(lastSequence);
+    }
+    void Detach() noexcept
+    {
+        MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+        m_detached = true;
+        // Sender may be inside Send, handle is released by Attach or Disconnect
+        ShutdownTransport();
+    }
+    void Disconnect() noexcept
+    {
+        ShutdownTransport();
+        {
+            MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+            lk.Wait(m_sendDone, [this]() { return m_mailbox.Claim(); });
+            CloseTransport();
+        }
+        // Frames posted meanwhile fail on closed connection
+        SendPending();
+    }
+    void Attach(Impl& connection) noexcept
+    {
+        {
+            MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+            // Sender may be still finishing frames of the lost connection
+            lk.Wait(m_sendDone, [this]() { return m_mailbox.Claim(); });
+            SetTransport(std::move(connection.m_transport));
+            // Bytes buffered for the lost connection are dropped
+            if (IsNonBlocking())
+                SetNonBlocking(true);
+            m_compressor.reset();
+            SetConnectionOptions(1, CapNone);
+        }
+        // Session is still detached, frames posted meanwhile only go to resend buffer
+        SendPending();
+    }
+    bool Resume(uint64_t lastSequence, const SharedFrame& acceptFrame) noexcept
+    {
+        MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+        if (!m_detached || !CanResumeFrom(lastSequence))
+            return false;
+        lk.Wait(m_sendDone, [this]() { return m_mailbox.Claim(); });
+        ReleaseFrames(lastSequence);
+        bool ret = true;
+        try 
+        {
+            m_sendingFrames.assign(m_resendFrames.begin(), m_resendFrames.end()); 
+        }
+        catch (std::exception&) 
+        { 
+            m_sendingFrames.clear();
+            ret = false;
+        }
+        m_detached = false;
+        lk.unlock();
+
+        // Connection options go before the sequenced stream, compression starts right after them
+        if (ret)
+        {
+            ret = SendFrame(acceptFrame);
+            if (HasCapability(CapCompression))
+                InitCompression();
+            ret = SendFrames() && ret;
+        }
+        return SendPending() && ret;
+    }
+
+protected:
+    // Sends frames from mailbox until it is empty, caller must have claimed mailbox
+    bool SendPending() noexcept
+    {
+        bool ret = true;
+        do
+        {
+            for (;;)
+            {
+                MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+                m_sendingFrames.clear();
+                size_t count = m_mailbox.PopBatch([this](QueuedFrame& queued) { TakeFrame(queued); }, MAX_FRAMES_PER_DRAIN);
+                if (!count)
+                    break;
+                if (m_detached) // detached session only keeps frames for resend
+                    continue;
+                lk.unlock();
+                ret = SendFrames() && ret;
+            }
+            MutexLock lk(m_postMtx, postStats, LOCK_SITE);
+            m_sendingFrames.clear();
+            if (m_mailbox.Release())
+            {
+                m_sendDone.notify_all();
+                break;
+            }
+        } while (m_mailbox.Claim());
+        return ret;
+    }
+    // Gives sequence number to frame taken from mailbox, must be called with locked m_postMtx
+    void TakeFrame(QueuedFrame& queued) noexcept
+    {
+        if (queued.sequence)
+        {
+            queued.sequence = ++m_lastSequence;
+            try
+            {
+                m_resendFrames.push_back(queued);
+            }
+            catch (std::exception&)
+            {
+                // Frame can't be resent, client that misses it won't be able to resume
+                m_releasedSequence = queued.sequence;
+                m_resendFrames.clear();
+            }
+            if (m_resendFrames.size() > DEF_RESEND_BUFFER_SIZE)
+            {
+                m_releasedSequence = m_resendFrames.front().sequence;
+                m_resendFrames.pop_front();
+            }
+        }
+        try
+        {
+            if (!m_detached)
+                m_sendingFrames.push_back(std::move(queued));
+        }
+        catch (std::exception&)
+        {
+        }
+    }
+    bool SendFrames() noexcept
+    {
+        bool ret = true;
+        // Sequence numbers are carried only by batch frames
+        if (!HasCapability(CapBatching) ||
+            (m_sendingFrames.size() == 1 && !m_sendingFrames.front().sequence))
+        {
+            for (const auto& queued : m_sendingFrames)
+                ret = SendFrame(queued.frame) && ret;
+            return ret;
+        }
+
+        m_batch.Clear();
+        m_batch.SetProtocolVersion(GetProtocolVersion());
+        for (const auto& queued : m_sendingFrames)
+        {
+            // Sequenced and plain frames can't share a batch
+            if (m_batch.Count() && !m_batch.FirstSequence() != !queued.sequence)
+                ret = SendBatch() && ret;
+            if (AppendToBatch(queued))
+                continue;
+
+            if (m_batch.Count())
+                ret = SendBatch() && ret;
+            if (!AppendToBatch(queued)) // can't be batched, send as is
+                ret = SendFrame(queued.frame) && ret;
+        }
+        if (m_batch.Count())
+            ret = SendBatch() && ret;
+        return ret;
+    }
+    // Frames are shared by connections of all versions, older ones get a converted copy
+    bool SendFrame(const SharedFrame& frame) noexcept
+    {
+        if (GetProtocolVersion() >= NANOSECOND_TIMESTAMP_VERSION)
+            return SendData(frame.data.get(), frame.size);
+        try
+        {
+            m_convertedFrame.assign(frame.data.get(), frame.data.get() + frame.size);
+        }
+        catch (std::exception&)
+        {
+            WSASetLastError(ERROR_OUTOFMEMORY);
+            return false;
+        }
+        ClientMessage::ConvertFrameTimeStamp(m_convertedFrame.data(), frame.size, GetProtocolVersion());
+        return SendData(m_convertedFrame.data(), frame.size);
+    }
+    bool AppendToBatch(const QueuedFrame& queued) noexcept
+    {
+        try
+        {
+            if (!m_batch.Count())
+                m_batch.SetFirstSequence(queued.sequence);
+            return m_batch.Append(queued.frame.data.get(), queued.frame.size);
+        }
+        catch (std::exception&)
+        {
+            return false;
+        }
+    }
+    bool SendBatch() noexcept
+    {
+        bool ret = SendData(m_batch.Data(), m_batch.Size());
+        m_batch.Clear();
+        return ret;
+    }
+
+    // Must be called with locked m_postMtx
+    bool CanResumeFrom(uint64_t lastSequence) const noexcept
+    {
+        return m_resumeToken && lastSequence >= m_releasedSequence && lastSequence <= m_lastSequence;
+    }
+    void ReleaseFrames(uint64_t sequence) noexcept
+    {
+        while (!m_resendFrames.empty() && m_resendFrames.front().sequence <= sequence)
+            m_resendFrames.pop_front();
+        m_releasedSequence = (std::max)(m_releasedSequence, sequence);
+    }
+
 protected:
     static size_t idCounter;
     size_t m_id;
+
+    Mailbox<QueuedFrame> m_mailbox;     // posted frames, sent by the thread that claimed mailbox
+    std::mutex m_postMtx;
+    std::condition_variable m_sendDone; // mailbox released
+    std::vector<QueuedFrame> m_sendingFrames;
+    MessageBatch m_batch;
+    std::vector<char> m_convertedFrame; // frame with timestamp of older protocol version
+
+    // Resumable session
+    std::deque<QueuedFrame> m_resendFrames; // sequenced frames not acknowledged by client
+    std::atomic<uint64_t> m_resumeToken = 0;
+    uint64_t m_lastSequence = 0;        // sequence number of the last posted frame
+    uint64_t m_releasedSequence = 0;    // frames up to this sequence number can't be resent
+    bool m_detached = false;
 };
 
 size_t ServerClient::Impl::idCounter = 0;
@@ -47,20 +317,21 @@ ServerClient::ServerClient(ServerClient &&) = default;
 ServerClient & ServerClient::operator=(ServerClient &&) = default;
 
 ServerClient::ServerClient() : m_impl(new Impl) {}
-ServerClient::ServerClient(SOCKET listenSock) : m_impl(new Impl(listenSock)) {}
+ServerClient::ServerClient(TransportUPtr transport) : m_impl(new Impl(std::move(transport))) {}
+ServerClient::ServerClient(size_t mailboxCapacity) : m_impl(new Impl(mailboxCapacity)) {}
 ServerClient::~ServerClient() = default;
 
-bool ServerClient::Init(SOCKET listenSock) noexcept
+bool ServerClient::Init(TransportUPtr transport) noexcept
 {
-    return m_impl->Init(listenSock);
+    return m_impl->Init(std::move(transport));
 }
-CSOCKET* ServerClient::GetSocket() noexcept
+void ServerClient::Close() noexcept
 {
-    return m_impl->GetSocket();
+    m_impl->ShutdownTransport();
 }
-CSOCKADDR_IN* ServerClient::GetAddr() noexcept
+void ServerClient::Disconnect() noexcept
 {
-    return m_impl->GetAddr();
+    m_impl->Disconnect();
 }
 const std::wstring* ServerClient::GetName() const noexcept
 {
@@ -76,15 +347,100 @@ size_t ServerClient::Id() const noexcept
     return m_impl->Id();
 }
 
+uint32_t ServerClient::GetProtocolVersion() const noexcept
+{
+    return m_impl->GetProtocolVersion();
+}
+uint32_t ServerClient::GetCapabilities() const noexcept
+{
+    return m_impl->GetCapabilities();
+}
+bool ServerClient::HasCapability(uint32_t cap) const noexcept
+{
+    return m_impl->HasCapability(cap);
+}
+void ServerClient::SetConnectionOptions(uint32_t version, uint32_t capabilities) noexcept
+{
+    m_impl->SetConnectionOptions(version, capabilities);
+}
+
+bool ServerClient::InitCompression() noexcept
+{
+    return m_impl->InitCompression();
+}
+bool ServerClient::InitDecompression() noexcept
+{
+    return m_impl->InitDecompression();
+}
+const FrameCompressor* ServerClient::GetCompressor() const noexcept
+{
+    return m_impl->GetCompressor();
+}
+
 bool ServerClient::SendData(const void* data, uint32_t size) const noexcept
 {
     return m_impl->SendData(data, size);
 }
+bool ServerClient::PostData(const SharedFrame& frame) noexcept
+{
+    return m_impl->PostData(frame);
+}
 bool ServerClient::RecvData(std::vector<char>& data, uint32_t* recved) const noexcept
 {
     return m_impl->RecvData(data, recved);
 }
 
+bool ServerClient::SetNonBlocking(bool nonBlocking) noexcept
+{
+    return m_impl->SetNonBlocking(nonBlocking);
+}
+bool ServerClient::SetWakeup(Transport::Wakeup wakeup) noexcept
+{
+    Transport* transport = m_impl->GetTransport();
+    return transport && transport->SetWakeup(std::move(wakeup));
+}
+bool ServerClient::FlushSend() noexcept
+{
+    return m_impl->ClientBase::SendPending();
+}
+bool ServerClient::RecvAvailable(bool& closed) noexcept
+{
+    return m_impl->RecvAvailable(closed);
+}
+bool ServerClient::NextFrame(std::vector<char>& data, bool& ready) noexcept
+{
+    return m_impl->NextFrame(data, ready);
+}
+
+void ServerClient::EnableResume(uint64_t token) noexcept
+{
+    m_impl->EnableResume(token);
+}
+uint64_t ServerClient::GetResumeToken() const noexcept
+{
+    return m_impl->GetResumeToken();
+}
+void ServerClient::Ack(uint64_t sequence) noexcept
+{
+    m_impl->Ack(sequence);
+}
+bool ServerClient::CanResume(uint64_t lastSequence) noexcept
+{
+    return m_impl->CanResume(lastSequence);
+}
+void ServerClient::Detach() noexcept
+{
+    m_impl->Detach();
+}
+void ServerClient::Attach(ServerClient& connection) noexcept
+{
+    m_impl->Attach(*connection.m_impl);
+}
+bool ServerClient::Resume(uint64_t lastSequence, const SharedFrame& acceptFrame) noexcept
+{
+    return m_impl->Resume(lastSequence, acceptFrame);
+}
+
 bool ServerClient::operator !() const
 {
     return !*m_impl;
@@ -4,6 +4,24 @@
 #include <memory>
 #include <vector>
 #include "Common.h"
+#include "Transport.h"
+
+#ifndef DEF_RESEND_BUFFER_SIZE
+#define DEF_RESEND_BUFFER_SIZE 4096 // unacknowledged frames kept for resend to resumed session
+#endif
+
+#ifndef DEF_MAILBOX_CAPACITY
+#define DEF_MAILBOX_CAPACITY 256 // frames posted to client and not sent yet
+#endif
+
+class FrameCompressor;
+
+// Serialized frame shared by all its recipients
+struct SharedFrame
+{
+    std::shared_ptr<const char> data;
+    uint32_t size = 0;
+};
 
 class ServerClient
 {
@@ -16,18 +34,59 @@ public:
 
     ServerClient();
     ~ServerClient();
-    explicit ServerClient(SOCKET listenSock);
+    explicit ServerClient(TransportUPtr transport);
+    // Mailbox capacity is rounded up to power of two
+    explicit ServerClient(size_t mailboxCapacity);
 
-    bool Init(SOCKET listenSock) noexcept;
-    CSOCKET* GetSocket() noexcept;
-    CSOCKADDR_IN* GetAddr() noexcept;
+    bool Init(TransportUPtr transport) noexcept;
+    // Can be called from another thread to break blocking calls. Connection is shut down,
+    // its handle is released by Disconnect, Attach or destructor.
+    void Close() noexcept;
+    // Closes connection once the thread sending posted frames is done with it.
+    // Caller must be the only thread that receives from the connection.
+    void Disconnect() noexcept;
     const std::wstring* GetName() const noexcept;
     bool SetName(std::wstring name) noexcept; // uses move copy of name
     size_t Id() const noexcept;
 
+    uint32_t GetProtocolVersion() const noexcept;
+    uint32_t GetCapabilities() const noexcept;
+    bool HasCapability(uint32_t cap) const noexcept;
+    void SetConnectionOptions(uint32_t version, uint32_t capabilities) noexcept;
+
+    bool InitCompression() noexcept;
+    bool InitDecompression() noexcept;
+    const FrameCompressor* GetCompressor() const noexcept;
+
     bool SendData(const void* data, uint32_t size) const noexcept;
+    // Puts frame into client's mailbox without locks. Thread that finds mailbox idle sends
+    // frames posted by all threads, packed into batch frames if client supports batching.
+    // Returns false if sending failed or mailbox is full, then connection is shut down and session can't be resumed.
+    bool PostData(const SharedFrame& frame) noexcept;
     bool RecvData(std::vector<char>& data, uint32_t* recved = nullptr) const noexcept;
 
+    // Non-blocking transport of single-threaded server, see ClientBase
+    bool SetNonBlocking(bool nonBlocking) noexcept;
+    bool SetWakeup(Transport::Wakeup wakeup) noexcept;
+    // Sends bytes transport couldn't take before
+    bool FlushSend() noexcept;
+    bool RecvAvailable(bool& closed) noexcept;
+    bool NextFrame(std::vector<char>& data, bool& ready) noexcept;
+
+    // Resumable session. Frames posted after EnableResume get sequence numbers and are kept
+    // until client acknowledges them, so they can be resent after reconnect.
+    void EnableResume(uint64_t token) noexcept;
+    uint64_t GetResumeToken() const noexcept;
+    void Ack(uint64_t sequence) noexcept;
+    // Checks that all frames after lastSequence are still kept
+    bool CanResume(uint64_t lastSequence) noexcept;
+    // Shuts connection down, frames posted to detached session are only kept for resend
+    void Detach() noexcept;
+    // Takes connection of the new client object, compression state and connection options are reset
+    void Attach(ServerClient& connection) noexcept;
+    // Sends acceptFrame, then frames client hasn't received and continues sending of posted frames
+    bool Resume(uint64_t lastSequence, const SharedFrame& acceptFrame) noexcept;
+
     bool operator !() const;
     explicit operator bool() const { return !!*this; }
 private:
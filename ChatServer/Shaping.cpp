@@ -0,0 +1,417 @@
+#include "Shaping.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+typedef std::unique_lock<std::mutex> MutexLock;
+
+using namespace std::literals;
+
+// Idle direction saves up at most this much time of its rate
+constexpr auto SHAPING_BURST = 10ms;
+constexpr size_t RECV_CHUNK_SIZE = 64 * 1024;
+// Non-blocking Recv stops reading ahead when this many bytes wait for their time
+constexpr size_t MAX_KEPT_SIZE = 256 * 1024;
+
+// Number with unit us, ms or s
+static bool ParseDuration(const std::string& text, ShapingConfig::Duration& duration)
+{
+    static const struct { const char* name; double scale; } units[] =
+    {
+        { "us", 1 }, { "ms", 1e3 }, { "s", 1e6 },
+    };
+    size_t end = 0;
+    double value;
+    try { value = std::stod(text, &end); }
+    catch (std::exception&) { return false; }
+    if (value < 0)
+        return false;
+
+    std::string unit = text.substr(end);
+    for (const auto& u : units)
+    {
+        if (unit == u.name)
+        {
+            duration = ShapingConfig::Duration(static_cast<int64_t>(value * u.scale));
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+static bool ParseInteger(const std::string& text, T& value)
+{
+    size_t end = 0;
+    unsigned long long number;
+    try { number = std::stoull(text, &end); }
+    catch (std::exception&) { return false; }
+    if (end != text.size() || text[0] == '-' || number != static_cast<T>(number))
+        return false;
+    value = static_cast<T>(number);
+    return true;
+}
+
+bool ShapingConfig::Load(const std::string& path, std::string& error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "Can't open " + path;
+        return false;
+    }
+    return Parse(file, error);
+}
+
+bool ShapingConfig::Parse(std::istream& config, std::string& error)
+{
+    std::string line;
+    for (size_t lineNo = 1; std::getline(config, line); ++lineNo)
+    {
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        std::istringstream stream(line);
+        std::vector<std::string> words;
+        for (std::string word; stream >> word;)
+            words.push_back(std::move(word));
+        if (words.empty())
+            continue;
+
+        const std::string& key = words[0];
+        bool ok = false;
+        if (words.size() != 2)
+            ok = false;
+        else if (key == "fraction")
+        {
+            size_t end = 0;
+            try { fraction = std::stod(words[1], &end); ok = end == words[1].size(); }
+            catch (std::exception&) {}
+            ok = ok && fraction >= 0 && fraction <= 1;
+        }
+        else if (key == "seed")
+            ok = ParseInteger(words[1], seed);
+        else if (key == "latency")
+            ok = ParseDuration(words[1], latency);
+        else if (key == "jitter")
+            ok = ParseDuration(words[1], jitter);
+        else if (key == "send-rate")
+            ok = ParseInteger(words[1], sendRate);
+        else if (key == "recv-rate")
+            ok = ParseInteger(words[1], recvRate);
+        else if (key == "max-write")
+            ok = ParseInteger(words[1], maxWrite);
+        else if (key == "stall-every")
+            ok = ParseDuration(words[1], stallEvery);
+        else if (key == "stall-time")
+            ok = ParseDuration(words[1], stallTime);
+        else if (key == "reset-after")
+            ok = ParseDuration(words[1], resetAfter);
+
+        if (!ok)
+        {
+            error = "Invalid line " + std::to_string(lineNo) + ": " + line;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+ShapedTransport::ShapedTransport(TransportUPtr&& transport, const ShapingConfig& config, uint64_t seed) noexcept
+    : m_transport(std::move(transport)), m_config(config), m_random(seed)
+{
+    Clock::time_point now = Clock::now();
+    m_resetAt = m_config.resetAfter.count() ? now + Random(m_config.resetAfter) : Clock::time_point::max();
+    m_nextStall = m_config.stallEvery.count() ? now + Random(m_config.stallEvery) : Clock::time_point::max();
+    m_sendFreeAt = m_recvFreeAt = m_lastReady = now;
+}
+
+int ShapedTransport::Send(const char* data, int size) noexcept
+{
+    if (!CheckLink())
+        return SOCKET_ERROR;
+    if (m_config.maxWrite)
+    {
+        MutexLock lk(m_mtx);
+        std::uniform_int_distribution<uint32_t> write(1, m_config.maxWrite);
+        size = (std::min)(size, static_cast<int>(write(m_random)));
+    }
+    if (!Pace(m_config.sendRate, m_sendFreeAt, size) || !WaitTransport(true))
+        return SOCKET_ERROR;
+
+    int result = m_transport->Send(data, size);
+    if (result > 0)
+        Spend(m_config.sendRate, m_sendFreeAt, result);
+    return result;
+}
+
+// Blocking call reads when nothing is kept, so data arriving during the wait stays in transport
+// and gets its latency when read. Non-blocking call reads all that has arrived.
+int ShapedTransport::Recv(char* data, int size) noexcept
+{
+    if (!CheckLink())
+        return SOCKET_ERROR;
+    if (m_config.latency.count() == 0 && m_config.jitter.count() == 0)
+    {
+        if (!Pace(m_config.recvRate, m_recvFreeAt, size) || !WaitTransport(false))
+            return SOCKET_ERROR;
+        int result = m_transport->Recv(data, size);
+        if (result > 0)
+            Spend(m_config.recvRate, m_recvFreeAt, result);
+        return result;
+    }
+
+    while (!m_recvError && (m_received.empty() ||
+        (m_nonBlocking && !m_received.back().data.empty() && m_keptSize < MAX_KEPT_SIZE)))
+    {
+        if (ReadChunk() == SOCKET_ERROR)
+        {
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+                m_recvError = WSAGetLastError();
+            break;
+        }
+    }
+    if (m_received.empty())
+    {
+        WSASetLastError(m_recvError ? m_recvError : WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    }
+
+    Chunk& chunk = m_received.front();
+    if (!WaitUntil(chunk.ready))
+        return SOCKET_ERROR;
+    if (chunk.data.empty())
+        return 0;
+    if (!Pace(m_config.recvRate, m_recvFreeAt, size))
+        return SOCKET_ERROR;
+
+    int count = (std::min)(size, static_cast<int>(chunk.data.size() - chunk.offset));
+    memcpy(data, chunk.data.data() + chunk.offset, count);
+    chunk.offset += count;
+    m_keptSize -= count;
+    if (chunk.offset == chunk.data.size())
+        m_received.pop_front();
+    Spend(m_config.recvRate, m_recvFreeAt, count);
+    return count;
+}
+
+bool ShapedTransport::SetNonBlocking(bool nonBlocking) noexcept
+{
+    if (!m_transport->SetNonBlocking(nonBlocking))
+        return false;
+    MutexLock lk(m_mtx);
+    m_nonBlocking = nonBlocking;
+    return true;
+}
+
+void ShapedTransport::Close() noexcept
+{
+    {
+        MutexLock lk(m_mtx);
+        m_closed = true;
+        m_transport->Close();
+    }
+    m_cv.notify_all();
+}
+
+void ShapedTransport::Shutdown() noexcept
+{
+    {
+        MutexLock lk(m_mtx);
+        m_closed = true;
+        m_transport->Shutdown();
+    }
+    m_cv.notify_all();
+}
+
+bool ShapedTransport::IsOpen() const noexcept
+{
+    return m_transport->IsOpen();
+}
+
+SOCKET ShapedTransport::Handle() const noexcept
+{
+    return m_transport->Handle();
+}
+
+bool ShapedTransport::WaitUntil(Clock::time_point time) noexcept
+{
+    MutexLock lk(m_mtx);
+    while (!m_closed && !m_reset && Clock::now() < time)
+    {
+        if (m_nonBlocking)
+        {
+            WSASetLastError(WSAEWOULDBLOCK);
+            return false;
+        }
+        m_cv.wait_until(lk, time);
+    }
+    if (m_closed || m_reset)
+    {
+        WSASetLastError(m_closed ? WSAECONNABORTED : WSAECONNRESET);
+        return false;
+    }
+    return true;
+}
+
+bool ShapedTransport::CheckLink() noexcept
+{
+    MutexLock lk(m_mtx);
+    for (;;)
+    {
+        if (m_closed || m_reset)
+        {
+            WSASetLastError(m_closed ? WSAECONNABORTED : WSAECONNRESET);
+            return false;
+        }
+        Clock::time_point now = Clock::now();
+        if (now >= m_resetAt)
+        {
+            // Peer gets RST instead of end of stream
+            SOCKET sock = m_transport->Handle();
+            if (sock != INVALID_SOCKET)
+            {
+                LINGER linger = { 1, 0 };
+                ::setsockopt(sock, SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&linger), sizeof(linger));
+            }
+            m_transport->Close();
+            m_reset = true;
+            lk.unlock();
+            m_cv.notify_all();
+            WSASetLastError(WSAECONNRESET);
+            return false;
+        }
+        if (now >= m_nextStall)
+        {
+            m_stallEnd = now + m_config.stallTime;
+            m_nextStall = m_stallEnd + Random(m_config.stallEvery);
+        }
+        if (now >= m_stallEnd)
+            return true;
+        if (m_nonBlocking)
+        {
+            WSASetLastError(WSAEWOULDBLOCK);
+            return false;
+        }
+        m_cv.wait_until(lk, m_stallEnd);
+    }
+}
+
+bool ShapedTransport::WaitTransport(bool write) noexcept
+{
+    SOCKET sock = m_transport->Handle();
+    for (;;)
+    {
+        Clock::time_point deadline;
+        {
+            MutexLock lk(m_mtx);
+            if (m_nonBlocking || sock == INVALID_SOCKET)
+                return true;
+            deadline = (std::min)(m_resetAt, m_nextStall);
+        }
+        if (deadline == Clock::time_point::max())
+            return true;
+
+        // Rounded up, so link check after timeout finds deadline passed
+        auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+            (std::max)(deadline - Clock::now(), Clock::duration::zero())) + 1us;
+        timeval waitTime = { static_cast<long>(wait / 1s), static_cast<long>(wait % 1s / 1us) };
+        fd_set fd;
+        FD_ZERO(&fd);
+        FD_SET(sock, &fd);
+        int selectRes = ::select(1, write ? nullptr : &fd, write ? &fd : nullptr, nullptr, &waitTime);
+        if (selectRes > 0)
+            return true;
+        // Close from another thread fails select, link check tells it
+        int error = WSAGetLastError();
+        if (!CheckLink())
+            return false;
+        if (selectRes == SOCKET_ERROR)
+        {
+            WSASetLastError(error);
+            return false;
+        }
+    }
+}
+
+bool ShapedTransport::Pace(uint64_t rate, Clock::time_point& freeAt, int& size) noexcept
+{
+    if (!rate)
+        return true;
+    freeAt = (std::max)(freeAt, Clock::now() - SHAPING_BURST);
+    if (!WaitUntil(freeAt))
+        return false;
+    uint64_t burst = (std::max)(rate * SHAPING_BURST / 1s, uint64_t(1));
+    size = static_cast<int>((std::min)(static_cast<uint64_t>(size), burst));
+    return true;
+}
+
+void ShapedTransport::Spend(uint64_t rate, Clock::time_point& freeAt, int count) noexcept
+{
+    if (rate)
+        freeAt += std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(count * 1000000000ull / rate));
+}
+
+// Returns result of transport Recv, end of stream is kept as empty chunk
+int ShapedTransport::ReadChunk() noexcept
+{
+    try { m_recvBuffer.resize(RECV_CHUNK_SIZE); }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return SOCKET_ERROR; }
+    if (!WaitTransport(false))
+        return SOCKET_ERROR;
+    int result = m_transport->Recv(m_recvBuffer.data(), static_cast<int>(m_recvBuffer.size()));
+    if (result == SOCKET_ERROR)
+        return result;
+
+    Chunk chunk;
+    {
+        MutexLock lk(m_mtx);
+        Clock::duration delay = m_config.latency;
+        if (m_config.jitter.count())
+        {
+            std::uniform_int_distribution<int64_t> jitter(0, m_config.jitter.count());
+            delay += ShapingConfig::Duration(jitter(m_random));
+        }
+        // Data keeps its order whatever jitter is
+        chunk.ready = (std::max)(Clock::now() + delay, m_lastReady);
+    }
+    m_lastReady = chunk.ready;
+    try
+    {
+        chunk.data.assign(m_recvBuffer.begin(), m_recvBuffer.begin() + result);
+        m_received.push_back(std::move(chunk));
+    }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return SOCKET_ERROR; }
+    m_keptSize += result;
+    return result;
+}
+
+// Exponentially distributed time, called under m_mtx or by constructor
+ShapedTransport::Clock::duration ShapedTransport::Random(ShapingConfig::Duration mean) noexcept
+{
+    std::exponential_distribution<double> time(1.0 / mean.count());
+    return std::chrono::duration_cast<Clock::duration>(ShapingConfig::Duration(static_cast<int64_t>(time(m_random))));
+}
+
+
+ShapingListener::ShapingListener(std::shared_ptr<Listener> listener, const ShapingConfig& config) noexcept
+    : m_listener(std::move(listener)), m_config(config), m_random(config.seed)
+{
+}
+
+bool ShapingListener::Accept(TransportUPtr& transport) noexcept
+{
+    if (!m_listener->Accept(transport))
+        return false;
+    if (!transport)
+        return true;
+
+    std::uniform_real_distribution<double> chance;
+    uint64_t seed = m_random();
+    if (chance(m_random) >= m_config.fraction)
+        return true;
+    TransportUPtr shaped(new (std::nothrow) ShapedTransport(std::move(transport), m_config, seed));
+    // Connection is dropped rather than failing listener
+    transport = std::move(shaped);
+    return true;
+}
@@ -0,0 +1,121 @@
+#ifndef _SHAPING_H_
+#define _SHAPING_H_
+
+#include "Transport.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Impairments of shaped connections, both directions unless told otherwise. Config file lines,
+// '#' starts a comment:
+//   fraction F         of accepted connections that are shaped, chosen at random
+//   seed N             seed of all random choices
+//   latency T          added to received data
+//   jitter T           random addition to latency, data isn't reordered
+//   send-rate N        bytes per second sent to peer, 0 - unlimited
+//   recv-rate N        bytes per second received from peer, 0 - unlimited
+//   max-write N        one send takes 1 to N bytes, 0 - as many as transport does
+//   stall-every T      mean time between stalls, 0 - none
+//   stall-time T       neither direction moves during a stall
+//   reset-after T      mean time from accept to reset of connection, 0 - never
+// Times are numbers with unit us, ms or s.
+struct ShapingConfig
+{
+    typedef std::chrono::microseconds Duration;
+
+    double fraction = 1;
+    uint64_t seed = 1;
+    Duration latency{ 0 };
+    Duration jitter{ 0 };
+    uint64_t sendRate = 0;
+    uint64_t recvRate = 0;
+    uint32_t maxWrite = 0;
+    Duration stallEvery{ 0 };
+    Duration stallTime{ 0 };
+    Duration resetAfter{ 0 };
+
+    // Error names line of config
+    bool Load(const std::string& path, std::string& error);
+    bool Parse(std::istream& config, std::string& error);
+};
+
+// Decorator of blocking transport that impairs it as config says. Blocking calls wait out
+// latency, rate and stalls and are broken by Close. Non-blocking calls return WSAEWOULDBLOCK
+// meanwhile, poll of Handle doesn't wake when waiting ends, so callers retry by timeout.
+// Reset closes transport, socket one with RST, and calls return WSAECONNRESET since.
+// Reset and stall begin during a blocking call waiting for socket data, transports without
+// handle are checked when calls begin.
+class ShapedTransport : public Transport
+{
+public:
+    ShapedTransport(TransportUPtr&& transport, const ShapingConfig& config, uint64_t seed) noexcept;
+
+    int Send(const char* data, int size) noexcept override;
+    int Recv(char* data, int size) noexcept override;
+    bool SetNonBlocking(bool nonBlocking) noexcept override;
+    void Close() noexcept override;
+    void Shutdown() noexcept override;
+    bool IsOpen() const noexcept override;
+    SOCKET Handle() const noexcept override;
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Data of Recv kept until its time, empty chunk is end of stream
+    struct Chunk
+    {
+        Clock::time_point ready;
+        std::vector<char> data;
+        size_t offset = 0;
+    };
+
+    // Waits until time or close, false and error set if call can't go on
+    bool WaitUntil(Clock::time_point time) noexcept;
+    // Checks reset and stall, waits out stall
+    bool CheckLink() noexcept;
+    // Blocking call waits for socket until next reset or stall, so they happen to a silent link too
+    bool WaitTransport(bool write) noexcept;
+    // Bytes the direction can move now, waits for the first of them
+    bool Pace(uint64_t rate, Clock::time_point& freeAt, int& size) noexcept;
+    void Spend(uint64_t rate, Clock::time_point& freeAt, int count) noexcept;
+    int ReadChunk() noexcept;
+    Clock::duration Random(ShapingConfig::Duration mean) noexcept;
+
+    TransportUPtr m_transport;
+    const ShapingConfig m_config;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_closed = false;
+    bool m_reset = false;
+    bool m_nonBlocking = false;
+    std::mt19937_64 m_random;                // guarded by m_mtx
+    Clock::time_point m_resetAt;
+    Clock::time_point m_nextStall;
+    Clock::time_point m_stallEnd;
+    // State of a direction is used by its calling thread only
+    Clock::time_point m_sendFreeAt;
+    Clock::time_point m_recvFreeAt;
+    std::deque<Chunk> m_received;
+    size_t m_keptSize = 0;
+    int m_recvError = 0;                    // delivered after kept data
+    Clock::time_point m_lastReady;
+    std::vector<char> m_recvBuffer;
+};
+
+// Shapes connections of another listener, those not chosen by fraction are passed as they are
+class ShapingListener : public Listener
+{
+public:
+    ShapingListener(std::shared_ptr<Listener> listener, const ShapingConfig& config) noexcept;
+
+    bool Accept(TransportUPtr& transport) noexcept override;
+private:
+    std::shared_ptr<Listener> m_listener;
+    ShapingConfig m_config;
+    std::mt19937_64 m_random;
+};
+
+#endif // !_SHAPING_H_
@@ -0,0 +1,532 @@
+
+#include "TextCodec.h"
+#include <algorithm>
+#include <atomic>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXT_CODEC_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace TextCodec;
+
+namespace
+{
+
+// Kernels stop on a block that needs scalar processing, scalar code processes at most that block
+constexpr ptrdiff_t BLOCK_SIZE = 16;
+
+inline bool IsSurrogate(uint32_t c) noexcept
+{
+    return (c & 0xFFFFF800) == 0xD800;
+}
+inline bool IsHighSurrogate(uint32_t c) noexcept
+{
+    return (c & 0xFFFFFC00) == 0xD800;
+}
+inline bool IsLowSurrogate(uint32_t c) noexcept
+{
+    return (c & 0xFFFFFC00) == 0xDC00;
+}
+
+inline char* EncodeUtf8(uint32_t c, char* out) noexcept
+{
+    if (c < 0x80)
+        *out++ = static_cast<char>(c);
+    else if (c < 0x800)
+    {
+        *out++ = static_cast<char>(0xC0 | (c >> 6));
+        *out++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        *out++ = static_cast<char>(0xE0 | (c >> 12));
+        *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        *out++ = static_cast<char>(0xF0 | (c >> 18));
+        *out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    return out;
+}
+
+// Returns pointer to the next sequence or nullptr if sequence is invalid
+inline const unsigned char* DecodeUtf8(const unsigned char* p, const unsigned char* end, uint32_t& c) noexcept
+{
+    uint32_t lead = *p++;
+    size_t nCont;
+    uint32_t minValue;
+    if (lead < 0x80)
+    {
+        c = lead;
+        return p;
+    }
+    else if ((lead & 0xE0) == 0xC0)
+    {
+        c = lead & 0x1F;
+        nCont = 1;
+        minValue = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        c = lead & 0x0F;
+        nCont = 2;
+        minValue = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        c = lead & 0x07;
+        nCont = 3;
+        minValue = 0x10000;
+    }
+    else
+        return nullptr;
+
+    if (static_cast<size_t>(end - p) < nCont)
+        return nullptr;
+    for (size_t i = 0; i < nCont; ++i, ++p)
+    {
+        if ((*p & 0xC0) != 0x80)
+            return nullptr;
+        c = (c << 6) | (*p & 0x3F);
+    }
+    // overlong encoding, surrogates and code points out of unicode range
+    if (c < minValue || c > 0x10FFFF || IsSurrogate(c))
+        return nullptr;
+    return p;
+}
+
+
+// Scalar kernels -------------------------------------------------------------------
+
+const uint16_t* SkipPlainScalar(const uint16_t* p, const uint16_t*) noexcept
+{
+    return p;
+}
+size_t AsciiToUtf8Scalar(const uint16_t* src, const uint16_t* end, char* dst) noexcept
+{
+    const uint16_t* p = src;
+    while (p < end && *p < 0x80)
+        *dst++ = static_cast<char>(*p++);
+    return p - src;
+}
+size_t AsciiFromUtf8Scalar(const char* src, const char* end, uint16_t* dst) noexcept
+{
+    const char* p = src;
+    while (p < end && static_cast<unsigned char>(*p) < 0x80)
+        *dst++ = static_cast<unsigned char>(*p++);
+    return p - src;
+}
+
+
+#ifdef TEXT_CODEC_X86
+
+// SSE2 kernels ---------------------------------------------------------------------
+
+// Skips blocks without zeroes and surrogates
+const uint16_t* SkipPlainSse2(const uint16_t* p, const uint16_t* end) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i surrogateMask = _mm_set1_epi16(static_cast<short>(0xF800));
+    const __m128i surrogateBits = _mm_set1_epi16(static_cast<short>(0xD800));
+    for (; end - p >= 8; p += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i special = _mm_or_si128(
+            _mm_cmpeq_epi16(v, zero),
+            _mm_cmpeq_epi16(_mm_and_si128(v, surrogateMask), surrogateBits));
+        if (_mm_movemask_epi8(special))
+            break;
+    }
+    return p;
+}
+size_t AsciiToUtf8Sse2(const uint16_t* src, const uint16_t* end, char* dst) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nonAsciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+    const uint16_t* p = src;
+    for (; end - p >= 8; p += 8, dst += 8)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, nonAsciiMask), zero)) != 0xFFFF)
+            break;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(v, v));
+    }
+    return p - src;
+}
+size_t AsciiFromUtf8Sse2(const char* src, const char* end, uint16_t* dst) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    const char* p = src;
+    for (; end - p >= 16; p += 16, dst += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        if (_mm_movemask_epi8(v))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return p - src;
+}
+
+
+// AVX2 kernels ---------------------------------------------------------------------
+
+TARGET_AVX2 const uint16_t* SkipPlainAvx2(const uint16_t* p, const uint16_t* end) noexcept
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i surrogateMask = _mm256_set1_epi16(static_cast<short>(0xF800));
+    const __m256i surrogateBits = _mm256_set1_epi16(static_cast<short>(0xD800));
+    for (; end - p >= 16; p += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i special = _mm256_or_si256(
+            _mm256_cmpeq_epi16(v, zero),
+            _mm256_cmpeq_epi16(_mm256_and_si256(v, surrogateMask), surrogateBits));
+        if (_mm256_movemask_epi8(special))
+            return p;
+    }
+    return SkipPlainSse2(p, end);
+}
+TARGET_AVX2 size_t AsciiToUtf8Avx2(const uint16_t* src, const uint16_t* end, char* dst) noexcept
+{
+    const __m256i nonAsciiMask = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    const uint16_t* p = src;
+    for (; end - p >= 16; p += 16, dst += 16)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        if (!_mm256_testz_si256(v, nonAsciiMask))
+            return p - src;
+        // packus works within 128 bit lanes, gather low qwords of both lanes
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(packed));
+    }
+    return (p - src) + AsciiToUtf8Sse2(p, end, dst);
+}
+TARGET_AVX2 size_t AsciiFromUtf8Avx2(const char* src, const char* end, uint16_t* dst) noexcept
+{
+    const char* p = src;
+    for (; end - p >= 32; p += 32, dst += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        if (_mm256_movemask_epi8(v))
+            return p - src;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+    return (p - src) + AsciiFromUtf8Sse2(p, end, dst);
+}
+
+#endif // TEXT_CODEC_X86
+
+
+// Kernels selection ----------------------------------------------------------------
+
+struct Kernels
+{
+    SimdLevel level;
+    const uint16_t* (*skipPlain)(const uint16_t* p, const uint16_t* end) noexcept;
+    size_t (*asciiToUtf8)(const uint16_t* src, const uint16_t* end, char* dst) noexcept;
+    size_t (*asciiFromUtf8)(const char* src, const char* end, uint16_t* dst) noexcept;
+};
+
+SimdLevel DetectSimdLevel() noexcept
+{
+#ifdef TEXT_CODEC_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    // OS must save AVX registers on context switch
+    if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+            return SimdLevel::AVX2;
+    }
+    return SimdLevel::SSE2;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#endif
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// Tables are constant initialized, so they are ready before any dynamic initialization
+#ifdef TEXT_CODEC_X86
+constexpr Kernels avx2Kernels = { SimdLevel::AVX2, SkipPlainAvx2, AsciiToUtf8Avx2, AsciiFromUtf8Avx2 };
+constexpr Kernels sse2Kernels = { SimdLevel::SSE2, SkipPlainSse2, AsciiToUtf8Sse2, AsciiFromUtf8Sse2 };
+#endif
+constexpr Kernels scalarKernels = { SimdLevel::Scalar, SkipPlainScalar, AsciiToUtf8Scalar, AsciiFromUtf8Scalar };
+
+const Kernels* SelectKernels(SimdLevel level) noexcept
+{
+#ifdef TEXT_CODEC_X86
+    if (level == SimdLevel::AVX2)
+        return &avx2Kernels;
+    if (level == SimdLevel::SSE2)
+        return &sse2Kernels;
+#endif
+    return &scalarKernels;
+}
+
+SimdLevel MaxSimdLevel() noexcept
+{
+    static const SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+std::atomic<const Kernels*> selectedKernels{ nullptr };   // nullptr until first use
+
+// Selected on first use, SetSimdLevel replaces the pointer while other threads transcode
+const Kernels& GetKernels() noexcept
+{
+    const Kernels* kernels = selectedKernels.load(std::memory_order_acquire);
+    if (kernels)
+        return *kernels;
+    const Kernels* expected = nullptr;
+    kernels = SelectKernels(MaxSimdLevel());
+    if (!selectedKernels.compare_exchange_strong(expected, kernels, std::memory_order_acq_rel))
+        kernels = expected;
+    return *kernels;
+}
+
+
+// UTF-16 ---------------------------------------------------------------------------
+
+// Returns first zero, end if there is none or nullptr if text before zero is invalid
+const uint16_t* ScanText16(const uint16_t* p, const uint16_t* end) noexcept
+{
+    const Kernels& kernels = GetKernels();
+    while (p < end)
+    {
+        p = kernels.skipPlain(p, end);
+        const uint16_t* blockEnd = p + (std::min)(end - p, BLOCK_SIZE);
+        while (p < blockEnd)
+        {
+            uint16_t c = *p;
+            if (c == 0)
+                return p;
+            if (!IsSurrogate(c))
+            {
+                ++p;
+                continue;
+            }
+            if (!IsHighSurrogate(c) || end - p < 2 || !IsLowSurrogate(p[1]))
+                return nullptr;
+            p += 2;
+        }
+    }
+    return end;
+}
+
+size_t Utf16ToUtf8(const uint16_t* src, size_t len, char* dst) noexcept
+{
+    const Kernels& kernels = GetKernels();
+    const uint16_t* p = src;
+    const uint16_t* end = src + len;
+    char* out = dst;
+    while (p < end)
+    {
+        size_t n = kernels.asciiToUtf8(p, end, out);
+        p += n;
+        out += n;
+
+        const uint16_t* blockEnd = p + (std::min)(end - p, BLOCK_SIZE);
+        while (p < blockEnd)
+        {
+            uint32_t c = *p++;
+            if (IsSurrogate(c))
+            {
+                if (!IsHighSurrogate(c) || p == end || !IsLowSurrogate(*p))
+                    return INVALID_TEXT;
+                c = 0x10000 + ((c - 0xD800) << 10) + (*p++ - 0xDC00);
+            }
+            out = EncodeUtf8(c, out);
+        }
+    }
+    return out - dst;
+}
+
+size_t Utf8ToUtf16(const char* src, size_t len, uint16_t* dst) noexcept
+{
+    const Kernels& kernels = GetKernels();
+    const char* p = src;
+    const char* end = src + len;
+    uint16_t* out = dst;
+    while (p < end)
+    {
+        size_t n = kernels.asciiFromUtf8(p, end, out);
+        p += n;
+        out += n;
+
+        const char* blockEnd = p + (std::min)(end - p, BLOCK_SIZE);
+        while (p < blockEnd)
+        {
+            uint32_t c;
+            auto next = DecodeUtf8(reinterpret_cast<const unsigned char*>(p),
+                reinterpret_cast<const unsigned char*>(end), c);
+            if (!next)
+                return INVALID_TEXT;
+            p = reinterpret_cast<const char*>(next);
+            if (c < 0x10000)
+                *out++ = static_cast<uint16_t>(c);
+            else
+            {
+                c -= 0x10000;
+                *out++ = static_cast<uint16_t>(0xD800 + (c >> 10));
+                *out++ = static_cast<uint16_t>(0xDC00 + (c & 0x3FF));
+            }
+        }
+    }
+    return out - dst;
+}
+
+
+// UTF-32 ---------------------------------------------------------------------------
+
+inline bool IsValidCodePoint(uint32_t c) noexcept
+{
+    return c <= 0x10FFFF && !IsSurrogate(c);
+}
+
+const uint32_t* ScanText32(const uint32_t* p, const uint32_t* end) noexcept
+{
+    for (; p < end; ++p)
+    {
+        if (*p == 0)
+            return p;
+        if (!IsValidCodePoint(*p))
+            return nullptr;
+    }
+    return end;
+}
+
+size_t Utf32ToUtf8(const uint32_t* src, size_t len, char* dst) noexcept
+{
+    char* out = dst;
+    for (const uint32_t* p = src, *end = src + len; p < end; ++p)
+    {
+        if (!IsValidCodePoint(*p))
+            return INVALID_TEXT;
+        out = EncodeUtf8(*p, out);
+    }
+    return out - dst;
+}
+
+size_t Utf8ToUtf32(const char* src, size_t len, uint32_t* dst) noexcept
+{
+    auto p = reinterpret_cast<const unsigned char*>(src);
+    auto end = p + len;
+    uint32_t* out = dst;
+    while (p < end)
+    {
+        p = DecodeUtf8(p, end, *out++);
+        if (!p)
+            return INVALID_TEXT;
+    }
+    return out - dst;
+}
+
+const wchar_t* ScanText(const wchar_t* begin, const wchar_t* end) noexcept
+{
+    if (sizeof(wchar_t) == sizeof(uint16_t))
+        return reinterpret_cast<const wchar_t*>(ScanText16(
+            reinterpret_cast<const uint16_t*>(begin), reinterpret_cast<const uint16_t*>(end)));
+    else
+        return reinterpret_cast<const wchar_t*>(ScanText32(
+            reinterpret_cast<const uint32_t*>(begin), reinterpret_cast<const uint32_t*>(end)));
+}
+
+} // namespace
+
+
+// TextCodec ------------------------------------------------------------------------
+
+const wchar_t* TextCodec::FindTerminator(const wchar_t* begin, const wchar_t* end) noexcept
+{
+    const wchar_t* p = ScanText(begin, end);
+    return p == end ? nullptr : p;
+}
+
+bool TextCodec::IsValid(const wchar_t* str, size_t len) noexcept
+{
+    // Text can't contain zeroes, so whole span is scanned only if there is none
+    return ScanText(str, str + len) == str + len;
+}
+
+size_t TextCodec::WideToUtf8(const wchar_t* src, size_t len, char* dst) noexcept
+{
+    if (sizeof(wchar_t) == sizeof(uint16_t))
+        return Utf16ToUtf8(reinterpret_cast<const uint16_t*>(src), len, dst);
+    else
+        return Utf32ToUtf8(reinterpret_cast<const uint32_t*>(src), len, dst);
+}
+
+size_t TextCodec::Utf8ToWide(const char* src, size_t len, wchar_t* dst) noexcept
+{
+    if (sizeof(wchar_t) == sizeof(uint16_t))
+        return Utf8ToUtf16(src, len, reinterpret_cast<uint16_t*>(dst));
+    else
+        return Utf8ToUtf32(src, len, reinterpret_cast<uint32_t*>(dst));
+}
+
+bool TextCodec::WideToUtf8(const std::wstring& src, std::string& dst)
+{
+    dst.resize(MaxUtf8Size(src.size()));
+    size_t n = WideToUtf8(src.data(), src.size(), &dst[0]);
+    if (n == INVALID_TEXT)
+    {
+        dst.clear();
+        return false;
+    }
+    dst.resize(n);
+    return true;
+}
+
+bool TextCodec::Utf8ToWide(const std::string& src, std::wstring& dst)
+{
+    dst.resize(src.size());
+    size_t n = Utf8ToWide(src.data(), src.size(), &dst[0]);
+    if (n == INVALID_TEXT)
+    {
+        dst.clear();
+        return false;
+    }
+    dst.resize(n);
+    return true;
+}
+
+SimdLevel TextCodec::GetSimdLevel() noexcept
+{
+    return GetKernels().level;
+}
+
+SimdLevel TextCodec::GetMaxSimdLevel() noexcept
+{
+    return MaxSimdLevel();
+}
+
+bool TextCodec::SetSimdLevel(SimdLevel level) noexcept
+{
+    if (level > MaxSimdLevel())
+        return false;
+    selectedKernels.store(SelectKernels(level), std::memory_order_release);
+    return true;
+}
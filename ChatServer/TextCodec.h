@@ -0,0 +1,52 @@
+#ifndef _TEXT_CODEC_H_
+#define _TEXT_CODEC_H_
+
+#include <cinttypes>
+#include <string>
+
+// Validation and transcoding of message text.
+// wchar_t text is UTF-16 on Windows and UTF-32 on other platforms.
+// UTF-16 kernels have SSE2 and AVX2 versions selected at startup by CPU features,
+// all other cases use scalar code.
+
+namespace TextCodec
+{
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+constexpr size_t INVALID_TEXT = static_cast<size_t>(-1);
+
+// Finds first zero character in [begin, end) and validates text before it in one pass.
+// Returns nullptr if there is no zero or text contains invalid code units.
+const wchar_t* FindTerminator(const wchar_t* begin, const wchar_t* end) noexcept;
+// Text of len characters without zeroes, terminator isn't required
+bool IsValid(const wchar_t* str, size_t len) noexcept;
+
+// Maximal size of UTF-8 text converted from len wchar_t characters
+constexpr size_t MaxUtf8Size(size_t len) noexcept
+{
+    return len * (sizeof(wchar_t) == 2 ? 3 : 4);
+}
+
+// Transcoding. dst must have room for MaxUtf8Size(len) bytes or len wide characters.
+// Returns number of written units or INVALID_TEXT if source is not valid.
+size_t WideToUtf8(const wchar_t* src, size_t len, char* dst) noexcept;
+size_t Utf8ToWide(const char* src, size_t len, wchar_t* dst) noexcept;
+
+bool WideToUtf8(const std::wstring& src, std::string& dst);
+bool Utf8ToWide(const std::string& src, std::wstring& dst);
+
+// Highest level supported by CPU is selected by default.
+// Level can be lowered to compare kernels, levels not supported by CPU are ignored.
+SimdLevel GetSimdLevel() noexcept;
+SimdLevel GetMaxSimdLevel() noexcept;
+bool SetSimdLevel(SimdLevel level) noexcept;
+
+} // namespace TextCodec
+
+#endif // !_TEXT_CODEC_H_
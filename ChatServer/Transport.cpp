@@ -0,0 +1,342 @@
+#include "Transport.h"
+#include <algorithm>
+#include <condition_variable>
+#include <vector>
+#include <string.h>
+
+typedef std::unique_lock<std::mutex> MutexLock;
+
+TransportUPtr SocketTransport::Connect(const SOCKADDR* addr, int addrSize, bool nonBlocking) noexcept
+{
+    CSOCKET sock;
+    if (!sock.Init(addr->sa_family, SOCK_STREAM, addr->sa_family == AF_INET ? IPPROTO_TCP : 0))
+        return nullptr;
+
+    u_long mode = nonBlocking ? 1 : 0;
+    if (nonBlocking && ::ioctlsocket(sock, FIONBIO, &mode) != 0)
+        return nullptr;
+    if (::connect(sock, addr, addrSize) != 0 && !(nonBlocking && WSAGetLastError() == WSAEWOULDBLOCK))
+        return nullptr;
+
+    TransportUPtr transport(new (std::nothrow) SocketTransport(sock.Release()));
+    if (!transport)
+        WSASetLastError(ERROR_OUTOFMEMORY);
+    return transport;
+}
+TransportUPtr SocketTransport::ConnectTcp(CSOCKADDR_IN addr, bool nonBlocking) noexcept
+{
+    return Connect(addr, addr.Size(), nonBlocking);
+}
+TransportUPtr SocketTransport::ConnectUnix(const std::string& path, bool nonBlocking) noexcept
+{
+    CSOCKADDR_UN addr;
+    if (!addr.SetPath(path))
+    {
+        WSASetLastError(WSAEINVAL);
+        return nullptr;
+    }
+    return Connect(addr, addr.Size(), nonBlocking);
+}
+
+int SocketTransport::Send(const char* data, int size) noexcept
+{
+    return ::send(m_socket, data, size, 0);
+}
+int SocketTransport::Recv(char* data, int size) noexcept
+{
+    return ::recv(m_socket, data, size, 0);
+}
+bool SocketTransport::SetNonBlocking(bool nonBlocking) noexcept
+{
+    u_long mode = nonBlocking ? 1 : 0;
+    return ::ioctlsocket(m_socket, FIONBIO, &mode) == 0;
+}
+void SocketTransport::Close() noexcept
+{
+    m_socket.Reset();
+}
+void SocketTransport::Shutdown() noexcept
+{
+    m_shutdown = true;
+    ::shutdown(m_socket, SD_BOTH);
+}
+bool SocketTransport::IsOpen() const noexcept
+{
+    return !!m_socket && !m_shutdown;
+}
+SOCKET SocketTransport::Handle() const noexcept
+{
+    return m_socket.Get();
+}
+
+
+SocketListener::~SocketListener() noexcept
+{
+    m_socket.Reset();
+    if (!m_unixPath.empty())
+        ::DeleteFileA(m_unixPath.c_str());
+}
+
+bool SocketListener::ListenTcp(uint16_t port) noexcept
+{
+    CSOCKADDR_IN addr(AF_INET, ::htons(port), ADDR_ANY);
+    return m_socket.Init(PF_INET, SOCK_STREAM, IPPROTO_TCP) &&
+        ::bind(m_socket, addr, addr.Size()) == 0 &&
+        ::listen(m_socket, SOMAXCONN) == 0;
+}
+
+#ifndef IO_REPARSE_TAG_AF_UNIX
+#define IO_REPARSE_TAG_AF_UNIX 0x80000023L
+#endif
+
+// Socket file stays after listener that wasn't closed, bind fails on it.
+// Only a socket nobody listens on is removed, other files are left to the user.
+static bool RemoveStaleSocket(const std::string& path, CSOCKADDR_UN& addr) noexcept
+{
+    WIN32_FIND_DATAA data;
+    HANDLE find = ::FindFirstFileA(path.c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return true;
+    ::FindClose(find);
+    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) || data.dwReserved0 != IO_REPARSE_TAG_AF_UNIX)
+    {
+        WSASetLastError(WSAEADDRINUSE);
+        return false;
+    }
+
+    CSOCKET probe;
+    if (!probe.Init(AF_UNIX, SOCK_STREAM, 0))
+        return false;
+    if (::connect(probe, addr, addr.Size()) == 0 || WSAGetLastError() != WSAECONNREFUSED)
+    {
+        WSASetLastError(WSAEADDRINUSE);
+        return false;
+    }
+    if (!::DeleteFileA(path.c_str()))
+    {
+        WSASetLastError(::GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool SocketListener::ListenUnix(const std::string& path) noexcept
+{
+    CSOCKADDR_UN addr;
+    if (!addr.SetPath(path))
+    {
+        WSASetLastError(WSAEINVAL);
+        return false;
+    }
+    if (!m_socket.Init(AF_UNIX, SOCK_STREAM, 0))
+        return false;
+
+    if (!RemoveStaleSocket(path, addr) || ::bind(m_socket, addr, addr.Size()) != 0)
+        return false;
+    try { m_unixPath = path; }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return false; }
+    return ::listen(m_socket, SOMAXCONN) == 0;
+}
+
+bool SocketListener::Accept(TransportUPtr& transport) noexcept
+{
+    transport.reset();
+
+    timeval waitTime = { 0, 0 };
+    fd_set fd;
+    FD_ZERO(&fd);
+    FD_SET(m_socket.Get(), &fd);
+    int selectRes = ::select(1, &fd, nullptr, nullptr, &waitTime);
+    if (selectRes <= 0)
+        return selectRes == 0;
+
+    CSOCKET sock(::accept(m_socket, nullptr, nullptr));
+    if (!sock)
+        return false;
+    transport.reset(new (std::nothrow) SocketTransport(sock.Release()));
+    if (!transport)
+    {
+        WSASetLastError(ERROR_OUTOFMEMORY);
+        return false;
+    }
+    return true;
+}
+
+
+// One direction of pipe: ring buffer written by one end and read by the other
+struct PipeTransport::Channel
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<char> buffer;
+    size_t head = 0;        // offset of first unread byte
+    size_t size = 0;        // unread bytes
+    bool writerClosed = false;
+    bool readerClosed = false;
+};
+
+PipeTransport::PipeTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out) noexcept
+    : m_in(std::move(in)), m_out(std::move(out)), m_nonBlocking(false), m_open(true)
+{
+}
+
+PipeTransport::~PipeTransport() noexcept
+{
+    Close();
+}
+
+bool PipeTransport::CreatePair(TransportUPtr& first, TransportUPtr& second, size_t bufferSize) noexcept
+{
+    first.reset();
+    second.reset();
+    if (bufferSize == 0)
+    {
+        WSASetLastError(WSAEINVAL);
+        return false;
+    }
+    try
+    {
+        auto forward = std::make_shared<Channel>();
+        auto backward = std::make_shared<Channel>();
+        forward->buffer.resize(bufferSize);
+        backward->buffer.resize(bufferSize);
+        first.reset(new PipeTransport(backward, forward));
+        second.reset(new PipeTransport(forward, backward));
+    }
+    catch (std::exception&)
+    {
+        first.reset();
+        second.reset();
+        WSASetLastError(ERROR_OUTOFMEMORY);
+        return false;
+    }
+    return true;
+}
+
+int PipeTransport::Send(const char* data, int size) noexcept
+{
+    Channel& ch = *m_out;
+    MutexLock lk(ch.mtx);
+    for (;;)
+    {
+        if (ch.writerClosed)
+        {
+            WSASetLastError(WSAECONNABORTED);
+            return SOCKET_ERROR;
+        }
+        if (ch.readerClosed)
+        {
+            WSASetLastError(WSAECONNRESET);
+            return SOCKET_ERROR;
+        }
+        size_t capacity = ch.buffer.size();
+        if (ch.size != capacity || size == 0)
+            break;
+        if (m_nonBlocking)
+        {
+            WSASetLastError(WSAEWOULDBLOCK);
+            return SOCKET_ERROR;
+        }
+        ch.cv.wait(lk);
+    }
+
+    // Free space may wrap around the end of buffer
+    size_t capacity = ch.buffer.size();
+    size_t count = (std::min)(static_cast<size_t>(size), capacity - ch.size);
+    size_t tail = (ch.head + ch.size) % capacity;
+    size_t first = (std::min)(count, capacity - tail);
+    memcpy(ch.buffer.data() + tail, data, first);
+    memcpy(ch.buffer.data(), data + first, count - first);
+    ch.size += count;
+    lk.unlock();
+    ch.cv.notify_all();
+    return static_cast<int>(count);
+}
+
+int PipeTransport::Recv(char* data, int size) noexcept
+{
+    Channel& ch = *m_in;
+    MutexLock lk(ch.mtx);
+    for (;;)
+    {
+        if (ch.readerClosed)
+        {
+            WSASetLastError(WSAECONNABORTED);
+            return SOCKET_ERROR;
+        }
+        if (ch.size != 0 || size == 0)
+            break;
+        if (ch.writerClosed)
+            return 0;
+        if (m_nonBlocking)
+        {
+            WSASetLastError(WSAEWOULDBLOCK);
+            return SOCKET_ERROR;
+        }
+        ch.cv.wait(lk);
+    }
+
+    size_t capacity = ch.buffer.size();
+    size_t count = (std::min)(static_cast<size_t>(size), ch.size);
+    size_t first = (std::min)(count, capacity - ch.head);
+    memcpy(data, ch.buffer.data() + ch.head, first);
+    memcpy(data + first, ch.buffer.data(), count - first);
+    ch.head = (ch.head + count) % capacity;
+    ch.size -= count;
+    lk.unlock();
+    ch.cv.notify_all();
+    return static_cast<int>(count);
+}
+
+bool PipeTransport::SetNonBlocking(bool nonBlocking) noexcept
+{
+    m_nonBlocking = nonBlocking;
+    return true;
+}
+
+// Unread bytes are dropped, peer gets end of stream after the bytes it hasn't read yet
+void PipeTransport::Close() noexcept
+{
+    if (!m_open.exchange(false))
+        return;
+    {
+        MutexLock lk(m_in->mtx);
+        m_in->readerClosed = true;
+        m_in->size = 0;
+    }
+    m_in->cv.notify_all();
+    {
+        MutexLock lk(m_out->mtx);
+        m_out->writerClosed = true;
+    }
+    m_out->cv.notify_all();
+}
+
+bool PipeTransport::IsOpen() const noexcept
+{
+    return m_open;
+}
+
+
+TransportUPtr PipeListener::Connect() noexcept
+{
+    TransportUPtr client, server;
+    if (!PipeTransport::CreatePair(client, server, m_bufferSize))
+        return nullptr;
+    MutexLock lk(m_mtx);
+    try { m_pending.push_back(std::move(server)); }
+    catch (std::exception&) { WSASetLastError(ERROR_OUTOFMEMORY); return nullptr; }
+    return client;
+}
+
+bool PipeListener::Accept(TransportUPtr& transport) noexcept
+{
+    transport.reset();
+    MutexLock lk(m_mtx);
+    if (!m_pending.empty())
+    {
+        transport = std::move(m_pending.front());
+        m_pending.pop_front();
+    }
+    return true;
+}
@@ -0,0 +1,149 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "Common.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#ifndef DEF_PIPE_BUFFER_SIZE
+#define DEF_PIPE_BUFFER_SIZE (256 * 1024) // bytes in flight in one direction of in-memory pipe
+#endif
+
+// Byte stream connection of ClientBase. Send and Recv follow ::send and ::recv: they return
+// SOCKET_ERROR with error set by WSASetLastError, WSAEWOULDBLOCK in non-blocking mode,
+// and Recv returns 0 after peer closed connection.
+// Shutdown can be called from another thread to break blocking calls. Close releases the handle,
+// so it must not race with other calls: a thread still inside Send could use a reused handle.
+// Object stays valid after both.
+class Transport
+{
+public:
+    typedef std::function<void()> Wakeup;
+
+    Transport(const Transport&) = delete;
+    Transport& operator = (const Transport&) = delete;
+
+    Transport() noexcept {}
+    virtual ~Transport() noexcept {}
+
+    virtual int Send(const char* data, int size) noexcept = 0;
+    virtual int Recv(char* data, int size) noexcept = 0;
+    virtual bool SetNonBlocking(bool nonBlocking) noexcept = 0;
+    virtual void Close() noexcept = 0;
+    // Connection fails in both directions, handle is kept until Close
+    virtual void Shutdown() noexcept { Close(); }
+    virtual bool IsOpen() const noexcept = 0;
+    // Socket for WSAPoll and WSAEventSelect, INVALID_SOCKET if transport isn't a socket
+    virtual SOCKET Handle() const noexcept { return INVALID_SOCKET; }
+    // Hook is called when transport may have become readable or writable, so event loops
+    // without poll find it. Returns false if transport doesn't call hooks.
+    virtual bool SetWakeup(Wakeup) noexcept { return false; }
+};
+
+typedef std::unique_ptr<Transport> TransportUPtr;
+
+// Source of connections of server, polled by accepting thread
+class Listener
+{
+public:
+    Listener(const Listener&) = delete;
+    Listener& operator = (const Listener&) = delete;
+
+    Listener() noexcept {}
+    virtual ~Listener() noexcept {}
+
+    // Takes pending connection without waiting, transport stays empty if there is none.
+    // Returns false if listener failed.
+    virtual bool Accept(TransportUPtr& transport) noexcept = 0;
+};
+
+
+// TCP or Unix domain stream socket
+class SocketTransport : public Transport
+{
+public:
+    explicit SocketTransport(SOCKET sock) noexcept : m_socket(sock), m_shutdown(false) {}
+
+    // Return nullptr on error, non-blocking connect may be still in progress
+    static TransportUPtr Connect(const SOCKADDR* addr, int addrSize, bool nonBlocking = false) noexcept;
+    static TransportUPtr ConnectTcp(CSOCKADDR_IN addr, bool nonBlocking = false) noexcept;
+    // Needs Windows 10 1803 or newer
+    static TransportUPtr ConnectUnix(const std::string& path, bool nonBlocking = false) noexcept;
+
+    int Send(const char* data, int size) noexcept override;
+    int Recv(char* data, int size) noexcept override;
+    bool SetNonBlocking(bool nonBlocking) noexcept override;
+    void Close() noexcept override;
+    void Shutdown() noexcept override;
+    bool IsOpen() const noexcept override;
+    SOCKET Handle() const noexcept override;
+private:
+    CSOCKET m_socket;
+    std::atomic_bool m_shutdown;
+};
+
+class SocketListener : public Listener
+{
+public:
+    SocketListener() noexcept {}
+    ~SocketListener() noexcept;
+
+    // Listens on port of all interfaces
+    bool ListenTcp(uint16_t port) noexcept;
+    // Stale socket file of previous run is replaced, file in use or not a socket fails with WSAEADDRINUSE.
+    // Socket file is removed with listener.
+    bool ListenUnix(const std::string& path) noexcept;
+
+    bool Accept(TransportUPtr& transport) noexcept override;
+private:
+    CSOCKET m_socket;
+    std::string m_unixPath;
+};
+
+
+// In-memory connection within one process, no kernel calls are made.
+// Blocking calls wait on condition variable, non-blocking ones have nothing to poll,
+// event loops retry them.
+class PipeTransport : public Transport
+{
+public:
+    ~PipeTransport() noexcept;
+
+    // Connected ends, each direction holds up to bufferSize bytes
+    static bool CreatePair(TransportUPtr& first, TransportUPtr& second, size_t bufferSize = DEF_PIPE_BUFFER_SIZE) noexcept;
+
+    int Send(const char* data, int size) noexcept override;
+    int Recv(char* data, int size) noexcept override;
+    bool SetNonBlocking(bool nonBlocking) noexcept override;
+    void Close() noexcept override;
+    bool IsOpen() const noexcept override;
+private:
+    struct Channel;
+    PipeTransport(std::shared_ptr<Channel> in, std::shared_ptr<Channel> out) noexcept;
+
+    std::shared_ptr<Channel> m_in;
+    std::shared_ptr<Channel> m_out;
+    std::atomic_bool m_nonBlocking;
+    std::atomic_bool m_open;
+};
+
+// Connections made by Connect are accepted by server of the same process
+class PipeListener : public Listener
+{
+public:
+    explicit PipeListener(size_t bufferSize = DEF_PIPE_BUFFER_SIZE) noexcept : m_bufferSize(bufferSize) {}
+
+    // Returns client end of new connection, nullptr on error
+    TransportUPtr Connect() noexcept;
+
+    bool Accept(TransportUPtr& transport) noexcept override;
+private:
+    size_t m_bufferSize;
+    std::mutex m_mtx;
+    std::deque<TransportUPtr> m_pending;
+};
+
+#endif // !_TRANSPORT_H_
@@ -0,0 +1,71 @@
+#include "Simulator.h"
+#include "../ChatServer/Logger.h"
+#include <iostream>
+#include <cstring>
+#include <string>
+
+// Deterministic simulation of ChatServer with many clients, see Workload.h for script format.
+// Usage: ChatSim [options] script
+//   --clients N      overrides clients of script
+//   --seed N         overrides seed of script
+
+static void PrintUsage()
+{
+    std::cout << "Usage: ChatSim [--clients N] [--seed N] script" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 1;
+    try
+    {
+        const char* path = nullptr;
+        const char* clients = nullptr;
+        const char* seed = nullptr;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+                clients = argv[++i];
+            else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+                seed = argv[++i];
+            else if (!path && strncmp(argv[i], "--", 2) != 0)
+                path = argv[i];
+            else
+            {
+                PrintUsage();
+                return ret;
+            }
+        }
+        if (!path)
+        {
+            PrintUsage();
+            return ret;
+        }
+
+        Workload workload;
+        std::string error;
+        if (!workload.Load(path, error))
+        {
+            std::cout << error << std::endl;
+            return ret;
+        }
+        if (clients)
+            workload.clients = std::stoul(clients);
+        if (seed)
+            workload.seed = std::stoull(seed);
+
+        // Every lost connection would be logged
+        Logger::SetLevel(LogLevel::Error);
+        Simulator simulator(workload);
+        ret = !simulator.Run();
+    }
+    catch (std::exception& exc)
+    {
+        std::cout << exc.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cout << "Unknown exception" << std::endl;
+    }
+    return ret;
+}
@@ -0,0 +1,427 @@
+#include "SimNetwork.h"
+#include <algorithm>
+#include <string.h>
+
+// Throttled reader may catch up on bytes of this long pause at once
+constexpr SimTime SLOW_READ_BURST = 100 * SIM_MS;
+// Drained buffer bigger than this is freed, so idle links of many clients take little memory
+constexpr size_t MAX_IDLE_BUFFER_SIZE = 4096;
+// Read bytes are removed from the front of buffer when there are this many of them
+constexpr size_t COMPACT_SIZE = 64 * 1024;
+
+void SimScheduler::Schedule(SimTime time, SimEventKind kind, uint32_t index, uint8_t direction)
+{
+    m_events.push({ (std::max)(time, m_now), m_order++, kind, direction, index });
+}
+
+bool SimScheduler::Next(SimEvent& event)
+{
+    if (m_events.empty())
+        return false;
+    event = m_events.top();
+    m_events.pop();
+    m_now = event.time;
+    return true;
+}
+
+bool SimScheduler::Peek(SimTime& time) const noexcept
+{
+    if (m_events.empty())
+        return false;
+    time = m_events.top().time;
+    return true;
+}
+
+
+struct SimNetwork::Link
+{
+    // Bytes or close marker sent by one call
+    struct Flight
+    {
+        SimTime arrival;
+        size_t size;
+        bool close;
+    };
+
+    // One direction of link
+    struct Stream
+    {
+        std::vector<char> bytes;        // unread bytes from head, arrived ones first
+        size_t head = 0;
+        size_t arrived = 0;             // bytes from head receiver can read
+        std::deque<Flight> inFlight;
+        SimTime freeAt = 0;             // sender's bandwidth is busy until
+        SimTime lastArrival = 0;
+        bool writerClosed = false;
+        bool closeArrived = false;
+        bool resetArrived = false;
+        bool readerClosed = false;      // sender learned that receiver is gone, sends fail
+        bool discard = false;           // receiver is closed, bytes are lost
+        bool senderBlocked = false;     // sender found window full and waits for wakeup
+        bool readPending = false;       // ReadWakeup is scheduled
+
+        size_t Unread() const noexcept { return bytes.size() - head; }
+        void Drop() noexcept
+        {
+            std::vector<char>().swap(bytes);
+            head = 0;
+            arrived = 0;
+        }
+    };
+
+    Stream streams[2];
+    SimTransport* ends[2] = {};         // by outgoing direction
+};
+
+static SimNetwork::Direction Opposite(SimNetwork::Direction dir) noexcept
+{
+    return dir == SimNetwork::ToServer ? SimNetwork::ToClient : SimNetwork::ToServer;
+}
+
+SimNetwork::SimNetwork(SimScheduler& scheduler, const NetConfig& config, uint64_t seed)
+    : m_scheduler(scheduler), m_config(config), m_random(seed)
+{
+    m_config.window = (std::max)(m_config.window, 1u);
+}
+
+SimNetwork::~SimNetwork()
+{
+    m_pending.clear();
+}
+
+std::unique_ptr<SimTransport> SimNetwork::Connect()
+{
+    uint32_t index = static_cast<uint32_t>(m_links.size());
+    std::unique_ptr<SimTransport> client;
+    try
+    {
+        std::unique_ptr<Link> link(new Link);
+        client.reset(new SimTransport(*this, index, ToServer));
+        std::unique_ptr<SimTransport> server(new SimTransport(*this, index, ToClient));
+        link->ends[ToServer] = client.get();
+        link->ends[ToClient] = server.get();
+        m_links.push_back(std::move(link));
+        m_pending.push_back(std::move(server));
+    }
+    catch (std::exception&)
+    {
+        WSASetLastError(ERROR_OUTOFMEMORY);
+        return nullptr;
+    }
+    ++m_stats.links;
+    return client;
+}
+
+std::unique_ptr<SimTransport> SimNetwork::Accept()
+{
+    if (m_pending.empty())
+        return nullptr;
+    std::unique_ptr<SimTransport> server = std::move(m_pending.front());
+    m_pending.pop_front();
+    return server;
+}
+
+void SimNetwork::ProcessEvent(const SimEvent& event)
+{
+    if (event.index >= m_links.size() || !m_links[event.index])
+        return;
+    Link& link = *m_links[event.index];
+    Direction dir = static_cast<Direction>(event.direction);
+    Link::Stream& stream = link.streams[dir];
+
+    switch (event.kind)
+    {
+    case SimEventKind::Arrival:
+    {
+        if (stream.inFlight.empty())
+            return;
+        Link::Flight flight = stream.inFlight.front();
+        stream.inFlight.pop_front();
+        if (stream.discard || stream.resetArrived)
+            return;
+        if (flight.close)
+            stream.closeArrived = true;
+        else
+            stream.arrived += flight.size;
+        WakeReceiver(link, dir);
+        break;
+    }
+    case SimEventKind::Reset:
+    {
+        // Receiver loses unread bytes and can't send anymore
+        stream.resetArrived = true;
+        stream.Drop();
+        Link::Stream& back = link.streams[Opposite(dir)];
+        back.readerClosed = true;
+        back.Drop();
+        WakeReceiver(link, dir);
+        break;
+    }
+    case SimEventKind::ReadWakeup:
+        stream.readPending = false;
+        WakeReceiver(link, dir);
+        break;
+    default:
+        break;
+    }
+}
+
+int SimNetwork::Send(uint32_t index, Direction dir, const char* data, int size) noexcept
+{
+    Link& link = *m_links[index];
+    Link::Stream& stream = link.streams[dir];
+    if (stream.readerClosed)
+    {
+        WSASetLastError(WSAECONNRESET);
+        return SOCKET_ERROR;
+    }
+    size_t unread = stream.Unread();
+    if (stream.discard)
+    {
+        m_stats.bytes[dir] += (std::max)(size, 0);
+        return (std::max)(size, 0);
+    }
+    if (unread >= m_config.window)
+    {
+        stream.senderBlocked = true;
+        ++m_stats.blockedSends;
+        WSASetLastError(WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    }
+    if (size <= 0)
+        return 0;
+
+    size_t count = (std::min)(static_cast<size_t>(size), m_config.window - unread);
+    SimTime now = m_scheduler.Now();
+    SimTime start = (std::max)(now, stream.freeAt);
+    SimTime transmit = m_config.bandwidth ? count * SIM_SECOND / m_config.bandwidth : 0;
+    SimTime jitter = m_config.jitter ? std::uniform_int_distribution<SimTime>(0, m_config.jitter)(m_random) : 0;
+    // Bytes of a link never overtake each other
+    SimTime arrival = (std::max)(start + transmit + m_config.latency + jitter, stream.lastArrival);
+    try
+    {
+        stream.bytes.insert(stream.bytes.end(), data, data + count);
+        stream.inFlight.push_back({ arrival, count, false });
+        m_scheduler.Schedule(arrival, SimEventKind::Arrival, index, dir);
+    }
+    catch (std::exception&)
+    {
+        WSASetLastError(ERROR_OUTOFMEMORY);
+        return SOCKET_ERROR;
+    }
+    stream.freeAt = start + transmit;
+    stream.lastArrival = arrival;
+    m_stats.bytes[dir] += count;
+    return static_cast<int>(count);
+}
+
+int SimNetwork::Recv(uint32_t index, Direction dir, char* data, int size, uint64_t readRate, SimTime& readFrom) noexcept
+{
+    Link& link = *m_links[index];
+    Link::Stream& stream = link.streams[dir];
+    if (stream.resetArrived)
+    {
+        WSASetLastError(WSAECONNRESET);
+        return SOCKET_ERROR;
+    }
+    if (stream.arrived == 0)
+    {
+        if (stream.closeArrived)
+            return 0;
+        WSASetLastError(WSAEWOULDBLOCK);
+        return SOCKET_ERROR;
+    }
+
+    SimTime now = m_scheduler.Now();
+    size_t count = (std::min)(static_cast<size_t>((std::max)(size, 0)), stream.arrived);
+    if (readRate)
+    {
+        // Reader has time budget, each byte costs 1 / readRate seconds
+        readFrom = (std::max)(readFrom, now > SLOW_READ_BURST ? now - SLOW_READ_BURST : 0);
+        uint64_t allowed = (now - readFrom) * readRate / SIM_SECOND;
+        if (allowed == 0)
+        {
+            size_t chunk = (std::min)(stream.arrived, static_cast<size_t>(MAX_SEND_RECV_DATA_SIZE));
+            ScheduleRead(index, dir, readFrom + (chunk * SIM_SECOND + readRate - 1) / readRate);
+            WSASetLastError(WSAEWOULDBLOCK);
+            return SOCKET_ERROR;
+        }
+        count = static_cast<size_t>((std::min)(static_cast<uint64_t>(count), allowed));
+        readFrom += count * SIM_SECOND / readRate;
+    }
+
+    memcpy(data, stream.bytes.data() + stream.head, count);
+    stream.head += count;
+    stream.arrived -= count;
+    if (stream.head == stream.bytes.size())
+    {
+        if (stream.bytes.capacity() > MAX_IDLE_BUFFER_SIZE)
+            std::vector<char>().swap(stream.bytes);
+        else
+            stream.bytes.clear();
+        stream.head = 0;
+    }
+    else if (stream.head >= COMPACT_SIZE)
+    {
+        stream.bytes.erase(stream.bytes.begin(), stream.bytes.begin() + stream.head);
+        stream.head = 0;
+    }
+
+    // Reader may stop before it has taken everything, it is woken up again
+    if (stream.arrived)
+        ScheduleRead(index, dir, now);
+    if (stream.senderBlocked && stream.Unread() < m_config.window)
+    {
+        stream.senderBlocked = false;
+        WakeSender(link, dir);
+    }
+    return static_cast<int>(count);
+}
+
+void SimNetwork::Close(uint32_t index, Direction outgoing, bool reset) noexcept
+{
+    Link& link = *m_links[index];
+    Link::Stream& out = link.streams[outgoing];
+    Link::Stream& in = link.streams[Opposite(outgoing)];
+
+    // Peer's bytes are lost until it learns of close
+    in.discard = true;
+    in.Drop();
+    if (in.senderBlocked)
+    {
+        in.senderBlocked = false;
+        WakeSender(link, Opposite(outgoing));
+    }
+
+    out.writerClosed = true;
+    SimTime now = m_scheduler.Now();
+    try
+    {
+        if (reset)
+        {
+            // Bytes in flight are lost
+            ++m_stats.resets;
+            m_scheduler.Schedule(now + m_config.latency, SimEventKind::Reset, index, outgoing);
+        }
+        else
+        {
+            // Peer gets end of stream after bytes sent before
+            SimTime arrival = (std::max)((std::max)(now, out.freeAt) + m_config.latency, out.lastArrival);
+            out.inFlight.push_back({ arrival, 0, true });
+            out.lastArrival = arrival;
+            m_scheduler.Schedule(arrival, SimEventKind::Arrival, index, outgoing);
+        }
+    }
+    catch (std::exception&)
+    {
+    }
+}
+
+void SimNetwork::Release(uint32_t index, Direction outgoing) noexcept
+{
+    if (index >= m_links.size() || !m_links[index])
+        return;
+    Link& link = *m_links[index];
+    link.ends[outgoing] = nullptr;
+    // Events of released link are ignored
+    if (!link.ends[ToServer] && !link.ends[ToClient])
+        m_links[index].reset();
+}
+
+void SimNetwork::WakeSender(Link& link, Direction dir) noexcept
+{
+    SimTransport* end = link.ends[dir];
+    if (end && end->m_wakeup)
+        end->m_wakeup();
+}
+
+void SimNetwork::WakeReceiver(Link& link, Direction dir) noexcept
+{
+    SimTransport* end = link.ends[Opposite(dir)];
+    if (end && end->m_wakeup)
+        end->m_wakeup();
+}
+
+void SimNetwork::ScheduleRead(uint32_t index, Direction dir, SimTime time) noexcept
+{
+    Link::Stream& stream = m_links[index]->streams[dir];
+    if (stream.readPending)
+        return;
+    try
+    {
+        m_scheduler.Schedule(time, SimEventKind::ReadWakeup, index, dir);
+        stream.readPending = true;
+    }
+    catch (std::exception&)
+    {
+    }
+}
+
+
+SimTransport::~SimTransport() noexcept
+{
+    Close();
+    m_network.Release(m_link, m_outgoing);
+}
+
+int SimTransport::Send(const char* data, int size) noexcept
+{
+    if (!m_open)
+    {
+        WSASetLastError(WSAECONNABORTED);
+        return SOCKET_ERROR;
+    }
+    return m_network.Send(m_link, m_outgoing, data, size);
+}
+
+int SimTransport::Recv(char* data, int size) noexcept
+{
+    if (!m_open)
+    {
+        WSASetLastError(WSAECONNABORTED);
+        return SOCKET_ERROR;
+    }
+    return m_network.Recv(m_link, Opposite(m_outgoing), data, size, m_readRate, m_readFrom);
+}
+
+// Simulation can't wait, blocking mode isn't supported
+bool SimTransport::SetNonBlocking(bool nonBlocking) noexcept
+{
+    if (!nonBlocking)
+        WSASetLastError(WSAEOPNOTSUPP);
+    return nonBlocking;
+}
+
+void SimTransport::Close() noexcept
+{
+    if (!m_open)
+        return;
+    m_open = false;
+    m_network.Close(m_link, m_outgoing, false);
+}
+
+void SimTransport::Reset() noexcept
+{
+    if (!m_open)
+        return;
+    m_open = false;
+    m_network.Close(m_link, m_outgoing, true);
+}
+
+bool SimTransport::IsOpen() const noexcept
+{
+    return m_open;
+}
+
+bool SimTransport::SetWakeup(Wakeup wakeup) noexcept
+{
+    m_wakeup = std::move(wakeup);
+    return true;
+}
+
+
+bool SimListener::Accept(TransportUPtr& transport) noexcept
+{
+    transport = m_network.Accept();
+    return true;
+}
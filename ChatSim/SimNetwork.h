@@ -0,0 +1,167 @@
+#ifndef _SIM_NETWORK_H_
+#define _SIM_NETWORK_H_
+
+#include "../ChatServer/Transport.h"
+#include <cinttypes>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+#ifndef DEF_SIM_WINDOW
+#define DEF_SIM_WINDOW (64 * 1024) // bytes sender may have unread by receiver in one direction
+#endif
+
+// Virtual time in nanoseconds since start of simulation
+typedef uint64_t SimTime;
+
+constexpr SimTime SIM_MS = 1000000;
+constexpr SimTime SIM_SECOND = 1000000000;
+
+enum class SimEventKind : uint8_t
+{
+    Arrival,    // bytes or close of a link direction reach receiver
+    Reset,      // abrupt loss of connection reaches receiver
+    ReadWakeup, // receiver has bytes left unread
+    Client,     // simulated client timer
+    Workload,   // next workload step
+};
+
+struct SimEvent
+{
+    SimTime time;
+    uint64_t order;     // events of the same time run in scheduling order
+    SimEventKind kind;
+    uint8_t direction;
+    uint32_t index;
+
+    bool operator > (const SimEvent& other) const noexcept
+    {
+        return time != other.time ? time > other.time : order > other.order;
+    }
+};
+
+// Virtual clock and queue of events, the only source of time of simulation
+class SimScheduler
+{
+public:
+    SimTime Now() const noexcept { return m_now; }
+    void Schedule(SimTime time, SimEventKind kind, uint32_t index, uint8_t direction = 0);
+    // Takes the earliest event and advances clock to it, returns false if there are none
+    bool Next(SimEvent& event);
+    // Time of the earliest event, false if there are none
+    bool Peek(SimTime& time) const noexcept;
+    size_t Pending() const noexcept { return m_events.size(); }
+private:
+    SimTime m_now = 0;
+    uint64_t m_order = 0;
+    std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> m_events;
+};
+
+struct NetConfig
+{
+    SimTime latency = SIM_MS;       // one way
+    SimTime jitter = 0;             // added to latency at random, order of bytes is kept
+    uint64_t bandwidth = 0;         // bytes per second of each link direction, 0 - unlimited
+    uint32_t window = DEF_SIM_WINDOW;
+};
+
+struct NetStats
+{
+    uint64_t links = 0;
+    uint64_t bytes[2] = {};         // by direction: to server, to client
+    uint64_t blockedSends = 0;      // sender found window full
+    uint64_t resets = 0;
+};
+
+class SimTransport;
+
+// Links between simulated clients and server. Each link direction delivers bytes in order
+// after latency, spends bandwidth of its sender and keeps at most window bytes unread,
+// so sender blocks on slow reader.
+class SimNetwork
+{
+public:
+    enum Direction : uint8_t
+    {
+        ToServer,
+        ToClient,
+    };
+
+    SimNetwork(SimScheduler& scheduler, const NetConfig& config, uint64_t seed);
+    ~SimNetwork();
+
+    // New link, server end is queued for accept
+    std::unique_ptr<SimTransport> Connect();
+    std::unique_ptr<SimTransport> Accept();
+    // Network events, other kinds are ignored
+
+    void ProcessEvent(const SimEvent& event);
+    const NetStats& GetStats() const noexcept { return m_stats; }
+
+private:
+    friend class SimTransport;
+    struct Link;
+
+    int Send(uint32_t link, Direction dir, const char* data, int size) noexcept;
+    int Recv(uint32_t link, Direction dir, char* data, int size, uint64_t readRate, SimTime& readFrom) noexcept;
+    void Close(uint32_t link, Direction outgoing, bool reset) noexcept;
+    void Release(uint32_t link, Direction outgoing) noexcept;
+    void WakeSender(Link& link, Direction dir) noexcept;
+    void WakeReceiver(Link& link, Direction dir) noexcept;
+    void ScheduleRead(uint32_t link, Direction dir, SimTime time) noexcept;
+
+private:
+    SimScheduler& m_scheduler;
+    NetConfig m_config;
+    std::mt19937_64 m_random;
+    std::vector<std::unique_ptr<Link>> m_links;     // released links are null
+    std::deque<std::unique_ptr<SimTransport>> m_pending;
+    NetStats m_stats;
+};
+
+// End of simulated link, all calls are non-blocking
+class SimTransport : public Transport
+{
+public:
+    ~SimTransport() noexcept;
+
+    int Send(const char* data, int size) noexcept override;
+    int Recv(char* data, int size) noexcept override;
+    bool SetNonBlocking(bool nonBlocking) noexcept override;
+    void Close() noexcept override;
+    bool IsOpen() const noexcept override;
+    bool SetWakeup(Wakeup wakeup) noexcept override;
+
+    // Connection is lost: peer gets WSAECONNRESET instead of end of stream
+    void Reset() noexcept;
+    // Reader takes at most rate bytes per second, 0 - unlimited
+    void SetReadRate(uint64_t rate) noexcept { m_readRate = rate; }
+
+private:
+    friend class SimNetwork;
+    SimTransport(SimNetwork& network, uint32_t link, SimNetwork::Direction outgoing) noexcept
+        : m_network(network), m_link(link), m_outgoing(outgoing) {}
+
+    SimNetwork& m_network;
+    uint32_t m_link;
+    SimNetwork::Direction m_outgoing;
+    Wakeup m_wakeup;
+    bool m_open = true;
+    uint64_t m_readRate = 0;
+    SimTime m_readFrom = 0;     // throttled reader has read bytes of time up to it
+};
+
+// Server side of simulated network
+class SimListener : public Listener
+{
+public:
+    explicit SimListener(SimNetwork& network) noexcept : m_network(network) {}
+
+    bool Accept(TransportUPtr& transport) noexcept override;
+private:
+    SimNetwork& m_network;
+};
+
+#endif // !_SIM_NETWORK_H_
@@ -0,0 +1,634 @@
+#include "Simulator.h"
+#include "../ChatServer/ClientBase.h"
+#include "../ChatServer/ClientMessage.h"
+#include "../ChatServer/Server.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std::literals;
+
+// Simulated clients behave like ChatClient
+constexpr uint64_t ACK_INTERVAL = 16;
+constexpr uint32_t RECONNECT_ATTEMPTS = 8;
+constexpr SimTime RECONNECT_INITIAL_DELAY = 250 * SIM_MS;
+constexpr SimTime RECONNECT_MAX_DELAY = 8 * SIM_SECOND;
+
+namespace
+{
+
+enum class SimClientState
+{
+    Idle,
+    Joining,        // ClientConnect is sent
+    Joined,
+    Reconnecting,   // waits for next attempt
+    Closed,
+};
+
+class SimClient : public ClientBase
+{
+public:
+    SimClientState state = SimClientState::Idle;
+    bool ready = false;             // queued to be processed
+    bool slow = false;              // reads at slow rate of workload
+    uint32_t attempt = 0;           // failed reconnection attempts
+    SimTime delay = 0;              // before next reconnection attempt
+    uint32_t joinedPos = 0;         // in list of joined clients
+    uint64_t resumeToken = 0;
+    uint64_t lastSequence = 0;
+    uint64_t ackedSequence = 0;
+
+    SimTransport* Link() noexcept
+    {
+        return static_cast<SimTransport*>(GetTransport());
+    }
+};
+
+// Latencies in microseconds with relative error below 1/16:
+// exact up to 32 us, then 16 buckets per power of two
+class LatencyHistogram
+{
+public:
+    void Add(SimTime ns) noexcept
+    {
+        uint64_t us = ns / 1000;
+        ++m_buckets[Bucket(us)];
+        ++m_count;
+        m_max = (std::max)(m_max, us);
+    }
+    void Clear() noexcept
+    {
+        std::fill(std::begin(m_buckets), std::end(m_buckets), 0);
+        m_count = 0;
+        m_max = 0;
+    }
+    uint64_t Count() const noexcept { return m_count; }
+    uint64_t Max() const noexcept { return m_max; }
+    // Lower bound of bucket with q-quantile
+    uint64_t Percentile(double q) const noexcept
+    {
+        uint64_t rank = static_cast<uint64_t>(q * (m_count ? m_count - 1 : 0));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            seen += m_buckets[i];
+            if (seen > rank)
+                return (std::min)(LowerBound(i), m_max);
+        }
+        return m_max;
+    }
+private:
+    static constexpr size_t BUCKET_COUNT = 32 + 60 * 16;
+    static size_t Bucket(uint64_t us) noexcept
+    {
+        if (us < 32)
+            return static_cast<size_t>(us);
+        uint32_t msb = 5;
+        while (us >> (msb + 1))
+            ++msb;
+        uint32_t shift = msb - 4;
+        return 32 + (shift - 1) * 16 + static_cast<size_t>((us >> shift) - 16);
+    }
+    static uint64_t LowerBound(size_t bucket) noexcept
+    {
+        if (bucket < 32)
+            return bucket;
+        size_t shift = (bucket - 32) / 16 + 1;
+        return static_cast<uint64_t>(16 + (bucket - 32) % 16) << shift;
+    }
+
+    uint64_t m_buckets[BUCKET_COUNT] = {};
+    uint64_t m_count = 0;
+    uint64_t m_max = 0;
+};
+
+} // namespace
+
+class Simulator::Impl
+{
+public:
+    explicit Impl(const Workload& workload);
+
+    bool Run();
+    const SimStats& GetStats() const noexcept
+    {
+        return m_stats;
+    }
+private:
+    bool Settle();
+    void ProcessEvent(const SimEvent& event);
+    void RunStep(uint32_t step);
+    void MarkReady(uint32_t index);
+    void ProcessClient(uint32_t index);
+    bool ProcessFrame(uint32_t index, const std::vector<char>& data);
+    void ProcessMessage(uint32_t index, ClientMessage& msg);
+    void Connect(uint32_t index);
+    bool SendConnectRequest(SimClient& client);
+    bool SendAck(SimClient& client);
+    bool Send(SimClient& client, ClientMessage& msg);
+    void SendMessage(uint32_t index, ClientCommand command);
+    void Drop(uint32_t index);
+    void ConnectionLost(uint32_t index);
+    void Close(uint32_t index, uint64_t& counter);
+    void AddJoined(uint32_t index);
+    void RemoveJoined(uint32_t index);
+    uint32_t RandomJoined();
+    std::chrono::steady_clock::time_point ServerTime() const;
+
+    void PrintReport(SimTime time, const SimStats& prev);
+    void PrintTotals() const;
+
+private:
+    Workload m_workload;
+    SimScheduler m_scheduler;
+    SimNetwork m_network;
+    Server m_server;
+    std::vector<std::unique_ptr<SimClient>> m_clients;
+    std::vector<uint32_t> m_ready;
+    std::vector<uint32_t> m_readyRound;
+    std::vector<uint32_t> m_joined;         // clients in Joined state
+    uint32_t m_nStarted = 0;
+    std::vector<uint64_t> m_stepDone;       // actions of workload steps
+    std::vector<uint64_t> m_stepCount;
+    std::mt19937_64 m_random;
+    std::wstring m_textPool;                // messages are taken from it at random offsets
+    std::vector<char> m_frame;
+    std::vector<ClientMessage> m_batchMsgs;
+    SimStats m_stats;
+    LatencyHistogram m_latency;
+    LatencyHistogram m_intervalLatency;
+};
+
+Simulator::Impl::Impl(const Workload& workload)
+    : m_workload(workload),
+    m_network(m_scheduler, workload.net, workload.seed),
+    m_server(0),
+    m_stepDone(workload.steps.size()),
+    m_stepCount(workload.steps.size()),
+    m_random(workload.seed + 1)
+{
+    m_server.AddListener(std::make_shared<SimListener>(m_network));
+    m_server.SetPresenceNotices(m_workload.presence);
+    m_server.SetMailboxCapacity(m_workload.mailboxCapacity);
+
+    static const wchar_t letters[] = L"abcdefghijklmnopqrstuvwxyz     ";
+    std::uniform_int_distribution<size_t> letter(0, sizeof(letters) / sizeof(letters[0]) - 2);
+    m_textPool.resize(m_workload.textSize * 2);
+    for (auto& ch : m_textPool)
+        ch = letters[letter(m_random)];
+
+    std::uniform_real_distribution<double> fraction(0, 1);
+    m_clients.reserve(m_workload.clients);
+    m_joined.reserve(m_workload.clients);
+    for (uint32_t i = 0; i < m_workload.clients; ++i)
+    {
+        m_clients.emplace_back(new SimClient);
+        m_clients.back()->SetName(L"u"s + std::to_wstring(i));
+        m_clients.back()->slow = fraction(m_random) < m_workload.slowFraction;
+    }
+}
+
+bool Simulator::Impl::Run()
+{
+    for (uint32_t i = 0; i < m_workload.steps.size(); ++i)
+        m_scheduler.Schedule(m_workload.steps[i].time, SimEventKind::Workload, i);
+
+    std::cout << std::left
+        << std::setw(8) << "time" << std::setw(10) << "joined"
+        << std::setw(12) << "sent/s" << std::setw(14) << "delivered/s"
+        << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+        << std::setw(10) << "lost" << "events" << std::endl;
+
+    auto wallStart = std::chrono::steady_clock::now();
+    SimTime interval = m_workload.reportInterval;
+    SimTime nextReport = interval ? interval : m_workload.duration + 1;
+    SimStats reported;
+
+    // Server starts listening at time 0
+    if (!Settle())
+        return false;
+    SimTime time;
+    while (m_scheduler.Peek(time) && time <= m_workload.duration)
+    {
+        for (; nextReport <= time; nextReport += interval)
+        {
+            PrintReport(nextReport, reported);
+            reported = m_stats;
+        }
+
+        // Events of the same moment, then server and clients do what they can
+        SimTime next;
+        SimEvent event;
+        while (m_scheduler.Peek(next) && next == time && m_scheduler.Next(event))
+        {
+            ++m_stats.events;
+            ProcessEvent(event);
+        }
+        if (!Settle())
+            return false;
+    }
+    for (; nextReport <= m_workload.duration; nextReport += interval)
+    {
+        PrintReport(nextReport, reported);
+        reported = m_stats;
+    }
+
+    PrintTotals();
+    // Output of the same script and seed is the same, so wall time goes apart from it
+    std::cerr << "Wall time: " << std::fixed << std::setprecision(1)
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count() << " s" << std::endl;
+    return true;
+}
+
+// Server and clients take turns until neither has more work at this moment
+bool Simulator::Impl::Settle()
+{
+    for (;;)
+    {
+        if (!m_server.Poll(ServerTime()))
+        {
+            std::cout << "Server failed" << std::endl;
+            return false;
+        }
+        if (m_ready.empty())
+            return true;
+        m_readyRound.swap(m_ready);
+        for (uint32_t index : m_readyRound)
+        {
+            m_clients[index]->ready = false;
+            ProcessClient(index);
+        }
+        m_readyRound.clear();
+    }
+}
+
+void Simulator::Impl::ProcessEvent(const SimEvent& event)
+{
+    switch (event.kind)
+    {
+    case SimEventKind::Workload:
+        RunStep(event.index);
+        break;
+    case SimEventKind::Client:
+        if (m_clients[event.index]->state == SimClientState::Reconnecting)
+            Connect(event.index);
+        break;
+    default:
+        m_network.ProcessEvent(event);
+        break;
+    }
+}
+
+// One action of workload step, the next one is scheduled
+void Simulator::Impl::RunStep(uint32_t step)
+{
+    const WorkloadStep& ws = m_workload.steps[step];
+    uint64_t& done = m_stepDone[step];
+    uint64_t& count = m_stepCount[step];
+    if (done == 0)
+    {
+        count = ws.action == WorkloadAction::Drop ?
+            static_cast<uint64_t>(ws.amount * m_joined.size() + 0.5) : static_cast<uint64_t>(ws.amount);
+    }
+    if (done >= count)
+        return;
+
+    switch (ws.action)
+    {
+    case WorkloadAction::Join:
+        if (m_nStarted < m_clients.size())
+            Connect(m_nStarted++);
+        break;
+    case WorkloadAction::Broadcast:
+        if (!m_joined.empty())
+            SendMessage(RandomJoined(), ClientCommand::BroadcastMessage);
+        break;
+    case WorkloadAction::Private:
+        if (!m_joined.empty())
+            SendMessage(RandomJoined(), ClientCommand::PrivateMessage);
+        break;
+    case WorkloadAction::Drop:
+        if (!m_joined.empty())
+            Drop(RandomJoined());
+        break;
+    case WorkloadAction::Leave:
+        if (!m_joined.empty())
+            Close(RandomJoined(), m_stats.left);
+        break;
+    }
+
+    if (++done < count)
+        m_scheduler.Schedule(ws.time + ws.spread * done / count, SimEventKind::Workload, step);
+}
+
+void Simulator::Impl::MarkReady(uint32_t index)
+{
+    SimClient& client = *m_clients[index];
+    if (client.ready)
+        return;
+    client.ready = true;
+    m_ready.push_back(index);
+}
+
+void Simulator::Impl::ProcessClient(uint32_t index)
+{
+    SimClient& client = *m_clients[index];
+    auto active = [&client]()
+    {
+        return client.state == SimClientState::Joining || client.state == SimClientState::Joined;
+    };
+    if (!active())
+        return;
+    if (!client.SendPending())
+    {
+        ConnectionLost(index);
+        return;
+    }
+
+    // Frames received before connection was lost are processed
+    bool closed = false;
+    bool received = client.RecvAvailable(closed);
+    for (bool ready = true; ready && active();)
+    {
+        if (!client.NextFrame(m_frame, ready) || (ready && !ProcessFrame(index, m_frame)))
+        {
+            Close(index, m_stats.protocolErrors);
+            return;
+        }
+    }
+    if (!active())
+        return;
+    if (!received)
+        ConnectionLost(index);
+    else if (closed)
+        Close(index, m_stats.disconnects);
+    else if (client.lastSequence - client.ackedSequence >= ACK_INTERVAL && !SendAck(client))
+        ConnectionLost(index);
+}
+
+bool Simulator::Impl::ProcessFrame(uint32_t index, const std::vector<char>& data)
+{
+    uint32_t size = static_cast<uint32_t>(data.size());
+    if (!MessageBatch::IsBatch(data.data(), size))
+    {
+        ClientMessage msg;
+        msg.Unserialize(data.data(), size);
+        ProcessMessage(index, msg);
+        return true;
+    }
+
+    m_batchMsgs.clear();
+    if (!MessageBatch::Unserialize(data.data(), size, m_batchMsgs))
+        return false;
+    for (auto& msg : m_batchMsgs)
+        ProcessMessage(index, msg);
+    return true;
+}
+
+void Simulator::Impl::ProcessMessage(uint32_t index, ClientMessage& msg)
+{
+    SimClient& client = *m_clients[index];
+    if (msg.sequence)
+    {
+        if (msg.sequence <= client.lastSequence) // resent after reconnect, but was already received
+            return;
+        client.lastSequence = msg.sequence;
+    }
+
+    switch (msg.command)
+    {
+    case ClientCommand::ConnectAccept:
+    {
+        client.SetConnectionOptions(msg.protocolVersion, msg.capabilities);
+        if (client.state != SimClientState::Joining)
+            return;
+        bool resumed = client.resumeToken && msg.resumeToken == client.resumeToken;
+        if (resumed)
+            ++m_stats.resumed;
+        else if (client.resumeToken)
+            ++m_stats.rejoined;
+        else
+            ++m_stats.joined;
+        client.resumeToken = client.HasCapability(CapResume) ? msg.resumeToken : 0;
+        if (!resumed)
+            client.lastSequence = client.ackedSequence = 0;
+        client.state = SimClientState::Joined;
+        client.attempt = 0;
+        AddJoined(index);
+        break;
+    }
+    case ClientCommand::BroadcastMessage:
+    case ClientCommand::PrivateMessage:
+    {
+        ++m_stats.deliveries;
+        SimTime now = m_scheduler.Now();
+        SimTime latency = now > msg.timeStamp ? now - msg.timeStamp : 0;
+        m_latency.Add(latency);
+        m_intervalLatency.Add(latency);
+        break;
+    }
+    case ClientCommand::ServerMsg:
+        if (msg.msg.compare(0, 22, L"ErrorNameAlreadyExists") == 0)
+            ++m_stats.nameConflicts;
+        break;
+    default:
+        break;
+    }
+}
+
+void Simulator::Impl::Connect(uint32_t index)
+{
+    SimClient& client = *m_clients[index];
+    std::unique_ptr<SimTransport> transport = m_network.Connect();
+    if (!transport)
+    {
+        Close(index, m_stats.protocolErrors);
+        return;
+    }
+    if (client.slow)
+        transport->SetReadRate(m_workload.slowRate);
+    transport->SetWakeup([this, index]() { MarkReady(index); });
+    client.SetTransport(std::move(transport));
+    client.SetNonBlocking(true);
+    client.state = SimClientState::Joining;
+    if (!SendConnectRequest(client))
+        ConnectionLost(index);
+}
+
+bool Simulator::Impl::SendConnectRequest(SimClient& client)
+{
+    ClientMessage msg;
+    msg.command = ClientCommand::ClientConnect;
+    msg.protocolVersion = PROTOCOL_VERSION;
+    msg.capabilities = CapBatching | CapResume;
+    msg.resumeToken = client.resumeToken;
+    msg.sequence = client.lastSequence;
+    return Send(client, msg);
+}
+
+bool Simulator::Impl::SendAck(SimClient& client)
+{
+    ClientMessage msg;
+    msg.command = ClientCommand::Ack;
+    msg.sequence = client.lastSequence;
+    if (!Send(client, msg))
+        return false;
+    client.ackedSequence = client.lastSequence;
+    return true;
+}
+
+bool Simulator::Impl::Send(SimClient& client, ClientMessage& msg)
+{
+    uint32_t size = 0;
+    msg.from = *client.GetName();
+    msg.timeStamp = m_scheduler.Now();
+    auto data = msg.Serialize(&size);
+    return data && client.SendData(data.get(), size);
+}
+
+void Simulator::Impl::SendMessage(uint32_t index, ClientCommand command)
+{
+    ClientMessage msg;
+    msg.command = command;
+    if (command == ClientCommand::PrivateMessage)
+        msg.pmTo = *m_clients[RandomJoined()]->GetName();
+    size_t offset = std::uniform_int_distribution<size_t>(0, m_textPool.size() - m_workload.textSize)(m_random);
+    msg.msg.assign(m_textPool, offset, m_workload.textSize);
+    if (Send(*m_clients[index], msg))
+        ++m_stats.messagesSent;
+    else
+        ConnectionLost(index);
+}
+
+// Connection breaks without close, server learns it after latency
+void Simulator::Impl::Drop(uint32_t index)
+{
+    m_clients[index]->Link()->Reset();
+    ++m_stats.dropped;
+    ConnectionLost(index);
+}
+
+// Client with session reconnects like ChatClient, others are closed
+void Simulator::Impl::ConnectionLost(uint32_t index)
+{
+    SimClient& client = *m_clients[index];
+    bool joined = client.state == SimClientState::Joined;
+    if (joined)
+        RemoveJoined(index);
+    client.SetTransport(nullptr);
+    if (!client.resumeToken)
+    {
+        client.state = SimClientState::Closed;
+        ++m_stats.disconnects;
+        return;
+    }
+
+    if (joined)
+    {
+        client.attempt = 0;
+        client.delay = RECONNECT_INITIAL_DELAY;
+    }
+    else if (++client.attempt == RECONNECT_ATTEMPTS)
+    {
+        client.state = SimClientState::Closed;
+        ++m_stats.gaveUp;
+        return;
+    }
+    else
+        client.delay = (std::min)(client.delay * 2, RECONNECT_MAX_DELAY);
+    client.state = SimClientState::Reconnecting;
+    m_scheduler.Schedule(m_scheduler.Now() + client.delay, SimEventKind::Client, index);
+}
+
+void Simulator::Impl::Close(uint32_t index, uint64_t& counter)
+{
+    SimClient& client = *m_clients[index];
+    if (client.state == SimClientState::Joined)
+        RemoveJoined(index);
+    client.state = SimClientState::Closed;
+    client.SetTransport(nullptr);
+    ++counter;
+}
+
+void Simulator::Impl::AddJoined(uint32_t index)
+{
+    m_clients[index]->joinedPos = static_cast<uint32_t>(m_joined.size());
+    m_joined.push_back(index);
+}
+
+void Simulator::Impl::RemoveJoined(uint32_t index)
+{
+    uint32_t pos = m_clients[index]->joinedPos;
+    m_joined[pos] = m_joined.back();
+    m_clients[m_joined[pos]]->joinedPos = pos;
+    m_joined.pop_back();
+}
+
+uint32_t Simulator::Impl::RandomJoined()
+{
+    return m_joined[std::uniform_int_distribution<size_t>(0, m_joined.size() - 1)(m_random)];
+}
+
+// Server's steady clock is virtual time
+std::chrono::steady_clock::time_point Simulator::Impl::ServerTime() const
+{
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(m_scheduler.Now())));
+}
+
+void Simulator::Impl::PrintReport(SimTime time, const SimStats& prev)
+{
+    double interval = double(m_workload.reportInterval) / SIM_SECOND;
+    auto rate = [interval](uint64_t cur, uint64_t prev)
+    {
+        return interval > 0 ? double(cur - prev) / interval : 0.0;
+    };
+    std::cout << std::left << std::fixed << std::setprecision(0)
+        << std::setw(8) << double(time) / SIM_SECOND << std::setw(10) << m_joined.size()
+        << std::setw(12) << rate(m_stats.messagesSent, prev.messagesSent)
+        << std::setw(14) << rate(m_stats.deliveries, prev.deliveries)
+        << std::setw(10) << m_intervalLatency.Percentile(0.5)
+        << std::setw(10) << m_intervalLatency.Percentile(0.99)
+        << std::setw(10) << m_stats.dropped + m_stats.disconnects - prev.dropped - prev.disconnects
+        << m_stats.events - prev.events << std::endl;
+    m_intervalLatency.Clear();
+}
+
+void Simulator::Impl::PrintTotals() const
+{
+    double seconds = double(m_workload.duration) / SIM_SECOND;
+    double interval = seconds > 0 ? seconds : 1;
+    const NetStats& net = m_network.GetStats();
+    std::cout << std::fixed << std::setprecision(1)
+        << "\nVirtual time:      " << seconds << " s, " << m_stats.events << " events"
+        << "\nJoined clients:    " << m_stats.joined << " of " << m_workload.clients << ", " << m_joined.size() << " joined at the end"
+        << "\nMessages:          " << m_stats.messagesSent << " sent, " << m_stats.deliveries << " delivered, "
+        << m_stats.deliveries / interval << "/s"
+        << "\nLatency:           p50 " << m_latency.Percentile(0.5) << " us, p99 " << m_latency.Percentile(0.99)
+        << " us, p99.9 " << m_latency.Percentile(0.999) << " us, max " << m_latency.Max() << " us"
+        << "\nDropped:           " << m_stats.dropped << ", resumed " << m_stats.resumed
+        << ", new session " << m_stats.rejoined << ", gave up " << m_stats.gaveUp
+        << "\nDisconnects:       " << m_stats.disconnects
+        << "\nLeft:              " << m_stats.left
+        << "\nName conflicts:    " << m_stats.nameConflicts
+        << "\nProtocol errors:   " << m_stats.protocolErrors
+        << "\nNetwork:           " << net.links << " connections, " << net.bytes[SimNetwork::ToServer] / 1024 << " KB to server, "
+        << net.bytes[SimNetwork::ToClient] / 1024 << " KB to clients, " << net.blockedSends << " blocked sends" << std::endl;
+}
+
+Simulator::Simulator(const Workload& workload) : m_impl(new Impl(workload)) {}
+Simulator::~Simulator() = default;
+
+bool Simulator::Run()
+{
+    return m_impl->Run();
+}
+
+const SimStats& Simulator::GetStats() const noexcept
+{
+    return m_impl->GetStats();
+}
@@ -0,0 +1,43 @@
+#ifndef _SIMULATOR_H_
+#define _SIMULATOR_H_
+
+#include "Workload.h"
+#include <memory>
+
+struct SimStats
+{
+    uint64_t joined = 0;            // new sessions, first join of client or after its session expired
+    uint64_t resumed = 0;
+    uint64_t rejoined = 0;          // reconnected client got a new session
+    uint64_t messagesSent = 0;      // broadcast and private messages
+    uint64_t deliveries = 0;        // of those messages to simulated clients
+    uint64_t dropped = 0;           // connections lost by workload
+    uint64_t disconnects = 0;       // server closed connection, e.g. slow consumer
+    uint64_t gaveUp = 0;            // reconnection attempts ran out
+    uint64_t left = 0;
+    uint64_t nameConflicts = 0;
+    uint64_t protocolErrors = 0;
+    uint64_t events = 0;
+};
+
+// Real server driven by Server::Poll on virtual clock, its clients are simulated over
+// simulated network. All randomness comes from workload seed, so a run is reproducible.
+// Server takes no virtual time: latencies are those of network and of server's queues.
+class Simulator
+{
+public:
+    Simulator(const Simulator&) = delete;
+    Simulator& operator = (const Simulator&) = delete;
+
+    explicit Simulator(const Workload& workload);
+    ~Simulator();
+
+    // Runs workload for its duration printing progress, false if server failed
+    bool Run();
+    const SimStats& GetStats() const noexcept;
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+#endif // !_SIMULATOR_H_
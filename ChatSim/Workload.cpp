@@ -0,0 +1,159 @@
+#include "Workload.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+// Number with unit ns, us, ms or s
+static bool ParseTime(const std::string& text, SimTime& time)
+{
+    static const struct { const char* name; double scale; } units[] =
+    {
+        { "ns", 1 }, { "us", 1e3 }, { "ms", 1e6 }, { "s", 1e9 },
+    };
+    size_t end = 0;
+    double value;
+    try { value = std::stod(text, &end); }
+    catch (std::exception&) { return false; }
+    if (value < 0)
+        return false;
+
+    std::string unit = text.substr(end);
+    for (const auto& u : units)
+    {
+        if (unit == u.name)
+        {
+            time = static_cast<SimTime>(value * u.scale);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseNumber(const std::string& text, double& value)
+{
+    size_t end = 0;
+    try { value = std::stod(text, &end); }
+    catch (std::exception&) { return false; }
+    return end == text.size() && value >= 0;
+}
+
+template <typename T>
+static bool ParseInteger(const std::string& text, T& value)
+{
+    size_t end = 0;
+    unsigned long long number;
+    try { number = std::stoull(text, &end); }
+    catch (std::exception&) { return false; }
+    if (end != text.size() || text[0] == '-' || number != static_cast<T>(number))
+        return false;
+    value = static_cast<T>(number);
+    return true;
+}
+
+// at T action N [over T]
+static bool ParseStep(const std::vector<std::string>& words, WorkloadStep& step)
+{
+    static const struct { const char* name; WorkloadAction action; } actions[] =
+    {
+        { "join", WorkloadAction::Join },
+        { "broadcast", WorkloadAction::Broadcast },
+        { "pm", WorkloadAction::Private },
+        { "drop", WorkloadAction::Drop },
+        { "leave", WorkloadAction::Leave },
+    };
+    if ((words.size() != 4 && words.size() != 6) || !ParseTime(words[1], step.time))
+        return false;
+    if (words.size() == 6 && (words[4] != "over" || !ParseTime(words[5], step.spread)))
+        return false;
+
+    auto it = std::find_if(std::begin(actions), std::end(actions),
+        [&name = words[2]](const auto& a) { return name == a.name; });
+    if (it == std::end(actions))
+        return false;
+    step.action = it->action;
+    if (!ParseNumber(words[3], step.amount))
+        return false;
+    return step.action == WorkloadAction::Drop ? step.amount <= 1 : step.amount == std::floor(step.amount);
+}
+
+bool Workload::Load(const std::string& path, std::string& error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "Can't open " + path;
+        return false;
+    }
+    return Parse(file, error);
+}
+
+bool Workload::Parse(std::istream& script, std::string& error)
+{
+    std::string line;
+    for (size_t lineNo = 1; std::getline(script, line); ++lineNo)
+    {
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        std::istringstream stream(line);
+        std::vector<std::string> words;
+        for (std::string word; stream >> word;)
+            words.push_back(std::move(word));
+        if (words.empty())
+            continue;
+
+        const std::string& key = words[0];
+        bool ok = false;
+        if (key == "at")
+        {
+            WorkloadStep step;
+            ok = ParseStep(words, step);
+            if (ok)
+                steps.push_back(step);
+        }
+        else if (key == "slow")
+        {
+            ok = words.size() == 3 && ParseNumber(words[1], slowFraction) && slowFraction <= 1 &&
+                ParseInteger(words[2], slowRate);
+        }
+        else if (words.size() != 2)
+            ok = false;
+        else if (key == "clients")
+            ok = ParseInteger(words[1], clients);
+        else if (key == "seed")
+            ok = ParseInteger(words[1], seed);
+        else if (key == "duration")
+            ok = ParseTime(words[1], duration);
+        else if (key == "report")
+            ok = ParseTime(words[1], reportInterval);
+        else if (key == "latency")
+            ok = ParseTime(words[1], net.latency);
+        else if (key == "jitter")
+            ok = ParseTime(words[1], net.jitter);
+        else if (key == "bandwidth")
+            ok = ParseInteger(words[1], net.bandwidth);
+        else if (key == "window")
+            ok = ParseInteger(words[1], net.window) && net.window != 0;
+        else if (key == "text")
+            ok = ParseInteger(words[1], textSize) && textSize != 0;
+        else if (key == "presence")
+        {
+            ok = words[1] == "on" || words[1] == "off";
+            presence = words[1] == "on";
+        }
+        else if (key == "mailbox")
+            ok = ParseInteger(words[1], mailboxCapacity) && mailboxCapacity != 0;
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            error = "Invalid line " + std::to_string(lineNo) + ": " + line;
+            return false;
+        }
+    }
+
+    std::stable_sort(steps.begin(), steps.end(),
+        [](const WorkloadStep& a, const WorkloadStep& b) { return a.time < b.time; });
+    return true;
+}
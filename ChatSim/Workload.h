@@ -0,0 +1,73 @@
+#ifndef _WORKLOAD_H_
+#define _WORKLOAD_H_
+
+#include "SimNetwork.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+#ifndef DEF_SIM_CLIENTS
+#define DEF_SIM_CLIENTS 1000 // simulated clients of workload without clients line
+#endif
+
+#ifndef DEF_SIM_MAILBOX_CAPACITY
+#define DEF_SIM_MAILBOX_CAPACITY 16 // frames of server session mailbox, single-threaded server sends posted frames at once
+#endif
+
+enum class WorkloadAction
+{
+    Join,       // clients that haven't joined yet connect
+    Broadcast,  // random joined clients send broadcast message
+    Private,    // random joined clients send private message to another joined client
+    Drop,       // fraction of joined clients lose connection and reconnect
+    Leave,      // random joined clients disconnect and don't return
+};
+
+// Actions spread evenly over spread time starting at time
+struct WorkloadStep
+{
+    SimTime time = 0;
+    SimTime spread = 0;
+    WorkloadAction action = WorkloadAction::Join;
+    double amount = 0;          // count of actions, fraction of joined clients for Drop
+};
+
+// Simulation script. Lines, '#' starts a comment:
+//   clients N              simulated clients
+//   seed N                 seed of all random choices
+//   duration T             virtual time of the run
+//   report T               interval of progress rows, 0 - only totals
+//   latency T              one way latency of links
+//   jitter T               random addition to latency
+//   bandwidth N            bytes per second of link direction, 0 - unlimited
+//   window N               bytes sent and not read yet by receiver of link direction
+//   slow F N               fraction of clients reading N bytes per second
+//   text N                 characters of message text
+//   presence on|off        join and leave notices and user list on join, off - joins cost O(1) frames
+//   mailbox N              frames server session may have posted and not sent
+//   at T join N [over T]
+//   at T broadcast N [over T]
+//   at T pm N [over T]
+//   at T drop F [over T]
+//   at T leave N [over T]
+// Times are numbers with unit ns, us, ms or s.
+struct Workload
+{
+    uint32_t clients = DEF_SIM_CLIENTS;
+    uint64_t seed = 1;
+    SimTime duration = 60 * SIM_SECOND;
+    SimTime reportInterval = SIM_SECOND;
+    NetConfig net;
+    double slowFraction = 0;
+    uint64_t slowRate = 0;
+    uint32_t textSize = 64;
+    bool presence = true;
+    uint32_t mailboxCapacity = DEF_SIM_MAILBOX_CAPACITY;
+    std::vector<WorkloadStep> steps;    // sorted by time
+
+    // Error names line of script
+    bool Load(const std::string& path, std::string& error);
+    bool Parse(std::istream& script, std::string& error);
+};
+
+#endif // !_WORKLOAD_H_